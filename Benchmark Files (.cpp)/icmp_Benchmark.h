@@ -0,0 +1,138 @@
+/* ICMP Packet Watcher - Timing loop and JSON report shared by the benchmarks */
+
+/* Every benchmark prints a table for people and, with --json, one JSON document instead, so a build can compare
+   the numbers with an earlier run and fail on a regression:
+
+     {"benchmark":"checksum","quick":false,"results":[{"name":"checksum/1500","value":41.3,"unit":"ns"}, ...]}
+
+   Result names are unique within a benchmark and stay the same between versions; the value is a plain number in
+   the given unit. --json=file writes the document to a file and keeps the table on stdout. --quick shortens every
+   measurement (ctest runs the benchmarks that way, as a smoke test of the code paths they cover). A benchmark
+   exits with 1 when a correctness check fails and with 77 (skipped) when it cannot run here. */
+
+#ifndef ICMP_BENCHMARK_H
+#define ICMP_BENCHMARK_H
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#define BenchmarkSkipped 77                                                 // Exit code ctest reports as skipped (SKIP_RETURN_CODE)
+
+struct BenchmarkOptions
+{
+    bool        json;                                                       // JSON document instead of the table on stdout
+    const char* jsonFile;                                                   // --json=file: the document goes there, the table stays on stdout
+    bool        quick;
+};
+
+// Parses --json, --json=file and --quick. Other arguments are left to the benchmark, their indexes are returned in rest.
+inline BenchmarkOptions ParseBenchmarkOptions(int argc, char* argv[], std::vector<int>* rest = NULL)
+{
+    BenchmarkOptions options;
+    options.json     = false;
+    options.jsonFile = NULL;
+    options.quick    = false;
+    for (int a = 1; a < argc; ++a)
+    {
+        if (strcmp(argv[a], "--json") == 0)
+            options.json = true;
+        else if (strncmp(argv[a], "--json=", 7) == 0)
+            options.jsonFile = argv[a] + 7;
+        else if (strcmp(argv[a], "--quick") == 0)
+            options.quick = true;
+        else if (rest != NULL)
+            rest->push_back(a);
+    }
+    return options;
+}
+
+class BenchmarkReport
+{
+public:
+    BenchmarkReport(const char* benchmark, const BenchmarkOptions& options)
+        : benchmark_(benchmark), options_(options)
+    {
+    }
+
+    // The table is printed by the benchmark itself, only when this returns true
+    bool Table() const { return !options_.json; }
+
+    void Add(const std::string& name, double value, const char* unit)
+    {
+        Result result;
+        result.name  = name;
+        result.value = value;
+        result.unit  = unit;
+        results_.push_back(result);
+    }
+
+    // Writes the JSON document where the options ask for it. Returns false if the file cannot be written.
+    bool Finish() const
+    {
+        if (options_.json)
+            Write(stdout);
+        if (options_.jsonFile == NULL)
+            return true;
+        FILE* file = fopen(options_.jsonFile, "w");
+        if (file == NULL)
+        {
+            fprintf(stderr, "Unable to write %s\n", options_.jsonFile);
+            return false;
+        }
+        Write(file);
+        fclose(file);
+        return true;
+    }
+
+private:
+    struct Result
+    {
+        std::string name;
+        double      value;
+        const char* unit;
+    };
+
+    void Write(FILE* out) const
+    {
+        fprintf(out, "{\"benchmark\":\"%s\",\"quick\":%s,\"results\":[", benchmark_, options_.quick ? "true" : "false");
+        for (size_t i = 0; i < results_.size(); ++i)
+            fprintf(out, "%s\n  {\"name\":\"%s\",\"value\":%.6g,\"unit\":\"%s\"}", i == 0 ? "" : ",", results_[i].name.c_str(),
+                    results_[i].value, results_[i].unit);
+        fprintf(out, "\n]}\n");
+        fflush(out);
+    }
+
+    const char*         benchmark_;
+    BenchmarkOptions    options_;
+    std::vector<Result> results_;
+};
+
+inline volatile unsigned long long BenchmarkSink;                           // Keeps the compiler from dropping the timed calls
+
+// Runs fn until at least minNs have passed and returns the mean time per call in nanoseconds
+template <typename Func>
+double TimeIt(Func fn, double minNs = 20e6)
+{
+    long long iterations = 1;
+    for (;;)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (long long i = 0; i < iterations; ++i)
+            BenchmarkSink = fn();
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        if (ns > minNs)
+            return ns / iterations;
+        iterations *= 2;
+    }
+}
+
+// Measuring time per call: 20 ms normally, 2 ms with --quick
+inline double BenchmarkMinNs(const BenchmarkOptions& options)
+{
+    return options.quick ? 2e6 : 20e6;
+}
+
+#endif // ICMP_BENCHMARK_H
@@ -0,0 +1,126 @@
+/* ICMP Packet Watcher - checksum() microbenchmark */
+
+/* Compares the checksum variants of icmp_Checksum.h on 32 B through 64 KB buffers:
+     original     the 16-bit word loop the raw socket prober used before
+     scalar       32-bit words into a 64-bit accumulator
+     sse2 / avx2  widened 16-bit lanes (only on x86, avx2 only if the CPU has it)
+     checksum()   the run time selected variant the prober calls
+     incremental  RFC 1624 update of icmp_sequence and icmp_timestamp, independent of the payload size
+   Every variant is checked against the original loop before it is timed.
+
+   To compile: g++ -O2 icmp_ChecksumBenchmark.cpp -o checksum_bench  (or the icmp_ChecksumBenchmark target of the CMake build)
+   To run: ./checksum_bench [--json[=file]] [--quick]  (see icmp_Benchmark.h) */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "icmp_Benchmark.h"
+#include "../Source Code Files (.cpp)/icmp_Checksum.h"
+
+using namespace std;
+
+// The checksum loop of the original prober, kept as the baseline (with the odd byte read as unsigned)
+unsigned short ChecksumOriginal(const unsigned short* buff, int size)
+{
+    unsigned long cksum = 0;
+    while (size > 1)
+    {
+        cksum += *buff++;
+        size -= sizeof(unsigned short);
+    }
+    if (size)
+        cksum += *(const unsigned char*)buff;
+    cksum = (cksum >> 16) + (cksum & 0xffff);
+    cksum += (cksum >> 16);
+    return (unsigned short)(~cksum);
+}
+
+int main(int argc, char* argv[])
+{
+    BenchmarkOptions options = ParseBenchmarkOptions(argc, argv);
+    BenchmarkReport report("checksum", options);
+    double minNs = BenchmarkMinNs(options);
+    const int sizes[] = { 32, 64, 128, 256, 512, 1024, 1500, 4096, 9000, 16384, 65536 };
+    vector<unsigned char> data(65536 + 16);
+    srand(1);
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = (unsigned char)rand();
+
+    const unsigned short* buff = (const unsigned short*)&data[0];
+    bool avx2 = false;
+#ifdef ICMP_CHECKSUM_X86
+    avx2 = ChecksumCpuHasAVX2();
+#endif
+
+    // Correctness: every variant against the original loop, odd sizes included
+    for (int size = 0; size <= 4099; ++size)
+    {
+        unsigned short expected = ChecksumOriginal(buff, size);
+        bool ok = (unsigned short)~ChecksumFold(ChecksumPartialScalar(buff, size)) == expected && checksum(buff, size) == expected;
+#ifdef ICMP_CHECKSUM_X86
+        ok = ok && (unsigned short)~ChecksumFold(ChecksumPartialSSE2(buff, size)) == expected;
+        if (avx2)
+            ok = ok && (unsigned short)~ChecksumFold(ChecksumPartialAVX2(buff, size)) == expected;
+#endif
+        if (!ok)
+        {
+            printf("Checksum mismatch at size %d\n", size);
+            return 1;
+        }
+    }
+
+    if (report.Table())
+        printf("%8s %12s %12s %12s %12s %12s %12s\n", "bytes", "original", "scalar", "sse2", "avx2", "checksum()", "incremental");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+    {
+        int size = sizes[s];
+        double tOriginal = TimeIt([&]() { return ChecksumOriginal(buff, size); }, minNs);
+        double tScalar   = TimeIt([&]() { return (unsigned short)~ChecksumFold(ChecksumPartialScalar(buff, size)); }, minNs);
+        double tSSE2 = 0, tAVX2 = 0;
+#ifdef ICMP_CHECKSUM_X86
+        tSSE2 = TimeIt([&]() { return (unsigned short)~ChecksumFold(ChecksumPartialSSE2(buff, size)); }, minNs);
+        if (avx2)
+            tAVX2 = TimeIt([&]() { return (unsigned short)~ChecksumFold(ChecksumPartialAVX2(buff, size)); }, minNs);
+#endif
+        double tDispatch = TimeIt([&]() { return checksum(buff, size); }, minNs);
+
+        // Incremental: the prober patches a 16-bit sequence number and a timestamp per request
+        unsigned short cksum = checksum(buff, size);
+        unsigned short seq = 0;
+        unsigned long stamp = 0;
+        double tIncremental = TimeIt([&]() {
+            unsigned short nextSeq = (unsigned short)(seq + 1);
+            unsigned long nextStamp = stamp + 7;
+            cksum = ChecksumUpdate16(cksum, seq, nextSeq);
+            cksum = ChecksumUpdate(cksum, &stamp, &nextStamp, sizeof(stamp));
+            seq = nextSeq;
+            stamp = nextStamp;
+            return cksum;
+        }, minNs);
+
+        if (report.Table())
+            printf("%8d %9.1f ns %9.1f ns %9.1f ns %9.1f ns %9.1f ns %9.1f ns   (checksum() %.2f GB/s, %.1fx original)\n",
+                   size, tOriginal, tScalar, tSSE2, tAVX2, tDispatch, tIncremental,
+                   size / tDispatch, tOriginal / tDispatch);
+
+        char name[64];
+        snprintf(name, sizeof(name), "original/%d", size);
+        report.Add(name, tOriginal, "ns");
+        snprintf(name, sizeof(name), "scalar/%d", size);
+        report.Add(name, tScalar, "ns");
+#ifdef ICMP_CHECKSUM_X86
+        snprintf(name, sizeof(name), "sse2/%d", size);
+        report.Add(name, tSSE2, "ns");
+        if (avx2)
+        {
+            snprintf(name, sizeof(name), "avx2/%d", size);
+            report.Add(name, tAVX2, "ns");
+        }
+#endif
+        snprintf(name, sizeof(name), "checksum/%d", size);
+        report.Add(name, tDispatch, "ns");
+        snprintf(name, sizeof(name), "incremental/%d", size);
+        report.Add(name, tIncremental, "ns");
+    }
+    return report.Finish() ? 0 : 1;
+}
@@ -0,0 +1,602 @@
+/* ICMP Packet Watcher - End-to-end echo benchmark against a local responder */
+
+/* Sends real echo requests through the prober's socket path (icmp_Transport.h, icmp_Batch.h, icmp_Pipeline.h) to a
+   responder on this host: by default the kernel's own echo reply on 127.0.0.1, or any address given with --target,
+   for example the far end of a veth pair in a network namespace. Nothing leaves the machine. The numbers:
+     flood/pps            replies per second of a pipelined flood (window of requests in flight, batched sends and
+                          receives), the most this host can push through the probe loop
+     flood/cpu_*_ns       user and system CPU time per answered probe during the flood (getrusage)
+     latency/...          a lockstep run, one request in flight: the RTT seen by the program (from before the send
+                          call to after the reply is parsed) against the RTT between the kernel's TX and RX stamps.
+                          The difference is the overhead the program adds to every RTT it measures (p50 and p99).
+     pinger/...           the flood again through the embeddable Pinger (icmp_Pinger.h): one subscription without an
+                          interval, a result callback per reply, the same window and batch. Replies per second and CPU
+                          per probe against flood/... show what the library's bookkeeping costs. Built as C++20 it also
+                          times a coroutine that awaits one ping after the other (pinger/await_rtt_*).
+     flood_lossy/...      a short flood with every 100th reply thrown away, a window of 16 and a 100 ms timeout: how
+                          long it takes (ms) and its request rate. Fails when the lost replies hold up the sender.
+     paced_lossy/...      the same with the pacing and adaptive timeouts of -w 32 -i 1: deadlines skipped and the largest
+                          lag behind the schedule. Fails when lost replies, the first one with its 1 s initial timeout,
+                          make the schedule fall behind.
+   On a raw socket the replies of a loopback target arrive together with our own requests; the socket filter of
+   TransportFilterId drops the requests in the kernel, as in the prober.
+
+   To compile: g++ -O2 -pthread icmp_LoopbackBenchmark.cpp -o loopback_bench  (or the icmp_LoopbackBenchmark target of the CMake build)
+   To run: ./loopback_bench [--target address] [--dgram] [--uring] [--seconds s] [--count n] [--window n] [--json[=file]] [--quick]
+   --dgram uses a ping socket instead of a raw socket (a raw socket that cannot be opened falls back to one), --uring
+   the io_uring event loop of a build with ICMP_WITH_IO_URING. Exits with 77 (skipped) when no socket can be opened
+   or the target does not answer. Linux only. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+#include <vector>
+#include "icmp_Benchmark.h"
+#include "../Source Code Files (.cpp)/icmp_Transport.h"
+#include "../Source Code Files (.cpp)/icmp_Batch.h"
+#include "../Source Code Files (.cpp)/icmp_Echo.h"
+#include "../Source Code Files (.cpp)/icmp_Pipeline.h"
+#include "../Source Code Files (.cpp)/icmp_Rto.h"
+#include "../Source Code Files (.cpp)/icmp_Stats.h"
+#include "../Source Code Files (.cpp)/icmp_Pinger.h"
+
+using namespace std;
+
+#define LoopbackRequestLength 44                                            // The prober's request: ICMP_Header and 32 bytes of data
+#define LoopbackTimeoutMs     1000
+#define LossyCount            3000                                          // The lossy flood, see RunLossyFlood
+#define LossyWindow           16
+#define LossyDropEvery        100
+#define LossyTimeoutMs        100
+#define PacedCount            500                                           // The paced lossy run, see RunPacedLossyFlood
+#define PacedWindow           32
+#define PacedIntervalNs       1000000ULL
+#define PacedDropEvery        10
+
+struct LoopbackOptions
+{
+    unsigned long target;
+    IcmpSocketKind kind;
+    bool          uring;
+    double        seconds;                                                  // Flood duration
+    int           count;                                                    // Lockstep requests
+    int           window;                                                   // Flood requests in flight
+    int           batch;
+};
+
+// User and system CPU time of the process so far, in nanoseconds
+void CpuTimeNs(unsigned long long* userNs, unsigned long long* sysNs)
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    *userNs = (unsigned long long)usage.ru_utime.tv_sec * 1000000000ULL + (unsigned long long)usage.ru_utime.tv_usec * 1000ULL;
+    *sysNs  = (unsigned long long)usage.ru_stime.tv_sec * 1000000000ULL + (unsigned long long)usage.ru_stime.tv_usec * 1000ULL;
+}
+
+// Opens the socket a phase runs on, with its id filter and the request it sends. Returns false if none can be opened.
+bool OpenEchoSocket(const LoopbackOptions& options, IcmpSocket* s, char* request)
+{
+    if (!TransportOpen(options.kind, s) && (options.kind != ICMP_SOCKET_RAW || !TransportOpen(ICMP_SOCKET_DGRAM, s)))
+        return false;
+    TransportFilterId(*s);
+    TransportSetNonBlocking(*s);
+
+    ICMP_Header* pIcmp = (ICMP_Header*)request;
+    memset(request, 'E', LoopbackRequestLength);
+    pIcmp->icmp_type      = 8;
+    pIcmp->icmp_code      = 0;
+    pIcmp->icmp_checksum  = 0;
+    pIcmp->icmp_id        = s->id;
+    pIcmp->icmp_sequence  = 0;
+    pIcmp->icmp_timestamp = 0;
+    memset(request + sizeof(ICMP_Header), 0, sizeof(unsigned long long));
+    pIcmp->icmp_checksum  = checksum((const unsigned short*)request, LoopbackRequestLength);
+    return true;
+}
+
+// What one pipelined flood is to do
+struct FloodPlan
+{
+    int                window;                                              // Requests in flight at most
+    unsigned long long endNs;                                               // Sending stops at this time, or
+    unsigned long long count;                                               // after this many requests (0: no limit)
+    unsigned int       dropEvery;                                           // Every dropEvery-th reply is ignored, as if lost (0: none)
+    unsigned long      timeoutMs;
+};
+
+struct FloodResult
+{
+    unsigned long long sent, received, lost;
+    double             elapsedNs;
+    double             userNs, sysNs;                                       // CPU time of the whole flood
+    double             sendPerCall, recvPerCall;
+    int                batch;
+    const char*        loop;
+};
+
+/* Pipelined flood: up to plan.window requests in flight, sent and received in batches, the same loop as the prober's
+   pipelined mode without its per-probe output. The replies the plan drops keep their place in the window until they
+   time out. Returns false if no socket can be opened or nothing was answered. */
+bool Flood(const LoopbackOptions& options, const FloodPlan& plan, FloodResult* result)
+{
+    IcmpSocket s;
+    char request[LoopbackRequestLength];
+    if (!OpenEchoSocket(options, &s, request))
+        return false;
+    TransportEnableTimestamps(s, false);
+    TransportLoop loop;
+    if (!loop.Init(options.uring) || !loop.Add(s, &s))
+    {
+        printf("Unable to start the event loop! Error code:%d\n", TransportLastError());
+        TransportClose(s);
+        return false;
+    }
+
+    InFlightWindow window(plan.window);
+    SendBatch sendBatch(request, LoopbackRequestLength, options.batch);
+    RecvBatch recvBatch(options.batch);
+    unsigned short seq = 1;
+    unsigned long long sent = 0, received = 0, lost = 0;
+    unsigned long long userStartNs, sysStartNs, userEndNs, sysEndNs;
+    CpuTimeNs(&userStartNs, &sysStartNs);
+    unsigned long long startNs = TransportMonotonicNs();
+    bool sending = true;
+    while (sending || window.Outstanding() > 0)
+    {
+        unsigned long long nowNs = TransportMonotonicNs();
+        unsigned long now = TransportTickMs();
+        sending = nowNs < plan.endNs && (plan.count == 0 || sent < plan.count);
+        while (sending && !sendBatch.Full() && window.CanSend() && (plan.count == 0 || sent < plan.count))
+        {
+            lost += window.Retire(seq, [](unsigned short, unsigned long) {});
+            PatchEchoRequest((ICMP_Header*)sendBatch.Queue(options.target), seq, nowNs);
+            window.Insert(seq++, now);
+            ++sent;
+        }
+        if (sendBatch.Count() > 0 && sendBatch.Flush(loop, s) == TRANSPORT_ERROR)
+        {
+            printf("Sending failed! Error code:%d\n", TransportLastError());
+            TransportClose(s);
+            return false;
+        }
+
+        void* ready[1];
+        loop.Wait(ready, 1, window.CanSend() && sending ? 0 : window.MillisUntilNextExpiry(now, plan.timeoutMs));
+        int n;
+        while ((n = recvBatch.Receive(s)) > 0)
+            for (int r = 0; r < n; ++r)
+            {
+                ICMP_Header* pReply = ParseEchoReply(recvBatch.Data(r), recvBatch.Length(r), s);
+                unsigned long sentTick;
+                if (pReply == NULL || recvBatch.Source(r) != options.target || (plan.dropEvery > 0 && pReply->icmp_sequence % plan.dropEvery == 0))
+                    continue;
+                if (window.Complete(pReply->icmp_sequence, &sentTick))
+                    ++received;
+            }
+        lost += window.Expire(TransportTickMs(), plan.timeoutMs, [](unsigned short, unsigned long) {});
+    }
+    result->elapsedNs = (double)(TransportMonotonicNs() - startNs);
+    CpuTimeNs(&userEndNs, &sysEndNs);
+    TransportClose(s);
+    result->sent        = sent;
+    result->received    = received;
+    result->lost        = lost;
+    result->userNs      = (double)(userEndNs - userStartNs);
+    result->sysNs       = (double)(sysEndNs - sysStartNs);
+    result->sendPerCall = PacketsPerCall(sendBatch.Packets(), sendBatch.Calls());
+    result->recvPerCall = PacketsPerCall(recvBatch.Packets(), recvBatch.Calls());
+    result->batch       = sendBatch.Capacity();
+    result->loop        = loop.Name();
+    return received > 0;
+}
+
+// The flood for options.seconds with options.window requests in flight
+bool RunFlood(const LoopbackOptions& options, BenchmarkReport& report)
+{
+    FloodPlan plan;
+    plan.window    = options.window;
+    plan.endNs     = TransportMonotonicNs() + (unsigned long long)(options.seconds * 1e9);
+    plan.count     = 0;
+    plan.dropEvery = 0;
+    plan.timeoutMs = LoopbackTimeoutMs;
+    FloodResult result;
+    if (!Flood(options, plan, &result))
+        return false;
+
+    double pps = (double)result.received / (result.elapsedNs / 1e9);
+    double userNs = result.userNs / (double)result.received;
+    double sysNs = result.sysNs / (double)result.received;
+    double lossPercent = 100.0 * (double)result.lost / (double)result.sent;
+    report.Add("flood/pps", pps, "packets/s");
+    report.Add("flood/cpu_user_ns", userNs, "ns");
+    report.Add("flood/cpu_sys_ns", sysNs, "ns");
+    report.Add("flood/cpu_ns", userNs + sysNs, "ns");
+    report.Add("flood/loss", lossPercent, "%");
+    report.Add("flood/send_per_call", result.sendPerCall, "packets");
+    report.Add("flood/recv_per_call", result.recvPerCall, "packets");
+    if (report.Table())
+    {
+        printf("Flood (%s, window %d, batch %d): %.0f replies/s, CPU per probe %.0f ns (user %.0f, system %.0f), loss %.2f%%\n",
+               result.loop, options.window, result.batch, pps, userNs + sysNs, userNs, sysNs, lossPercent);
+        printf("  packets per syscall: send %.1f, receive %.1f\n", result.sendPerCall, result.recvPerCall);
+    }
+    return true;
+}
+
+/* A flood that loses every LossyDropEvery-th reply: LossyCount requests, LossyWindow in flight, a timeout of
+   LossyTimeoutMs. A lost request only takes up its place in the window until it times out, so the run takes about as
+   long as sending the requests, plus one timeout. A sender that waited for lost requests to time out, as this one did
+   while sequence numbers shared their window slots, would take one timeout per loss. Returns 1 if the counts are
+   wrong or the run took half that long, 77 if it cannot run. */
+int RunLossyFlood(const LoopbackOptions& options, BenchmarkReport& report)
+{
+    FloodPlan plan;
+    plan.window    = LossyWindow;
+    plan.endNs     = ~0ULL;
+    plan.count     = LossyCount;
+    plan.dropEvery = LossyDropEvery;
+    plan.timeoutMs = LossyTimeoutMs;
+    FloodResult result;
+    if (!Flood(options, plan, &result))
+        return BenchmarkSkipped;
+
+    unsigned long long dropped = LossyCount / LossyDropEvery;
+    double limitMs = (double)(dropped * LossyTimeoutMs) / 2;
+    double elapsedMs = result.elapsedNs / 1e6;
+    report.Add("flood_lossy/elapsed", elapsedMs, "ms");
+    report.Add("flood_lossy/pps", (double)result.sent / (result.elapsedNs / 1e9), "packets/s");
+    if (report.Table())
+        printf("Lossy flood (window %d, every %dth reply lost, timeout %d ms): %llu requests in %.0f ms, %llu answered, %llu lost\n",
+               LossyWindow, LossyDropEvery, LossyTimeoutMs, result.sent, elapsedMs, result.received, result.lost);
+    if (result.sent != LossyCount || result.lost < dropped || result.received + result.lost != result.sent)
+    {
+        printf("Lossy flood: %llu sent, %llu answered, %llu lost, expected %d sent and at least %llu lost\n", result.sent,
+               result.received, result.lost, LossyCount, dropped);
+        return 1;
+    }
+    if (elapsedMs > limitMs)
+    {
+        printf("Lossy flood: %.0f ms for %d requests, lost replies held up the sender (limit %.0f ms)\n", elapsedMs, LossyCount, limitMs);
+        return 1;
+    }
+    return 0;
+}
+
+/* The pipelined mode as the prober runs it with -w PacedWindow -i 1: PacedCount requests paced by a ProbeScheduler,
+   which skips the deadlines it is more than an interval behind, each one given up at its own deadline from the
+   adaptive timeout (icmp_Rto.h, default bounds). Every PacedDropEvery-th reply is thrown away, starting with the
+   first: that request was sent before there was an RTT sample and waits out the initial timeout of 1 s. A lost
+   request only takes up its place in the window until its deadline, so the schedule keeps up. Were the sender to
+   wait for it, the schedule would fall behind by most of that second and skip the rest of the run. Returns 1 if it
+   fell half a second behind, half the deadlines were skipped or the counts are wrong, 77 if it cannot run. A busy
+   host skips a few deadlines either way. */
+int RunPacedLossyFlood(const LoopbackOptions& options, BenchmarkReport& report)
+{
+    IcmpSocket s;
+    char request[LoopbackRequestLength];
+    if (!OpenEchoSocket(options, &s, request))
+        return BenchmarkSkipped;
+    TransportEnableTimestamps(s, false);
+    TransportLoop loop;
+    if (!loop.Init(options.uring) || !loop.Add(s, &s))
+    {
+        TransportClose(s);
+        return BenchmarkSkipped;
+    }
+
+    RtoTable rto(1, MakeRtoConfig());
+    InFlightWindow window(PacedWindow);
+    window.UseDeadlines(TransportMonotonicNs(), rto.Config().granularityNs);
+    SendBatch sendBatch(request, LoopbackRequestLength, options.batch);
+    RecvBatch recvBatch(options.batch);
+    ProbeScheduler schedule(1);
+    schedule.Start(TransportMonotonicNs());
+    schedule.Add(0, PacedIntervalNs, PacedCount, false);
+    unsigned short seq = 1;
+    unsigned long long sent = 0, received = 0, lost = 0;
+    auto onTimedOut = [&rto](unsigned short, unsigned long) { rto.OnTimeout(0); };
+    while (!schedule.Finished() || window.Outstanding() > 0)
+    {
+        unsigned long now = TransportTickMs();
+        schedule.Run(TransportMonotonicNs(), sendBatch.Capacity() - sendBatch.Count(), [&](unsigned int, unsigned long long) {
+            if (!window.CanSend())
+                return false;
+            lost += window.Retire(seq, onTimedOut);
+            unsigned long long nowNs = TransportMonotonicNs();
+            PatchEchoRequest((ICMP_Header*)sendBatch.Queue(options.target), seq, nowNs);
+            window.Insert(seq++, now, nowNs + rto.TimeoutNs(0));
+            ++sent;
+            return true;
+        });
+        if (sendBatch.Count() > 0 && sendBatch.Flush(loop, s) == TRANSPORT_ERROR)
+        {
+            printf("Sending failed! Error code:%d\n", TransportLastError());
+            TransportClose(s);
+            return BenchmarkSkipped;
+        }
+
+        long long untilExpiry = window.NsUntilNextExpiry(TransportMonotonicNs());
+        long waitMs = untilExpiry < 0 ? -1 : (long)((untilExpiry + 999999) / 1000000);
+        long untilSend = schedule.WaitMs(TransportMonotonicNs());
+        if (window.CanSend() && untilSend >= 0 && (waitMs < 0 || untilSend < waitMs))
+            waitMs = untilSend;
+        void* ready[1];
+        loop.Wait(ready, 1, sendBatch.Count() > 0 ? 1 : waitMs);
+        int n;
+        while ((n = recvBatch.Receive(s)) > 0)
+            for (int r = 0; r < n; ++r)
+            {
+                ICMP_Header* pReply = ParseEchoReply(recvBatch.Data(r), recvBatch.Length(r), s);
+                unsigned long sentTick;
+                if (pReply == NULL || recvBatch.Source(r) != options.target || pReply->icmp_sequence % PacedDropEvery == 1)
+                    continue;
+                if (window.Complete(pReply->icmp_sequence, &sentTick))
+                {
+                    rto.Sample(0, EchoRttNs(pReply, 0, recvBatch.Stamp(r)));
+                    ++received;
+                }
+            }
+        lost += window.ExpireDue(TransportMonotonicNs(), onTimedOut);
+    }
+    TransportClose(s);
+
+    const ScheduleStats& stats = schedule.Stats();
+    report.Add("paced_lossy/skipped", (double)stats.Skipped(), "probes");
+    report.Add("paced_lossy/max_lag", stats.MaxLagNs() / 1e6, "ms");
+    if (report.Table())
+        printf("Paced lossy flood (window %d, every %dth reply lost, adaptive timeout): %llu sent, %llu answered, %llu lost, "
+               "%llu skipped, lag max %.3f ms\n", PacedWindow, PacedDropEvery, sent, received, lost, stats.Skipped(), stats.MaxLagNs() / 1e6);
+    if (sent + stats.Skipped() != PacedCount || received + lost != sent || lost < sent / PacedDropEvery)
+    {
+        printf("Paced lossy flood: %llu sent, %llu skipped, %llu answered, %llu lost, expected %d sent or skipped, every %dth lost\n",
+               sent, stats.Skipped(), received, lost, PacedCount, PacedDropEvery);
+        return 1;
+    }
+    if (stats.Skipped() > PacedCount / 2 || stats.MaxLagNs() >= RtoInitialNs / 2)
+    {
+        printf("Paced lossy flood: %llu of %d probes skipped, lag max %.3f ms, lost replies held up the schedule\n", stats.Skipped(),
+               PacedCount, stats.MaxLagNs() / 1e6);
+        return 1;
+    }
+    return 0;
+}
+
+/* One request in flight at a time. Each request is stamped right before the send call and its reply is timed right
+   after it is parsed; the kernel stamps bound the part of that RTT spent below the socket. Without TX stamps (a kernel
+   or socket that does not give them) the send stamp of the payload stands in, so only the receive side is measured. */
+bool RunLockstep(const LoopbackOptions& options, BenchmarkReport& report)
+{
+    IcmpSocket s;
+    char request[LoopbackRequestLength];
+    if (!OpenEchoSocket(options, &s, request))
+        return false;
+    bool txStamps = (TransportEnableTimestamps(s, true) & TRANSPORT_STAMP_TX) != 0;
+    TransportLoop loop;
+    if (!loop.Init(options.uring) || !loop.Add(s, &s))
+    {
+        TransportClose(s);
+        return false;
+    }
+
+    RecvBatch recvBatch(8);
+    LatencyHistogram userRtt, kernelRtt, overhead;
+    unsigned long long userStartNs, sysStartNs, userEndNs, sysEndNs;
+    CpuTimeNs(&userStartNs, &sysStartNs);
+    int answered = 0;
+    for (int i = 1; i <= options.count; ++i)
+    {
+        unsigned short seq = (unsigned short)i;
+        unsigned long long sendNs = TransportMonotonicNs();
+        PatchEchoRequest((ICMP_Header*)request, seq, sendNs);
+        if (loop.Send(s, request, LoopbackRequestLength, options.target) == TRANSPORT_ERROR)
+            break;
+
+        unsigned long long rxNs = 0, doneNs = 0;
+        while (doneNs == 0 && TransportMonotonicNs() - sendNs < LoopbackTimeoutMs * 1000000ULL)
+        {
+            void* ready[1];
+            loop.Wait(ready, 1, LoopbackTimeoutMs);
+            int n;
+            while ((n = recvBatch.Receive(s)) > 0)
+                for (int r = 0; r < n; ++r)
+                {
+                    ICMP_Header* pReply = ParseEchoReply(recvBatch.Data(r), recvBatch.Length(r), s);
+                    if (pReply != NULL && pReply->icmp_sequence == seq && recvBatch.Source(r) == options.target)
+                    {
+                        doneNs = TransportMonotonicNs();
+                        rxNs = recvBatch.Stamp(r);
+                    }
+                }
+        }
+        if (doneNs == 0)
+            continue;
+
+        // The OPT_ID counter of the TX stamps starts at 0 with the first request, which has sequence number 1
+        unsigned long long txNs = sendNs;
+        TransportTxStamp stamps[8];
+        int nStamps;
+        while (txStamps && (nStamps = TransportRecvTxStamps(s, stamps, 8)) > 0)
+            for (int t = 0; t < nStamps; ++t)
+                if ((unsigned short)(stamps[t].id + 1) == seq && stamps[t].ns >= sendNs && stamps[t].ns <= rxNs)
+                    txNs = stamps[t].ns;
+        unsigned long long kernelNs = rxNs > txNs ? rxNs - txNs : 0;
+        userRtt.Record(doneNs - sendNs);
+        kernelRtt.Record(kernelNs);
+        overhead.Record(doneNs - sendNs > kernelNs ? doneNs - sendNs - kernelNs : 0);
+        ++answered;
+    }
+    CpuTimeNs(&userEndNs, &sysEndNs);
+    TransportClose(s);
+    if (answered == 0)
+        return false;
+
+    double cpuNs = (double)(userEndNs - userStartNs + sysEndNs - sysStartNs) / (double)answered;
+    report.Add("latency/user_rtt_p50", (double)userRtt.Percentile(50), "ns");
+    report.Add("latency/user_rtt_p99", (double)userRtt.Percentile(99), "ns");
+    report.Add("latency/kernel_rtt_p50", (double)kernelRtt.Percentile(50), "ns");
+    report.Add("latency/kernel_rtt_p99", (double)kernelRtt.Percentile(99), "ns");
+    report.Add("latency/overhead_p50", (double)overhead.Percentile(50), "ns");
+    report.Add("latency/overhead_p99", (double)overhead.Percentile(99), "ns");
+    report.Add("latency/cpu_ns", cpuNs, "ns");
+    report.Add("latency/tx_stamps", txStamps ? 1 : 0, "bool");
+    if (report.Table())
+    {
+        printf("Lockstep (%d of %d answered, %s): RTT p50/p99 program %.1f/%.1f us, kernel %.1f/%.1f us%s\n", answered, options.count,
+               txStamps ? "kernel TX stamps" : "no TX stamps", userRtt.Percentile(50) / 1e3, userRtt.Percentile(99) / 1e3,
+               kernelRtt.Percentile(50) / 1e3, kernelRtt.Percentile(99) / 1e3, txStamps ? "" : " (receive side only)");
+        printf("  overhead added by the program p50/p99 %.1f/%.1f us, CPU per probe %.0f ns\n", overhead.Percentile(50) / 1e3,
+               overhead.Percentile(99) / 1e3, cpuNs);
+    }
+    return true;
+}
+
+#ifdef ICMP_PINGER_COROUTINES
+// Awaits count pings one after the other, each timed from before the co_await to after the coroutine resumed
+PingerTask AwaitPings(Pinger& pinger, unsigned long target, int count, LatencyHistogram* rtt, int* answered, bool* done)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        unsigned long long startNs = TransportMonotonicNs();
+        PingResult result = co_await pinger.Async(target);
+        if (result.status == PING_REPLY)
+        {
+            rtt->Record(TransportMonotonicNs() - startNs);
+            ++*answered;
+        }
+    }
+    *done = true;
+}
+#endif
+
+/* The flood through the Pinger: a subscription with no interval and no end keeps options.window probes in flight
+   until options.seconds are over, then it is ended and the probes still out are waited for. */
+bool RunPinger(const LoopbackOptions& options, BenchmarkReport& report)
+{
+    PingerConfig config;
+    config.kind        = options.kind;
+    config.preferUring = options.uring;
+    config.batch       = options.batch;
+    config.timeoutMs   = LoopbackTimeoutMs;
+    config.maxInFlight = (unsigned int)options.window;
+    Pinger pinger(config);
+    if (!pinger.Open())
+        return false;
+
+    unsigned long long received = 0;
+    unsigned long long userStartNs, sysStartNs, userEndNs, sysEndNs;
+    CpuTimeNs(&userStartNs, &sysStartNs);
+    unsigned long long startNs = TransportMonotonicNs();
+    unsigned long long endNs = startNs + (unsigned long long)(options.seconds * 1e9);
+    unsigned int flood = pinger.Subscribe(options.target, 0, -1, [&received](const PingResult& result) {
+        if (result.status == PING_REPLY)
+            ++received;
+    });
+    while (TransportMonotonicNs() < endNs)
+        pinger.Poll(LoopbackTimeoutMs);
+    pinger.Unsubscribe(flood);
+    double elapsedNs = (double)(TransportMonotonicNs() - startNs);
+    CpuTimeNs(&userEndNs, &sysEndNs);
+    while (!pinger.Idle())
+        pinger.Poll(-1);
+    if (received == 0)
+        return false;
+
+    double pps = (double)received / (elapsedNs / 1e9);
+    double cpuNs = (double)(userEndNs - userStartNs + sysEndNs - sysStartNs) / (double)received;
+    double lossPercent = 100.0 * (double)pinger.Timeouts() / (double)pinger.Sent();
+    report.Add("pinger/pps", pps, "packets/s");
+    report.Add("pinger/cpu_ns", cpuNs, "ns");
+    report.Add("pinger/loss", lossPercent, "%");
+    if (report.Table())
+        printf("Pinger (%s, window %d, batch %d): %.0f replies/s, CPU per probe %.0f ns, loss %.2f%%\n", pinger.LoopName(),
+               options.window, options.batch, pps, cpuNs, lossPercent);
+
+#ifdef ICMP_PINGER_COROUTINES
+    LatencyHistogram rtt;
+    int answered = 0;
+    bool done = false;
+    AwaitPings(pinger, options.target, options.count, &rtt, &answered, &done);
+    while (!done)
+        pinger.Poll(-1);
+    if (answered == 0)
+        return false;
+    report.Add("pinger/await_rtt_p50", (double)rtt.Percentile(50), "ns");
+    report.Add("pinger/await_rtt_p99", (double)rtt.Percentile(99), "ns");
+    if (report.Table())
+        printf("  co_await (%d of %d answered): RTT p50/p99 %.1f/%.1f us\n", answered, options.count, rtt.Percentile(50) / 1e3,
+               rtt.Percentile(99) / 1e3);
+#endif
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    vector<int> rest;
+    BenchmarkOptions benchmarkOptions = ParseBenchmarkOptions(argc, argv, &rest);
+    BenchmarkReport report("loopback", benchmarkOptions);
+
+    LoopbackOptions options;
+    options.target  = inet_addr("127.0.0.1");
+    options.kind    = ICMP_SOCKET_RAW;
+    options.uring   = false;
+    options.seconds = benchmarkOptions.quick ? 0.2 : 2.0;
+    options.count   = benchmarkOptions.quick ? 200 : 5000;
+    options.window  = 256;
+    options.batch   = 32;
+    for (size_t i = 0; i < rest.size(); ++i)
+    {
+        const char* arg = argv[rest[i]];
+        const char* value = i + 1 < rest.size() ? argv[rest[i + 1]] : NULL;
+        bool used = true;
+        if (strcmp(arg, "--dgram") == 0)
+            options.kind = ICMP_SOCKET_DGRAM;
+        else if (strcmp(arg, "--uring") == 0)
+            options.uring = true;
+        else if (strcmp(arg, "--target") == 0 && value != NULL && (options.target = inet_addr(value)) != INADDR_NONE)
+            ++i;
+        else if (strcmp(arg, "--seconds") == 0 && value != NULL && (options.seconds = atof(value)) > 0)
+            ++i;
+        else if (strcmp(arg, "--count") == 0 && value != NULL && (options.count = atoi(value)) > 0 && options.count <= 65535)
+            ++i;
+        else if (strcmp(arg, "--window") == 0 && value != NULL && (options.window = atoi(value)) > 0 && options.window <= 32768)
+            ++i;
+        else
+            used = false;
+        if (!used)
+        {
+            printf("Usage: %s [--target address] [--dgram] [--uring] [--seconds s] [--count n] [--window n] [--json[=file]] [--quick]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (!TransportStartup())
+        return BenchmarkSkipped;
+    IcmpSocket probe;
+    char request[LoopbackRequestLength];
+    if (!OpenEchoSocket(options, &probe, request))
+    {
+        printf("Unable to open a raw or ping socket (root or net.ipv4.ping_group_range needed), skipped\n");
+        return BenchmarkSkipped;
+    }
+    if (probe.kind != options.kind)
+    {
+        options.kind = probe.kind;
+        if (report.Table())
+            printf("No raw socket, using a ping socket\n");
+    }
+    TransportClose(probe);
+
+    if (!RunFlood(options, report) || !RunLockstep(options, report) || !RunPinger(options, report))
+    {
+        printf("No replies from the target, skipped\n");
+        return BenchmarkSkipped;
+    }
+    int lossy = RunLossyFlood(options, report);
+    if (lossy == 0)
+        lossy = RunPacedLossyFlood(options, report);
+    if (lossy != 0)
+        return lossy;
+    return report.Finish() ? 0 : 1;
+}
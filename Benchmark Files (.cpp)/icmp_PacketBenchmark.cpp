@@ -0,0 +1,544 @@
+/* ICMP Packet Watcher - Echo request construction and reply parsing microbenchmark */
+
+/* Times the per-packet work of the prober outside the socket calls, with the functions of icmp_Echo.h:
+     build/full/N     building an N-byte echo request from scratch: header fields, payload fill, send stamp and
+                      checksum() over the whole message (what every request cost before the requests were prebuilt)
+     build/patch/N    PatchEchoRequest on a prebuilt request: sequence number and stamps with an incremental
+                      checksum update, the same for every size
+     build/paris      PatchEchoRequest plus HoldEchoChecksum, the per-probe work of the traceroute mode
+     parse/reply_raw      ParseEchoReply and EchoRttNs on a raw socket datagram (IP header first, checksum verified)
+     parse/reply_dgram    the same on a ping socket datagram (no IP header)
+     parse/reply_foreign  an echo reply for another icmp_id, the path of a reply that is skipped
+     parse/error_full     a time exceeded error quoting the whole request, matched with ParseProbeError and timed
+     parse/error_short    the same with the 8-byte quote RFC 792 requires, which has no send stamp
+     parse/error_frag     a fragmentation needed error with its next-hop MTU
+     metrics/count        one counter update of the thread's metrics slot (icmp_Metrics.h), as per send or receive call
+     metrics/record       one histogram update (bucket and sum), as for a syscall time or a schedule lag
+     tsdb/append          one record into the time-series store (icmp_TimeSeries.h), block sealing and writes included,
+                          for 64 targets probed once a second with jitter, 1% loss and some ICMP errors
+     tsdb/bytes_per_record  the size of that store per record, index included
+     tsdb/decode          one record decoded with every column
+     tsdb/decode_rtt      one record through the event and rtt columns only, what a percentile query reads
+     tsdb/query/N         loss and percentiles of every target over the middle N% of the run, per call
+     rto/sample           one RTT into a target's SRTT/RTTVAR (icmp_Rto.h), as per reply
+     rto/timeout          the timeout of a target, as per request sent
+     inflight/ring        one request of a stream to 1024 targets through the InFlightTable with one 20 ms timeout:
+                          inserted, answered 50 requests later (1% are lost) and expired from the send-order ring
+     inflight/deadline    the same with a timeout per target (2 to 6 ms) on the table's TimingWheel
+   Every case is checked first: patched and built requests must sum to a valid checksum, every parse must return
+   the sequence number, destination and RTT that went in, the store must give back every record and the same
+   counts as a scan of the records for a window, and both in-flight tables must expire exactly the lost requests,
+   no later than their timeout.
+
+   To compile: g++ -O2 -pthread icmp_PacketBenchmark.cpp -o packet_bench  (or the icmp_PacketBenchmark target of the CMake build)
+   To run: ./packet_bench [--json[=file]] [--quick]  (see icmp_Benchmark.h) */
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "icmp_Benchmark.h"
+#include "../Source Code Files (.cpp)/icmp_Echo.h"
+#include "../Source Code Files (.cpp)/icmp_InFlightTable.h"
+#include "../Source Code Files (.cpp)/icmp_Rto.h"
+#include "../Source Code Files (.cpp)/icmp_TimeSeries.h"
+
+using namespace std;
+
+#define EchoId      0x4d2
+#define EchoTarget  0x0100007f                                              // 127.0.0.1 in network byte order
+#define EchoRouter  0x0101a8c0                                              // 192.168.1.1
+#define EchoSendNs  1000000000ULL
+#define EchoRecvNs  1000123456ULL
+
+// Builds an echo request of len bytes the way the prober once did for every request: all fields, the payload and a
+// full checksum. The checksum is stored as computed, so the request sums to zero.
+void BuildEchoRequest(char* packet, int len, unsigned short seq, unsigned long long sendNs)
+{
+    ICMP_Header* pIcmp = (ICMP_Header*)packet;
+    pIcmp->icmp_type      = 8;
+    pIcmp->icmp_code      = 0;
+    pIcmp->icmp_checksum  = 0;
+    pIcmp->icmp_id        = EchoId;
+    pIcmp->icmp_sequence  = seq;
+    pIcmp->icmp_timestamp = (unsigned int)(sendNs / 1000000ULL);
+    memset(packet + sizeof(ICMP_Header), 'Y', len - sizeof(ICMP_Header));
+    memcpy(packet + sizeof(ICMP_Header), &sendNs, sizeof(sendNs));
+    pIcmp->icmp_checksum = checksum((const unsigned short*)packet, len);
+}
+
+// Writes a 20-byte IPv4 header (no options), the received datagrams and quotes start with one
+void BuildIpHeader(unsigned char* ip, int totalLen, unsigned int source, unsigned int destination)
+{
+    memset(ip, 0, 20);
+    ip[0] = 0x45;
+    ip[2] = (unsigned char)(totalLen >> 8);
+    ip[3] = (unsigned char)totalLen;
+    ip[8] = 64;
+    ip[9] = 1;
+    memcpy(ip + 12, &source, 4);
+    memcpy(ip + 16, &destination, 4);
+}
+
+// A received raw socket datagram: IP header, then an ICMP error of the given type/code quoting quoteLen bytes of request
+int BuildError(unsigned char* datagram, unsigned char type, unsigned char code, unsigned short mtu, const char* request, int quoteLen)
+{
+    int len = 20 + 8 + 20 + quoteLen;
+    BuildIpHeader(datagram, len, EchoRouter, EchoTarget);
+    unsigned char* icmp = datagram + 20;
+    memset(icmp, 0, 8);
+    icmp[0] = type;
+    icmp[1] = code;
+    icmp[6] = (unsigned char)(mtu >> 8);
+    icmp[7] = (unsigned char)mtu;
+    BuildIpHeader(icmp + 8, 20 + 44, EchoTarget, EchoTarget);             // The quoted request as it was sent
+    memcpy(icmp + 28, request, quoteLen);
+    return len;
+}
+
+#define StoreTargets  64
+#define StoreRounds   4096                                                  // Probes per target, one a second
+#define StoreStartNs  1700000000000000000ULL
+
+// The records of a long run for the store cases, in the order they are written, and their Unix times
+void BuildStoreRecords(vector<OutputRecord>* records, vector<unsigned long long>* times)
+{
+    unsigned long long random = 88172645463325252ULL;
+    for (int round = 0; round < StoreRounds; ++round)
+        for (int t = 0; t < StoreTargets; ++t)
+        {
+            random ^= random << 13;                                         // xorshift64
+            random ^= random >> 7;
+            random ^= random << 17;
+            OutputRecord record;
+            memset(&record, 0, sizeof(record));
+            record.target = 10 | (unsigned int)(t + 1) << 24;               // 10.0.0.t+1 in network byte order
+            record.from   = record.target;
+            record.seq    = (unsigned short)(round + 1);
+            unsigned int roll = (unsigned int)(random % 1000);
+            if (roll < 10)
+                record.event = OUTPUT_TIMEOUT;
+            else if (roll == 10)
+            {
+                record.event    = OUTPUT_ERROR;
+                record.from     = EchoRouter;
+                record.icmpType = 3;
+                record.icmpCode = 1;
+                record.rttNs    = 1000000 + (random >> 40) % 1000000;
+            }
+            else
+            {
+                record.event = OUTPUT_REPLY;
+                record.rttNs = 20000000 + (random >> 32) % 2000000;         // 20 to 22 ms, kernel stamps to the ns
+            }
+            records->push_back(record);
+            times->push_back(StoreStartNs + (unsigned long long)round * 1000000000ULL + (unsigned long long)t * 15625000ULL +
+                             (random >> 48) % 50000);                       // Up to 50 us of schedule jitter
+        }
+}
+
+// Writes the records into a store and returns the file's bytes, empty if the temporary file failed
+vector<unsigned char> WriteStore(const vector<OutputRecord>& records, const vector<unsigned long long>& times)
+{
+    vector<unsigned char> bytes;
+    FILE* file = tmpfile();
+    if (file == NULL)
+        return bytes;
+    TimeSeriesWriter writer(file);
+    for (size_t i = 0; i < records.size(); ++i)
+        writer.Write(records[i], times[i]);
+    writer.Close();
+    bytes.resize((size_t)writer.Bytes());
+    rewind(file);
+    if (writer.Failed() || fread(&bytes[0], 1, bytes.size(), file) != bytes.size())
+        bytes.clear();
+    fclose(file);
+    return bytes;
+}
+
+// Every record comes back from the store with its time, and a window query counts what a scan of the records counts
+bool CheckStore(const TimeSeriesReader& reader, const vector<OutputRecord>& records, const vector<unsigned long long>& times)
+{
+    vector<size_t> next(StoreTargets, 0);                                   // Per target: records seen so far, in order
+    vector<vector<size_t>> byTarget(StoreTargets);
+    for (size_t i = 0; i < records.size(); ++i)
+        byTarget[(records[i].target >> 24) - 1].push_back(i);
+    size_t decoded = 0;
+    bool ok = reader.Indexed();
+    for (size_t b = 0; ok && b < reader.Blocks(); ++b)
+    {
+        TimeSeriesBlockInfo block;
+        ok = reader.Block(b, &block) && reader.Decode(block, [&](const OutputRecord& got) {
+            int t = (int)(got.target >> 24) - 1;
+            if (t < 0 || t >= StoreTargets || next[t] >= byTarget[t].size())
+            {
+                ok = false;
+                return;
+            }
+            size_t i = byTarget[t][next[t]++];
+            const OutputRecord& want = records[i];
+            ok = ok && got.timeNs == times[i] && got.rttNs == want.rttNs && got.from == want.from && got.seq == want.seq &&
+                 got.event == want.event && got.icmpType == want.icmpType && got.icmpCode == want.icmpCode;
+            ++decoded;
+        });
+    }
+    if (!ok || decoded != records.size())
+        return false;
+
+    unsigned long long fromNs = StoreStartNs + 300500000000ULL, toNs = StoreStartNs + 2700250000000ULL;
+    unsigned long long replies = 0, timeouts = 0, errors = 0;
+    for (size_t i = 0; i < records.size(); ++i)
+        if (times[i] >= fromNs && times[i] < toNs)
+        {
+            replies  += records[i].event == OUTPUT_REPLY;
+            timeouts += records[i].event == OUTPUT_TIMEOUT;
+            errors   += records[i].event == OUTPUT_ERROR;
+        }
+    vector<TimeSeriesSummary> summaries;
+    TimeSeriesQueryStats stats;
+    reader.Query(fromNs, toNs, true, 0, true, &summaries, &stats);
+    for (size_t s = 0; s < summaries.size(); ++s)
+    {
+        replies  -= summaries[s].replies;
+        timeouts -= summaries[s].timeouts;
+        errors   -= summaries[s].errors;
+        ok = ok && summaries[s].rtt.Count() == summaries[s].replies;
+    }
+    return ok && summaries.size() == StoreTargets && replies == 0 && timeouts == 0 && errors == 0 && stats.decoded > 0 &&
+           stats.rttOnly > 0 && stats.read < stats.blocks;
+}
+
+#define InFlightTargets  1024
+#define InFlightStepNs   10000ULL                                           // One request every 10 us
+#define InFlightAnswered 50                                                 // Replies come 50 requests (500 us) later
+#define InFlightTimeout  20                                                 // ms, the one timeout of the ring
+
+unsigned long long InFlightKey(unsigned long long n)
+{
+    return InFlightTable::MakeKey((unsigned long)(n % InFlightTargets) + 1, (unsigned short)(n / InFlightTargets));
+}
+
+/* Request n of the stream: sent at n * 10 us, and the reply to request n - 50 taken out unless that one is lost
+   (every 100th). Whatever is due expires, through the ring without rto, through the wheel with the timeouts of rto.
+   *lateNs gets the largest delay of an expiry past its timeout. Returns the number expired. */
+int InFlightStep(InFlightTable& table, const RtoTable* rto, unsigned long long n, unsigned long long* lateNs)
+{
+    unsigned long long nowNs = n * InFlightStepNs;
+    unsigned int target = (unsigned int)(n % InFlightTargets);
+    if (rto != NULL)
+        table.Insert(InFlightKey(n), target, (unsigned int)(nowNs / 1000000ULL), nowNs + rto->TimeoutNs(target));
+    else
+        table.Insert(InFlightKey(n), target, (unsigned int)(nowNs / 1000000ULL));
+    InFlightEntry entry;
+    if (n >= InFlightAnswered && (n - InFlightAnswered) % 100 != 0)
+        table.Remove(InFlightKey(n - InFlightAnswered), &entry);
+    auto expired = [&](const InFlightEntry& lost) {
+        unsigned long long timeoutNs = rto != NULL ? rto->TimeoutNs(lost.target) : InFlightTimeout * 1000000ULL;
+        unsigned long long dueNs = (unsigned long long)lost.sentTick * 1000000ULL + timeoutNs;
+        if (nowNs > dueNs + 1000000ULL && nowNs - dueNs - 1000000ULL > *lateNs)   // sentTick is the millisecond it was sent in
+            *lateNs = nowNs - dueNs - 1000000ULL;
+    };
+    if (rto != NULL)
+        return table.ExpireDue(nowNs, expired);
+    return table.Expire((unsigned int)(nowNs / 1000000ULL), InFlightTimeout, expired);
+}
+
+int main(int argc, char* argv[])
+{
+    BenchmarkOptions options = ParseBenchmarkOptions(argc, argv);
+    BenchmarkReport report("packet", options);
+    double minNs = BenchmarkMinNs(options);
+    const int lengths[] = { 44, 1480, 65515 };                              // The prober's request, a 1500-byte datagram, the largest one
+
+    IcmpSocket raw, dgram;
+    memset(&raw, 0, sizeof(raw));
+    raw.id = EchoId;
+    raw.hasIpHeader = true;
+    dgram = raw;
+    dgram.hasIpHeader = false;
+
+    vector<char> packet(65536);
+    vector<char> built(65536);
+    char* request = &packet[0];
+
+    // Correctness: a patched request must equal one built from scratch, and both must sum to zero
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++l)
+    {
+        int len = lengths[l];
+        BuildEchoRequest(request, len, 0, 0);
+        PatchEchoRequest((ICMP_Header*)request, 77, EchoSendNs);
+        BuildEchoRequest(&built[0], len, 77, EchoSendNs);
+        if (memcmp(request, &built[0], len) != 0 || checksum((const unsigned short*)request, len) != 0)
+        {
+            printf("Patched request of %d bytes does not match the built one\n", len);
+            return 1;
+        }
+    }
+    BuildEchoRequest(request, 44, 0, 0);
+    PatchEchoRequest((ICMP_Header*)request, 9, EchoSendNs);
+    HoldEchoChecksum((ICMP_Header*)request, 0x1234);
+    if (((ICMP_Header*)request)->icmp_checksum != 0x1234 || checksum((const unsigned short*)request, 44) != 0)
+    {
+        printf("HoldEchoChecksum did not keep the flow checksum\n");
+        return 1;
+    }
+
+    // The datagrams the parse cases read: the reply to a 44-byte request sent at EchoSendNs with sequence 9
+    BuildEchoRequest(request, 44, 9, EchoSendNs);
+    unsigned char replyRaw[20 + 44], replyDgram[44], replyForeign[20 + 44];
+    BuildIpHeader(replyRaw, sizeof(replyRaw), EchoTarget, EchoTarget);
+    memcpy(replyRaw + 20, request, 44);
+    unsigned short oldWord, newWord;                                        // Echo reply: type 0, the checksum patched to match
+    memcpy(&oldWord, replyRaw + 20, 2);
+    replyRaw[20] = 0;
+    memcpy(&newWord, replyRaw + 20, 2);
+    ((ICMP_Header*)(replyRaw + 20))->icmp_checksum = ChecksumUpdate16(((ICMP_Header*)(replyRaw + 20))->icmp_checksum, oldWord, newWord);
+    memcpy(replyDgram, replyRaw + 20, 44);
+    memcpy(replyForeign, replyRaw, sizeof(replyRaw));
+    ((ICMP_Header*)(replyForeign + 20))->icmp_id = EchoId + 1;
+    unsigned char errorFull[20 + 8 + 20 + 44], errorShort[20 + 8 + 20 + 8], errorFrag[20 + 8 + 20 + 44];
+    int errorFullLen  = BuildError(errorFull, 11, 0, 0, request, 44);
+    int errorShortLen = BuildError(errorShort, 11, 0, 0, request, 8);
+    int errorFragLen  = BuildError(errorFrag, 3, 4, 1400, request, 44);
+
+    IcmpErrorInfo error;
+    ICMP_Header* pReply = ParseEchoReply((char*)replyRaw, sizeof(replyRaw), raw);
+    bool ok = pReply != NULL && pReply->icmp_sequence == 9 && EchoRttNs(pReply, 0, EchoRecvNs) == EchoRecvNs - EchoSendNs;
+    pReply = ParseEchoReply((char*)replyDgram, sizeof(replyDgram), dgram);
+    ok = ok && pReply != NULL && pReply->icmp_sequence == 9;
+    ok = ok && ParseEchoReply((char*)replyForeign, sizeof(replyForeign), raw) == NULL;
+    unsigned char replyCorrupt[20 + 44];
+    memcpy(replyCorrupt, replyRaw, sizeof(replyRaw));
+    replyCorrupt[20 + 30] ^= 0x40;                                          // A flipped payload bit
+    unsigned long long failures = MetricsLocal().counters[METRIC_CHECKSUM_FAILURES].load();
+    ok = ok && ParseEchoReply((char*)replyCorrupt, sizeof(replyCorrupt), raw) == NULL
+            && MetricsLocal().counters[METRIC_CHECKSUM_FAILURES].load() == failures + 1;
+    ok = ok && ParseProbeError((char*)errorFull, errorFullLen, raw, &error) && error.seq == 9 && error.destination == EchoTarget
+            && ErrorRttNs(error, 0, EchoRecvNs) == EchoRecvNs - EchoSendNs;
+    ok = ok && ParseProbeError((char*)errorShort, errorShortLen, raw, &error) && error.seq == 9 && ErrorRttNs(error, 0, EchoRecvNs) == 0;
+    ok = ok && ParseProbeError((char*)errorFrag, errorFragLen, raw, &error) && error.mtu == 1400;
+    if (!ok)
+    {
+        printf("Parsing a reply or error returned the wrong result\n");
+        return 1;
+    }
+
+    vector<OutputRecord> storeRecords;
+    vector<unsigned long long> storeTimes;
+    BuildStoreRecords(&storeRecords, &storeTimes);
+    vector<unsigned char> store = WriteStore(storeRecords, storeTimes);
+    TimeSeriesReader reader;
+    if (store.empty() || !reader.Attach(&store[0], store.size()) || !CheckStore(reader, storeRecords, storeTimes))
+    {
+        printf("The time-series store did not give back the records written to it\n");
+        return 1;
+    }
+
+    // Target t has RTTs of (1 + t % 8) * 250 us, which gives it a timeout of 2 to 6 ms
+    RtoTable inFlightRto(InFlightTargets, MakeRtoConfig(2000000ULL, 1000000000ULL));
+    for (unsigned int t = 0; t < InFlightTargets; ++t)
+        inFlightRto.Sample(t, (1 + t % 8) * 250000ULL);
+    for (int mode = 0; mode < 2; ++mode)
+    {
+        InFlightTable table(4096);
+        if (mode == 1)
+            table.UseDeadlines(0);
+        unsigned long long lateNs = 0, expired = 0;
+        const unsigned long long requests = 200000;
+        for (unsigned long long n = 0; n < requests; ++n)
+            expired += InFlightStep(table, mode == 1 ? &inFlightRto : NULL, n, &lateNs);
+        // Every request is answered, expired or still outstanding, and the lost ones sent 30 ms before the end are gone
+        unsigned long long lost = requests / 100, unanswered = InFlightAnswered;
+        if (expired + table.Size() != lost + unanswered || expired < (requests - 3000) / 100 || lateNs > 1000000ULL)
+        {
+            printf("The in-flight table (%s) expired %llu of %llu lost requests, up to %.3f ms late\n", mode == 1 ? "deadlines" : "ring",
+                   expired, lost, lateNs / 1e6);
+            return 1;
+        }
+    }
+
+    if (report.Table())
+        printf("%-24s %12s\n", "case", "time");
+    char name[64];
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++l)
+    {
+        int len = lengths[l];
+        unsigned short seq = 0;
+        unsigned long long sendNs = EchoSendNs;
+        double tFull = TimeIt([&]() {
+            BuildEchoRequest(request, len, ++seq, ++sendNs);
+            return ((ICMP_Header*)request)->icmp_checksum;
+        }, minNs);
+        BuildEchoRequest(request, len, 0, 0);
+        double tPatch = TimeIt([&]() {
+            PatchEchoRequest((ICMP_Header*)request, ++seq, ++sendNs);
+            return ((ICMP_Header*)request)->icmp_checksum;
+        }, minNs);
+        snprintf(name, sizeof(name), "build/full/%d", len);
+        report.Add(name, tFull, "ns");
+        if (report.Table())
+            printf("%-24s %9.1f ns\n", name, tFull);
+        snprintf(name, sizeof(name), "build/patch/%d", len);
+        report.Add(name, tPatch, "ns");
+        if (report.Table())
+            printf("%-24s %9.1f ns\n", name, tPatch);
+    }
+
+    unsigned short seq = 0;
+    unsigned long long sendNs = EchoSendNs;
+    BuildEchoRequest(request, 44, 0, 0);
+    double tParis = TimeIt([&]() {
+        PatchEchoRequest((ICMP_Header*)request, ++seq, ++sendNs);
+        HoldEchoChecksum((ICMP_Header*)request, 0x1234);
+        return ((ICMP_Header*)request)->icmp_checksum;
+    }, minNs);
+
+    // Each parse case runs what the receive loop does with such a datagram
+    double tReplyRaw = TimeIt([&]() {
+        ICMP_Header* p = ParseEchoReply((char*)replyRaw, sizeof(replyRaw), raw);
+        return p != NULL ? EchoRttNs(p, 0, EchoRecvNs) : 0;
+    }, minNs);
+    double tReplyDgram = TimeIt([&]() {
+        ICMP_Header* p = ParseEchoReply((char*)replyDgram, sizeof(replyDgram), dgram);
+        return p != NULL ? EchoRttNs(p, 0, EchoRecvNs) : 0;
+    }, minNs);
+    double tReplyForeign = TimeIt([&]() {
+        return (unsigned long long)(ParseEchoReply((char*)replyForeign, sizeof(replyForeign), raw) != NULL);
+    }, minNs);
+    double tErrorFull = TimeIt([&]() {
+        if (ParseEchoReply((char*)errorFull, errorFullLen, raw) != NULL || !ParseProbeError((char*)errorFull, errorFullLen, raw, &error))
+            return 0ULL;
+        return ErrorRttNs(error, 0, EchoRecvNs) + error.seq;
+    }, minNs);
+    double tErrorShort = TimeIt([&]() {
+        if (ParseEchoReply((char*)errorShort, errorShortLen, raw) != NULL || !ParseProbeError((char*)errorShort, errorShortLen, raw, &error))
+            return 0ULL;
+        return ErrorRttNs(error, 0, EchoRecvNs) + error.seq;
+    }, minNs);
+    double tErrorFrag = TimeIt([&]() {
+        if (ParseEchoReply((char*)errorFrag, errorFragLen, raw) != NULL || !ParseProbeError((char*)errorFrag, errorFragLen, raw, &error))
+            return 0ULL;
+        return (unsigned long long)error.mtu + error.seq;
+    }, minNs);
+
+    ThreadMetrics& metrics = MetricsLocal();
+    unsigned long long value = 0;
+    double tMetricsCount = TimeIt([&]() {
+        metrics.Count(METRIC_PACKETS_RECEIVED, 32);
+        return metrics.counters[METRIC_PACKETS_RECEIVED].load(std::memory_order_relaxed);
+    }, minNs);
+    double tMetricsRecord = TimeIt([&]() {
+        value = value * 6364136223846793005ULL + 1442695040888963407ULL;   // Spread over the buckets
+        metrics.Record(METRIC_RECV_CALL_NS, value >> 34);
+        return value;
+    }, minNs);
+
+    // The store cases: appending goes to a temporary file that grows as long as the timing runs
+    FILE* appendFile = tmpfile();
+    if (appendFile == NULL)
+    {
+        printf("Unable to create a temporary file\n");
+        return 1;
+    }
+    TimeSeriesWriter appender(appendFile);
+    size_t next = 0;
+    unsigned long long runNs = 0;                                           // Later passes continue in time after the first
+    double tStoreAppend = TimeIt([&]() {
+        if (next == storeRecords.size())
+        {
+            next = 0;
+            runNs += (unsigned long long)StoreRounds * 1000000000ULL;
+        }
+        appender.Write(storeRecords[next], storeTimes[next] + runNs);
+        ++next;
+        return appender.Records();
+    }, minNs);
+    appender.Close();
+    fclose(appendFile);
+    double recordsPerPass = (double)storeRecords.size();
+    double tStoreDecode = TimeIt([&]() {
+        unsigned long long sum = 0;
+        TimeSeriesBlockInfo block;
+        for (size_t b = 0; b < reader.Blocks(); ++b)
+            if (reader.Block(b, &block))
+                reader.Decode(block, [&sum](const OutputRecord& record) { sum += record.rttNs + record.seq; });
+        return sum;
+    }, minNs) / recordsPerPass;
+    double tStoreDecodeRtt = TimeIt([&]() {
+        unsigned long long sum = 0;
+        TimeSeriesBlockInfo block;
+        for (size_t b = 0; b < reader.Blocks(); ++b)
+            if (reader.Block(b, &block))
+                reader.DecodeRtts(block, [&sum](unsigned char, unsigned long long rttNs) { sum += rttNs; });
+        return sum;
+    }, minNs) / recordsPerPass;
+    const int windows[] = { 10, 50, 100 };                                  // Percent of the run, centered
+    double tStoreQuery[3];
+    vector<TimeSeriesSummary> summaries;
+    TimeSeriesQueryStats queryStats;
+    for (int w = 0; w < 3; ++w)
+    {
+        unsigned long long spanNs = (unsigned long long)StoreRounds * 1000000000ULL;
+        unsigned long long fromNs = StoreStartNs + spanNs / 2 - spanNs * windows[w] / 200, toNs = fromNs + spanNs * windows[w] / 100 + 1;
+        tStoreQuery[w] = TimeIt([&]() {
+            reader.Query(fromNs, toNs, true, 0, true, &summaries, &queryStats);
+            return summaries[0].replies;
+        }, minNs);
+    }
+
+    RtoTable rto(InFlightTargets, MakeRtoConfig());
+    unsigned int rtoTarget = 0;
+    double tRtoSample = TimeIt([&]() {
+        value = value * 6364136223846793005ULL + 1442695040888963407ULL;
+        rtoTarget = (rtoTarget + 1) & (InFlightTargets - 1);
+        rto.Sample(rtoTarget, 20000000ULL + (value >> 44));                 // 20 ms and up to 1 ms of jitter
+        return rto.Estimator(rtoTarget).SrttNs();
+    }, minNs);
+    double tRtoTimeout = TimeIt([&]() {
+        rtoTarget = (rtoTarget + 1) & (InFlightTargets - 1);
+        return rto.TimeoutNs(rtoTarget);
+    }, minNs);
+    double tInFlight[2];
+    for (int mode = 0; mode < 2; ++mode)
+    {
+        InFlightTable table(4096);
+        if (mode == 1)
+            table.UseDeadlines(0);
+        unsigned long long n = 0, lateNs = 0;
+        tInFlight[mode] = TimeIt([&]() {
+            return (unsigned long long)InFlightStep(table, mode == 1 ? &inFlightRto : NULL, n++, &lateNs);
+        }, minNs);
+    }
+
+    const struct { const char* name; double ns; } cases[] = {
+        { "build/paris", tParis },
+        { "parse/reply_raw", tReplyRaw },
+        { "parse/reply_dgram", tReplyDgram },
+        { "parse/reply_foreign", tReplyForeign },
+        { "parse/error_full", tErrorFull },
+        { "parse/error_short", tErrorShort },
+        { "parse/error_frag", tErrorFrag },
+        { "metrics/count", tMetricsCount },
+        { "metrics/record", tMetricsRecord },
+        { "tsdb/append", tStoreAppend },
+        { "tsdb/decode", tStoreDecode },
+        { "tsdb/decode_rtt", tStoreDecodeRtt },
+        { "tsdb/query/10", tStoreQuery[0] },
+        { "tsdb/query/50", tStoreQuery[1] },
+        { "tsdb/query/100", tStoreQuery[2] },
+        { "rto/sample", tRtoSample },
+        { "rto/timeout", tRtoTimeout },
+        { "inflight/ring", tInFlight[0] },
+        { "inflight/deadline", tInFlight[1] },
+    };
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c)
+    {
+        report.Add(cases[c].name, cases[c].ns, "ns");
+        if (report.Table())
+            printf("%-24s %9.1f ns\n", cases[c].name, cases[c].ns);
+    }
+    double bytesPerRecord = (double)store.size() / (double)storeRecords.size();
+    report.Add("tsdb/bytes_per_record", bytesPerRecord, "bytes");
+    if (report.Table())
+        printf("%-24s %9.2f bytes\n", "tsdb/bytes_per_record", bytesPerRecord);
+    return report.Finish() ? 0 : 1;
+}
@@ -0,0 +1,393 @@
+/* ICMP Packet Watcher - Capture writing and offline replay throughput */
+
+/* Builds the traffic of a sweep over 1024 targets, 200 rounds 10 ms apart (20 with --quick), as the prober would
+   capture it: every request, and for most of them a reply after 1 to 3 ms, a tenth of which carry IP options. Mixed
+   in are replies that are lost, duplicated, late (after the 20 ms timeout) or fail their checksum, time exceeded
+   errors quoting the whole request, errors truncated to less than the request's first 8 bytes, and replies to
+   another prober's icmp_id. The packets are written with the PcapWriter of icmp_Pcap.h and replayed from the file
+   with the PcapReplay of icmp_Replay.h:
+     write/pcap, write/pcapng                one packet into the buffered writer, per packet of the whole capture,
+                                             until its writer thread has put the last one in the file
+     write/pcap_mapped, write/pcapng_mapped  the same through the memory mapped writer (-K)
+     read/pcap, read/pcapng                  one packet handed out by PcapReader
+     replay/pcap, replay/pcapng              one packet through both passes of the replay: targets, matching,
+                                             statistics and timeouts
+     replay/rate                             packets per second of replay/pcapng
+   Every file is checked first: the replay must count exactly the requests, replies, duplicates, late replies,
+   errors, truncated errors, foreign packets, checksum failures and timeouts that went in, for all four writers.
+   The reader is checked on the same packets rewritten the way tcpdump stores them elsewhere: microsecond pcap in
+   the other byte order, Ethernet frames with a VLAN tag. The capture files are written to the current directory
+   and removed at the end.
+
+   To compile: g++ -O2 -pthread icmp_PcapBenchmark.cpp -o pcap_bench  (or the icmp_PcapBenchmark target of the CMake build)
+   To run: ./pcap_bench [--json[=file]] [--quick]  (see icmp_Benchmark.h) */
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include "icmp_Benchmark.h"
+#include "../Source Code Files (.cpp)/icmp_Pcap.h"
+#include "../Source Code Files (.cpp)/icmp_Replay.h"
+
+using namespace std;
+
+#define PcapTargets      1024
+#define PcapRequestLen   44                                                 // ICMP_Header and 32 bytes of payload, as the prober sends
+#define PcapId           0x4d2
+#define PcapForeignId    0x1234
+#define PcapRouter       0x0101a8c0                                         // 192.168.1.1 in network byte order
+#define PcapRoundNs      10000000ULL
+#define PcapTimeoutNs    20000000ULL
+#define PcapStartNs      1000000000ULL
+
+enum PcapEventKind
+{
+    EVENT_REQUEST,
+    EVENT_REPLY,
+    EVENT_REPLY_OPTIONS,                                                    // With 4 bytes of IP options
+    EVENT_REPLY_CORRUPT,                                                    // Wrong ICMP checksum
+    EVENT_REPLY_FOREIGN,                                                    // Another prober's icmp_id
+    EVENT_ERROR,                                                            // Time exceeded, the whole request quoted
+    EVENT_ERROR_TRUNCATED                                                   // Time exceeded quoting only 4 bytes of it
+};
+
+struct PcapEvent
+{
+    unsigned long long timeNs;
+    unsigned int       target;
+    unsigned short     seq;
+    PcapEventKind      kind;
+
+    bool operator<(const PcapEvent& other) const { return timeNs < other.timeNs; }
+};
+
+// What the replay has to count for the traffic
+struct PcapExpected
+{
+    unsigned long long requests, replies, duplicates, late, errors, truncated, foreign, corrupt, lost;
+};
+
+static unsigned long TargetAddress(unsigned int t)
+{
+    return 10 | (t / 256 + 1) << 16 | (t % 256) << 24;                      // 10.0.x.y in network byte order
+}
+
+static unsigned long long RandomNext(unsigned long long& random)
+{
+    random ^= random << 13;                                                 // xorshift64
+    random ^= random >> 7;
+    random ^= random << 17;
+    return random;
+}
+
+// The events of every round in time order, and the counts they should give
+static vector<PcapEvent> BuildEvents(int rounds, PcapExpected* expected)
+{
+    vector<PcapEvent> events;
+    memset(expected, 0, sizeof(*expected));
+    unsigned long long random = 88172645463325252ULL;
+    for (int r = 0; r < rounds; ++r)
+        for (unsigned int t = 0; t < PcapTargets; ++t)
+        {
+            PcapEvent request = { PcapStartNs + r * PcapRoundNs + t * 9000ULL, t, (unsigned short)(r + 1), EVENT_REQUEST };
+            events.push_back(request);
+            ++expected->requests;
+            unsigned long long rttNs = 1000000ULL + RandomNext(random) % 2000000ULL;
+            PcapEvent answer = request;
+            answer.timeNs += rttNs;
+            unsigned int roll = (unsigned int)(RandomNext(random) % 1000);
+            if (roll < 10)                                                  // Lost
+                ++expected->lost;
+            else if (roll < 20)
+            {
+                answer.kind = EVENT_ERROR;
+                ++expected->errors;
+                ++expected->lost;
+            }
+            else if (roll < 25)
+            {
+                answer.kind = EVENT_ERROR_TRUNCATED;                        // Does not end the probe, it times out
+                ++expected->truncated;
+                ++expected->lost;
+            }
+            else if (roll < 30)
+            {
+                answer.kind = EVENT_REPLY_CORRUPT;
+                ++expected->corrupt;
+                ++expected->foreign;
+                ++expected->lost;
+            }
+            else if (roll < 35)
+            {
+                answer.kind = EVENT_REPLY;
+                answer.timeNs = request.timeNs + PcapTimeoutNs + 10000000ULL;
+                ++expected->late;
+                ++expected->lost;
+            }
+            else
+            {
+                answer.kind = roll < 135 ? EVENT_REPLY_OPTIONS : EVENT_REPLY;
+                ++expected->replies;
+                if (roll >= 990)
+                {
+                    PcapEvent duplicate = answer;
+                    duplicate.timeNs += 100000ULL;
+                    events.push_back(duplicate);
+                    ++expected->duplicates;
+                }
+            }
+            if (roll >= 10)
+                events.push_back(answer);
+            if (roll % 200 == 7)
+            {
+                PcapEvent foreign = answer;
+                foreign.kind = EVENT_REPLY_FOREIGN;
+                events.push_back(foreign);
+                ++expected->foreign;
+            }
+        }
+    stable_sort(events.begin(), events.end());
+    return events;
+}
+
+static void BuildIcmp(unsigned char* icmp, unsigned char type, unsigned short id, unsigned short seq)
+{
+    memset(icmp, 'Y', PcapRequestLen);
+    icmp[0] = type;
+    icmp[1] = 0;
+    icmp[2] = icmp[3] = 0;
+    memcpy(icmp + 4, &id, 2);
+    memcpy(icmp + 6, &seq, 2);
+    unsigned short sum = checksum((const unsigned short*)icmp, PcapRequestLen);
+    memcpy(icmp + 2, &sum, 2);
+}
+
+static int BuildIp(unsigned char* ip, int optionBytes, int payloadLen, unsigned long source, unsigned long destination)
+{
+    int headerLen = 20 + optionBytes, total = headerLen + payloadLen;
+    unsigned int address;
+    memset(ip, 0, headerLen);
+    ip[0] = (unsigned char)(0x40 | headerLen / 4);
+    ip[2] = (unsigned char)(total >> 8);
+    ip[3] = (unsigned char)total;
+    ip[8] = 57;
+    ip[9] = 1;
+    address = (unsigned int)source;
+    memcpy(ip + 12, &address, 4);
+    address = (unsigned int)destination;
+    memcpy(ip + 16, &address, 4);
+    for (int i = 0; i < optionBytes - 1; ++i)
+        ip[20 + i] = 1;                                                     // NOP, then end of options
+    return headerLen;
+}
+
+// A received datagram for the event, IP header first as a raw socket delivers it. Returns its length.
+static int BuildReceived(const PcapEvent& event, unsigned char* datagram)
+{
+    unsigned long target = TargetAddress(event.target);
+    if (event.kind == EVENT_ERROR || event.kind == EVENT_ERROR_TRUNCATED)
+    {
+        int quoteLen = event.kind == EVENT_ERROR ? PcapRequestLen : 4;
+        int len = BuildIp(datagram, 0, 8 + 20 + quoteLen, PcapRouter, 0);
+        unsigned char* icmp = datagram + len;
+        memset(icmp, 0, 8);
+        icmp[0] = 11;
+        BuildIp(icmp + 8, 0, PcapRequestLen, 0, target);
+        BuildIcmp(icmp + 28, 8, PcapId, event.seq);
+        unsigned short sum = checksum((const unsigned short*)icmp, 8 + 20 + quoteLen);
+        memcpy(icmp + 2, &sum, 2);
+        return len + 8 + 20 + quoteLen;
+    }
+    int len = BuildIp(datagram, event.kind == EVENT_REPLY_OPTIONS ? 4 : 0, PcapRequestLen, target, 0);
+    BuildIcmp(datagram + len, 0, event.kind == EVENT_REPLY_FOREIGN ? PcapForeignId : PcapId, event.seq);
+    if (event.kind == EVENT_REPLY_CORRUPT)
+        datagram[len + 2] ^= 0x40;
+    return len + PcapRequestLen;
+}
+
+// Writes the events into a new capture file and times the writer per packet
+static bool WriteCapture(const char* path, PcapFormat format, bool mapped, const vector<PcapEvent>& events, double* nsPerPacket)
+{
+    IcmpSocket raw;
+    memset(&raw, 0, sizeof(raw));
+    raw.hasIpHeader = true;
+    vector<unsigned char> packets(events.size() * 128);                     // Built up front, only the writer is timed
+    vector<int> lengths(events.size());
+    for (size_t e = 0; e < events.size(); ++e)
+    {
+        unsigned char* packet = &packets[e * 128];
+        if (events[e].kind == EVENT_REQUEST)
+        {
+            BuildIcmp(packet, 8, PcapId, events[e].seq);
+            lengths[e] = PcapRequestLen;
+        }
+        else
+            lengths[e] = BuildReceived(events[e], packet);
+    }
+    PcapWriter writer;                                                      // Unpaced, so the ring holds the whole capture and drops nothing
+    if (!writer.Open(path, format, mapped, 1, (unsigned int)(events.size() * 256)))
+        return false;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t e = 0; e < events.size(); ++e)
+    {
+        const char* packet = (const char*)&packets[e * 128];
+        if (events[e].kind == EVENT_REQUEST)
+            writer.WriteSent(packet, lengths[e], TargetAddress(events[e].target), 0, events[e].timeNs);
+        else
+            writer.WriteReceived(raw, packet, lengths[e], 0, events[e].timeNs);
+    }
+    bool ok = writer.Close();
+    *nsPerPacket = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / events.size();
+    return ok && writer.Packets() == events.size();
+}
+
+// The replay of the file counts what went in
+static bool CheckReplay(const char* path, const PcapExpected& expected, size_t packets)
+{
+    PcapReader reader;
+    if (!reader.Open(path))
+    {
+        printf("Pcap: %s cannot be read back\n", path);
+        return false;
+    }
+    PcapReplay replay(MakeRtoConfig(PcapTimeoutNs, PcapTimeoutNs));
+    replay.Run(reader);
+    RttStats all;
+    for (size_t t = 0; t < replay.Targets(); ++t)
+        all.Merge(replay.Stats(t));
+    bool ok = replay.Packets() == packets && replay.Targets() == PcapTargets && all.Sent() == expected.requests &&
+              replay.Replies() == expected.replies && all.Duplicates() == expected.duplicates && all.Late() == expected.late &&
+              replay.Errors() == expected.errors && replay.TruncatedErrors() == expected.truncated && replay.Foreign() == expected.foreign &&
+              replay.ChecksumFailures() == expected.corrupt && all.Lost() == expected.lost && all.Errors() == expected.errors &&
+              replay.TimedOut() == expected.lost - expected.errors && replay.Other() == 0 && replay.Malformed() == 0 &&
+              all.MinNs() >= 1000000ULL && all.MaxNs() < 3100000ULL && !reader.Damaged();
+    if (!ok)
+    {
+        printf("Pcap: replay of %s counted %llu packets, %llu sent, %llu replies, %llu duplicates, %llu late, %llu errors, %llu truncated, "
+               "%llu foreign, %llu checksum failures, %llu lost\n", path, replay.Packets(), all.Sent(), replay.Replies(), all.Duplicates(),
+               all.Late(), replay.Errors(), replay.TruncatedErrors(), replay.Foreign(), replay.ChecksumFailures(), all.Lost());
+        printf("      expected %zu packets, %llu sent, %llu replies, %llu duplicates, %llu late, %llu errors, %llu truncated, "
+               "%llu foreign, %llu checksum failures, %llu lost\n", packets, expected.requests, expected.replies, expected.duplicates,
+               expected.late, expected.errors, expected.truncated, expected.foreign, expected.corrupt, expected.lost);
+    }
+    return ok;
+}
+
+static void Put32Swapped(vector<unsigned char>& out, unsigned int v)
+{
+    unsigned char bytes[4] = { (unsigned char)(v >> 24), (unsigned char)(v >> 16), (unsigned char)(v >> 8), (unsigned char)v };
+    out.insert(out.end(), bytes, bytes + 4);
+}
+
+// The first packets of a capture as a big-endian microsecond pcap of Ethernet frames with a VLAN tag read the same
+static bool CheckForeignLayout(const char* path)
+{
+    PcapReader reader;
+    if (!reader.Open(path))
+        return false;
+    vector<unsigned char> other;
+    unsigned int header[6] = { 0xA1B2C3D4, 0x00020004, 0, 0, 65535, 1 }; // Version 2.4, Ethernet
+    for (int i = 0; i < 6; ++i)
+        Put32Swapped(other, header[i]);
+    vector<PcapPacket> originals;
+    PcapPacket packet;
+    while (originals.size() < 100 && reader.Next(&packet))
+    {
+        originals.push_back(packet);
+        static const unsigned char ethernet[18] = { 2, 0, 0, 0, 0, 1, 2, 0, 0, 0, 0, 2, 0x81, 0x00, 0x00, 0x07, 0x08, 0x00 };
+        Put32Swapped(other, (unsigned int)(packet.timeNs / 1000000000ULL));
+        Put32Swapped(other, (unsigned int)(packet.timeNs % 1000000000ULL / 1000));
+        Put32Swapped(other, (unsigned int)(packet.length + 18));
+        Put32Swapped(other, (unsigned int)(packet.length + 18));
+        other.insert(other.end(), ethernet, ethernet + 18);
+        other.insert(other.end(), packet.ip, packet.ip + packet.length);
+    }
+    PcapReader again;
+    if (!again.Open(&other[0], other.size()))
+        return false;
+    for (size_t i = 0; i < originals.size(); ++i)
+        if (!again.Next(&packet) || packet.length != originals[i].length || memcmp(packet.ip, originals[i].ip, packet.length) != 0 ||
+            packet.timeNs != originals[i].timeNs / 1000 * 1000)
+            return false;
+    return !again.Next(&packet) && !again.Damaged() && again.Skipped() == 0;
+}
+
+int main(int argc, char* argv[])
+{
+    BenchmarkOptions options = ParseBenchmarkOptions(argc, argv);
+    BenchmarkReport report("pcap", options);
+    double minNs = BenchmarkMinNs(options);
+
+    PcapExpected expected;
+    vector<PcapEvent> events = BuildEvents(options.quick ? 20 : 200, &expected);
+    const char* files[4] = { "icmp_pcap_bench.pcap", "icmp_pcap_bench.pcapng", "icmp_pcap_bench_mapped.pcap", "icmp_pcap_bench_mapped.pcapng" };
+    double writeNs[4];
+    bool ok = true;
+    for (int f = 0; f < 4 && ok; ++f)
+    {
+        ok = WriteCapture(files[f], PcapFormatOf(files[f]), f >= 2, events, &writeNs[f]);
+        if (!ok)
+            printf("Pcap: unable to write %s here\n", files[f]);
+    }
+    if (!ok)
+    {
+        for (int f = 0; f < 4; ++f)
+            remove(files[f]);
+        return BenchmarkSkipped;
+    }
+    for (int f = 0; f < 4 && ok; ++f)
+        ok = CheckReplay(files[f], expected, events.size());
+    if (ok && !(ok = CheckForeignLayout(files[0])))
+        printf("Pcap: a big-endian Ethernet capture reads differently\n");
+    if (!ok)
+    {
+        for (int f = 0; f < 4; ++f)
+            remove(files[f]);
+        return 1;
+    }
+
+    double readNs[2], replayNs[2];
+    for (int f = 0; f < 2; ++f)
+    {
+        PcapReader reader;
+        reader.Open(files[f]);
+        readNs[f] = TimeIt([&]() {
+            PcapPacket packet;
+            unsigned long long bytes = 0;
+            reader.Rewind();
+            while (reader.Next(&packet))
+                bytes += packet.length;
+            return bytes;
+        }, minNs) / events.size();
+        replayNs[f] = TimeIt([&]() {
+            PcapReplay replay(MakeRtoConfig(PcapTimeoutNs, PcapTimeoutNs));
+            replay.Run(reader);
+            return replay.Replies();
+        }, minNs) / events.size();
+    }
+    for (int f = 0; f < 4; ++f)
+        remove(files[f]);
+
+    const struct { const char* name; double value; const char* unit; } cases[] = {
+        { "write/pcap", writeNs[0], "ns" },
+        { "write/pcapng", writeNs[1], "ns" },
+        { "write/pcap_mapped", writeNs[2], "ns" },
+        { "write/pcapng_mapped", writeNs[3], "ns" },
+        { "read/pcap", readNs[0], "ns" },
+        { "read/pcapng", readNs[1], "ns" },
+        { "replay/pcap", replayNs[0], "ns" },
+        { "replay/pcapng", replayNs[1], "ns" },
+        { "replay/rate", 1e3 / replayNs[1], "Mpkt/s" },
+    };
+    if (report.Table())
+        printf("%zu packets\n%-24s %12s\n", events.size(), "case", "value");
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c)
+    {
+        report.Add(cases[c].name, cases[c].value, cases[c].unit);
+        if (report.Table())
+            printf("%-24s %9.1f %s\n", cases[c].name, cases[c].value, cases[c].unit);
+    }
+    return report.Finish() ? 0 : 1;
+}
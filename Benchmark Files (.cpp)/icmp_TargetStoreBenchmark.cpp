@@ -0,0 +1,385 @@
+/* ICMP Packet Watcher - Target state at million-target scale */
+
+/* Holds 10^6 targets (10^5 with --quick) in the TargetStore of icmp_TargetStore.h and, as the baseline, in one
+   object per target in a std::unordered_map keyed by address, the layout a prober usually starts with. Both hold the
+   same state: an RttStats, an RtoEstimator, the error counts by class, the sequence number and the cold fields.
+     bytes_per_target       heap bytes per target, pages / nodes, buckets and index included
+     add                    one target of a bulk add of all of them into an empty store / map
+     add_max_pause          the longest single insert of that add (the map rehashes as it grows, the store never does)
+     churn                  one target of removing a tenth of the set and adding a new tenth
+     find                   address -> target, at random; find/sorted is a binary search over the sorted address list,
+                            the lookup the sweep used before
+     sweep                  one probe of a round over every target scheduled by ProbeScheduler: sequence number and
+                            timeout on send, then the reply (classified and recorded as an RTT sample) or, for 1%,
+                            the loss. sweep/scheduler is the same round with nothing done per probe, the cost both
+                            layouts share
+     totals                 one target of summing the sent, received and lost counters over all of them
+   The store is checked first: ids in the order added, duplicates keep their id, a full store refuses more, removed
+   addresses are gone while the others are still found, removed ids come back before any new page is taken and
+   start from zero, the totals equal the sums of the per-target counters, and Stats() gives what an RttStats fed the
+   same probes gives.
+
+   To compile: g++ -O2 -pthread icmp_TargetStoreBenchmark.cpp -o target_store_bench  (or the icmp_TargetStoreBenchmark target of the CMake build)
+   To run: ./target_store_bench [--json[=file]] [--quick]  (see icmp_Benchmark.h) */
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+#include "icmp_Benchmark.h"
+#include "../Source Code Files (.cpp)/icmp_Scheduler.h"
+#include "../Source Code Files (.cpp)/icmp_Stats.h"
+#include "../Source Code Files (.cpp)/icmp_TargetStore.h"
+#include "../Source Code Files (.cpp)/icmp_Types.h"
+
+using namespace std;
+
+// Heap bytes taken by the baseline map, counted by its allocator
+static size_t CountedBytes = 0;
+
+template <typename T>
+struct CountingAllocator
+{
+    typedef T value_type;
+    CountingAllocator() {}
+    template <typename U> CountingAllocator(const CountingAllocator<U>&) {}
+    T* allocate(size_t n)
+    {
+        CountedBytes += n * sizeof(T);
+        return (T*)::operator new(n * sizeof(T));
+    }
+    void deallocate(T* p, size_t n)
+    {
+        CountedBytes -= n * sizeof(T);
+        ::operator delete(p);
+    }
+    template <typename U> bool operator==(const CountingAllocator<U>&) const { return true; }
+    template <typename U> bool operator!=(const CountingAllocator<U>&) const { return false; }
+};
+
+// The baseline: everything about a target in one object, hot and cold fields side by side
+struct TargetRecord
+{
+    unsigned int       address;
+    unsigned short     seq;
+    RttStats           stats;
+    RtoEstimator       rto;
+    IcmpErrorCounts    errors;
+    unsigned long long intervalNs;
+    unsigned long long addedNs;
+};
+
+typedef unordered_map<unsigned int, TargetRecord, hash<unsigned int>, equal_to<unsigned int>,
+                      CountingAllocator<pair<const unsigned int, TargetRecord> > > TargetMap;
+
+// Distinct addresses in a scattered order: an odd multiplier is a bijection on 32 bits
+static unsigned long TargetAddress(unsigned int n)
+{
+    return (unsigned long)(unsigned int)((n + 1) * 2654435761u);
+}
+
+static double NsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+}
+
+static unsigned long long RandomNext(unsigned long long& state)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+// Runs one round of ProbeScheduler over every target in steps of 1 ms of simulated time, probe(id) for each
+template <typename Probe>
+static double SweepRound(unsigned int targets, Probe probe)
+{
+    const unsigned long long periodNs = 1000000000ULL;
+    ProbeScheduler schedule(targets);
+    schedule.Start(0);
+    for (unsigned int id = 0; id < targets; ++id)
+        schedule.Add(id, periodNs, 1, true);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (unsigned long long nowNs = 0; !schedule.Finished(); nowNs += 1000000ULL)
+        schedule.Run(nowNs, 1 << 30, [&](unsigned int id, unsigned long long) { probe(id); return true; });
+    return NsSince(start) / targets;
+}
+
+static bool CheckStore()
+{
+    const unsigned int capacity = 3 * TargetStorePage + 100;
+    TargetStore store(capacity);
+    vector<unsigned long> addresses(capacity + 10);
+    for (unsigned int i = 0; i < addresses.size(); ++i)
+        addresses[i] = i == 5 ? 0 : TargetAddress(i);                       // 0.0.0.0 is a target like any other
+    vector<unsigned int> ids(addresses.size());
+    if (store.Add(&addresses[0], NULL, capacity, 7, &ids[0]) != capacity || store.Size() != capacity)
+        return false;
+    for (unsigned int i = 0; i < capacity; ++i)
+        if (ids[i] != i || store.Find(addresses[i]) != i || store.Address(i) != addresses[i] || store.AddedNs(i) != 7)
+            return false;
+    vector<unsigned int> more(addresses.size());
+    if (store.Add(&addresses[0], NULL, addresses.size(), 8, &more[0]) != 0 || more[capacity - 1] != capacity - 1 ||
+        more[capacity] != TargetStoreNone || store.Find(addresses[capacity]) != TargetStoreNone)
+        return false;
+
+    // Counters: target i is sent i % 5 + 1 probes, the first is answered, the others lost
+    unsigned long long sent = 0, received = 0, lost = 0;
+    for (unsigned int i = 0; i < capacity; ++i)
+        for (unsigned int p = 0; p <= i % 5; ++p)
+        {
+            if (store.OnSent(i) != p + 1)
+                return false;
+            ++sent;
+            if (p == 0)
+            {
+                if (store.OnReply(i, 1) != REPLY_NEW)
+                    return false;
+                store.Record(i, 1000000ULL + i);
+                ++received;
+            }
+            else
+            {
+                store.OnLost(i);
+                ++lost;
+            }
+        }
+    unsigned long long s, r, l;
+    store.Totals(&s, &r, &l);
+    if (s != sent || r != received || l != lost || store.Sent(9) != 5 || store.Lost(9) != 4 || !store.Rto(9).Sampled())
+        return false;
+
+    // The summary columns against an RttStats fed the same: replies out of order, a duplicate, a late reply, an error
+    TargetStore single(1);
+    unsigned long address = 1;
+    unsigned int id;
+    single.Add(&address, NULL, 1, 0, &id);
+    RttStats expected;
+    const unsigned short seqs[] = { 1, 3, 2, 3, 5 };
+    const unsigned long long rtts[] = { 1200000, 900000, 4100000, 0, 2500000 };
+    for (int p = 0; p < 6; ++p)
+    {
+        single.OnSent(id);
+        expected.OnSent();
+    }
+    for (int p = 0; p < 5; ++p)
+    {
+        ReplyKind kind = single.OnReply(id, seqs[p], p == 4);
+        if (kind != expected.OnReply(seqs[p], p == 4))
+            return false;
+        if (kind == REPLY_NEW)
+        {
+            single.Record(id, rtts[p]);
+            expected.Record(rtts[p]);
+        }
+    }
+    single.OnError(id);
+    expected.OnError();
+    single.CountError(id, 3);
+    RttStats stats = single.Stats(id);
+    if (stats.Sent() != expected.Sent() || stats.Received() != expected.Received() || stats.Lost() != expected.Lost() ||
+        stats.Errors() != expected.Errors() || stats.Late() != expected.Late() || stats.Duplicates() != expected.Duplicates() ||
+        stats.Reordered() != expected.Reordered() || stats.MinNs() != expected.MinNs() || stats.MaxNs() != expected.MaxNs() ||
+        stats.MeanNs() != expected.MeanNs() || stats.JitterNs() != expected.JitterNs() || stats.Received() != 3 ||
+        single.Errors(id).Count(ICMP_ERROR_UNREACHABLE) != 1)
+        return false;
+
+    // Every other target out, then new ones back in: the same ids, no new page, a clean state
+    vector<unsigned int> removed;
+    for (unsigned int i = 0; i < capacity; i += 2)
+        removed.push_back(i);
+    if (store.Remove(&removed[0], removed.size()) != removed.size() || store.Remove(&removed[0], 1) != 0 ||
+        store.Size() != capacity - removed.size())
+        return false;
+    size_t bytes = store.Bytes();
+    for (unsigned int i = 0; i < capacity; ++i)
+        if (store.Find(addresses[i]) != (i % 2 == 0 ? TargetStoreNone : i))
+            return false;
+    vector<unsigned long> fresh(removed.size());
+    for (size_t i = 0; i < fresh.size(); ++i)
+        fresh[i] = TargetAddress(capacity + 100 + (unsigned int)i);
+    vector<unsigned int> freshIds(fresh.size());
+    if (store.Add(&fresh[0], NULL, fresh.size(), 9, &freshIds[0]) != fresh.size() || store.IdLimit() != capacity || store.Bytes() != bytes)
+        return false;
+    for (size_t i = 0; i < fresh.size(); ++i)
+        if (freshIds[i] % 2 != 0 || store.Find(fresh[i]) != freshIds[i] || store.Sent(freshIds[i]) != 0 || store.Rto(freshIds[i]).Sampled() ||
+            store.Seq(freshIds[i]) != 0 || store.AddedNs(freshIds[i]) != 9)
+            return false;
+    for (unsigned int i = 1; i < capacity; i += 2)
+        if (store.Find(addresses[i]) != i || store.Sent(i) != i % 5 + 1)
+            return false;
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    BenchmarkOptions options = ParseBenchmarkOptions(argc, argv);
+    BenchmarkReport report("target_store", options);
+    double minNs = BenchmarkMinNs(options);
+
+    if (!CheckStore())
+    {
+        printf("TargetStore: wrong ids, lookups or counters\n");
+        return 1;
+    }
+
+    const unsigned int targets = options.quick ? 100000 : 1000000;
+    const RtoConfig rtoConfig = MakeRtoConfig();
+    vector<unsigned long> addresses(targets);
+    for (unsigned int i = 0; i < targets; ++i)
+        addresses[i] = TargetAddress(i);
+    vector<unsigned int> ids(targets);
+
+    // One insert at a time for the longest pause, then the timed bulk add into a fresh store / map
+    double storeMaxPause = 0, mapMaxPause = 0;
+    {
+        TargetStore store(targets);
+        TargetMap map;
+        for (unsigned int i = 0; i < targets; ++i)
+        {
+            chrono::steady_clock::time_point one = chrono::steady_clock::now();
+            store.Add(&addresses[i], NULL, 1, 0, &ids[i]);
+            storeMaxPause = max(storeMaxPause, NsSince(one));
+            one = chrono::steady_clock::now();
+            map[(unsigned int)addresses[i]].address = (unsigned int)addresses[i];
+            mapMaxPause = max(mapMaxPause, NsSince(one));
+        }
+    }
+    TargetStore store(targets);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    store.Add(&addresses[0], NULL, targets, 0, &ids[0]);
+    double storeAdd = NsSince(start) / targets;
+    TargetMap map;
+    start = chrono::steady_clock::now();
+    for (unsigned int i = 0; i < targets; ++i)
+        map[(unsigned int)addresses[i]].address = (unsigned int)addresses[i];
+    double mapAdd = NsSince(start) / targets;
+    double storeBytes = (double)store.Bytes() / targets, mapBytes = (double)CountedBytes / targets;
+    if (store.Size() != targets || map.size() != targets)
+    {
+        printf("TargetStore: %u of %u targets added\n", store.Size(), targets);
+        return 1;
+    }
+
+    // Churn: the oldest tenth goes, a new tenth comes
+    const unsigned int tenth = targets / 10;
+    vector<unsigned long> churned(tenth);
+    for (unsigned int i = 0; i < tenth; ++i)
+        churned[i] = TargetAddress(targets + i);
+    vector<unsigned int> churnedIds(tenth);
+    start = chrono::steady_clock::now();
+    store.Remove(&ids[0], tenth);
+    store.Add(&churned[0], NULL, tenth, 0, &churnedIds[0]);
+    double storeChurn = NsSince(start) / tenth;
+    start = chrono::steady_clock::now();
+    for (unsigned int i = 0; i < tenth; ++i)
+        map.erase((unsigned int)addresses[i]);
+    for (unsigned int i = 0; i < tenth; ++i)
+        map[(unsigned int)churned[i]].address = (unsigned int)churned[i];
+    double mapChurn = NsSince(start) / tenth;
+    for (unsigned int i = 0; i < tenth; ++i)
+    {
+        addresses[i] = churned[i];
+        ids[i] = churnedIds[i];
+    }
+    if (store.Size() != targets || map.size() != targets || store.IdLimit() != targets)
+    {
+        printf("TargetStore: churn left %u targets and %u ids\n", store.Size(), store.IdLimit());
+        return 1;
+    }
+
+    // Lookups of random targets
+    vector<unsigned long> sorted(addresses);
+    sort(sorted.begin(), sorted.end());
+    unsigned long long random = 0x9E3779B97F4A7C15ULL;
+    double storeFind = TimeIt([&]() { return (unsigned long long)store.Find(addresses[RandomNext(random) % targets]); }, minNs);
+    double mapFind = TimeIt([&]() { return (unsigned long long)map.find((unsigned int)addresses[RandomNext(random) % targets])->second.address; }, minNs);
+    double sortedFind = TimeIt([&]() {
+        return (unsigned long long)(lower_bound(sorted.begin(), sorted.end(), addresses[RandomNext(random) % targets]) - sorted.begin());
+    }, minNs);
+
+    // A sweep round: scheduler ids are store ids; the map's records are reached through a pointer per id
+    vector<TargetRecord*> records(targets);
+    for (unsigned int i = 0; i < targets; ++i)
+        records[ids[i]] = &map.find((unsigned int)addresses[i])->second;
+    unsigned long long sink = 0;
+    double sweepScheduler = SweepRound(targets, [&](unsigned int id) { sink += id; });
+    double sweepStore = SweepRound(targets, [&](unsigned int id) {
+        unsigned short seq = store.OnSent(id);
+        sink += seq + store.TimeoutNs(id, rtoConfig);
+        if (RandomNext(random) % 100 == 0)
+            store.OnLost(id);
+        else if (store.OnReply(id, seq) == REPLY_NEW)
+            store.Record(id, 1000000ULL + (random & 0xFFFFF));
+    });
+    double sweepMap = SweepRound(targets, [&](unsigned int id) {
+        TargetRecord& record = *records[id];
+        record.stats.OnSent();
+        sink += ++record.seq + record.rto.TimeoutNs(rtoConfig);
+        if (RandomNext(random) % 100 == 0)
+        {
+            record.stats.OnLost();
+            record.rto.OnTimeout();
+        }
+        else if (record.stats.OnReply(record.seq) == REPLY_NEW)
+        {
+            unsigned long long rttNs = 1000000ULL + (random & 0xFFFFF);
+            record.stats.Record(rttNs);
+            record.rto.Sample(rttNs);
+        }
+    });
+    BenchmarkSink = sink;
+
+    unsigned long long sent, received, lost;
+    store.Totals(&sent, &received, &lost);
+    if (sent != targets || received + lost != targets)
+    {
+        printf("TargetStore: a sweep round counted %llu sent, %llu received, %llu lost of %u\n", sent, received, lost, targets);
+        return 1;
+    }
+    double storeTotals = TimeIt([&]() {
+        unsigned long long s, r, l;
+        store.Totals(&s, &r, &l);
+        return s + r + l;
+    }, minNs) / targets;
+    double mapTotals = TimeIt([&]() {
+        unsigned long long s = 0, r = 0, l = 0;
+        for (TargetMap::const_iterator it = map.begin(); it != map.end(); ++it)
+        {
+            s += it->second.stats.Sent();
+            r += it->second.stats.Received();
+            l += it->second.stats.Lost();
+        }
+        return s + r + l;
+    }, minNs) / targets;
+
+    const struct { const char* name; double value; const char* unit; } cases[] = {
+        { "store/bytes_per_target", storeBytes, "bytes" },
+        { "map/bytes_per_target", mapBytes, "bytes" },
+        { "store/add", storeAdd, "ns" },
+        { "map/add", mapAdd, "ns" },
+        { "store/add_max_pause", storeMaxPause / 1000.0, "us" },
+        { "map/add_max_pause", mapMaxPause / 1000.0, "us" },
+        { "store/churn", storeChurn, "ns" },
+        { "map/churn", mapChurn, "ns" },
+        { "store/find", storeFind, "ns" },
+        { "map/find", mapFind, "ns" },
+        { "find/sorted", sortedFind, "ns" },
+        { "sweep/scheduler", sweepScheduler, "ns" },
+        { "store/sweep", sweepStore, "ns" },
+        { "map/sweep", sweepMap, "ns" },
+        { "store/totals", storeTotals, "ns" },
+        { "map/totals", mapTotals, "ns" },
+    };
+    if (report.Table())
+        printf("%u targets\n%-24s %12s\n", targets, "case", "value");
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c)
+    {
+        report.Add(cases[c].name, cases[c].value, cases[c].unit);
+        if (report.Table())
+            printf("%-24s %9.1f %s\n", cases[c].name, cases[c].value, cases[c].unit);
+    }
+    return report.Finish() ? 0 : 1;
+}
@@ -0,0 +1,209 @@
+/* ICMP Packet Watcher - Batched send and receive buffers for the probe hot path */
+
+/* SendBatch holds "capacity" prebuilt copies of the echo request. The caller takes the next slot, patches its
+   sequence number and timestamp in place (the checksum is patched incrementally from the slot's previous values)
+   and Flush() hands all queued slots to the kernel in one TransportSendBatch (sendmmsg on Linux).
+
+   RecvBatch replaces the single 1024-byte receive buffer with a preallocated ring of receive buffers that
+   Receive() fills with one TransportRecvBatch (recvmmsg on Linux).
+
+   Both count packets and calls, so the run statistics can report packets per syscall for tuning the batch size. They
+   also report the packets and the time of every call to the calling thread's metrics (icmp_Metrics.h): two clock
+   reads per call, not per packet. SendBatch counts send errors as well: the requests the kernel refused, and the ones
+   an io_uring loop took and that failed later. Either request stays in flight and times out, so it is also lost. With Capture() every packet sent or received is written to a capture file too
+   (icmp_Pcap.h, -C). */
+
+#ifndef ICMP_BATCH_H
+#define ICMP_BATCH_H
+
+#include <string.h>
+#include <vector>
+#include "icmp_Metrics.h"
+#include "icmp_Pcap.h"
+#include "icmp_Transport.h"
+
+class SendBatch
+{
+public:
+    SendBatch(const char* packet, int len, int capacity)
+        : len_(len), count_(0), calls_(0), packets_(0), errors_(0), loopErrors_(0), capture_(NULL), captureProducer_(0)
+    {
+        capacity_ = capacity < 1 ? 1 : (capacity > TRANSPORT_MAX_BATCH ? TRANSPORT_MAX_BATCH : capacity);
+        storage_.resize((size_t)capacity_ * len_);
+        slots_.resize(capacity_);
+        for (int i = 0; i < capacity_; ++i)
+        {
+            slots_[i].data = &storage_[(size_t)i * len_];
+            slots_[i].len  = len_;
+            memcpy(slots_[i].data, packet, len_);                           // Prebuilt: header, payload and checksum are already in place
+        }
+    }
+
+    int  Capacity() const { return capacity_; }
+    int  Count() const    { return count_; }
+    bool Full() const     { return count_ == capacity_; }
+
+    // Writes every packet sent from now on to capture as well, through the ring of producer; NULL stops it
+    void Capture(PcapWriter* capture, int producer = 0)
+    {
+        capture_ = capture;
+        captureProducer_ = producer;
+    }
+
+    // Next free slot, addressed to destination (sent with the given IP TTL, 0 for the socket's). The caller patches
+    // it before the next Flush().
+    char* Queue(unsigned long destination, int ttl = 0)
+    {
+        TransportPacket& slot = slots_[count_++];
+        slot.addr = destination;
+        slot.ttl  = ttl;
+        return slot.data;
+    }
+
+    /* Sends everything queued with as few calls as possible. Returns the number of packets sent, or TRANSPORT_ERROR
+       if a packet was refused (that packet is dropped, the ones behind it stay queued). Packets that did not fit
+       into the socket buffer stay queued for the next Flush(). */
+    template <typename Loop>
+    int Flush(Loop& loop, IcmpSocket& s)
+    {
+        int nSent = 0;
+        ThreadMetrics& metrics = MetricsLocal();
+        CountLoopErrors(loop);
+        while (count_ > 0)
+        {
+            unsigned long long startNs = TransportMonotonicNs();
+            int nRet = loop.SendBatch(s, &slots_[0], count_);
+            metrics.Record(METRIC_SEND_CALL_NS, TransportMonotonicNs() - startNs);
+            ++calls_;
+            if (nRet == TRANSPORT_WOULD_BLOCK)
+                break;
+            if (nRet == TRANSPORT_ERROR)
+            {
+                ++errors_;
+                metrics.Count(METRIC_SEND_ERRORS);
+                Consume(1);
+                return TRANSPORT_ERROR;
+            }
+            metrics.Count(METRIC_PACKETS_SENT, nRet);
+            if (capture_ != NULL)
+                for (int i = 0; i < nRet; ++i)
+                    capture_->WriteSent(slots_[i].data, slots_[i].len, slots_[i].addr, slots_[i].ttl, startNs, captureProducer_);
+            packets_ += nRet;
+            nSent += nRet;
+            Consume(nRet);
+        }
+        return nSent;
+    }
+
+    /* Takes the sends that loop found failed since the last call (io_uring completions, reaped by its Wait()) into
+       Errors() and the metrics. Flush() calls it; a run calls it once more after its last Wait(). */
+    template <typename Loop>
+    void CountLoopErrors(Loop& loop)
+    {
+        unsigned long long loopErrors = loop.SendErrors();
+        if (loopErrors == loopErrors_)
+            return;
+        errors_ += loopErrors - loopErrors_;
+        MetricsLocal().Count(METRIC_SEND_ERRORS, loopErrors - loopErrors_);
+        loopErrors_ = loopErrors;
+    }
+
+    unsigned long long Calls() const   { return calls_; }
+    unsigned long long Packets() const { return packets_; }                 // Taken by the kernel or the io_uring queue
+    unsigned long long Errors() const  { return errors_; }                  // Refused, or failed after they were queued
+
+private:
+    // Moves the unsent slots to the front. Slot buffers are swapped, not copied, so each keeps its own packet.
+    void Consume(int n)
+    {
+        for (int i = n; i < count_; ++i)
+        {
+            TransportPacket sent = slots_[i - n];
+            slots_[i - n] = slots_[i];
+            slots_[i] = sent;
+        }
+        count_ -= n;
+    }
+
+    std::vector<char>            storage_;
+    std::vector<TransportPacket> slots_;
+    int                          len_;
+    int                          capacity_;
+    int                          count_;
+    unsigned long long           calls_;
+    unsigned long long           packets_;
+    unsigned long long           errors_;
+    unsigned long long           loopErrors_;                               // The loop's SendErrors() at the last count
+    PcapWriter*                  capture_;
+    int                          captureProducer_;                          // Its ring in capture_, one per probe thread
+};
+
+class RecvBatch
+{
+public:
+    explicit RecvBatch(int capacity, int bufferSize = 2048)
+        : count_(0), bufferSize_(bufferSize), calls_(0), packets_(0), capture_(NULL), captureProducer_(0)
+    {
+        capacity_ = capacity < 1 ? 1 : (capacity > TRANSPORT_MAX_BATCH ? TRANSPORT_MAX_BATCH : capacity);
+        storage_.resize((size_t)capacity_ * bufferSize_);
+        slots_.resize(capacity_);
+        for (int i = 0; i < capacity_; ++i)
+            slots_[i].data = &storage_[(size_t)i * bufferSize_];
+    }
+
+    // Writes every datagram received from now on to capture as well, through the ring of producer; NULL stops it
+    void Capture(PcapWriter* capture, int producer = 0)
+    {
+        capture_ = capture;
+        captureProducer_ = producer;
+    }
+
+    // Receives up to Capacity() datagrams without waiting. Returns their number, 0 if none was queued, or TRANSPORT_ERROR.
+    int Receive(IcmpSocket& s)
+    {
+        for (int i = 0; i < capacity_; ++i)
+            slots_[i].len = bufferSize_;
+        ThreadMetrics& metrics = MetricsLocal();
+        unsigned long long startNs = TransportMonotonicNs();
+        int nRet = TransportRecvBatch(s, &slots_[0], capacity_);
+        metrics.Record(METRIC_RECV_CALL_NS, TransportMonotonicNs() - startNs);
+        ++calls_;
+        if (nRet == TRANSPORT_WOULD_BLOCK)
+            return count_ = 0;
+        if (nRet < 0)
+            return TRANSPORT_ERROR;
+        metrics.Count(METRIC_PACKETS_RECEIVED, nRet);
+        if (capture_ != NULL)
+            for (int i = 0; i < nRet; ++i)
+                capture_->WriteReceived(s, slots_[i].data, slots_[i].len, slots_[i].addr, slots_[i].stampNs, captureProducer_);
+        packets_ += nRet;
+        return count_ = nRet;
+    }
+
+    char*              Data(int i) const   { return slots_[i].data; }
+    int                Length(int i) const { return slots_[i].len; }
+    unsigned long      Source(int i) const { return slots_[i].addr; }
+    unsigned long long Stamp(int i) const  { return slots_[i].stampNs; }    // Receive time, see TransportPacket
+
+    unsigned long long Calls() const   { return calls_; }
+    unsigned long long Packets() const { return packets_; }
+
+private:
+    std::vector<char>            storage_;
+    std::vector<TransportPacket> slots_;
+    int                          capacity_;
+    int                          count_;
+    int                          bufferSize_;
+    unsigned long long           calls_;
+    unsigned long long           packets_;
+    PcapWriter*                  capture_;
+    int                          captureProducer_;                          // Its ring in capture_, one per probe thread
+};
+
+// Packets per call, for the run statistics
+inline double PacketsPerCall(unsigned long long packets, unsigned long long calls)
+{
+    return calls == 0 ? 0.0 : (double)packets / (double)calls;
+}
+
+#endif // ICMP_BATCH_H
@@ -0,0 +1,232 @@
+/* ICMP Packet Watcher - Internet checksum (RFC 1071) and incremental update (RFC 1624) */
+
+/* The one's complement sum does not depend on the width of the words that are added, as long as the carries are
+   folded back in at the end (2^16 = 1 modulo 0xffff). So instead of adding one 16-bit word per iteration:
+     - ChecksumPartialScalar adds 32-bit words into a 64-bit accumulator,
+     - ChecksumPartialSSE2 / ChecksumPartialAVX2 widen 16-bit words into 32-bit lanes and add 8 / 16 words per instruction.
+   The variant is picked once at run time from the CPU features. checksum() keeps its original signature.
+
+   Between two echo requests only icmp_sequence and icmp_timestamp change. ChecksumUpdate patches the checksum from the
+   old and new bytes of a changed field alone (RFC 1624, eqn. 3: HC' = ~(~HC + ~m + m')), so the payload is never
+   summed again. */
+
+#ifndef ICMP_CHECKSUM_H
+#define ICMP_CHECKSUM_H
+
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define ICMP_CHECKSUM_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define ICMP_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define ICMP_TARGET_AVX2
+#endif
+
+// Folds a wide partial sum into the 16-bit one's complement sum (not yet complemented)
+inline unsigned short ChecksumFold(unsigned long long sum)
+{
+    sum = (sum >> 32) + (sum & 0xffffffffULL);                              // Add the carries back in until the sum fits in 16 bits
+    sum = (sum >> 32) + (sum & 0xffffffffULL);
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum = (sum >> 16) + (sum & 0xffff);
+    return (unsigned short)sum;
+}
+
+// Sum of the trailing 0..3 bytes, padded with zero bytes to whole 16-bit words (the odd byte rule of RFC 1071)
+inline unsigned long long ChecksumTail(const unsigned char* data, size_t size)
+{
+    unsigned long long sum = 0;
+    unsigned short word;
+    if (size >= 2)
+    {
+        memcpy(&word, data, 2);
+        sum += word;
+        data += 2;
+        size -= 2;
+    }
+    if (size)
+    {
+        word = 0;
+        memcpy(&word, data, 1);                                             // The last byte is the first byte of a zero padded word
+        sum += word;
+    }
+    return sum;
+}
+
+// Portable variant: 32-bit words into a 64-bit accumulator, four words per iteration
+inline unsigned long long ChecksumPartialScalar(const void* buff, size_t size)
+{
+    const unsigned char* data = (const unsigned char*)buff;
+    unsigned long long sum0 = 0, sum1 = 0;
+    while (size >= 16)
+    {
+        unsigned int w[4];
+        memcpy(w, data, 16);
+        sum0 += (unsigned long long)w[0] + w[1];
+        sum1 += (unsigned long long)w[2] + w[3];
+        data += 16;
+        size -= 16;
+    }
+    while (size >= 4)
+    {
+        unsigned int w;
+        memcpy(&w, data, 4);
+        sum0 += w;
+        data += 4;
+        size -= 4;
+    }
+    return sum0 + sum1 + ChecksumTail(data, size);
+}
+
+#ifdef ICMP_CHECKSUM_X86
+
+// Adds the four 32-bit lanes of an accumulator
+inline unsigned long long ChecksumHorizontalSSE2(__m128i acc)
+{
+    unsigned int lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    return (unsigned long long)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+// SSE2 variant: 16 bytes per load, 16-bit words widened into 32-bit lanes
+inline unsigned long long ChecksumPartialSSE2(const void* buff, size_t size)
+{
+    const unsigned char* data = (const unsigned char*)buff;
+    const __m128i zero = _mm_setzero_si128();
+    unsigned long long sum = 0;
+
+    while (size >= 16)
+    {
+        /* A lane gains at most 2 * 0xffff per block, so 32768 blocks (512 KB) fit into 32 bits before the
+           lanes are flushed into the 64-bit total. */
+        size_t blocks = size / 16;
+        if (blocks > 32768)
+            blocks = 32768;
+        size -= blocks * 16;
+
+        __m128i acc = _mm_setzero_si128();
+        for (; blocks > 0; --blocks, data += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)data);
+            acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+            acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+        }
+        sum += ChecksumHorizontalSSE2(acc);
+    }
+    return sum + ChecksumPartialScalar(data, size);
+}
+
+// AVX2 variant: 32 bytes per load, two independent accumulators to hide the add latency
+ICMP_TARGET_AVX2 inline unsigned long long ChecksumPartialAVX2(const void* buff, size_t size)
+{
+    const unsigned char* data = (const unsigned char*)buff;
+    const __m256i zero = _mm256_setzero_si256();
+    unsigned long long sum = 0;
+
+    while (size >= 32)
+    {
+        size_t blocks = size / 32;
+        if (blocks > 32768)
+            blocks = 32768;
+        size -= blocks * 32;
+
+        __m256i acc0 = _mm256_setzero_si256();
+        __m256i acc1 = _mm256_setzero_si256();
+        for (; blocks > 0; --blocks, data += 32)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i*)data);
+            acc0 = _mm256_add_epi32(acc0, _mm256_unpacklo_epi16(v, zero));
+            acc1 = _mm256_add_epi32(acc1, _mm256_unpackhi_epi16(v, zero));
+        }
+        __m128i lo = _mm_add_epi64(_mm_unpacklo_epi32(_mm256_castsi256_si128(acc0), _mm_setzero_si128()),
+                                   _mm_unpackhi_epi32(_mm256_castsi256_si128(acc0), _mm_setzero_si128()));
+        __m128i hi = _mm_add_epi64(_mm_unpacklo_epi32(_mm256_extracti128_si256(acc0, 1), _mm_setzero_si128()),
+                                   _mm_unpackhi_epi32(_mm256_extracti128_si256(acc0, 1), _mm_setzero_si128()));
+        lo = _mm_add_epi64(lo, _mm_unpacklo_epi32(_mm256_castsi256_si128(acc1), _mm_setzero_si128()));
+        lo = _mm_add_epi64(lo, _mm_unpackhi_epi32(_mm256_castsi256_si128(acc1), _mm_setzero_si128()));
+        hi = _mm_add_epi64(hi, _mm_unpacklo_epi32(_mm256_extracti128_si256(acc1, 1), _mm_setzero_si128()));
+        hi = _mm_add_epi64(hi, _mm_unpackhi_epi32(_mm256_extracti128_si256(acc1, 1), _mm_setzero_si128()));
+        unsigned long long lanes[2];
+        _mm_storeu_si128((__m128i*)lanes, _mm_add_epi64(lo, hi));
+        sum += lanes[0] + lanes[1];
+    }
+    return sum + ChecksumPartialSSE2(data, size);
+}
+
+inline bool ChecksumCpuHasAVX2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+#endif // ICMP_CHECKSUM_X86
+
+typedef unsigned long long (*ChecksumPartialFunc)(const void* buff, size_t size);
+
+// Widest variant the CPU supports, selected on first use
+inline ChecksumPartialFunc ChecksumSelect()
+{
+#ifdef ICMP_CHECKSUM_X86
+    static const ChecksumPartialFunc selected = ChecksumCpuHasAVX2() ? ChecksumPartialAVX2 : ChecksumPartialSSE2;
+#else
+    static const ChecksumPartialFunc selected = ChecksumPartialScalar;
+#endif
+    return selected;
+}
+
+// Checksum calculation. Returns the complemented one's complement sum, ready to be stored in the header.
+// Small buffers (a bare header) skip the SIMD set-up, it costs more than it saves below 64 bytes.
+inline unsigned short checksum(const unsigned short* buff, int size)
+{
+    unsigned long long sum = size < 64 ? ChecksumPartialScalar(buff, (size_t)size) : ChecksumSelect()(buff, (size_t)size);
+    return (unsigned short)~ChecksumFold(sum);
+}
+
+/* Incremental update (RFC 1624). oldBytes and newBytes are the old and new contents of a field that starts at an even
+   offset in the checksummed data and has an even length. Returns the new checksum. */
+inline unsigned short ChecksumUpdate(unsigned short oldChecksum, const void* oldBytes, const void* newBytes, size_t size)
+{
+    const unsigned char* oldData = (const unsigned char*)oldBytes;
+    const unsigned char* newData = (const unsigned char*)newBytes;
+    unsigned long long sum = (unsigned short)~oldChecksum;
+    for (size_t i = 0; i + 1 < size; i += 2)
+    {
+        unsigned short oldWord, newWord;
+        memcpy(&oldWord, oldData + i, 2);
+        memcpy(&newWord, newData + i, 2);
+        sum += (unsigned short)~oldWord;
+        sum += newWord;
+    }
+    return (unsigned short)~ChecksumFold(sum);
+}
+
+// Incremental update for a single 16-bit field
+inline unsigned short ChecksumUpdate16(unsigned short oldChecksum, unsigned short oldWord, unsigned short newWord)
+{
+    return ChecksumUpdate(oldChecksum, &oldWord, &newWord, sizeof(unsigned short));
+}
+
+/* Value for a 16-bit filler word (now holding oldWord, with the packet's checksum at currentChecksum) that makes the
+   checksum come out as wantedChecksum instead. Paris traceroute uses it to give every probe of a flow the same ICMP
+   checksum, which load balancers hash together with the addresses. From RFC 1624: ~wanted = ~current + ~old + new. */
+inline unsigned short ChecksumCompensate(unsigned short currentChecksum, unsigned short oldWord, unsigned short wantedChecksum)
+{
+    unsigned long long sum = (unsigned long long)(unsigned short)~wantedChecksum + currentChecksum + oldWord;
+    return ChecksumFold(sum);
+}
+
+#endif // ICMP_CHECKSUM_H
@@ -0,0 +1,122 @@
+/* ICMP Packet Watcher - Echo request layout, patching and reply/error parsing */
+
+/* The echo request of the raw socket prober: the 8-byte ICMP echo header plus icmp_timestamp (ICMP_Header), then
+   the 64-bit send stamp and the rest of the payload. A request is built and summed once; every send after that
+   only patches the sequence number and stamps (PatchEchoRequest). Replies and ICMP errors are matched back to the
+   request by ParseEchoReply and ParseProbeError. The prober and the benchmarks share these, so the benchmarks time
+   the code that runs on the probe path. */
+
+#ifndef ICMP_ECHO_H
+#define ICMP_ECHO_H
+
+#include <stddef.h>
+#include <string.h>
+#include "icmp_Checksum.h"
+#include "icmp_Metrics.h"
+#include "icmp_Transport.h"
+#include "icmp_Types.h"
+
+typedef struct ICMP_Header
+{
+    unsigned char   icmp_type;                                              // The message type, for example [0 - echo reply], [8 - echo request] ------------------------------->Type description occupies 8 bits
+    unsigned char   icmp_code;                                              // This is significant when sending an error message (unreach), and specifies the kind of error ----->Code description occupies 8 bits
+    unsigned short  icmp_checksum;                                          // The checksum for the icmp header + data. same as the IP checksum. -------------------------------->Checksum description occupies 16 bits
+    unsigned short  icmp_id;                                                // An identifier that uniquely identifies this request, usually set to the process ID
+    unsigned short  icmp_sequence;                                          // Identifies the sequence of echo messages, if more than one is sent. (as knwon as serial number)
+    unsigned int    icmp_timestamp;                                         // latency (Its data size counts inside the data buffer as well), 32 bits on every platform
+} ICMP_Header;
+
+// The first 8 bytes of the data part carry the 64-bit TransportMonotonicNs() send stamp. The reply echoes it back, so
+// the RTT needs no per-request state and does not wrap; icmp_timestamp keeps the low 32 bits of the millisecond tick.
+inline unsigned long long EchoSendStamp(const ICMP_Header* pIcmp)
+{
+    unsigned long long nSendNs;
+    memcpy(&nSendNs, (const char*)pIcmp + sizeof(ICMP_Header), sizeof(nSendNs));
+    return nSendNs;
+}
+
+// Sets the sequence number and send stamps of a prepared echo request. Only these fields change between requests,
+// so the checksum is patched from their old and new values (RFC 1624) instead of summing the whole packet again.
+inline void PatchEchoRequest(ICMP_Header* pIcmp, unsigned short nSeq, unsigned long long nSendNs)
+{
+    char* pStamp = (char*)pIcmp + sizeof(ICMP_Header);
+    unsigned int nTimestamp = (unsigned int)(nSendNs / 1000000ULL);
+    unsigned short cksum = pIcmp->icmp_checksum;
+    cksum = ChecksumUpdate16(cksum, pIcmp->icmp_sequence, nSeq);
+    cksum = ChecksumUpdate(cksum, &pIcmp->icmp_timestamp, &nTimestamp, sizeof(nTimestamp));
+    cksum = ChecksumUpdate(cksum, pStamp, &nSendNs, sizeof(nSendNs));
+    pIcmp->icmp_sequence  = nSeq;
+    pIcmp->icmp_timestamp = nTimestamp;
+    memcpy(pStamp, &nSendNs, sizeof(nSendNs));
+    pIcmp->icmp_checksum  = cksum;
+}
+
+// Paris traceroute: rewrites the 16-bit word behind the send stamp so the request's checksum is nChecksum again after
+// PatchEchoRequest changed it. Every probe of a flow then looks the same to a load balancer hashing the ICMP header.
+inline void HoldEchoChecksum(ICMP_Header* pIcmp, unsigned short nChecksum)
+{
+    char* pBalance = (char*)pIcmp + sizeof(ICMP_Header) + sizeof(unsigned long long);
+    unsigned short nOld;
+    memcpy(&nOld, pBalance, sizeof(nOld));
+    unsigned short nNew = ChecksumCompensate(pIcmp->icmp_checksum, nOld, nChecksum);
+    memcpy(pBalance, &nNew, sizeof(nNew));
+    pIcmp->icmp_checksum = nChecksum;
+}
+
+// RTT of a reply in nanoseconds, up to its receive stamp. It starts at the kernel TX stamp when there is one that
+// fits between the payload send stamp and the reply, so time spent queued in user space and the socket is excluded.
+inline unsigned long long EchoRttNs(const ICMP_Header* pRecvIcmp, unsigned long long nTxNs, unsigned long long nRxNs)
+{
+    unsigned long long nSendNs = EchoSendStamp(pRecvIcmp);
+    if (nTxNs >= nSendNs && nTxNs <= nRxNs)
+        nSendNs = nTxNs;
+    return nRxNs > nSendNs ? nRxNs - nSendNs : 0;
+}
+
+// Returns the ICMP header of a received datagram if it is an echo reply carrying our identifier and a send stamp,
+// otherwise NULL. On raw sockets the IP header length is taken from the IHL field instead of assuming a fixed 20 bytes;
+// ping sockets deliver the ICMP message without the IP header.
+// A raw socket gets the reply before the kernel has checked it, so the ICMP checksum is verified here (unless the
+// receive buffer cut the datagram short); a reply that fails is counted in the thread's metrics and NULL is returned.
+// The kernel only hands a ping socket replies that passed its own check.
+inline ICMP_Header* ParseEchoReply(char* recvBuf, int nRet, const IcmpSocket& s)
+{
+    int nIpHeaderLen = s.hasIpHeader ? (recvBuf[0] & 0x0F) * 4 : 0;
+    if ((s.hasIpHeader && nIpHeaderLen < 20) || nRet < nIpHeaderLen + (int)sizeof(ICMP_Header) + (int)sizeof(unsigned long long))
+        return NULL;
+
+    ICMP_Header* pRecvIcmp = (ICMP_Header*)(recvBuf + nIpHeaderLen);
+    if (pRecvIcmp->icmp_type != 0 || pRecvIcmp->icmp_id != s.id)
+        return NULL;
+    if (s.hasIpHeader && (((unsigned char)recvBuf[2] << 8) | (unsigned char)recvBuf[3]) == nRet &&
+        checksum((const unsigned short*)pRecvIcmp, nRet - nIpHeaderLen) != 0)
+    {
+        MetricsLocal().Count(METRIC_CHECKSUM_FAILURES);
+        return NULL;
+    }
+    return pRecvIcmp;
+}
+
+// Returns true if a received datagram is an ICMP error (unreachable, time exceeded, ...) that quotes one of our echo
+// requests; pError then holds the quoted destination and sequence number. Only raw sockets see these: a ping
+// socket queues errors on its error queue (IP_RECVERR) instead, and they count as timeouts there.
+inline bool ParseProbeError(char* recvBuf, int nRet, const IcmpSocket& s, IcmpErrorInfo* pError)
+{
+    int nIpHeaderLen = s.hasIpHeader ? (recvBuf[0] & 0x0F) * 4 : 0;
+    if ((s.hasIpHeader && nIpHeaderLen < 20) || nRet <= nIpHeaderLen)
+        return false;
+    if (!ParseIcmpError((const unsigned char*)recvBuf + nIpHeaderLen, nRet - nIpHeaderLen, pError))
+        return false;
+    return pError->echo && pError->id == s.id;
+}
+
+// Time from sending a probe to the error it caused. Routers quote at least 8 bytes of the request, most quote far
+// more; when the quote reaches the send stamp in the payload it is timed like a reply, otherwise the RTT is 0.
+inline unsigned long long ErrorRttNs(const IcmpErrorInfo& error, unsigned long long nTxNs, unsigned long long nRxNs)
+{
+    if (error.probeLength < (int)sizeof(ICMP_Header) + (int)sizeof(unsigned long long))
+        return 0;
+    return EchoRttNs((const ICMP_Header*)error.probe, nTxNs, nRxNs);
+}
+
+#endif // ICMP_ECHO_H
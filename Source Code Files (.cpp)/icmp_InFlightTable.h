@@ -0,0 +1,255 @@
+/* ICMP Packet Watcher - In-flight table for the multi-target sweep mode */
+
+/* When one raw socket probes thousands of destinations, a reply can only be matched back to its request by the
+   pair (destination address, sequence number). The table below is an open-addressing hash table with a fixed,
+   power-of-two capacity: it is sized once when the sweep starts and never rehashes, an entry is 16 bytes, and
+   a lookup is a multiply, a shift and usually a single cache line. Deleted entries are removed by shifting the
+   following entries back, so there are no tombstones and probe chains stay short however long the run lasts.
+
+   With one timeout for all requests they expire in send order, and a ring of send records finds the next one. With
+   a timeout per target (icmp_Rto.h, UseDeadlines) they do not: the send records then hang on a TimingWheel at
+   their deadlines instead, in 1 ms ticks by default (the event loop waits in milliseconds), so a request to a close target is given up within a tick of its
+   own timeout however many slower ones went out before it. Both keep one 16-byte record per request in flight. */
+
+#ifndef ICMP_INFLIGHT_TABLE_H
+#define ICMP_INFLIGHT_TABLE_H
+
+#include <stddef.h>
+#include <vector>
+#include "icmp_Scheduler.h"
+
+struct InFlightEntry
+{
+    unsigned long long key;                                                 // MakeKey(destination, sequence), 0 marks an empty slot
+    unsigned int       target;                                              // Index of the destination in the target list
+    unsigned int       sentTick;                                            // Tick count (ms) at the moment the request was sent
+};
+
+class InFlightTable
+{
+public:
+    // maxInFlight is the largest number of requests that may be outstanding at the same time
+    explicit InFlightTable(unsigned int maxInFlight)
+        : wheel_(0), size_(0), ringHead_(0), ringCount_(0)
+    {
+        unsigned int ringCapacity = 1;
+        while (ringCapacity < maxInFlight)
+            ringCapacity <<= 1;
+        ring_.resize(ringCapacity);
+        ringMask_ = ringCapacity - 1;
+
+        bits_ = 1;
+        while ((1u << bits_) < ringCapacity * 2)                             // Keep the load factor at or below 50%
+            ++bits_;
+        slots_.resize(1u << bits_);
+        mask_ = (1u << bits_) - 1;
+        for (size_t i = 0; i < slots_.size(); ++i)
+            slots_[i].key = 0;
+    }
+
+    // Destination address (network byte order) in bits 16..47, sequence number in bits 0..15, bit 48 keeps the key non-zero
+    static unsigned long long MakeKey(unsigned long destination, unsigned short seq)
+    {
+        return (1ull << 48) | ((unsigned long long)(destination & 0xffffffffUL) << 16) | seq;
+    }
+
+    unsigned int Size() const     { return size_; }
+    bool         Full() const     { return ringCount_ == ring_.size(); }
+
+    // Returns false if the key is already outstanding or the table is full
+    bool Insert(unsigned long long key, unsigned int target, unsigned int sentTick)
+    {
+        if (Full() || !Add(key, target, sentTick))
+            return false;
+        SendRecord& record = ring_[(ringHead_ + ringCount_++) & ringMask_];
+        record.key      = key;
+        record.sentTick = sentTick;
+        return true;
+    }
+
+    /* Switches to deadlines of their own per request: Insert() with a deadline, ExpireDue() and NsUntilNextExpiry()
+       take the place of Insert(), Expire() and MillisUntilNextExpiry(). Call before the first Insert(). */
+    void UseDeadlines(unsigned long long startNs, unsigned long long tickNs = 1000000)
+    {
+        wheel_ = TimingWheel((unsigned int)ring_.size(), tickNs);
+        wheel_.Start(startNs);
+        free_.clear();
+        for (size_t id = ring_.size(); id > 0; --id)
+            free_.push_back((unsigned int)(id - 1));
+    }
+
+    // Deadline mode: the request expires once deadlineNs (TransportMonotonicNs clock) has passed
+    bool Insert(unsigned long long key, unsigned int target, unsigned int sentTick, unsigned long long deadlineNs)
+    {
+        if (Full() || !Add(key, target, sentTick))
+            return false;
+        unsigned int id = free_.back();                                     // The ring's records serve as the timers
+        free_.pop_back();
+        ++ringCount_;
+        ring_[id].key      = key;
+        ring_[id].sentTick = sentTick;
+        wheel_.Schedule(id, deadlineNs);
+        return true;
+    }
+
+    // Removes the entry for a reply. Returns false for duplicates, late replies and foreign packets.
+    bool Remove(unsigned long long key, InFlightEntry* entry)
+    {
+        unsigned int i = Hash(key);
+        while (slots_[i].key != key)
+        {
+            if (slots_[i].key == 0)
+                return false;
+            i = (i + 1) & mask_;
+        }
+        *entry = slots_[i];
+        Erase(i);
+        return true;
+    }
+
+    /* Requests go out in send order with one timeout, so they expire in send order too. The ring remembers
+       the send order; entries whose reply already arrived are simply skipped when they reach the head.
+       Every expired request is handed to onExpired(entry). */
+    template <typename Callback>
+    int Expire(unsigned int now, unsigned int timeout, Callback onExpired)
+    {
+        int expired = 0;
+        while (ringCount_ > 0)
+        {
+            SendRecord& record = ring_[ringHead_];
+            unsigned int i = Find(record.key);
+            if (i != NotFound && slots_[i].sentTick == record.sentTick)
+            {
+                if (now - record.sentTick < timeout)
+                    break;
+                InFlightEntry entry = slots_[i];
+                Erase(i);
+                ++expired;
+                onExpired(entry);
+            }
+            ringHead_ = (ringHead_ + 1) & ringMask_;
+            --ringCount_;
+        }
+        return expired;
+    }
+
+    /* Deadline mode: hands every request whose deadline has passed to onExpired(entry). As in Expire(), the timers
+       of requests that were answered are not cancelled, they are skipped when they come due. */
+    template <typename Callback>
+    int ExpireDue(unsigned long long nowNs, Callback onExpired)
+    {
+        int expired = 0;
+        wheel_.Advance(nowNs, [&](unsigned int id, unsigned long long) {
+            const SendRecord record = ring_[id];
+            free_.push_back(id);
+            --ringCount_;
+            unsigned int i = Find(record.key);
+            if (i != NotFound && slots_[i].sentTick == record.sentTick)
+            {
+                InFlightEntry entry = slots_[i];
+                Erase(i);
+                ++expired;
+                onExpired(entry);
+            }
+        });
+        return expired;
+    }
+
+    // Deadline mode: nanoseconds until the next deadline (0 if one has passed, -1 if nothing is outstanding)
+    long long NsUntilNextExpiry(unsigned long long nowNs) const
+    {
+        return wheel_.NsUntilNext(nowNs);
+    }
+
+    // Milliseconds until the oldest outstanding request expires (0 if it already has, -1 if nothing is outstanding)
+    long MillisUntilNextExpiry(unsigned int now, unsigned int timeout) const
+    {
+        for (unsigned int n = 0; n < ringCount_; ++n)
+        {
+            const SendRecord& record = ring_[(ringHead_ + n) & ringMask_];
+            unsigned int i = Find(record.key);
+            if (i != NotFound && slots_[i].sentTick == record.sentTick)
+            {
+                unsigned int age = now - record.sentTick;
+                return age >= timeout ? 0 : (long)(timeout - age);
+            }
+        }
+        return -1;
+    }
+
+private:
+    struct SendRecord
+    {
+        unsigned long long key;
+        unsigned int       sentTick;
+    };
+
+    static const unsigned int NotFound = 0xffffffffu;
+
+    // Adds the hash table entry, false if the key is already outstanding
+    bool Add(unsigned long long key, unsigned int target, unsigned int sentTick)
+    {
+        unsigned int i = Hash(key);
+        while (slots_[i].key != 0)
+        {
+            if (slots_[i].key == key)
+                return false;
+            i = (i + 1) & mask_;
+        }
+        slots_[i].key      = key;
+        slots_[i].target   = target;
+        slots_[i].sentTick = sentTick;
+        ++size_;
+        return true;
+    }
+
+    unsigned int Hash(unsigned long long key) const
+    {
+        return (unsigned int)((key * 0x9E3779B97F4A7C15ull) >> (64 - bits_));   // Fibonacci hashing
+    }
+
+    unsigned int Find(unsigned long long key) const
+    {
+        unsigned int i = Hash(key);
+        while (slots_[i].key != key)
+        {
+            if (slots_[i].key == 0)
+                return NotFound;
+            i = (i + 1) & mask_;
+        }
+        return i;
+    }
+
+    // Backward-shift deletion: move later entries of the same probe chain into the hole
+    void Erase(unsigned int hole)
+    {
+        unsigned int i = hole;
+        for (;;)
+        {
+            i = (i + 1) & mask_;
+            if (slots_[i].key == 0)
+                break;
+            unsigned int home = Hash(slots_[i].key);
+            if (((i - home) & mask_) >= ((i - hole) & mask_))               // Entry may move back to the hole without passing its home slot
+            {
+                slots_[hole] = slots_[i];
+                hole = i;
+            }
+        }
+        slots_[hole].key = 0;
+        --size_;
+    }
+
+    std::vector<InFlightEntry> slots_;
+    std::vector<SendRecord>    ring_;                                       // Send order, or the timers' records in deadline mode
+    TimingWheel                wheel_;                                      // Deadline mode: ring_ index by deadline
+    std::vector<unsigned int>  free_;                                       // Deadline mode: ring_ records not in use
+    unsigned int bits_;
+    unsigned int mask_;
+    unsigned int size_;
+    unsigned int ringMask_;
+    unsigned int ringHead_;
+    unsigned int ringCount_;
+};
+
+#endif // ICMP_INFLIGHT_TABLE_H
@@ -0,0 +1,380 @@
+/* ICMP Packet Watcher - Per-thread hot path metrics, Prometheus endpoint and shared-memory snapshot */
+
+/* Every thread that sends or receives gets a ThreadMetrics slot of its own the first time it calls MetricsLocal().
+   A slot is aligned to 64 bytes, so no two threads ever write the same cache line. Each slot has exactly one writer,
+   so a counter is bumped with a relaxed load and store: no locked instruction, no fence. Readers sum the slots
+   with relaxed loads. Nothing takes a lock on either side.
+
+     counters     packets sent and received (datagrams handed to and read from the kernel), timeouts, echo replies
+                  with a bad checksum, foreign packets (ICMP that the socket received but that belongs to no probe of
+                  the run), and send errors (requests the kernel refused, or failed after an io_uring loop queued them)
+     histograms   time spent in one send call and in one receive call (a batch of packets on the batched paths), and
+                  scheduler lag (send time minus deadline). The buckets are powers of two, from 128 ns up to 2^33 ns
+                  (8.6 s), plus one bucket above that.
+
+   MetricsExporter runs a thread that serves the totals in the Prometheus text format on http://127.0.0.1:port/metrics.
+   It also copies them into a named shared-memory block (a MetricsSnapshot) every publish interval. A scraper on the
+   same host reads the block without a syscall into the prober. A sequence number guards each copy as a seqlock: it is
+   odd while the copy is being written, so a reader retries until it reads the same even value before and after. The
+   block layout, in host byte order:
+       0  u32 magic 0x504d4349 ("ICMP")   4  u32 version (2)   8  u64 sequence   16 u64 Unix time of the copy (ns)
+       24 u32 threads                     28 u32 reserved
+       32 u64 counters[MetricsCounters], in MetricCounter order
+          then per MetricHistogram: u64 buckets[MetricsBuckets], u64 sum (ns), u64 count
+   Stop() removes the block when the run ends. A run that is killed leaves the block behind with its last totals,
+   and the next run with the same name takes it over.
+   Slots are never reused, so the counters of a sweep shard whose thread has ended stay in the totals. Threads beyond
+   MetricsMaxThreads share the last slot; that one is updated with atomic adds. */
+
+#ifndef ICMP_METRICS_H
+#define ICMP_METRICS_H
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include "icmp_Transport.h"
+
+enum MetricCounter
+{
+    METRIC_PACKETS_SENT,
+    METRIC_PACKETS_RECEIVED,
+    METRIC_TIMEOUTS,
+    METRIC_CHECKSUM_FAILURES,
+    METRIC_FOREIGN_PACKETS,
+    METRIC_SEND_ERRORS,
+    MetricsCounters
+};
+
+enum MetricHistogram
+{
+    METRIC_SEND_CALL_NS,
+    METRIC_RECV_CALL_NS,
+    METRIC_SCHEDULE_LAG_NS,
+    MetricsHistograms
+};
+
+#define MetricsMaxThreads  512
+#define MetricsFirstBucket 7                                                // Bucket 0 holds up to 2^7 ns
+#define MetricsBuckets     28                                               // 2^7 .. 2^33 ns and one above
+#define MetricsMagic       0x504d4349u
+
+// Bucket of a value: the first power of two from 2^7 ns on that is not below it
+inline int MetricsBucket(unsigned long long ns)
+{
+    if (ns <= (1ULL << MetricsFirstBucket))
+        return 0;
+#if defined(_MSC_VER)
+    unsigned long highest;
+    _BitScanReverse64(&highest, ns - 1);
+    int bit = (int)highest + 1;                                             // ns <= 2^bit
+#else
+    int bit = 64 - __builtin_clzll(ns - 1);                                 // ns <= 2^bit
+#endif
+    return bit - MetricsFirstBucket >= MetricsBuckets - 1 ? MetricsBuckets - 1 : bit - MetricsFirstBucket;
+}
+
+struct alignas(64) ThreadMetrics
+{
+    std::atomic<unsigned long long> counters[MetricsCounters];
+    std::atomic<unsigned long long> buckets[MetricsHistograms][MetricsBuckets];
+    std::atomic<unsigned long long> sums[MetricsHistograms];
+    bool                            shared;                                 // Written by more than one thread (the overflow slot)
+
+    void Count(MetricCounter id, unsigned long long n = 1)
+    {
+        Bump(counters[id], n);
+    }
+
+    void Record(MetricHistogram id, unsigned long long ns)
+    {
+        Bump(buckets[id][MetricsBucket(ns)], 1);
+        Bump(sums[id], ns);
+    }
+
+private:
+    void Bump(std::atomic<unsigned long long>& value, unsigned long long n)
+    {
+        if (shared)
+            value.fetch_add(n, std::memory_order_relaxed);
+        else
+            value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+};
+
+// The totals over all threads, as they are laid out in the shared-memory block
+struct MetricsSnapshot
+{
+    unsigned int                    magic;
+    unsigned int                    version;
+    std::atomic<unsigned long long> sequence;                               // Odd while the block is being written
+    unsigned long long              unixNs;
+    unsigned int                    threads;
+    unsigned int                    reserved;
+    unsigned long long              counters[MetricsCounters];
+    struct
+    {
+        unsigned long long buckets[MetricsBuckets];
+        unsigned long long sumNs;
+        unsigned long long count;
+    }                               histograms[MetricsHistograms];
+};
+
+class MetricsRegistry
+{
+public:
+    // The one registry of the process. It lives in static storage, so every slot starts at zero.
+    static MetricsRegistry& Instance()
+    {
+        static MetricsRegistry registry;
+        return registry;
+    }
+
+    ThreadMetrics* Register()
+    {
+        unsigned int index = used_.fetch_add(1, std::memory_order_relaxed);
+        if (index >= MetricsMaxThreads - 1)
+        {
+            slots_[MetricsMaxThreads - 1].shared = true;
+            index = MetricsMaxThreads - 1;
+        }
+        return &slots_[index];
+    }
+
+    // Sums every slot into snapshot (all fields but magic, version and sequence)
+    void Collect(MetricsSnapshot* snapshot) const
+    {
+        unsigned int used = used_.load(std::memory_order_relaxed);
+        if (used > MetricsMaxThreads)
+            used = MetricsMaxThreads;
+        snapshot->unixNs  = TransportMonotonicNs() + TransportRealtimeOffsetNs();
+        snapshot->threads = used;
+        memset(snapshot->counters, 0, sizeof(snapshot->counters));
+        memset(snapshot->histograms, 0, sizeof(snapshot->histograms));
+        for (unsigned int t = 0; t < used; ++t)
+        {
+            const ThreadMetrics& slot = slots_[t];
+            for (int c = 0; c < MetricsCounters; ++c)
+                snapshot->counters[c] += slot.counters[c].load(std::memory_order_relaxed);
+            for (int h = 0; h < MetricsHistograms; ++h)
+            {
+                for (int b = 0; b < MetricsBuckets; ++b)
+                {
+                    unsigned long long n = slot.buckets[h][b].load(std::memory_order_relaxed);
+                    snapshot->histograms[h].buckets[b] += n;
+                    snapshot->histograms[h].count += n;
+                }
+                snapshot->histograms[h].sumNs += slot.sums[h].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    std::atomic<unsigned int> used_;
+    ThreadMetrics             slots_[MetricsMaxThreads];
+};
+
+// The calling thread's slot, registered on first use
+inline ThreadMetrics& MetricsLocal()
+{
+    thread_local ThreadMetrics* local = MetricsRegistry::Instance().Register();
+    return *local;
+}
+
+// Copies snapshot into the shared block under the seqlock
+inline void MetricsPublish(MetricsSnapshot* shared, const MetricsSnapshot& snapshot)
+{
+    unsigned long long sequence = shared->sequence.load(std::memory_order_relaxed);
+    shared->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    shared->magic    = MetricsMagic;
+    shared->version  = 2;                                                   // 2: send errors were added to the counters
+    shared->unixNs   = snapshot.unixNs;
+    shared->threads  = snapshot.threads;
+    shared->reserved = 0;
+    memcpy(shared->counters, snapshot.counters, sizeof(snapshot.counters));
+    memcpy(shared->histograms, snapshot.histograms, sizeof(snapshot.histograms));
+    shared->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+// Reads a consistent copy of a shared block, for scrapers written in C++. Returns false if it is not a metrics block.
+inline bool MetricsRead(const MetricsSnapshot* shared, MetricsSnapshot* copy)
+{
+    for (;;)
+    {
+        unsigned long long before = shared->sequence.load(std::memory_order_acquire);
+        if ((before & 1) == 0)
+        {
+            copy->magic    = shared->magic;
+            copy->version  = shared->version;
+            copy->unixNs   = shared->unixNs;
+            copy->threads  = shared->threads;
+            copy->reserved = 0;
+            memcpy(copy->counters, shared->counters, sizeof(copy->counters));
+            memcpy(copy->histograms, shared->histograms, sizeof(copy->histograms));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (shared->sequence.load(std::memory_order_relaxed) == before)
+            {
+                copy->sequence.store(before, std::memory_order_relaxed);
+                return copy->magic == MetricsMagic;
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+
+// Writes the snapshot in the Prometheus text exposition format (version 0.0.4)
+inline void MetricsFormat(const MetricsSnapshot& snapshot, std::string* out)
+{
+    static const char* const counterNames[MetricsCounters][2] = {
+        { "icmp_packets_sent_total", "Datagrams handed to the kernel." },
+        { "icmp_packets_received_total", "Datagrams read from the kernel, foreign ones included." },
+        { "icmp_timeouts_total", "Probes that got no answer within the timeout." },
+        { "icmp_checksum_failures_total", "Echo replies dropped for a bad ICMP checksum." },
+        { "icmp_foreign_packets_total", "Received ICMP packets that belong to no probe of the run." },
+        { "icmp_send_errors_total", "Requests the kernel refused or that failed after they were queued." },
+    };
+    static const char* const histogramNames[MetricsHistograms][2] = {
+        { "icmp_send_call_seconds", "Time spent in one send call (a whole batch on the batched paths)." },
+        { "icmp_recv_call_seconds", "Time spent in one receive call (a whole batch on the batched paths)." },
+        { "icmp_schedule_lag_seconds", "Send time minus the probe's deadline." },
+    };
+
+    char line[256];
+    for (int c = 0; c < MetricsCounters; ++c)
+    {
+        snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", counterNames[c][0], counterNames[c][1],
+                 counterNames[c][0], counterNames[c][0], snapshot.counters[c]);
+        out->append(line);
+    }
+    for (int h = 0; h < MetricsHistograms; ++h)
+    {
+        const char* name = histogramNames[h][0];
+        snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s histogram\n", name, histogramNames[h][1], name);
+        out->append(line);
+        unsigned long long cumulative = 0;
+        for (int b = 0; b < MetricsBuckets - 1; ++b)
+        {
+            cumulative += snapshot.histograms[h].buckets[b];
+            snprintf(line, sizeof(line), "%s_bucket{le=\"%.9g\"} %llu\n", name, (double)(1ULL << (b + MetricsFirstBucket)) / 1e9, cumulative);
+            out->append(line);
+        }
+        snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %.9f\n%s_count %llu\n", name, snapshot.histograms[h].count,
+                 name, (double)snapshot.histograms[h].sumNs / 1e9, name, snapshot.histograms[h].count);
+        out->append(line);
+    }
+    snprintf(line, sizeof(line), "# HELP icmp_metrics_threads Threads that have reported metrics.\n# TYPE icmp_metrics_threads gauge\n"
+             "icmp_metrics_threads %u\n", snapshot.threads);
+    out->append(line);
+}
+
+/* Serves /metrics on 127.0.0.1:port and publishes the shared-memory snapshot, from a thread of its own. Either may be
+   left out: port 0 opens no endpoint, a NULL name creates no shared memory. */
+class MetricsExporter
+{
+public:
+    MetricsExporter() : stop_(false), running_(false), port_(0), shared_(NULL), publishMs_(1000) {}
+    ~MetricsExporter() { Stop(); }
+
+    bool Start(unsigned short port, const char* sharedName, unsigned long publishMs = 1000)
+    {
+        port_      = port;
+        publishMs_ = publishMs == 0 ? 1 : publishMs;
+        if (port_ != 0 && !server_.Listen(port_))
+            return false;
+        if (sharedName != NULL)
+        {
+            shared_ = (MetricsSnapshot*)memory_.Create(sharedName, sizeof(MetricsSnapshot));
+            if (shared_ == NULL)
+            {
+                server_.Close();
+                return false;
+            }
+            Publish();
+        }
+        stop_.store(false);
+        thread_ = std::thread(&MetricsExporter::Run, this);
+        running_ = true;
+        return true;
+    }
+
+    // Publishes the final totals and removes the endpoint and the shared memory
+    void Stop()
+    {
+        if (!running_)
+            return;
+        stop_.store(true);
+        thread_.join();
+        running_ = false;
+        if (shared_ != NULL)
+            Publish();
+        server_.Close();
+        memory_.Close();
+        shared_ = NULL;
+    }
+
+private:
+    void Publish()
+    {
+        MetricsSnapshot snapshot;
+        MetricsRegistry::Instance().Collect(&snapshot);
+        MetricsPublish(shared_, snapshot);
+    }
+
+    void Run()
+    {
+        unsigned long long nextPublishNs = TransportMonotonicNs() + publishMs_ * 1000000ULL;
+        while (!stop_.load())
+        {
+            unsigned long long now = TransportMonotonicNs();
+            long waitMs = nextPublishNs > now ? (long)((nextPublishNs - now) / 1000000ULL) : 0;
+            if (waitMs > 100)
+                waitMs = 100;                                               // Stop() is noticed within 100 ms
+            if (port_ != 0)
+                server_.Serve(waitMs, [](const char* request, int, std::string* response) { Respond(request, response); });
+            else
+                TransportSleepMs((unsigned long)waitMs);
+            if (shared_ != NULL && TransportMonotonicNs() >= nextPublishNs)
+            {
+                Publish();
+                nextPublishNs += publishMs_ * 1000000ULL;
+                if (nextPublishNs < TransportMonotonicNs())
+                    nextPublishNs = TransportMonotonicNs() + publishMs_ * 1000000ULL;
+            }
+        }
+    }
+
+    static void Respond(const char* request, std::string* response)
+    {
+        if (strncmp(request, "GET /metrics", 12) != 0 || (request[12] != ' ' && request[12] != '?'))
+        {
+            response->assign("HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\nContent-Length: 10\r\nConnection: close\r\n\r\nnot found\n");
+            return;
+        }
+        MetricsSnapshot snapshot;
+        MetricsRegistry::Instance().Collect(&snapshot);
+        std::string body;
+        body.reserve(16384);
+        MetricsFormat(snapshot, &body);
+        char head[160];
+        snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %u\r\nConnection: close\r\n\r\n",
+                 (unsigned int)body.size());
+        response->assign(head);
+        response->append(body);
+    }
+
+    std::thread           thread_;
+    std::atomic<bool>     stop_;
+    bool                  running_;
+    unsigned short        port_;
+    TransportTcpServer    server_;
+    TransportSharedMemory memory_;
+    MetricsSnapshot*      shared_;
+    unsigned long         publishMs_;
+};
+
+#endif // ICMP_METRICS_H
@@ -0,0 +1,410 @@
+/* ICMP Packet Watcher - Asynchronous output writer for probe results */
+
+/* The probe loop does not print. It hands each result to OutputWriter::Emit(), which copies a fixed-size
+   OutputRecord into a single-producer/single-consumer ring and returns; a full ring drops the record (counted in
+   Dropped()) instead of waiting. A writer thread drains the rings, formats the records into a 64 KB buffer and
+   writes it to stdout or a file in large blocks, so terminal and disk I/O never run inside the timing loop.
+
+   Formats (one record per line except binary):
+     text     Reply from 10.0.0.1: seq=7 RTT=0.123 ms
+     csv      time_ns,target,seq,event,rtt_ns,from,icmp_type,icmp_code,hop,size   (header line first)
+     json     {"time_ns":...,"target":"10.0.0.1","seq":7,"event":"reply","rtt_ns":123456}
+     binary   32-byte little-endian records: u64 time_ns, u64 rtt_ns, u32 target, u32 from (both in network order
+              as on the wire), u16 seq, u8 event, u8 icmp_type, u8 icmp_code, u8 hop, u16 size
+     tsdb     not formatted: the records go to an OutputSink, the compressed store of icmp_TimeSeries.h
+   time_ns is Unix time in nanoseconds; events are reply, timeout, late, duplicate and error. An error is an ICMP
+   error message matched to the probe it quotes: from is the router or host that sent it, icmp_type/icmp_code tell
+   what it is and rtt_ns is the time it took to come back (0 when the quote is too short to carry the send stamp).
+   The text, csv and json formats only show from, icmp_type and icmp_code for errors. hop is the TTL a traceroute
+   probe was sent with (0 and not shown for other probes); its reply or time exceeded message names the hop in from.
+   size is the ICMP payload of a size sweep probe (-M), 0 and not shown otherwise. */
+
+#ifndef ICMP_OUTPUT_H
+#define ICMP_OUTPUT_H
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "icmp_Transport.h"
+#include "icmp_Types.h"
+
+enum OutputFormat
+{
+    OUTPUT_TEXT,
+    OUTPUT_CSV,
+    OUTPUT_JSON,
+    OUTPUT_BINARY,
+    OUTPUT_TSDB
+};
+
+enum OutputEvent
+{
+    OUTPUT_REPLY,
+    OUTPUT_TIMEOUT,
+    OUTPUT_LATE,
+    OUTPUT_DUPLICATE,
+    OUTPUT_ERROR
+};
+
+struct OutputRecord
+{
+    unsigned long long timeNs;                                              // TransportMonotonicNs clock, moved to Unix time by the writer
+    unsigned long long rttNs;                                               // 0 unless event is OUTPUT_REPLY or OUTPUT_ERROR
+    unsigned int       target;                                              // IPv4 address in network byte order
+    unsigned int       from;                                                // Sender of an OUTPUT_ERROR, otherwise the target
+    unsigned short     seq;
+    unsigned char      event;                                               // OutputEvent
+    unsigned char      icmpType;                                            // ICMP type and code of an OUTPUT_ERROR, otherwise 0
+    unsigned char      icmpCode;
+    unsigned char      hop;                                                 // TTL of a traceroute probe, otherwise 0
+    unsigned short     size;                                                // Payload bytes of a size sweep probe, otherwise 0
+};
+
+// Parses the -o argument, returns false for an unknown format
+inline bool ParseOutputFormat(const char* name, OutputFormat* format)
+{
+    static const char* const names[] = { "text", "csv", "json", "binary", "tsdb" };
+    for (int i = 0; i < 5; ++i)
+        if (strcmp(name, names[i]) == 0)
+        {
+            *format = (OutputFormat)i;
+            return true;
+        }
+    return false;
+}
+
+// Takes the records of the tsdb format on the writer thread, in place of the formatter (TimeSeriesWriter)
+class OutputSink
+{
+public:
+    virtual ~OutputSink() {}
+    virtual void Write(const OutputRecord& record, unsigned long long unixNs) = 0;
+    virtual void Close() = 0;                                               // Once, after the last record
+};
+
+/* Lock-free ring for one producer and one consumer. Each side keeps a cached copy of the other side's index and
+   only reloads it when the ring looks full (producer) or empty (consumer), so the shared cache lines are touched
+   once per batch rather than once per record. */
+class OutputRing
+{
+public:
+    explicit OutputRing(unsigned int capacity)
+        : head_(0), tail_(0), cachedTail_(0), cachedHead_(0)
+    {
+        unsigned int size = 1;
+        while (size < capacity)
+            size <<= 1;
+        mask_ = size - 1;
+        records_.resize(size);
+    }
+
+    bool Push(const OutputRecord& record)
+    {
+        unsigned long long tail = tail_.load(std::memory_order_relaxed);
+        if (tail - cachedHead_ > mask_)
+        {
+            cachedHead_ = head_.load(std::memory_order_acquire);
+            if (tail - cachedHead_ > mask_)
+                return false;
+        }
+        records_[tail & mask_] = record;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    int Pop(OutputRecord* records, int max)
+    {
+        unsigned long long head = head_.load(std::memory_order_relaxed);
+        if (head == cachedTail_)
+        {
+            cachedTail_ = tail_.load(std::memory_order_acquire);
+            if (head == cachedTail_)
+                return 0;
+        }
+        int count = 0;
+        while (count < max && head != cachedTail_)
+            records[count++] = records_[head++ & mask_];
+        head_.store(head, std::memory_order_release);
+        return count;
+    }
+
+private:
+    std::vector<OutputRecord> records_;
+    unsigned long long mask_;
+    alignas(64) std::atomic<unsigned long long> head_;                      // Consumer side
+    alignas(64) std::atomic<unsigned long long> tail_;                      // Producer side
+    alignas(64) unsigned long long cachedTail_;                             // Consumer's copy of tail_
+    alignas(64) unsigned long long cachedHead_;                             // Producer's copy of head_
+};
+
+class OutputWriter
+{
+public:
+    // One ring per probe thread; Emit(record, producer) must only be called from that producer's thread
+    OutputWriter(OutputFormat format, FILE* file, int producers = 1, unsigned int capacity = 1u << 16)
+        : format_(format), file_(file), sink_(NULL), stop_(false), written_(0), offsetNs_(0)
+    {
+        for (int i = 0; i < producers; ++i)
+            rings_.push_back(new OutputRing(capacity));
+        dropped_.resize(producers, 0);
+        buffer_.reserve(BufferSize + 256);
+    }
+
+    ~OutputWriter()
+    {
+        Stop();
+        for (size_t i = 0; i < rings_.size(); ++i)
+            delete rings_[i];
+    }
+
+    // Where the tsdb format's records go, set before Start()
+    void SetSink(OutputSink* sink) { sink_ = sink; }
+
+    void Start()
+    {
+        offsetNs_ = TransportRealtimeOffsetNs();
+        if (format_ == OUTPUT_CSV)
+            Append("time_ns,target,seq,event,rtt_ns,from,icmp_type,icmp_code,hop,size\n");
+        thread_ = std::thread(&OutputWriter::Run, this);
+    }
+
+    // Called on the probe path: never blocks, a full ring drops the record
+    void Emit(const OutputRecord& record, int producer = 0)
+    {
+        if (!rings_[producer]->Push(record))
+            ++dropped_[producer];
+    }
+
+    void Emit(OutputEvent event, unsigned long target, unsigned short seq, unsigned long long timeNs, unsigned long long rttNs, int producer = 0)
+    {
+        Emit(MakeRecord(event, target, seq, target, 0, 0, timeNs, rttNs, 0, 0), producer);
+    }
+
+    // An ICMP error from 'from' that answered the probe (target, seq)
+    void EmitError(unsigned long target, unsigned short seq, unsigned long from, unsigned char type, unsigned char code,
+                   unsigned long long timeNs, unsigned long long rttNs, int producer = 0)
+    {
+        Emit(MakeRecord(OUTPUT_ERROR, target, seq, from, type, code, timeNs, rttNs, 0, 0), producer);
+    }
+
+    // Result of a traceroute probe sent with TTL hop: a reply or error from 'from', or a timeout
+    void EmitHop(OutputEvent event, unsigned long target, unsigned short seq, unsigned char hop, unsigned long from, unsigned char type,
+                 unsigned char code, unsigned long long timeNs, unsigned long long rttNs, int producer = 0)
+    {
+        Emit(MakeRecord(event, target, seq, from, type, code, timeNs, rttNs, hop, 0), producer);
+    }
+
+    // Result of a size sweep probe with "size" bytes of payload: a reply or error from 'from', or a timeout
+    void EmitSize(OutputEvent event, unsigned long target, unsigned short seq, unsigned short size, unsigned long from, unsigned char type,
+                  unsigned char code, unsigned long long timeNs, unsigned long long rttNs, int producer = 0)
+    {
+        Emit(MakeRecord(event, target, seq, from, type, code, timeNs, rttNs, 0, size), producer);
+    }
+
+    // Writes everything still queued and stops the writer thread
+    void Stop()
+    {
+        if (!thread_.joinable())
+            return;
+        stop_.store(true, std::memory_order_release);
+        thread_.join();
+    }
+
+    unsigned long long Written() const { return written_; }
+    unsigned long long Dropped() const
+    {
+        unsigned long long dropped = 0;
+        for (size_t i = 0; i < dropped_.size(); ++i)
+            dropped += dropped_[i];
+        return dropped;
+    }
+
+private:
+    static const size_t BufferSize = 64 * 1024;
+
+    static OutputRecord MakeRecord(OutputEvent event, unsigned long target, unsigned short seq, unsigned long from, unsigned char type,
+                                   unsigned char code, unsigned long long timeNs, unsigned long long rttNs, unsigned char hop, unsigned short size)
+    {
+        OutputRecord record;
+        record.timeNs   = timeNs;
+        record.rttNs    = rttNs;
+        record.target   = (unsigned int)target;
+        record.from     = (unsigned int)from;
+        record.seq      = seq;
+        record.event    = (unsigned char)event;
+        record.icmpType = type;
+        record.icmpCode = code;
+        record.hop      = hop;
+        record.size     = size;
+        return record;
+    }
+
+    void Run()
+    {
+        OutputRecord records[256];
+        for (;;)
+        {
+            bool stopping = stop_.load(std::memory_order_acquire);          // Read before draining, so nothing queued earlier is missed
+            int drained = 0;
+            for (size_t r = 0; r < rings_.size(); ++r)
+            {
+                int count;
+                while ((count = rings_[r]->Pop(records, 256)) > 0)
+                {
+                    for (int i = 0; i < count; ++i)
+                        Format(records[i]);
+                    drained += count;
+                }
+            }
+            written_ += drained;
+            if (drained == 0)
+            {
+                Flush();
+                if (stopping)
+                {
+                    if (sink_ != NULL)
+                        sink_->Close();
+                    return;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+
+    void Flush()
+    {
+        if (buffer_.empty())
+            return;
+        fwrite(&buffer_[0], 1, buffer_.size(), file_);
+        fflush(file_);
+        buffer_.clear();
+    }
+
+    void Append(const char* data, size_t len)
+    {
+        buffer_.insert(buffer_.end(), data, data + len);
+        if (buffer_.size() >= BufferSize)
+            Flush();
+    }
+
+    void Append(const char* text) { Append(text, strlen(text)); }
+
+    static int FormatAddress(char* out, unsigned int address)
+    {
+        const unsigned char* b = (const unsigned char*)&address;
+        return sprintf(out, "%u.%u.%u.%u", b[0], b[1], b[2], b[3]);         // inet_ntoa is not thread-safe
+    }
+
+    void Format(const OutputRecord& record)
+    {
+        static const char* const events[] = { "reply", "timeout", "late", "duplicate", "error" };
+        const char* event = record.event < 5 ? events[record.event] : "unknown";
+        unsigned long long timeNs = (unsigned long long)((long long)record.timeNs + offsetNs_);
+        if (format_ == OUTPUT_TSDB)
+        {
+            if (sink_ != NULL)
+                sink_->Write(record, timeNs);
+            return;
+        }
+        char address[16], from[16];
+        FormatAddress(address, record.target);
+        FormatAddress(from, record.from);
+        bool error = record.event == OUTPUT_ERROR;
+        const char* codeName = error ? IcmpCodeName(record.icmpType, record.icmpCode) : NULL;
+        char size[16] = "";
+        if (record.size > 0)
+            snprintf(size, sizeof(size), " size=%u", record.size);
+        char line[256];
+        int len = 0;
+
+        switch (format_)
+        {
+        case OUTPUT_TEXT:
+            if (record.hop > 0 && record.event == OUTPUT_TIMEOUT)
+                len = snprintf(line, sizeof(line), "Hop %u to %s: seq=%u timed out!\n", record.hop, address, record.seq);
+            else if (record.hop > 0)
+                len = snprintf(line, sizeof(line), "Hop %u to %s: %s seq=%u RTT=%.3f ms (%s)\n", record.hop, address, from, record.seq,
+                               record.rttNs / 1e6, error ? (codeName != NULL ? codeName : IcmpTypeName(record.icmpType)) : "destination");
+            else if (record.event == OUTPUT_REPLY)
+                len = snprintf(line, sizeof(line), "Reply from %s: seq=%u%s RTT=%.3f ms\n", address, record.seq, size, record.rttNs / 1e6);
+            else if (record.event == OUTPUT_TIMEOUT)
+                len = snprintf(line, sizeof(line), "Request to %s seq=%u%s timed out!\n", address, record.seq, size);
+            else if (error && codeName != NULL)
+                len = snprintf(line, sizeof(line), "Error from %s for %s: seq=%u%s %s (%s)\n", from, address, record.seq, size,
+                               IcmpTypeName(record.icmpType), codeName);
+            else if (error)
+                len = snprintf(line, sizeof(line), "Error from %s for %s: seq=%u%s %s (code %u)\n", from, address, record.seq, size,
+                               IcmpTypeName(record.icmpType), record.icmpCode);
+            else
+                len = snprintf(line, sizeof(line), "Reply from %s: seq=%u (%s)\n", address, record.seq, event);
+            break;
+        case OUTPUT_CSV:
+            if (error)
+                len = snprintf(line, sizeof(line), "%llu,%s,%u,%s,%llu,%s,%u,%u,", timeNs, address, record.seq, event, record.rttNs,
+                               from, record.icmpType, record.icmpCode);
+            else
+                len = snprintf(line, sizeof(line), "%llu,%s,%u,%s,%llu,,,,", timeNs, address, record.seq, event, record.rttNs);
+            if (record.hop > 0)
+                len += snprintf(line + len, sizeof(line) - len, "%u", record.hop);
+            line[len++] = ',';
+            if (record.size > 0)
+                len += snprintf(line + len, sizeof(line) - len, "%u", record.size);
+            line[len++] = '\n';
+            break;
+        case OUTPUT_JSON:
+            len = snprintf(line, sizeof(line), "{\"time_ns\":%llu,\"target\":\"%s\",\"seq\":%u,\"event\":\"%s\",\"rtt_ns\":%llu",
+                           timeNs, address, record.seq, event, record.rttNs);
+            if (error)
+                len += snprintf(line + len, sizeof(line) - len, ",\"from\":\"%s\",\"icmp_type\":%u,\"icmp_code\":%u",
+                                from, record.icmpType, record.icmpCode);
+            if (record.hop > 0)
+                len += snprintf(line + len, sizeof(line) - len, ",\"hop\":%u", record.hop);
+            if (record.size > 0)
+                len += snprintf(line + len, sizeof(line) - len, ",\"size\":%u", record.size);
+            len += snprintf(line + len, sizeof(line) - len, "}\n");
+            break;
+        case OUTPUT_BINARY:
+        {
+            unsigned char* p = (unsigned char*)line;
+            for (int i = 0; i < 8; ++i)
+                *p++ = (unsigned char)(timeNs >> (8 * i));
+            for (int i = 0; i < 8; ++i)
+                *p++ = (unsigned char)(record.rttNs >> (8 * i));
+            memcpy(p, &record.target, 4);                                   // Already in network byte order
+            p += 4;
+            memcpy(p, &record.from, 4);
+            p += 4;
+            *p++ = (unsigned char)record.seq;
+            *p++ = (unsigned char)(record.seq >> 8);
+            *p++ = record.event;
+            *p++ = record.icmpType;
+            *p++ = record.icmpCode;
+            *p++ = record.hop;
+            *p++ = (unsigned char)record.size;
+            *p++ = (unsigned char)(record.size >> 8);
+            len = (int)(p - (unsigned char*)line);
+            break;
+        }
+        case OUTPUT_TSDB:
+            break;
+        }
+        if (len > 0)
+            Append(line, (size_t)len);
+    }
+
+    OutputFormat                     format_;
+    FILE*                            file_;
+    OutputSink*                      sink_;
+    std::vector<OutputRing*>         rings_;
+    std::vector<unsigned long long>  dropped_;                              // Per producer, only written by that producer
+    std::vector<char>                buffer_;
+    std::thread                      thread_;
+    std::atomic<bool>                stop_;
+    unsigned long long               written_;
+    long long                        offsetNs_;
+};
+
+#endif // ICMP_OUTPUT_H
@@ -0,0 +1,387 @@
+/* ICMP Packet Watcher - Prebuilt echo request templates and the per-size tables of the size sweep mode */
+
+/* The size sweep (-M sizes) sends echo requests with many payload sizes to one destination, up to the 65507 bytes
+   that fit into an IPv4 datagram, with the don't fragment bit set. Building a 64 KB request and summing it for its
+   checksum on every send would cost more than the send itself, so every size gets one complete template up front:
+   header, 'Y' fill and checksum are in place and sending a probe only patches the sequence number and send stamps
+   (PatchEchoRequest, incremental checksum). All templates live back to back in one arena.
+
+   PacketPool   The templates, one per ICMP length, built and summed once.
+   PoolBatch    Queues templates (not copies) for one TransportSendBatch. A template can be queued once per batch,
+                since patching it again would change a probe that has not left yet.
+   SizeCurve    Sent/received/lost, RTT percentiles and answers per size: the latency and loss curve, and where it
+                breaks off. A size that the local stack refuses (EMSGSIZE, larger than the interface MTU), a
+                fragmentation needed error naming the next-hop MTU, or sizes that are silently lost while smaller
+                ones are answered (a path MTU black hole: a router drops them without the error) are reported.
+
+   Sizes are ICMP payload bytes after the 8-byte echo header, like ping -s; the IP datagram is 28 bytes longer. */
+
+#ifndef ICMP_PACKETPOOL_H
+#define ICMP_PACKETPOOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <ostream>
+#include <vector>
+#include "icmp_Checksum.h"
+#include "icmp_Metrics.h"
+#include "icmp_Pcap.h"
+#include "icmp_Stats.h"
+#include "icmp_Transport.h"
+#include "icmp_Types.h"
+
+#define PacketPoolMaxSizes  1024                                            // Sizes of one sweep, the templates of all of them stay allocated
+#define PacketPoolMaxLength (65535 - 20)                                    // Largest ICMP message in an IPv4 datagram without options
+#define PacketPoolAlign     64
+
+class PacketPool
+{
+public:
+    /* One template per entry of lengths (whole ICMP messages): the first headerLen bytes are copied from header,
+       the rest is filled with fill, then the checksum at offset 2 is computed over the template. */
+    PacketPool(const void* header, int headerLen, unsigned char fill, const std::vector<int>& lengths)
+        : lengths_(lengths), offsets_(lengths.size())
+    {
+        size_t bytes = 0;
+        for (size_t i = 0; i < lengths_.size(); ++i)
+        {
+            offsets_[i] = bytes;
+            bytes += ((size_t)lengths_[i] + PacketPoolAlign - 1) / PacketPoolAlign * PacketPoolAlign;
+        }
+        arena_.resize(bytes);
+        for (size_t i = 0; i < lengths_.size(); ++i)
+        {
+            char* packet = &arena_[offsets_[i]];
+            int copied = headerLen < lengths_[i] ? headerLen : lengths_[i];
+            memcpy(packet, header, copied);
+            memset(packet + copied, fill, lengths_[i] - copied);
+            memset(packet + 2, 0, 2);
+            unsigned short sum = checksum((const unsigned short*)packet, lengths_[i]);
+            memcpy(packet + 2, &sum, 2);
+        }
+    }
+
+    int    Count() const           { return (int)lengths_.size(); }
+    char*  Data(int index)         { return &arena_[offsets_[index]]; }
+    int    Length(int index) const { return lengths_[index]; }
+    size_t Bytes() const           { return arena_.size(); }
+
+private:
+    std::vector<char>   arena_;
+    std::vector<int>    lengths_;
+    std::vector<size_t> offsets_;
+};
+
+class PoolBatch
+{
+public:
+    PoolBatch(PacketPool& pool, int capacity)
+        : pool_(pool), queued_(pool.Count(), 0), count_(0), refused_(-1), calls_(0), packets_(0), capture_(NULL), captureProducer_(0)
+    {
+        capacity_ = capacity < 1 ? 1 : (capacity > TRANSPORT_MAX_BATCH ? TRANSPORT_MAX_BATCH : capacity);
+        slots_.resize(capacity_);
+        indices_.resize(capacity_);
+    }
+
+    int  Capacity() const          { return capacity_; }
+    int  Count() const             { return count_; }
+    bool Full() const              { return count_ == capacity_; }
+    bool Queued(int index) const   { return queued_[index] != 0; }
+
+    // As SendBatch::Capture
+    void Capture(PcapWriter* capture, int producer = 0)
+    {
+        capture_ = capture;
+        captureProducer_ = producer;
+    }
+
+    // Queues template "index" for destination and returns it for patching. Not allowed while Queued(index).
+    char* Queue(int index, unsigned long destination)
+    {
+        TransportPacket& slot = slots_[count_];
+        slot.data = pool_.Data(index);
+        slot.len  = pool_.Length(index);
+        slot.addr = destination;
+        slot.ttl  = 0;
+        indices_[count_++] = index;
+        queued_[index] = 1;
+        return slot.data;
+    }
+
+    /* Same contract as SendBatch::Flush, Refused() then names the template that was dropped. The sends are
+       synchronous (TransportSendBatch, not the io_uring queue), so a size the local stack refuses is known at once. */
+    int Flush(IcmpSocket& s)
+    {
+        int nSent = 0;
+        ThreadMetrics& metrics = MetricsLocal();
+        while (count_ > 0)
+        {
+            unsigned long long startNs = TransportMonotonicNs();
+            int nRet = TransportSendBatch(s, &slots_[0], count_);
+            metrics.Record(METRIC_SEND_CALL_NS, TransportMonotonicNs() - startNs);
+            ++calls_;
+            if (nRet == TRANSPORT_WOULD_BLOCK)
+                break;
+            if (nRet == TRANSPORT_ERROR)
+            {
+                metrics.Count(METRIC_SEND_ERRORS);
+                refused_ = indices_[0];
+                Consume(1);
+                return TRANSPORT_ERROR;
+            }
+            metrics.Count(METRIC_PACKETS_SENT, nRet);
+            if (capture_ != NULL)
+                for (int i = 0; i < nRet; ++i)
+                    capture_->WriteSent(slots_[i].data, slots_[i].len, slots_[i].addr, slots_[i].ttl, startNs, captureProducer_);
+            packets_ += nRet;
+            nSent += nRet;
+            Consume(nRet);
+        }
+        return nSent;
+    }
+
+    int                Refused() const { return refused_; }
+    unsigned long long Calls() const   { return calls_; }
+    unsigned long long Packets() const { return packets_; }
+
+private:
+    void Consume(int n)
+    {
+        for (int i = 0; i < n; ++i)
+            queued_[indices_[i]] = 0;
+        for (int i = n; i < count_; ++i)
+        {
+            slots_[i - n]   = slots_[i];
+            indices_[i - n] = indices_[i];
+        }
+        count_ -= n;
+    }
+
+    PacketPool&                  pool_;
+    std::vector<TransportPacket> slots_;
+    std::vector<int>             indices_;                                  // Template of each queued slot
+    std::vector<unsigned char>   queued_;                                   // Per template: waiting in this batch
+    int                          capacity_;
+    int                          count_;
+    int                          refused_;
+    unsigned long long           calls_;
+    unsigned long long           packets_;
+    PcapWriter*                  capture_;
+    int                          captureProducer_;                          // Its ring in capture_, one per probe thread
+};
+
+/* Parses the -M argument: comma separated sizes and ranges min-max[/step] (step 1 if left out), for instance
+   "56,512,1400-1500/4". The sizes come back sorted without duplicates. Returns false for sizes outside
+   [minSize, maxSize] and for more than PacketPoolMaxSizes of them. */
+inline bool ParseSizeList(const char* spec, int minSize, int maxSize, std::vector<int>& sizes)
+{
+    sizes.clear();
+    const char* p = spec;
+    while (*p != '\0')
+    {
+        char* end;
+        long first = strtol(p, &end, 10);
+        long last = first, step = 1;
+        if (end == p)
+            return false;
+        p = end;
+        if (*p == '-')
+        {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1)
+                return false;
+            p = end;
+            if (*p == '/')
+            {
+                step = strtol(p + 1, &end, 10);
+                if (end == p + 1 || step < 1)
+                    return false;
+                p = end;
+            }
+        }
+        if (first < minSize || last > maxSize || first > last)
+            return false;
+        for (long size = first; size <= last; size += step)
+        {
+            if (sizes.size() >= PacketPoolMaxSizes * 4)                     // Duplicates are only removed below
+                return false;
+            sizes.push_back((int)size);
+        }
+        if (*p == ',')
+            ++p;
+        else if (*p != '\0')
+            return false;
+    }
+    std::sort(sizes.begin(), sizes.end());
+    sizes.erase(std::unique(sizes.begin(), sizes.end()), sizes.end());
+    return !sizes.empty() && sizes.size() <= PacketPoolMaxSizes;
+}
+
+struct SizePoint
+{
+    int                size;                                                // ICMP payload bytes
+    unsigned long long sent;                                                // Probes that went on the wire
+    RttStats           stats;                                               // Replies, errors and timeouts (its sent count is not used)
+    LatencyHistogram   histogram;
+    unsigned long long refused;                                             // Sends the local stack refused, never on the wire
+    unsigned long long fragNeeded;                                          // Fragmentation needed errors (type 3 code 4)
+    unsigned short     mtu;                                                 // Smallest next-hop MTU they reported, 0 if none did
+    unsigned long      mtuFrom;                                             // Router that reported it (network byte order)
+};
+
+class SizeCurve
+{
+public:
+    explicit SizeCurve(const std::vector<int>& sizes)
+        : points_(sizes.size())
+    {
+        for (size_t i = 0; i < sizes.size(); ++i)
+        {
+            points_[i].size       = sizes[i];
+            points_[i].sent       = 0;
+            points_[i].refused    = 0;
+            points_[i].fragNeeded = 0;
+            points_[i].mtu        = 0;
+            points_[i].mtuFrom    = 0;
+        }
+    }
+
+    SizePoint& Point(int index)             { return points_[index]; }
+    const SizePoint& Point(int index) const { return points_[index]; }
+
+    // A probe is counted as sent when it is queued, a refused send takes it back
+    void OnSent(int index)    { ++points_[index].sent; }
+    void OnRefused(int index) { --points_[index].sent; ++points_[index].refused; }
+    void OnLost(int index)    { points_[index].stats.OnLost(); }
+
+    void OnReply(int index, unsigned short seq, unsigned long long rttNs)
+    {
+        SizePoint& point = points_[index];
+        point.stats.OnReply(seq);
+        point.stats.Record(rttNs);
+        point.histogram.Record(rttNs);
+    }
+
+    void OnError(int index, const IcmpErrorInfo& error, unsigned long from)
+    {
+        SizePoint& point = points_[index];
+        point.stats.OnError();
+        if (error.type != 3 || error.code != 4)
+            return;
+        ++point.fragNeeded;
+        if (error.mtu != 0 && (point.mtu == 0 || error.mtu < point.mtu))
+        {
+            point.mtu     = error.mtu;
+            point.mtuFrom = from;
+        }
+    }
+
+    // Largest size with at least one reply, -1 if none was answered
+    int LargestAnswered() const
+    {
+        for (size_t i = points_.size(); i > 0; --i)
+            if (points_[i - 1].stats.Received() > 0)
+                return (int)i - 1;
+        return -1;
+    }
+
+    /* Index of the first size of a path MTU black hole, -1 if there is none: from there on every size that went on the
+       wire was lost without any answer (no reply, no error), while a smaller size was answered. */
+    int BlackHole() const
+    {
+        int answered = LargestAnswered();
+        if (answered < 0)
+            return -1;
+        int first = -1;
+        for (size_t i = answered + 1; i < points_.size(); ++i)
+        {
+            const SizePoint& point = points_[i];
+            if (point.sent == 0)
+                continue;                                                   // Refused locally, that is not the path's doing
+            if (point.stats.Errors() > 0 || point.stats.Lost() < point.sent)
+                return -1;                                                  // Answered with an error, or still in flight at the end
+            if (first < 0)
+                first = (int)i;
+        }
+        return first;
+    }
+
+    // One line per size, then where the curve breaks off
+    void Print(std::ostream& out, const char* name, bool dontFragment) const
+    {
+        char line[256];
+        snprintf(line, sizeof(line), "--- size sweep to %s (%s) ---\n", name, dontFragment ? "don't fragment" : "fragmentation allowed");
+        out<<line;
+        snprintf(line, sizeof(line), "%7s %8s %6s %6s %8s  %s\n", "payload", "IP bytes", "sent", "recv", "loss", "RTT min/p50/p99/max ms");
+        out<<line;
+        for (size_t i = 0; i < points_.size(); ++i)
+        {
+            const SizePoint& point = points_[i];
+            const RttStats& stats = point.stats;
+            int len = snprintf(line, sizeof(line), "%7d %8d %6llu %6llu ", point.size, point.size + 28, point.sent, stats.Received());
+            if (point.sent == 0)
+                len += snprintf(line + len, sizeof(line) - len, "%8s", "-");
+            else
+                len += snprintf(line + len, sizeof(line) - len, "%7.1f%%", 100.0 * (double)(point.sent - stats.Received()) / (double)point.sent);
+            if (stats.Received() > 0)
+                len += snprintf(line + len, sizeof(line) - len, "  %.3f/%.3f/%.3f/%.3f", stats.MinNs() / 1e6,
+                                point.histogram.Percentile(50) / 1e6, point.histogram.Percentile(99) / 1e6, stats.MaxNs() / 1e6);
+            if (point.refused > 0)
+                len += snprintf(line + len, sizeof(line) - len, "  refused locally %llu times", point.refused);
+            if (point.fragNeeded > 0 && point.mtu != 0)
+                len += snprintf(line + len, sizeof(line) - len, "  fragmentation needed, MTU %u", point.mtu);
+            else if (point.fragNeeded > 0)
+                len += snprintf(line + len, sizeof(line) - len, "  fragmentation needed");
+            if (stats.Errors() > point.fragNeeded)
+                len += snprintf(line + len, sizeof(line) - len, "  %llu other errors", stats.Errors() - point.fragNeeded);
+            out<<line<<'\n';
+        }
+
+        int answered = LargestAnswered();
+        if (answered < 0)
+        {
+            out<<"No size was answered\n";
+            return;
+        }
+        snprintf(line, sizeof(line), "Largest size answered: %d bytes of payload (%d byte IP datagram)\n",
+                 points_[answered].size, points_[answered].size + 28);
+        out<<line;
+        for (size_t i = 0; i < points_.size(); ++i)
+            if (points_[i].refused > 0)
+            {
+                snprintf(line, sizeof(line), "Refused by the local stack from %d bytes of payload on (larger than the interface MTU)\n", points_[i].size);
+                out<<line;
+                break;
+            }
+        const SizePoint* reported = NULL;
+        for (size_t i = 0; i < points_.size(); ++i)
+            if (points_[i].mtu != 0 && (reported == NULL || points_[i].mtu < reported->mtu))
+                reported = &points_[i];
+        if (reported != NULL)
+        {
+            const unsigned char* b = (const unsigned char*)&reported->mtuFrom;
+            snprintf(line, sizeof(line), "Path MTU %u reported by %u.%u.%u.%u (fragmentation needed)\n", reported->mtu, b[0], b[1], b[2], b[3]);
+            out<<line;
+        }
+        int hole = BlackHole();
+        if (hole >= 0 && dontFragment)
+        {
+            snprintf(line, sizeof(line), "Path MTU black hole: %d byte datagrams are answered, %d bytes and more are lost without a fragmentation needed error\n",
+                     points_[answered].size + 28, points_[hole].size + 28);
+            out<<line;
+        }
+        else if (hole >= 0)
+        {
+            snprintf(line, sizeof(line), "%d byte datagrams are answered, %d bytes and more are lost (their fragments are dropped on the path)\n",
+                     points_[answered].size + 28, points_[hole].size + 28);
+            out<<line;
+        }
+    }
+
+private:
+    std::vector<SizePoint> points_;
+};
+
+#endif // ICMP_PACKETPOOL_H
@@ -0,0 +1,736 @@
+/* ICMP Packet Watcher - pcap / pcapng capture files */
+
+/* -C file writes every packet the prober sends and receives to a capture file that Wireshark, tcpdump and -p read:
+     pcap      the classic format with nanosecond stamps (magic 0xA1B23C4D), when the file name does not end in .pcapng
+     pcapng    a section header, one interface and an enhanced packet block per packet, whose epb_flags option tells
+               sent (outbound) from received (inbound) packets
+   Both use LINKTYPE_RAW: every packet starts at its IPv4 header. Received datagrams are written as the raw socket
+   delivered them, IP options and all. Sent requests and what a ping socket receives carry no IP header; they get a
+   20-byte header made up here, with the TTL the request was sent with and 0.0.0.0 for the local address, which the
+   kernel only picks when the packet leaves. Times are the send time (just before the send call) and the receive stamp,
+   moved to Unix time.
+
+   PcapWriter   Every probe thread (a shard of a sweep) has a ring of its own (PcapRing) that it builds its records in;
+                it takes no lock and never writes to the file, and a full ring drops the packet (counted in Dropped()).
+                A writer thread drains the rings, oldest record at their fronts first so the shards merge into one
+                time line, and copies the records into a 1 MB buffer that goes to the file with one fwrite when it is
+                full, or, with -K, straight into a 64 MB window of the file mapped into memory (TransportMappedWriter),
+                so no write calls are made at all and the kernel writes the pages back.
+   PcapReader   Walks a capture held in memory or mapped from a file (TransportMappedFile) and hands out the IPv4
+                packets in it, link layer header skipped. It reads both formats in either byte order, microsecond and
+                nanosecond pcap, pcapng with any if_tsresol and several sections and interfaces, and the link types
+                raw IP, Ethernet (VLAN tags included), Linux cooked (v1 and v2) and BSD loopback, so captures taken
+                with tcpdump elsewhere replay too. A record that runs past the end of the file ends the walk and is
+                reported by Damaged(). */
+
+#ifndef ICMP_PCAP_H
+#define ICMP_PCAP_H
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "icmp_Checksum.h"
+#include "icmp_Transport.h"
+
+#define PcapLinkRaw         101                                             // LINKTYPE_RAW: the packet starts at the IP header
+#define PcapSnapLength      262144
+#define PcapBufferBytes     (1u << 20)
+#define PcapRingBytes       (2u << 20)                                      // Per probe thread, records not yet taken by the writer
+#define PcapMapWindow       (64u << 20)                                     // Mapped at a time with -K
+#define PcapMapGranularity  (64u << 10)                                     // Window offsets, the allocation granularity of Windows
+
+enum PcapFormat
+{
+    PCAP_FORMAT_PCAP,
+    PCAP_FORMAT_PCAPNG
+};
+
+// pcapng for a file name ending in .pcapng, pcap for any other
+inline PcapFormat PcapFormatOf(const char* path)
+{
+    size_t len = strlen(path);
+    return len >= 7 && strcmp(path + len - 7, ".pcapng") == 0 ? PCAP_FORMAT_PCAPNG : PCAP_FORMAT_PCAP;
+}
+
+// Ahead of each record in a PcapRing
+struct PcapRingEntry
+{
+    unsigned int       size;                                                // Ring bytes of the entry, 0: the rest of the ring is unused
+    unsigned int       bytes;                                               // Bytes of the file record that follows
+    unsigned long long unixNs;                                              // Its time, the order the writer merges the rings in
+};
+
+/* Lock-free ring of file records for one producer and one consumer, the OutputRing of icmp_Output.h for records of
+   any length. An entry never wraps around: when it does not fit in before the end, the producer marks the rest of
+   the ring unused and starts again at the front. */
+class PcapRing
+{
+public:
+    explicit PcapRing(unsigned int capacity)
+        : head_(0), tail_(0), cachedTail_(0), cachedHead_(0), pending_(0)
+    {
+        unsigned int size = 64;
+        while (size < capacity)
+            size <<= 1;
+        size_ = size;
+        bytes_.resize(size);
+    }
+
+    // Room for a file record of the given bytes, NULL when the ring is full. Commit() hands it to the consumer.
+    unsigned char* Reserve(unsigned int bytes, unsigned long long unixNs)
+    {
+        unsigned long long size = (sizeof(PcapRingEntry) + bytes + 7) & ~7ULL;
+        unsigned long long tail = tail_.load(std::memory_order_relaxed);
+        unsigned long long offset = tail & (size_ - 1);
+        unsigned long long skip = offset + size > size_ ? size_ - offset : 0;
+        if (tail + skip + size - cachedHead_ > size_)
+        {
+            cachedHead_ = head_.load(std::memory_order_acquire);
+            if (tail + skip + size - cachedHead_ > size_)
+                return NULL;
+        }
+        if (skip > 0)
+        {
+            ((PcapRingEntry*)&bytes_[offset])->size = 0;
+            tail += skip;
+        }
+        PcapRingEntry* entry = (PcapRingEntry*)&bytes_[tail & (size_ - 1)];
+        entry->size   = (unsigned int)size;
+        entry->bytes  = bytes;
+        entry->unixNs = unixNs;
+        pending_ = tail + size;
+        return (unsigned char*)(entry + 1);
+    }
+
+    void Commit() { tail_.store(pending_, std::memory_order_release); }
+
+    // The oldest entry, NULL when the ring is empty; its record follows it
+    const PcapRingEntry* Peek()
+    {
+        unsigned long long head = head_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            if (head == cachedTail_)
+            {
+                cachedTail_ = tail_.load(std::memory_order_acquire);
+                if (head == cachedTail_)
+                    return NULL;
+            }
+            const PcapRingEntry* entry = (const PcapRingEntry*)&bytes_[head & (size_ - 1)];
+            if (entry->size != 0)
+                return entry;
+            head += size_ - (head & (size_ - 1));
+            head_.store(head, std::memory_order_release);
+        }
+    }
+
+    // Frees the entry Peek() returned
+    void Pop(const PcapRingEntry* entry)
+    {
+        head_.store(head_.load(std::memory_order_relaxed) + entry->size, std::memory_order_release);
+    }
+
+private:
+    PcapRing(const PcapRing&);
+    PcapRing& operator=(const PcapRing&);
+
+    std::vector<unsigned char> bytes_;
+    unsigned long long size_;
+    alignas(64) std::atomic<unsigned long long> head_;                      // Consumer side
+    alignas(64) std::atomic<unsigned long long> tail_;                      // Producer side
+    alignas(64) unsigned long long cachedTail_;                             // Consumer's copy of tail_
+    alignas(64) unsigned long long cachedHead_;                             // Producer's copy of head_
+    unsigned long long pending_;                                            // tail_ once the reserved record is committed
+};
+
+class PcapWriter
+{
+public:
+    PcapWriter()
+        : file_(NULL), format_(PCAP_FORMAT_PCAP), mapped_(false), open_(false), failed_(false), window_(NULL), windowStart_(0),
+          windowEnd_(0), position_(0), used_(0), packets_(0), realtimeOffsetNs_(0), stop_(false)
+    {
+    }
+
+    ~PcapWriter()
+    {
+        Close();
+        for (size_t i = 0; i < rings_.size(); ++i)
+            delete rings_[i];
+    }
+
+    /* Creates the file, writes its header and starts the writer thread; mapped writes through a mapped window instead
+       of a buffer. One ring of ringBytes per producer: WriteSent() and WriteReceived() with a given producer must
+       only be called from that producer's thread. */
+    bool Open(const char* path, PcapFormat format, bool mapped, int producers = 1, unsigned int ringBytes = PcapRingBytes)
+    {
+        Close();
+        format_ = format;
+        mapped_ = mapped;
+        failed_ = false;
+        window_ = NULL;
+        windowStart_ = windowEnd_ = position_ = 0;
+        used_ = 0;
+        packets_ = 0;
+        realtimeOffsetNs_ = TransportRealtimeOffsetNs();
+        if (mapped ? !mappedFile_.Open(path) : (file_ = fopen(path, "wb")) == NULL)
+            return false;
+        if (!mapped)
+            buffer_.resize(PcapBufferBytes);
+        open_ = true;
+        for (size_t i = 0; i < rings_.size(); ++i)
+            delete rings_[i];
+        rings_.clear();
+        for (int i = 0; i < (producers < 1 ? 1 : producers); ++i)
+            rings_.push_back(new PcapRing(ringBytes));
+        dropped_.assign(rings_.size(), 0);
+
+        if (!WriteHeader())
+            return false;
+        stop_.store(false, std::memory_order_relaxed);
+        thread_ = std::thread(&PcapWriter::Run, this);
+        return true;
+    }
+
+    // An ICMP message that was sent to destination, behind a made-up IPv4 header. timeNs is on the TransportMonotonicNs clock.
+    void WriteSent(const char* icmp, int len, unsigned long destination, int ttl, unsigned long long timeNs, int producer = 0)
+    {
+        unsigned char header[20];
+        MakeIpHeader(header, len, 0, destination, ttl > 0 ? ttl : 64);
+        Packet(producer, header, 20, icmp, len, timeNs, true);
+    }
+
+    // A datagram received on s: written as it is from a raw socket, behind a made-up IPv4 header from a ping socket
+    void WriteReceived(const IcmpSocket& s, const char* data, int len, unsigned long source, unsigned long long timeNs, int producer = 0)
+    {
+        if (s.hasIpHeader)
+        {
+            Packet(producer, NULL, 0, data, len, timeNs, false);
+            return;
+        }
+        unsigned char header[20];
+        MakeIpHeader(header, len, source, 0, 64);
+        Packet(producer, header, 20, data, len, timeNs, false);
+    }
+
+    // Writes everything still queued, stops the writer thread and closes the file. Returns false if anything failed.
+    bool Close()
+    {
+        if (!open_)
+            return !failed_;
+        open_ = false;
+        if (thread_.joinable())
+        {
+            stop_.store(true, std::memory_order_release);
+            thread_.join();
+        }
+        if (mapped_)
+        {
+            if (!mappedFile_.Close(position_))
+                failed_ = true;
+            window_ = NULL;
+            return !failed_;
+        }
+        FlushBuffer();
+        if (fclose(file_) != 0)
+            failed_ = true;
+        file_ = NULL;
+        return !failed_;
+    }
+
+    unsigned long long Packets() const { return packets_; }               // Written to the file, final after Close()
+    unsigned long long Bytes() const   { return position_; }
+    bool               Failed() const  { return failed_; }
+    bool               Mapped() const  { return mapped_; }
+    PcapFormat         Format() const  { return format_; }
+    unsigned long long Dropped() const
+    {
+        unsigned long long dropped = 0;
+        for (size_t i = 0; i < dropped_.size(); ++i)
+            dropped += dropped_[i];
+        return dropped;
+    }
+
+private:
+    PcapWriter(const PcapWriter&);
+    PcapWriter& operator=(const PcapWriter&);
+
+    bool WriteHeader()
+    {
+        unsigned char* header;
+        if (format_ == PCAP_FORMAT_PCAP)
+        {
+            if ((header = Reserve(24)) == NULL)
+                return false;
+            Put32(header, 0xA1B23C4D);                                      // Nanosecond stamps
+            Put16(header + 4, 2);
+            Put16(header + 6, 4);
+            Put32(header + 8, 0);
+            Put32(header + 12, 0);
+            Put32(header + 16, PcapSnapLength);
+            Put32(header + 20, PcapLinkRaw);
+            return true;
+        }
+        if ((header = Reserve(28 + 32)) == NULL)
+            return false;
+        Put32(header, 0x0A0D0D0A);                                          // Section header block
+        Put32(header + 4, 28);
+        Put32(header + 8, 0x1A2B3C4D);
+        Put16(header + 12, 1);
+        Put16(header + 14, 0);
+        Put32(header + 16, 0xFFFFFFFFu);                                    // Section length not given
+        Put32(header + 20, 0xFFFFFFFFu);
+        Put32(header + 24, 28);
+        header += 28;
+        Put32(header, 1);                                                   // Interface description block
+        Put32(header + 4, 32);
+        Put16(header + 8, PcapLinkRaw);
+        Put16(header + 10, 0);
+        Put32(header + 12, PcapSnapLength);
+        Put16(header + 16, 9);                                              // if_tsresol: 10^-9 s
+        Put16(header + 18, 1);
+        Put32(header + 20, 9);
+        Put32(header + 24, 0);                                              // opt_endofopt
+        Put32(header + 28, 32);
+        return true;
+    }
+
+    static void Put16(unsigned char* p, unsigned short v)    { memcpy(p, &v, 2); }   // Host byte order, the magic tells readers which
+    static void Put32(unsigned char* p, unsigned int v)      { memcpy(p, &v, 4); }
+
+    static void MakeIpHeader(unsigned char* header, int len, unsigned long source, unsigned long destination, int ttl)
+    {
+        int total = len + 20 > 65535 ? 65535 : len + 20;
+        unsigned int address;
+        memset(header, 0, 20);
+        header[0] = 0x45;
+        header[2] = (unsigned char)(total >> 8);
+        header[3] = (unsigned char)total;
+        header[8] = (unsigned char)ttl;
+        header[9] = 1;                                                      // ICMP
+        address = (unsigned int)source;
+        memcpy(header + 12, &address, 4);
+        address = (unsigned int)destination;
+        memcpy(header + 16, &address, 4);
+        unsigned short sum = checksum((const unsigned short*)header, 20);
+        memcpy(header + 10, &sum, 2);
+    }
+
+    // Builds the file record of one packet in the producer's ring
+    void Packet(int producer, const unsigned char* header, int headerLen, const char* data, int len, unsigned long long timeNs, bool outbound)
+    {
+        unsigned long long unixNs = timeNs + (unsigned long long)realtimeOffsetNs_;
+        unsigned int captured = (unsigned int)(headerLen + len);
+        PcapRing& ring = *rings_[producer];
+        unsigned char* record;
+        if (format_ == PCAP_FORMAT_PCAP)
+        {
+            if ((record = ring.Reserve(16 + captured, unixNs)) == NULL)
+            {
+                ++dropped_[producer];
+                return;
+            }
+            Put32(record, (unsigned int)(unixNs / 1000000000ULL));
+            Put32(record + 4, (unsigned int)(unixNs % 1000000000ULL));
+            Put32(record + 8, captured);
+            Put32(record + 12, captured);
+            record += 16;
+        }
+        else
+        {
+            unsigned int padded = (captured + 3) & ~3u;
+            unsigned int total = 28 + padded + 12 + 4;                      // Header, data, epb_flags and opt_endofopt, length
+            if ((record = ring.Reserve(total, unixNs)) == NULL)
+            {
+                ++dropped_[producer];
+                return;
+            }
+            Put32(record, 6);                                               // Enhanced packet block
+            Put32(record + 4, total);
+            Put32(record + 8, 0);
+            Put32(record + 12, (unsigned int)(unixNs >> 32));
+            Put32(record + 16, (unsigned int)unixNs);
+            Put32(record + 20, captured);
+            Put32(record + 24, captured);
+            memset(record + 28 + captured, 0, padded - captured);
+            unsigned char* options = record + 28 + padded;
+            Put16(options, 2);                                              // epb_flags: direction
+            Put16(options + 2, 4);
+            Put32(options + 4, outbound ? 2 : 1);
+            Put32(options + 8, 0);
+            Put32(options + 12, total);
+            record += 28;
+        }
+        if (headerLen > 0)
+            memcpy(record, header, headerLen);
+        memcpy(record + headerLen, data, len);
+        ring.Commit();
+    }
+
+    // The writer thread: merges the rings into the file until Close()
+    void Run()
+    {
+        for (;;)
+        {
+            bool stopping = stop_.load(std::memory_order_acquire);          // Read before draining, so nothing queued earlier is missed
+            unsigned long long drained = 0;
+            for (;;)
+            {
+                PcapRing* ring = NULL;                                      // The oldest record at the front of a ring goes first
+                const PcapRingEntry* oldest = NULL;
+                for (size_t r = 0; r < rings_.size(); ++r)
+                {
+                    const PcapRingEntry* entry = rings_[r]->Peek();
+                    if (entry != NULL && (oldest == NULL || entry->unixNs < oldest->unixNs))
+                    {
+                        oldest = entry;
+                        ring = rings_[r];
+                    }
+                }
+                if (oldest == NULL)
+                    break;
+                unsigned char* record = Reserve(oldest->bytes);
+                if (record != NULL)
+                {
+                    memcpy(record, oldest + 1, oldest->bytes);
+                    ++packets_;
+                }
+                ring->Pop(oldest);
+                ++drained;
+            }
+            if (drained == 0)
+            {
+                if (stopping)
+                    return;
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+
+    // Room for the next bytes of the file, NULL once writing failed. Only the writer thread calls it after Open().
+    unsigned char* Reserve(size_t bytes)
+    {
+        if (failed_)
+            return NULL;
+        if (mapped_)
+        {
+            if (position_ + bytes > windowEnd_)
+            {
+                windowStart_ = position_ & ~(unsigned long long)(PcapMapGranularity - 1);
+                windowEnd_ = windowStart_ + PcapMapWindow;
+                if ((window_ = (unsigned char*)mappedFile_.Map(windowStart_, PcapMapWindow)) == NULL)
+                {
+                    failed_ = true;
+                    return NULL;
+                }
+            }
+            unsigned char* p = window_ + (position_ - windowStart_);
+            position_ += bytes;
+            return p;
+        }
+        if (used_ + bytes > buffer_.size() && !FlushBuffer())
+            return NULL;
+        unsigned char* p = &buffer_[used_];
+        used_ += bytes;
+        position_ += bytes;
+        return p;
+    }
+
+    bool FlushBuffer()
+    {
+        if (used_ > 0 && fwrite(&buffer_[0], 1, used_, file_) != used_)
+            failed_ = true;
+        used_ = 0;
+        return !failed_;
+    }
+
+    FILE*                      file_;
+    TransportMappedWriter      mappedFile_;
+    PcapFormat                 format_;
+    bool                       mapped_;
+    bool                       open_;
+    bool                       failed_;
+    unsigned char*             window_;                                     // Mapped [windowStart_, windowEnd_) of the file
+    unsigned long long         windowStart_;
+    unsigned long long         windowEnd_;
+    unsigned long long         position_;                                   // Bytes of the file written so far
+    size_t                     used_;                                       // Bytes in buffer_
+    std::vector<unsigned char> buffer_;
+    unsigned long long         packets_;
+    long long                  realtimeOffsetNs_;                           // Monotonic to Unix time, sampled by Open()
+    std::vector<PcapRing*>     rings_;                                      // One per producer
+    std::vector<unsigned long long> dropped_;                               // Per producer, only written by that producer
+    std::thread                thread_;
+    std::atomic<bool>          stop_;
+};
+
+// One IPv4 packet of a capture
+struct PcapPacket
+{
+    const unsigned char* ip;                                                // Its IPv4 header
+    int                  length;                                            // Captured bytes from ip on
+    int                  wireLength;                                        // Bytes it had on the wire from ip on
+    unsigned long long   timeNs;                                            // Unix time
+};
+
+class PcapReader
+{
+public:
+    PcapReader() : data_(NULL), size_(0), start_(0), offset_(0), ng_(false), swap_(false), records_(0), skipped_(0), damaged_(false) {}
+
+    // Maps the file; false if it cannot be read or is neither pcap nor pcapng
+    bool Open(const char* path)
+    {
+        size_t size;
+        const void* data = file_.Open(path, &size);
+        return data != NULL && Open(data, size);
+    }
+
+    // A capture already in memory, which has to stay there while it is read
+    bool Open(const void* data, size_t size)
+    {
+        data_ = (const unsigned char*)data;
+        size_ = size;
+        if (size < 12)
+            return false;
+        unsigned int magic;
+        memcpy(&magic, data_, 4);
+        ng_ = magic == 0x0A0D0D0A;                                          // The same in both byte orders
+        if (!ng_)
+        {
+            if (size < 24)
+                return false;
+            if (magic == 0xA1B2C3D4 || magic == 0xA1B23C4D)
+                swap_ = false;
+            else if (magic == 0xD4C3B2A1 || magic == 0x4D3CB2A1)
+                swap_ = true;
+            else
+                return false;
+            Interface classic;
+            classic.linkType       = Get32(data_ + 20) & 0xFFFF;            // The upper bits may carry the FCS length
+            classic.unitsPerSecond = Get32(data_) == 0xA1B23C4D ? 1000000000ULL : 1000000ULL;
+            interfaces_.assign(1, classic);
+            start_ = 24;
+        }
+        else
+            start_ = 0;
+        Rewind();
+        return true;
+    }
+
+    // Back to the first packet
+    void Rewind()
+    {
+        offset_ = start_;
+        records_ = skipped_ = 0;
+        damaged_ = false;
+        if (ng_)
+            interfaces_.clear();
+    }
+
+    // The next IPv4 packet; false at the end of the capture (or at a damaged record, see Damaged())
+    bool Next(PcapPacket* packet)
+    {
+        while (offset_ < size_)
+        {
+            const unsigned char* p = data_ + offset_;
+            size_t left = size_ - offset_;
+            const unsigned char* frame;
+            unsigned int captured, wire;
+            unsigned long long stamp;
+            const Interface* link;
+            if (!ng_)
+            {
+                if (left < 16 || Get32(p + 8) > left - 16)
+                    return Damage();
+                captured = Get32(p + 8);
+                wire     = Get32(p + 12);
+                stamp    = (unsigned long long)Get32(p) * interfaces_[0].unitsPerSecond + Get32(p + 4);
+                frame    = p + 16;
+                link     = &interfaces_[0];
+                offset_ += 16 + captured;
+            }
+            else
+            {
+                if (left < 12)
+                    return Damage();
+                unsigned int type;
+                memcpy(&type, p, 4);
+                if (type == 0x0A0D0D0A)                                     // Section header: byte order and interfaces start over
+                {
+                    unsigned int order;
+                    if (left < 28)
+                        return Damage();
+                    memcpy(&order, p + 8, 4);
+                    if (order != 0x1A2B3C4D && order != 0x4D3C2B1A)
+                        return Damage();
+                    swap_ = order == 0x4D3C2B1A;
+                    interfaces_.clear();
+                }
+                type = Get32(p);
+                unsigned int length = Get32(p + 4);
+                if (length < 12 || length % 4 != 0 || length > left)
+                    return Damage();
+                offset_ += length;
+                if (type == 1 && length >= 20)
+                {
+                    interfaces_.push_back(ReadInterface(p, length));
+                    continue;
+                }
+                if (type == 6 && length >= 32 && Get32(p + 8) < interfaces_.size())
+                {
+                    captured = Get32(p + 20);
+                    if (captured > length - 32)
+                        return Damage();
+                    wire   = Get32(p + 24);
+                    stamp  = ((unsigned long long)Get32(p + 12) << 32) | Get32(p + 16);
+                    frame  = p + 28;
+                    link   = &interfaces_[Get32(p + 8)];
+                }
+                else if (type == 3 && length >= 16 && !interfaces_.empty())  // Simple packet block: interface 0, no stamp
+                {
+                    wire     = Get32(p + 8);
+                    captured = wire < length - 16 ? wire : length - 16;
+                    stamp    = 0;
+                    frame    = p + 12;
+                    link     = &interfaces_[0];
+                }
+                else
+                    continue;
+            }
+            ++records_;
+            if (!LinkToIp(link->linkType, frame, (int)captured, (int)wire, packet))
+            {
+                ++skipped_;
+                continue;
+            }
+            packet->timeNs = stamp / link->unitsPerSecond * 1000000000ULL + stamp % link->unitsPerSecond * 1000000000ULL / link->unitsPerSecond;
+            return true;
+        }
+        return false;
+    }
+
+    PcapFormat         Format() const  { return ng_ ? PCAP_FORMAT_PCAPNG : PCAP_FORMAT_PCAP; }
+    size_t             Bytes() const   { return size_; }
+    unsigned long long Records() const { return records_; }                 // Packets read so far
+    unsigned long long Skipped() const { return skipped_; }                 // Of those, not IPv4 or of an unknown link type
+    bool               Damaged() const { return damaged_; }                 // The last record ran past the end of the file
+
+private:
+    struct Interface
+    {
+        unsigned int       linkType;
+        unsigned long long unitsPerSecond;                                  // Of the stamps
+    };
+
+    unsigned int Get16(const unsigned char* p) const
+    {
+        unsigned short v;
+        memcpy(&v, p, 2);
+        return swap_ ? (unsigned short)((v >> 8) | (v << 8)) : v;
+    }
+
+    unsigned int Get32(const unsigned char* p) const
+    {
+        unsigned int v;
+        memcpy(&v, p, 4);
+        return swap_ ? (v >> 24) | ((v >> 8) & 0xFF00) | ((v << 8) & 0xFF0000) | (v << 24) : v;
+    }
+
+    bool Damage()
+    {
+        damaged_ = true;
+        offset_ = size_;
+        return false;
+    }
+
+    // Interface description block: link type and if_tsresol (microseconds when it is not given)
+    Interface ReadInterface(const unsigned char* p, unsigned int length) const
+    {
+        Interface link;
+        link.linkType = Get16(p + 8);
+        link.unitsPerSecond = 1000000ULL;
+        for (unsigned int at = 16; at + 4 <= length - 4; )
+        {
+            unsigned int code = Get16(p + at), size = Get16(p + at + 2);
+            if (code == 0 || at + 4 + size > length - 4)
+                break;
+            if (code == 9 && size >= 1)
+            {
+                unsigned int exponent = p[at + 4] & 0x7F;
+                if ((p[at + 4] & 0x80) != 0 && exponent <= 40)
+                    link.unitsPerSecond = 1ULL << exponent;
+                else if ((p[at + 4] & 0x80) == 0 && exponent <= 12)
+                    for (link.unitsPerSecond = 1; exponent > 0; --exponent)
+                        link.unitsPerSecond *= 10;
+            }
+            at += 4 + ((size + 3) & ~3u);
+        }
+        return link;
+    }
+
+    // Skips the link layer header; false unless an IPv4 packet follows
+    static bool LinkToIp(unsigned int linkType, const unsigned char* frame, int captured, int wire, PcapPacket* packet)
+    {
+        int skip;
+        switch (linkType)
+        {
+        case 101:                                                           // Raw IP
+        case 228:                                                           // IPv4
+            skip = 0;
+            break;
+        case 1:                                                             // Ethernet, with any number of VLAN tags
+        {
+            if (captured < 14)
+                return false;
+            unsigned int type = (frame[12] << 8) | frame[13];
+            for (skip = 14; (type == 0x8100 || type == 0x88A8) && captured >= skip + 4; skip += 4)
+                type = (frame[skip + 2] << 8) | frame[skip + 3];
+            if (type != 0x0800)
+                return false;
+            break;
+        }
+        case 113:                                                           // Linux cooked capture
+            skip = 16;
+            if (captured < skip || ((frame[14] << 8) | frame[15]) != 0x0800)
+                return false;
+            break;
+        case 276:                                                           // Linux cooked capture v2
+            skip = 20;
+            if (captured < skip || ((frame[0] << 8) | frame[1]) != 0x0800)
+                return false;
+            break;
+        case 0:                                                             // BSD loopback: AF_INET in host order
+        case 108:                                                           // OpenBSD loopback: in network order
+            skip = 4;
+            if (captured < skip || !((frame[0] == 2 && frame[3] == 0) || (frame[0] == 0 && frame[3] == 2)) || frame[1] != 0 || frame[2] != 0)
+                return false;
+            break;
+        default:
+            return false;
+        }
+        if (captured <= skip || (frame[skip] >> 4) != 4)
+            return false;
+        packet->ip         = frame + skip;
+        packet->length     = captured - skip;
+        packet->wireLength = wire > skip ? wire - skip : captured - skip;
+        return true;
+    }
+
+    TransportMappedFile    file_;
+    const unsigned char*   data_;
+    size_t                 size_;
+    size_t                 start_;                                          // The first record
+    size_t                 offset_;                                         // The next record
+    bool                   ng_;
+    bool                   swap_;                                           // The capture was written in the other byte order
+    std::vector<Interface> interfaces_;                                     // One for pcap, those of the current section for pcapng
+    unsigned long long     records_;
+    unsigned long long     skipped_;
+    bool                   damaged_;
+};
+
+#endif // ICMP_PCAP_H
@@ -0,0 +1,482 @@
+/* ICMP Packet Watcher - Embeddable pinger: the probe engine as a library with callbacks and C++20 coroutines */
+
+/* Pinger runs the prober's engine inside another program. It sends one-shot pings and periodic streams to any
+   number of targets, without a process to spawn or text output to parse. Everything shares one socket and one event
+   loop: the requests go out in batches (SendBatch), timed by the deadline scheduler (ProbeScheduler) and its optional
+   rate limit. Replies and ICMP errors come in per recvmmsg (RecvBatch) and are matched through the (destination,
+   sequence) in-flight table (InFlightTable), as in the sweep mode. Timeouts expire from the same table.
+
+     PingerConfig   socket kind, event loop, batch size, timeout, payload size, rate limit, requests in flight
+     Ping(destination, callback)                            one probe; callback(const PingResult&) gets its result
+     Subscribe(destination, intervalNs, count, callback)    a stream: count probes (-1: no end) every intervalNs,
+                                                            each result to the callback; returns the subscription id
+     Unsubscribe(id)                                        ends a stream; its outstanding probes report nothing
+     co_await pinger.Async(destination)                     C++20: suspends the coroutine until the PingResult is in
+
+   The pinger does nothing on its own thread. Poll(timeoutMs) sends what is due, waits for replies (at most
+   timeoutMs, -1 for as long as nothing is due), and calls the callbacks; Run() polls until Stop(). A program with an
+   event loop of its own adds Socket() to it, calls Process() when the socket is readable and waits at most WaitMs()
+   between calls. With -u/io_uring, sends are only submitted to the kernel by Poll(). All of this happens on one
+   thread, and callbacks run on it too. A callback may call Ping, Subscribe, Unsubscribe and Stop, and resume
+   coroutines, but not Poll or Process. Close() ends every subscription without a result and sets the counters back
+   to zero, so the pinger can be opened again for a fresh run.
+
+   Destinations are IPv4 addresses in network byte order (inet_addr). Every probe gets a sequence number of its
+   own, so two streams to the same destination do not mix up their replies. A result carries the sequence number
+   and the subscription. With a raw socket the pinger needs root or CAP_NET_RAW (administrator on Windows). A ping
+   socket (ICMP_SOCKET_DGRAM, Linux) needs neither but does not see ICMP errors, so errors arrive as timeouts there.
+
+   In the CMake build, a program links the icmp_pinger interface library and includes "icmp_Pinger.h". Coroutines
+   need a C++20 compiler; the rest builds as C++17. */
+
+#ifndef ICMP_PINGER_H
+#define ICMP_PINGER_H
+
+#include <string.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "icmp_Transport.h"
+#include "icmp_Batch.h"
+#include "icmp_Checksum.h"
+#include "icmp_Echo.h"
+#include "icmp_InFlightTable.h"
+#include "icmp_Metrics.h"
+#include "icmp_Scheduler.h"
+#include "icmp_Types.h"
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#include <exception>
+#define ICMP_PINGER_COROUTINES 1
+#endif
+#endif
+
+#define PingerNoSubscription 0xFFFFFFFFu
+
+struct PingerConfig
+{
+    IcmpSocketKind kind           = ICMP_SOCKET_RAW;                        // ICMP_SOCKET_DGRAM: unprivileged ping socket (Linux)
+    bool           preferUring    = false;                                  // io_uring event loop (built with ICMP_WITH_IO_URING)
+    int            batch          = 32;                                     // Requests per sendmmsg, replies per recvmmsg
+    unsigned int   timeoutMs      = 1000;                                   // A probe without an answer by then is a timeout
+    int            payloadBytes   = 32;                                     // Data after the ICMP header, 8 to 65507 - 12
+    unsigned int   maxInFlight    = 65536;                                  // Probes outstanding at most, the rest wait
+    double         rate           = 0;                                      // Requests per second over all targets, 0 for no limit
+    double         burst          = 32;                                     // Requests that may go out back to back under the rate limit
+    bool           spread         = true;                                   // A stream starts at a random offset within its interval
+};
+
+enum PingStatus
+{
+    PING_REPLY,                                                             // Echo reply, rttNs is the round trip
+    PING_ERROR,                                                             // ICMP error quoting the probe (unreachable, time exceeded, ...)
+    PING_TIMEOUT                                                            // No answer within timeoutMs
+};
+
+struct PingResult
+{
+    PingStatus         status;
+    unsigned int       subscription;                                        // Id from Subscribe (a Ping has one too)
+    unsigned long      destination;                                         // Network byte order
+    unsigned long      from;                                                // Who answered: the target or the router of an error, 0 on timeout
+    unsigned short     seq;
+    unsigned char      type, code;                                          // Of an ICMP error
+    unsigned long long rttNs;                                               // Reply or error RTT (0 if the error did not quote the send stamp)
+    unsigned long long stampNs;                                             // Receive or expiry time, TransportMonotonicNs() clock
+};
+
+typedef std::function<void(const PingResult&)> PingCallback;
+
+#ifdef ICMP_PINGER_COROUTINES
+class PingAwaitable;
+#endif
+
+class Pinger
+{
+public:
+    explicit Pinger(const PingerConfig& config = PingerConfig())
+        : config_(config), open_(false), windowFull_(false), stop_(false), schedule_(64), inFlight_(config.maxInFlight == 0 ? 1 : config.maxInFlight),
+          nextSeq_(1), dispatching_(PingerNoSubscription), live_(0), delivered_(0), sent_(0), replies_(0), errors_(0),
+          timeouts_(0), ignored_(0)
+    {
+        if (config_.payloadBytes < (int)sizeof(unsigned long long))
+            config_.payloadBytes = (int)sizeof(unsigned long long);
+        if (config_.payloadBytes > 65507 - (int)sizeof(ICMP_Header))
+            config_.payloadBytes = 65507 - (int)sizeof(ICMP_Header);
+        if (config_.timeoutMs == 0)
+            config_.timeoutMs = 1;
+    }
+
+    ~Pinger() { Close(); }
+
+    // Opens the socket and the event loop. False on failure, TransportLastError() tells why.
+    bool Open()
+    {
+        if (open_)
+            return true;
+        if (!TransportOpen(config_.kind, &socket_))
+            return false;
+        loop_.reset(new TransportLoop());
+        if (!TransportSetNonBlocking(socket_) || !loop_->Init(config_.preferUring) || !loop_->Add(socket_, this))
+        {
+            TransportClose(socket_);
+            loop_.reset();
+            return false;
+        }
+        TransportFilterId(socket_);                                         // Other sockets' replies are dropped in the kernel
+        TransportEnableTimestamps(socket_, false);
+
+        int length = (int)sizeof(ICMP_Header) + config_.payloadBytes;
+        std::vector<char> request(length, 'Y');
+        ICMP_Header* pIcmp = (ICMP_Header*)&request[0];
+        pIcmp->icmp_type      = 8;
+        pIcmp->icmp_code      = 0;
+        pIcmp->icmp_checksum  = 0;
+        pIcmp->icmp_id        = socket_.id;
+        pIcmp->icmp_sequence  = 0;
+        pIcmp->icmp_timestamp = 0;
+        pIcmp->icmp_checksum  = checksum((const unsigned short*)&request[0], length);
+        sendBatch_.reset(new SendBatch(&request[0], length, config_.batch));
+        recvBatch_.reset(new RecvBatch(config_.batch, length + 128 > 2048 ? length + 128 : 2048));   // Room for IP options and an error's quote
+
+        schedule_.SetRate(config_.rate, config_.burst);
+        schedule_.Start(TransportMonotonicNs());
+        open_ = true;
+        return true;
+    }
+
+    // Closes the socket. Subscriptions and probes in flight end without a result, the counters start from zero again.
+    void Close()
+    {
+        if (open_)
+            TransportClose(socket_);
+        open_ = false;
+        loop_.reset();
+        sendBatch_.reset();
+        recvBatch_.reset();
+        streams_.clear();
+        free_.clear();
+        schedule_ = ProbeScheduler(64);
+        inFlight_ = InFlightTable(config_.maxInFlight == 0 ? 1 : config_.maxInFlight);
+        windowFull_ = false;
+        nextSeq_    = 1;
+        live_       = 0;
+        delivered_  = 0;
+        sent_ = replies_ = errors_ = timeouts_ = ignored_ = 0;
+    }
+
+    // One probe to destination. Returns its subscription id, PingerNoSubscription if the pinger is not open.
+    unsigned int Ping(unsigned long destination, PingCallback callback)
+    {
+        return Subscribe(destination, 0, 1, callback);
+    }
+
+    /* count probes (-1 for no end) to destination, one every intervalNs (0: as fast as the rate limit and the in-flight
+       limit allow). Each result goes to callback. The subscription ends after its last result or on Unsubscribe. */
+    unsigned int Subscribe(unsigned long destination, unsigned long long intervalNs, long long count, PingCallback callback)
+    {
+        if (!open_ || count == 0)
+            return PingerNoSubscription;
+        unsigned int id;
+        if (!free_.empty())
+        {
+            id = free_.back();
+            free_.pop_back();
+        }
+        else
+        {
+            id = (unsigned int)streams_.size();
+            streams_.push_back(PingStream());                              // A deque: callbacks running on other streams stay in place
+            schedule_.Grow((unsigned int)streams_.size());
+        }
+        PingStream& stream = streams_[id];
+        stream.destination = destination;
+        stream.callback    = callback;
+        stream.used        = true;
+        stream.active      = true;
+        stream.outstanding = 0;
+        ++live_;
+        schedule_.Add(id, intervalNs, count, config_.spread && intervalNs > 0, TransportMonotonicNs());
+        return id;
+    }
+
+    // Ends a subscription. Its probes still in flight are matched and then dropped without a callback.
+    void Unsubscribe(unsigned int id)
+    {
+        if (id >= streams_.size() || !streams_[id].active)
+            return;
+        streams_[id].active = false;
+        schedule_.Remove(id);
+        if (id != dispatching_)
+            Retire(id);
+    }
+
+#ifdef ICMP_PINGER_COROUTINES
+    PingAwaitable Async(unsigned long destination);
+#endif
+
+    /* One round without waiting: sends the probes that are due, takes every reply and error the socket holds and
+       expires the probes that timed out. Returns the number of results delivered. */
+    int Process()
+    {
+        delivered_ = 0;
+        if (!open_)
+            return 0;
+        sendBatch_->CountLoopErrors(*loop_);                                 // io_uring sends that failed after Poll submitted them
+        SendDue();
+        Receive();
+        inFlight_.Expire((unsigned int)TransportTickMs(), config_.timeoutMs, [this](const InFlightEntry& entry) {
+            PingResult result = PingResult();
+            result.status  = PING_TIMEOUT;
+            result.seq     = (unsigned short)(entry.key & 0xFFFF);
+            result.stampNs = TransportMonotonicNs();
+            ++timeouts_;
+            MetricsLocal().Count(METRIC_TIMEOUTS);
+            Deliver(entry.target, result);
+        });
+        SendDue();                                                          // Probes the callbacks asked for leave now
+        return delivered_;
+    }
+
+    // Milliseconds until Process() has work without a packet arriving: 0 if it has now, -1 if nothing is pending
+    long WaitMs()
+    {
+        if (!open_)
+            return -1;
+        if (sendBatch_->Count() > 0)
+            return 1;                                                       // The socket buffer was full, try again shortly
+        long untilSend = windowFull_ ? -1 : schedule_.WaitMs(TransportMonotonicNs());   // A full window waits for replies or expiries
+        long untilExpiry = inFlight_.MillisUntilNextExpiry((unsigned int)TransportTickMs(), config_.timeoutMs);
+        if (untilSend < 0)
+            return untilExpiry;
+        return untilExpiry < 0 || untilSend < untilExpiry ? untilSend : untilExpiry;
+    }
+
+    // Process(), then waits up to timeoutMs (-1: until something is due) for replies, then Process() again
+    int Poll(long timeoutMs)
+    {
+        if (!open_)
+            return 0;
+        int delivered = Process();
+        long waitMs = WaitMs();
+        if (waitMs < 0 || (timeoutMs >= 0 && timeoutMs < waitMs))
+            waitMs = timeoutMs;
+        if (delivered > 0)
+            waitMs = 0;
+        void* ready[1];
+        loop_->Wait(ready, 1, waitMs);                                      // Even without waiting: it submits io_uring's queued sends
+        return delivered + Process();
+    }
+
+    // Polls until Stop() is called (from a callback or another thread)
+    void Run()
+    {
+        stop_.store(false);
+        while (!stop_.load())
+            Poll(100);
+    }
+
+    void Stop() { stop_.store(true); }
+
+    bool          Idle() const   { return live_ == 0; }                     // No subscription left, nothing in flight
+    IcmpSocket&   Socket()       { return socket_; }
+    const char*   LoopName() const { return loop_ ? loop_->Name() : ""; }
+
+    unsigned long long Sent() const       { return sent_; }
+    unsigned long long Replies() const    { return replies_; }
+    unsigned long long Errors() const     { return errors_; }
+    unsigned long long Timeouts() const   { return timeouts_; }
+    unsigned long long Ignored() const    { return ignored_; }                // Duplicates, late replies, foreign packets
+    unsigned long long SendErrors() const { return sendBatch_ ? sendBatch_->Errors() : 0; }   // Refused or failed, they time out
+
+private:
+    struct PingStream
+    {
+        unsigned long destination;
+        PingCallback  callback;
+        bool          used;                                                 // Taken by a subscription, not on the free list
+        bool          active;                                               // Not unsubscribed
+        unsigned int  outstanding;                                          // Probes of the stream in the in-flight table
+    };
+
+    void SendDue()
+    {
+        unsigned int tick = (unsigned int)TransportTickMs();
+        windowFull_ = false;
+        int queued;
+        do
+        {
+            queued = schedule_.Run(TransportMonotonicNs(), sendBatch_->Capacity() - sendBatch_->Count(), [&](unsigned int id, unsigned long long) {
+                PingStream& stream = streams_[id];
+                unsigned short seq = nextSeq_++;
+                if (inFlight_.Full() || !inFlight_.Insert(InFlightTable::MakeKey(stream.destination, seq), id, tick))
+                {
+                    windowFull_ = true;                                     // Or a probe with this sequence number is still out there
+                    return false;
+                }
+                PatchEchoRequest((ICMP_Header*)sendBatch_->Queue(stream.destination), seq, TransportMonotonicNs());
+                ++stream.outstanding;
+                ++sent_;
+                return true;
+            });
+            if (sendBatch_->Count() > 0)
+                sendBatch_->Flush(*loop_, socket_);                         // A refused request is counted in SendErrors()
+        }
+        while (queued > 0 && sendBatch_->Count() == 0);
+    }
+
+    void Receive()
+    {
+        int received;
+        while ((received = recvBatch_->Receive(socket_)) > 0)
+        {
+            for (int r = 0; r < received; ++r)
+            {
+                char* data = recvBatch_->Data(r);
+                int length = recvBatch_->Length(r);
+                PingResult result = PingResult();
+                result.from    = recvBatch_->Source(r);
+                result.stampNs = recvBatch_->Stamp(r);
+                InFlightEntry entry;
+                IcmpErrorInfo error;
+                ICMP_Header* pReply = ParseEchoReply(data, length, socket_);
+                if (pReply != NULL)
+                {
+                    if (!inFlight_.Remove(InFlightTable::MakeKey(result.from, pReply->icmp_sequence), &entry))
+                    {
+                        ++ignored_;                                         // Duplicate, or the probe already timed out
+                        continue;
+                    }
+                    result.status = PING_REPLY;
+                    result.seq    = pReply->icmp_sequence;
+                    result.rttNs  = EchoRttNs(pReply, 0, result.stampNs);
+                    ++replies_;
+                }
+                else if (ParseProbeError(data, length, socket_, &error))
+                {
+                    if (!IcmpErrorEndsProbe((IcmpErrorClass)error.errorClass) ||
+                        !inFlight_.Remove(InFlightTable::MakeKey(error.destination, error.seq), &entry))
+                    {
+                        ++ignored_;
+                        continue;
+                    }
+                    result.status = PING_ERROR;
+                    result.seq    = error.seq;
+                    result.type   = error.type;
+                    result.code   = error.code;
+                    result.rttNs  = ErrorRttNs(error, 0, result.stampNs);
+                    ++errors_;
+                }
+                else
+                {
+                    ++ignored_;
+                    MetricsLocal().Count(METRIC_FOREIGN_PACKETS);
+                    continue;
+                }
+                Deliver(entry.target, result);
+            }
+        }
+    }
+
+    void Deliver(unsigned int id, PingResult& result)
+    {
+        PingStream& stream = streams_[id];
+        --stream.outstanding;
+        result.subscription = id;
+        result.destination  = stream.destination;
+        if (stream.active && stream.callback)
+        {
+            ++delivered_;
+            dispatching_ = id;
+            stream.callback(result);
+            dispatching_ = PingerNoSubscription;
+        }
+        Retire(id);
+    }
+
+    // Frees a subscription whose last result is in: unsubscribed, or its schedule has ended
+    void Retire(unsigned int id)
+    {
+        PingStream& stream = streams_[id];
+        if (!stream.used || stream.outstanding > 0 || (stream.active && schedule_.Remaining(id) != 0))
+            return;
+        stream.used     = false;
+        stream.active   = false;
+        stream.callback = nullptr;
+        free_.push_back(id);
+        --live_;
+    }
+
+    PingerConfig                    config_;
+    bool                            open_;
+    bool                            windowFull_;                            // Due probes wait for maxInFlight to drop
+    std::atomic<bool>               stop_;
+    IcmpSocket                      socket_;
+    std::unique_ptr<TransportLoop>  loop_;                                  // Built by Open(), a closed pinger has none
+    ProbeScheduler                  schedule_;
+    InFlightTable                   inFlight_;
+    std::unique_ptr<SendBatch>      sendBatch_;                             // Built by Open(), they need the socket's icmp_id
+    std::unique_ptr<RecvBatch>      recvBatch_;
+    std::deque<PingStream>          streams_;
+    std::vector<unsigned int>       free_;
+    unsigned short                  nextSeq_;
+    unsigned int                    dispatching_;                           // Subscription whose callback is running
+    unsigned int                    live_;
+    int                             delivered_;
+    unsigned long long              sent_, replies_, errors_, timeouts_, ignored_;
+};
+
+#ifdef ICMP_PINGER_COROUTINES
+// co_await pinger.Async(destination) yields the PingResult; the coroutine resumes inside Poll/Process
+class PingAwaitable
+{
+public:
+    PingAwaitable(Pinger& pinger, unsigned long destination) : pinger_(pinger), destination_(destination), result_() {}
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        unsigned int id = pinger_.Ping(destination_, [this, handle](const PingResult& result) {
+            result_ = result;
+            handle.resume();
+        });
+        if (id != PingerNoSubscription)
+            return true;
+        result_.status = PING_TIMEOUT;                                      // Not open: resume at once with a timeout
+        result_.destination = destination_;
+        return false;
+    }
+
+    PingResult await_resume() const noexcept { return result_; }
+
+private:
+    Pinger&       pinger_;
+    unsigned long destination_;
+    PingResult    result_;
+};
+
+inline PingAwaitable Pinger::Async(unsigned long destination)
+{
+    return PingAwaitable(*this, destination);
+}
+
+// Return type for a fire-and-forget coroutine that awaits pings: it starts at once and frees itself at the end
+struct PingerTask
+{
+    struct promise_type
+    {
+        PingerTask          get_return_object() noexcept { return PingerTask(); }
+        std::suspend_never  initial_suspend() noexcept   { return std::suspend_never(); }
+        std::suspend_never  final_suspend() noexcept     { return std::suspend_never(); }
+        void                return_void() noexcept       {}
+        void                unhandled_exception()        { std::terminate(); }
+    };
+};
+#endif
+
+#endif // ICMP_PINGER_H
@@ -0,0 +1,191 @@
+/* ICMP Packet Watcher - In-flight window for the pipelined echo engine */
+
+/* In lockstep mode every echo request waits for its reply (or its timeout, icmp_Rto.h) before the
+   next one is sent. The pipelined engine keeps up to "window" requests outstanding at the same time and
+   matches replies back to their request by icmp_id/icmp_sequence. This file holds the bookkeeping for the
+   outstanding requests, the socket calls stay in icmp_RawSocket.cpp. */
+
+#ifndef ICMP_PIPELINE_H
+#define ICMP_PIPELINE_H
+
+#include <vector>
+#include "icmp_Scheduler.h"
+
+// One outstanding echo request
+struct InFlightSlot
+{
+    bool           inUse;                                                   // Slot holds a request that is still waiting for its reply
+    unsigned long  sentTick;                                                // Tick count (ms) at the moment the request was sent
+    unsigned long long txStampNs;                                           // Kernel send timestamp, 0 until it arrives
+};
+
+/* There is a slot for every sequence number, so a lookup is a single array access and a request keeps its slot until
+   its reply, its error or its timeout, however many requests are sent after it. The window only limits how many
+   are outstanding: a lost reply takes up one place in it until its timeout, it never holds up the sequence numbers
+   after it. A slot is wanted again only when the 16-bit sequence numbers wrap around while its request is still
+   out (65536 requests within one timeout); Retire() gives that request up first, as its reply could no longer be
+   told from the new one's.
+
+   With one timeout the requests expire in sequence order (Expire). With the adaptive timeout of icmp_Rto.h every
+   request has a deadline of its own (UseDeadlines): the slots are then also timers on a TimingWheel, so a request
+   is given up within a tick of its deadline even when one sent earlier was given a longer timeout. */
+class InFlightWindow
+{
+public:
+    static const unsigned int Slots = 65536;                                // One per sequence number
+
+    explicit InFlightWindow(int window)
+        : slots_(Slots), wheel_(0), window_(window < 1 ? 1 : (window > 65535 ? 65535 : window)), outstanding_(0), oldestSeq_(0), newestSeq_(0)
+    {
+        for (unsigned int i = 0; i < Slots; ++i)
+            slots_[i].inUse = false;
+    }
+
+    int Window() const      { return window_; }
+    int Outstanding() const { return outstanding_; }
+
+    // Another request may be sent while fewer than "window" are outstanding
+    bool CanSend() const
+    {
+        return outstanding_ < window_;
+    }
+
+    /* Frees the slot of seq for a new request if the one sent with it 65536 sequence numbers ago is still outstanding:
+       it is handed to onExpired(seq, sentTick) as if it had timed out. Call before Insert(); returns 1 if a request
+       was given up, else 0. */
+    template <typename Callback>
+    int Retire(unsigned short seq, Callback onExpired)
+    {
+        InFlightSlot& slot = slots_[seq];
+        if (!slot.inUse)
+            return 0;
+        slot.inUse = false;
+        --outstanding_;
+        if (wheel_.Size() > 0)
+            wheel_.Cancel(seq);
+        if (seq == oldestSeq_)
+            ++oldestSeq_;                                                   // Expire() walks on from the next one
+        onExpired(seq, slot.sentTick);
+        return 1;
+    }
+
+    void Insert(unsigned short seq, unsigned long sentTick)
+    {
+        InFlightSlot& slot = slots_[seq];
+        slot.inUse    = true;
+        slot.sentTick = sentTick;
+        slot.txStampNs = 0;
+        if (outstanding_++ == 0)
+            oldestSeq_ = seq;
+        newestSeq_ = seq;
+    }
+
+    /* Switches to deadlines of their own per request: Insert() with a deadline, ExpireDue() and NsUntilNextExpiry()
+       take the place of Insert(), Expire() and MillisUntilNextExpiry(). Call before the first Insert(). */
+    void UseDeadlines(unsigned long long startNs, unsigned long long tickNs = 1000000)
+    {
+        wheel_ = TimingWheel(Slots, tickNs);
+        wheel_.Start(startNs);
+    }
+
+    // Deadline mode: the request expires once deadlineNs (TransportMonotonicNs clock) has passed
+    void Insert(unsigned short seq, unsigned long sentTick, unsigned long long deadlineNs)
+    {
+        Insert(seq, sentTick);
+        wheel_.Schedule(seq, deadlineNs);                                   // The slot is the timer
+    }
+
+    // Attaches the kernel send timestamp to an outstanding request
+    void SetTxStamp(unsigned short seq, unsigned long long stampNs)
+    {
+        InFlightSlot& slot = slots_[seq];
+        if (slot.inUse)
+            slot.txStampNs = stampNs;
+    }
+
+    // Returns false if the sequence number is not outstanding (duplicate, late reply after expiry, or foreign packet)
+    bool Complete(unsigned short seq, unsigned long* sentTick, unsigned long long* txStampNs = NULL)
+    {
+        InFlightSlot& slot = slots_[seq];
+        if (!slot.inUse)
+            return false;
+
+        *sentTick   = slot.sentTick;
+        if (txStampNs != NULL)
+            *txStampNs = slot.txStampNs;
+        slot.inUse  = false;
+        --outstanding_;
+        if (wheel_.Size() > 0)
+            wheel_.Cancel(seq);
+        return true;
+    }
+
+    /* Requests are sent in sequence order with the same timeout, so they also expire in sequence order.
+       Walking from the oldest outstanding sequence number makes this amortized O(1) per request.
+       Every expired sequence number is handed to onExpired(seq, sentTick). */
+    template <typename Callback>
+    int Expire(unsigned long now, unsigned long timeout, Callback onExpired)
+    {
+        int expired = 0;
+        while (outstanding_ > 0)
+        {
+            InFlightSlot& slot = slots_[oldestSeq_];
+            if (slot.inUse)
+            {
+                if (now - slot.sentTick < timeout)
+                    break;                                                  // The oldest request is still within its timeout
+                slot.inUse = false;
+                --outstanding_;
+                ++expired;
+                onExpired(oldestSeq_, slot.sentTick);
+            }
+            if (oldestSeq_ == newestSeq_)
+                break;
+            ++oldestSeq_;
+        }
+        return expired;
+    }
+
+    // Deadline mode: hands every request whose deadline has passed to onExpired(seq, sentTick)
+    template <typename Callback>
+    int ExpireDue(unsigned long long nowNs, Callback onExpired)
+    {
+        int expired = 0;
+        wheel_.Advance(nowNs, [&](unsigned int index, unsigned long long) {
+            InFlightSlot& slot = slots_[index];
+            slot.inUse = false;
+            --outstanding_;
+            ++expired;
+            onExpired((unsigned short)index, slot.sentTick);
+        });
+        return expired;
+    }
+
+    // Deadline mode: nanoseconds until the next deadline (0 if one has passed, -1 if nothing is outstanding)
+    long long NsUntilNextExpiry(unsigned long long nowNs) const
+    {
+        return wheel_.NsUntilNext(nowNs);
+    }
+
+    // Milliseconds until the oldest outstanding request expires (0 if it already has, -1 if nothing is outstanding)
+    long MillisUntilNextExpiry(unsigned long now, unsigned long timeout) const
+    {
+        if (outstanding_ == 0)
+            return -1;
+        unsigned short seq = oldestSeq_;
+        while (!slots_[seq].inUse && seq != newestSeq_)
+            ++seq;
+        unsigned long age = now - slots_[seq].sentTick;
+        return age >= timeout ? 0 : (long)(timeout - age);
+    }
+
+private:
+    std::vector<InFlightSlot> slots_;                                       // Indexed by sequence number
+    TimingWheel    wheel_;                                                  // Deadline mode: slot index by deadline
+    int            window_;
+    int            outstanding_;
+    unsigned short oldestSeq_;                                              // Oldest sequence number that may still be outstanding
+    unsigned short newestSeq_;                                              // Most recently sent sequence number
+};
+
+#endif // ICMP_PIPELINE_H
@@ -1,292 +1,1614 @@
-/* Prepared by Yekta Parlak - August 2022 */
-
-/* Steps:
-1- Define the ICMP header structure
-2- Checksum calculation of ICMP packet
-3- Create an original socket with a protocol type of IPPROTO_ICMP, set the properties of the socket.
-4- Create and initialize ICMP packets.
-5- Call the sendto function to send an ICMP request to the remote host.
-6- Call the recvfrom function to receive the ICMP response.
-
-
-/* To compile: g++ *.cpp -o pingraw.exe -lws2_32 -fPIC -static -static-libgcc -static-libstdc++
-   To run: ./pingraw + IP adress  (for instance ./pingraw 1.1.1.1) */
-
-#define _CRT_SECURE_NO_WARNINGS
-#define _WINSOCK_DEPRECATED_NO_WARNINGS 
-
-#include <stdio.h>
-#include <Ws2tcpip.h>
-#include <Winsock2.h>
-#include <iostream>
-#pragma comment (lib, "ws2_32.lib") 										// For linking the dynamic library of WinSock2   
-
-using namespace std;  
-
-#define DataLength 32 																				
-
-typedef struct ICMP_Header  
-{ 
-    unsigned char   icmp_type;												// The message type, for example [0 - echo reply], [8 - echo request] ------------------------------->Type description occupies 8 bits
-    unsigned char   icmp_code;												// This is significant when sending an error message (unreach), and specifies the kind of error ----->Code description occupies 8 bits
-    unsigned short  icmp_checksum;											// The checksum for the icmp header + data. same as the IP checksum. -------------------------------->Checksum description occupies 16 bits
-    unsigned short  icmp_id;												// An identifier that uniquely identifies this request, usually set to the process ID
-    unsigned short  icmp_sequence;											// Identifies the sequence of echo messages, if more than one is sent. (as knwon as serial number)	
-	unsigned long   icmp_timestamp; 										// latency (Its data size counts inside the data buffer as well)
-} ICMP_Header; 
-
-
-// Checksum calculation.
-unsigned short checksum(unsigned short* buff, int size)
-{
-	unsigned long cksum = 0;							 					//initialize the internet checksum to 0 at the beginning
-	while(size>1)										 					//Sum all the words together, adding the final byte if size is odd
-	{					
-		cksum += *buff++;								 					//Add the data to be verified bit by bit every 16 bits and save it in cksum
-		size -= sizeof(unsigned short);					 					//After adding every 16 bits, subtract 16 from the amount of checksum data
-	}					
-
-	if(size)											 					//If the data to be checked is an odd number, after the loop, the content of the last byte needs to be added to the previous result
-
-	cksum += *(char*)buff;					
-
-    cksum = (cksum >> 16) + (cksum & 0xffff);    							//The previous result produced a carry, and the carry needs to be added to the final result.
-																			//Adds the left and right 16-bit words in the 32-bit integer. It basically splits the number in half and adds the two halves together. sum>>16 gives you the left half, and sum & 0xffff gives you the right half.
-
-
-	cksum += (cksum >> 16);							    					//Then when these 2 are added together, they could possible overflow.
-       																		//This line below, adds the overflow back into the original number.
-
-	return (unsigned short)(~cksum);				    					// Return the bitwise complement of the resulting mishmash
-}
-
-
-
-int main(int argc, char *argv[ ]) 
-{ 
-
-	/***** Start WinSock ****/				              		            // read it: https://docs.microsoft.com/en-us/windows/win32/winsock/initializing-winsock
-	WSADATA wsaData;                                  			            // The WSADATA structure contains information about the Windows Sockets implementation.
-	int ret;
-	ret = WSAStartup(MAKEWORD(2,2), &wsaData);					            // read it: https://docs.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-sendto?source=recommendations
-	
-	
-		if((ret=WSAStartup(MAKEWORD(1,0),&wsaData))!=0)
-		{
-			cout<<"Error to start WinSock 2.2";
-			exit(0);
-		}
-
-	char szDestIp[256] ={0}; 									            // Store the IP address or domain name to be pinged
-
-	    // If a user typed more than 1 argument, check it.
-		if (argc > 2)
-		{
-		 	cout<<"\nCheck your argument again!\n"<<endl;
-		 	return -1;
-		}
-
-	strcpy(szDestIp,argv[1]);
-		
-	unsigned long ulDestIP = inet_addr(szDestIp);   			            //Converts a dotted decimal IP address to a 32-bit binary representation of the IP address
-															                //In other words, inet_addr function converts the network host address (such as 192.168.1.10) to a network endian binary value
-
-
-      	// Check the written destination IP address whether in right format or not.			    
-		if(ulDestIP == INADDR_NONE)
-		{
-			cout<<"\nWrong IP address format. Host not found!\n"<<endl;
-			WSACleanup();
-			return -1;
-		}
-	
-
-    // Create a raw socket for sending and receiving ICMP packets 
-    SOCKET sRaw = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);    		        /*It is a standard command to create a datagram raw socket.
-                                                                            From the moment that it is created, you can send any ICMP packets over it, and
-                                                                            receive any ICMP packets that the host received after that socket was created. 
-                                                                            The protocol number for ICMP is 1. */
-															                // read it: http://www.cs.binghamton.edu/~steflik/cs455/rawip.txt
-
-																		  	// About IPPROTO_IP: It creates a socket that sends/receives raw data for IPv4-based protocols.
-
-
-	/*Set receive timeout*/
-	int Timeout=10000; 																			// Set the receiving timeout, skip receiving if it is not received within 10 seconds
-	ret = setsockopt(sRaw, SOL_SOCKET, SO_RCVTIMEO, (char*)&Timeout, sizeof(Timeout));        	
-																								 /* SO_RCVTIMEO is an option to set a timeout value for input operations.
-
-	/* The sockaddr_in structure specifies the address family.
-	The server, port and IP address of the server to be connected to. */                                                                                           
-	sockaddr_in RecvAddr;
-	RecvAddr.sin_family = AF_INET; 	  				                 // address family					                										
-	RecvAddr.sin_port = htons(0); 						             // port numebr										
-	RecvAddr.sin_addr.s_addr = inet_addr(szDestIp); 	             // destination IP adress	        /* Extra Note: */
-																						         		// SOCKET socket(
-																							     		// int af,		    -> Used to specify the address format used by the socket, only AF_INET is supported in WInsock
-																							     		// int type,	    -> Used to specify the type of socket
-																							     		// int protocol	-> Used with the type parameter to specify the protocol type used. Can be IPPROTO_ICMP
-																							     		// );
-
-	// ICMP packet creation
-	char buff[sizeof(ICMP_Header) + DataLength + 8];				// This buffer should also be large enough to also hold 8 more bytes of data (the size of an ICMP error message) (rfc792 says).
-	ICMP_Header* pIcmp = (ICMP_Header*)buff; 						/* Cast the binary data to our struct. Means, convert the array to the ICMP header type */
-
-
-	//Fill in the ICMP packet data                                  // read it: https://book.huihoo.com/iptables-tutorial/x1078.htm
-	pIcmp->icmp_type = 8;	                                        /* The type field contains the ICMP type of the packet. This is always different from ICMP type to type.
-																	For example ICMP Destination Unreachable packets will have a type 3 set to it. For a complete listing of
-																	the different ICMP types, see the ICMP types appendix. This field contains 8 bits total. */
-
-	pIcmp->icmp_code = 0;										    /* All ICMP types can contain different codes as well. Some types only have a single code, while others have
-																	several codes that they can use. For example, the ICMP Destination Unreachable (type 3) can have at least
-																	code 0, 1, 2, 3, 4 or 5 set. Each code has a different meaning. */
-
-	pIcmp->icmp_id = (USHORT)::GetCurrentProcessId(); 				/*Get process number as ID  uniquely. It can be adjustable specifically */
-
-	pIcmp->icmp_checksum = 0; 										/*The Checksum is a 16 bit field containing a one's complement of the ones complement of the headers starting with the ICMP type and down.
-																	While calculating the checksum, the checksum field should be set to zero */
-
-	pIcmp->icmp_sequence = 0; 										/* serial number */
-
-	pIcmp->icmp_timestamp = 0; 				
-
-
-	// Fill data part
-	memset(&buff[sizeof(ICMP_Header)], 'Y', DataLength);          // Embed inside the data part with a single letter multiple times
-		
-																										
-	// Start sending and receiving ICMP packets 
-	USHORT nSeq = 1;   			   								  //Sequence number of the sent ICMP packet
-	char recvBuf[1024] = { 0 };	   								  //Define the receive buffer. We need a pointer to the memory space where the binary data of the packet is stored
-	sockaddr_in from;   		   								  //Save the source address of the received data
-	int nLen = sizeof(from);       								  //address length
-	ICMP_Header* pRecvIcmp; 	   								  //pointer to the header of the ICMP message. It means, cast binary data to a data structure
-	static int Number = 0;				 
-	bool bTimeout = FALSE;
-		
-		int n;
-		cout<<"Enter time interval in milliseconds:"<<endl;
-		cin>>n;
-
-
-
-		long long int m;
-		cout<<"Enter ping count:"<<endl;
-		cin>>m;
-
-	for (long long int i = 0; i < m; ++i) 
- 	
-	{ 
-
-		int nRet; 
-
-		
-		pIcmp->icmp_checksum  = 0;
-		pIcmp->icmp_timestamp = GetTickCount();
-		pIcmp->icmp_sequence  = nSeq++; 
-		pIcmp->icmp_checksum  = checksum((unsigned short*)buff, sizeof(ICMP_Header) + DataLength); 
-
-
-
-		// The sendto function sends data to a specific destination.
-		/*  read it: https://docs.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-sendto?source=recommendations */
-		nRet = sendto(sRaw, buff, sizeof(ICMP_Header) + DataLength, 0, (SOCKADDR *)&RecvAddr, sizeof(RecvAddr)); 
-
-
-		// The recvfrom function receives a datagram, and stores the source address.
-		/* read it: https://docs.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-recvfrom?source=recommendations */
-		nRet = recvfrom(sRaw, recvBuf, 1024, 0, (sockaddr*)&from, &nLen); 
-
-
-
-			if(nRet == SOCKET_ERROR)
-			{
-				if(WSAGetLastError() == WSAETIMEDOUT)
-				{
-					cout<<" timed out!\n";
-					bTimeout=TRUE;   //receive time out
-					break;
-				}
-				cout<<"Receiving failed! Error code:"<<WSAGetLastError()<<endl;
-				return -1;
-
-			}
-		
-
-		// parsing(ayristirma) the received ICMP packet
-		int nTick = GetTickCount(); 
-
-
-		ICMP_Header* pRecvIcmp = (ICMP_Header*)(recvBuf + 20);  		   					    //The received data contains 20 bytes of IP header. If we type cast binary data to structs we have to add the length of the last header to the data pointer to get the beginning of the next header
-																	    						/*   next_header = (struct header*) (buffer + sizeof(struct header));   */
-
-			cout<<'\n';
-			cout<< DataLength <<" Bytes payload, sent to "<<inet_ntoa(from.sin_addr)<<'\n';     //  inet_ntoa() function converts the binary value transmitted by the network into a dot-decimal IP address (standard ASCII point-separated address,)
-			cout<<"Round Trip Time (RTT): "<<nTick -pRecvIcmp->icmp_timestamp<<" ms"<< '\n';
-			cout<<"Time Interval: "<< n<< " ms"<< '\n';
-			cout<<"Ping Count: "<<++Number<< '\n';
-					
-			if (SOCKET_ERROR == 0)
-            	{
-            	    cout << "FAILED!" << endl;
-				}
-            	else
-            	{
-            	    cout << "OK" << endl;
-            	}
-
-				int milli_seconds=n; 																								
-		Sleep(milli_seconds);    
-  } 
-	closesocket(sRaw);
-	WSACleanup();
- 	return 0;
-} 
-
-
-/* Data must include min. 8 bytes of data for ICMP error messages. The data portion is mandatory in reply packets, if there is a data portion in the
-/* request packet. The answering system must send a reply containing exactly the same data portion. The RFC792 does not specify if the data portion
-/* in the request packet is mandatory. The Data in this schema is not marked as (optional) as in many other RFCs. */
-																				
- /*  0                   1                   2                   3
-     0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
-     +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-
-     |     Type      |        Code   |          Checksum            |
-     +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-
-     |           Identifier          |        Sequence Number       |
-     +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-
-     |     Data ...														  // read it: https://superuser.com/questions/1086312/why-does-icmp-echo-request-and-echo-reply-packets-contain-a-data-portion 
-     +-+-+-+-+-                                                          */  
-																				
-																				
-/* However, sending a ping with zero bytes of data is entirely possible. On Windows try: ping <destination> -l 0
-																				
-To put in a nutshell, this proves that the Data-portion in an ICMP-Echo-Request is optional.  */
-
-
-/* To inject our own packets, all we need to know is the structures of the
-protocols that need to be included. Below you will find a short introduction to
-the ICMP header. */
-
-/* The data types/sizes we need to use are:
- unsigned char      --> 1 byte (8 bits),
- unsigned short int --> 2 bytes (16 bits)
- unsigned int       --> 4 bytes (32 bits) */
-// read it : http://www.cs.binghamton.edu/~steflik/cs455/rawip.txt
-
- /* IP itself has no mechanism for establishing and maintaining a connection, or
- even containing data as a direct payload. Internet Control Messaging Protocol
-is an addition to IP to carry error, routing and control messages and
- data, and is often considered as a protocol of the network layer. */	
-
-
-/* ============================================================================== */
-
-
-/* The usage of Timestamp:
-
-read it: https://www.rfc-editor.org/rfc/rfc1122 
-
-The use of the ICMP Timestamps is optional, and may, or may not, be implemented.
-You may find many hosts or network devices do not implement this option.  */
+/* Prepared by Yekta Parlak - August 2022 */
+
+/* Steps:
+1- Define the ICMP header structure
+2- Checksum calculation of ICMP packet
+3- Create an original socket with a protocol type of IPPROTO_ICMP, set the properties of the socket.
+4- Create and initialize ICMP packets.
+5- Call the sendto function to send an ICMP request to the remote host.
+6- Call the recvfrom function to receive the ICMP response.
+
+
+/* To compile: g++ *.cpp -o pingraw.exe -lws2_32 -fPIC -static -static-libgcc -static-libstdc++
+   To compile on Linux: g++ -O2 -pthread icmp_RawSocket.cpp -o pingraw  (add -DICMP_WITH_IO_URING for the io_uring event loop)
+   To run: ./pingraw + IP adress  (for instance ./pingraw 1.1.1.1)
+   Linux options: -d uses an unprivileged SOCK_DGRAM ping socket instead of a raw socket, -u the io_uring event loop
+   Batching: -b batch sets how many requests go out per sendmmsg and replies come in per recvmmsg (default 32)
+   Output: -o text|csv|json|binary selects the per-probe record format, -f file writes the records to a file instead of stdout
+   Store: -o tsdb -f file keeps the records in a compressed time-series file for long runs, read with icmp_TimeSeriesQuery (icmp_TimeSeries.h)
+   RTTs are measured in nanoseconds from the send stamp in the payload (or the kernel TX stamp) to the kernel RX stamp
+   Pipelined mode: ./pingraw + IP adress + -w window  (for instance ./pingraw 1.1.1.1 -w 256 keeps up to 256 requests in flight)
+   Sweep mode: ./pingraw -s targets [-r rate] [-B burst]  (for instance ./pingraw -s 10.0.0.0/16 -r 20000, targets may also be a target file)
+   Sharded sweep: -j shards runs the sweep on that many threads, each with its own socket (for instance ./pingraw -s 10.0.0.0/8 -r 1000000 -j 8)
+   Size sweep: ./pingraw + IP adress + -M sizes [-F]  (for instance ./pingraw 1.1.1.1 -M 56,1400-1500/4) latency and loss per payload size with DF set (-F allows fragmentation)
+   Traceroute mode: ./pingraw -T targets [-m hops] [-P flow]  (for instance ./pingraw -T 8.8.8.8 -r 5000) probes every hop of every target at once
+   Watcher mode: ./pingraw -W interface [-t seconds]  (for instance ./pingraw -W eth0) counts all ICMP traffic without sending
+   Without prompts: -i interval (milliseconds) and -c count answer the two questions from the command line (for instance ./pingraw 1.1.1.1 -i 100 -c 10)
+   Timeouts: -R min-max bounds the adaptive per-target timeout in milliseconds (default 10-10000), -R ms fixes it (icmp_Rto.h)
+   Metrics: -x port serves Prometheus metrics on http://127.0.0.1:port/metrics, -X name publishes them in a shared-memory block (icmp_Metrics.h)
+   Capture: -C file writes every packet sent and received to a pcap file (pcapng if the name ends in .pcapng), -K writes it through a memory mapping (icmp_Pcap.h)
+   Replay mode: ./pingraw -p file  (for instance ./pingraw -p probe.pcapng) feeds a capture through the reply matching and statistics without a network (icmp_Replay.h)
+   Probes go out at absolute deadlines, the interval may be fractional (0.25 ms) and a sweep target may have its own (10.0.0.1@100) */
+
+#define _CRT_SECURE_NO_WARNINGS
+#define _WINSOCK_DEPRECATED_NO_WARNINGS 
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include "icmp_Transport.h"
+#include "icmp_Batch.h"
+#include "icmp_Checksum.h"
+#include "icmp_Echo.h"
+#include "icmp_Pipeline.h"
+#include "icmp_Stats.h"
+#include "icmp_InFlightTable.h"
+#include "icmp_Metrics.h"
+#include "icmp_Output.h"
+#include "icmp_PacketPool.h"
+#include "icmp_Pcap.h"
+#include "icmp_Replay.h"
+#include "icmp_Rto.h"
+#include "icmp_Scheduler.h"
+#include "icmp_Shard.h"
+#include "icmp_TargetStore.h"
+#include "icmp_Targets.h"
+#include "icmp_TimeSeries.h"
+#include "icmp_Trace.h"
+#include "icmp_Types.h"
+#include "icmp_Watcher.h"
+
+using namespace std;  
+
+#define DataLength 32 																				
+
+// The ICMP header structure and the echo request helpers (send stamp, incremental patching, reply and error parsing)
+// live in icmp_Echo.h.
+
+// Nanoseconds as milliseconds for printing (cout prints 3 decimals, so microseconds are visible)
+double NsToMs(unsigned long long ns)
+{
+	return (double)ns / 1000000.0;
+}
+
+// Nanoseconds until a deadline as an event loop wait, rounded up to whole milliseconds (-1, no deadline, stays -1)
+long NsToWaitMs(long long ns)
+{
+	return ns < 0 ? -1 : (long)((ns + 999999) / 1000000);
+}
+
+
+// Pipelined echo engine. Sending and receiving are decoupled: up to nWindow requests are kept outstanding and
+// every reply is matched back to its request by icmp_id/icmp_sequence, so a lost reply no longer stalls the run.
+// Every request expires at its own deadline, the target's timeout (rto) at the time it was sent.
+int RunPipelined(IcmpSocket& sRaw, unsigned long ulDestIP, char* buff, unsigned long long nIntervalNs, long long int nCount, int nWindow, RtoTable& rto, bool bUring, int nBatch, OutputWriter& output, PcapWriter* pCapture)
+{
+	TransportSetNonBlocking(sRaw);											// sendto/recvfrom return at once instead of waiting for SO_RCVTIMEO
+	TransportLoop loop;
+	if (!loop.Init(bUring) || !loop.Add(sRaw, &sRaw))
+	{
+		cout<<"Unable to start the event loop! Error code:"<<TransportLastError()<<endl;
+		return -1;
+	}
+
+	InFlightWindow window(nWindow);
+	window.UseDeadlines(TransportMonotonicNs(), rto.Config().granularityNs);
+	SendBatch sendBatch(buff, sizeof(ICMP_Header) + DataLength, nBatch);		// Prebuilt copies of the request, sent per sendmmsg
+	RecvBatch recvBatch(nBatch);											// Ring of receive buffers, filled per recvmmsg
+	sendBatch.Capture(pCapture);
+	recvBatch.Capture(pCapture);
+	RttStats stats;															// Fixed size, whatever the ping count
+	LatencyHistogram histogram;
+	IcmpCodeCounts errorCodes;												// ICMP errors quoting our requests, by type and code
+	unsigned short nSeq = 1;
+	long long int nSent = 0, nReceived = 0, nTimedOut = 0, nIgnored = 0;
+	ProbeScheduler schedule(1);												// Deadlines every nIntervalNs, 0 sends as fast as the window refills
+	schedule.Start(TransportMonotonicNs());
+	schedule.Add(0, nIntervalNs, nCount, false);
+	auto onTimedOut = [&](unsigned short seq, unsigned long) {
+		MetricsLocal().Count(METRIC_TIMEOUTS);
+		rto.OnTimeout(0);
+		stats.OnLost();
+		output.Emit(OUTPUT_TIMEOUT, ulDestIP, seq, TransportMonotonicNs(), 0);
+	};
+
+	while (!schedule.Finished() || window.Outstanding() > 0)
+	{
+		unsigned long now = TransportTickMs();
+
+		// Queue the requests that are due, as far as the window allows, and send them in batches. Requests that do not
+		// fit into the socket buffer stay queued for the next round.
+		int nQueued;
+		do
+		{
+			nQueued = schedule.Run(TransportMonotonicNs(), sendBatch.Capacity() - sendBatch.Count(), [&](unsigned int, unsigned long long) {
+				if (!window.CanSend())
+					return false;											// As many outstanding as the window holds
+				nTimedOut += window.Retire(nSeq, onTimedOut);				// Sequence numbers wrapped onto one still out
+				unsigned long long nNowNs = TransportMonotonicNs();
+				PatchEchoRequest((ICMP_Header*)sendBatch.Queue(ulDestIP), nSeq, nNowNs);
+				window.Insert(nSeq++, now, nNowNs + rto.TimeoutNs(0));
+				stats.OnSent();
+				++nSent;
+				return true;
+			});
+			if (sendBatch.Count() > 0 && sendBatch.Flush(loop, sRaw) == TRANSPORT_ERROR)
+			{
+				cout<<"Sending failed! Error code:"<<TransportLastError()<<endl;
+				return -1;
+			}
+		}
+		while (nQueued > 0 && sendBatch.Count() == 0 && window.CanSend());
+
+		// Wait until a reply arrives, the next request is due or the next deadline passes
+		long waitMs = NsToWaitMs(window.NsUntilNextExpiry(TransportMonotonicNs()));
+		if (window.CanSend() && sendBatch.Count() == 0)
+		{
+			long untilSend = schedule.WaitMs(TransportMonotonicNs());		// Rounded down, a sub-millisecond rest is polled
+			if (untilSend >= 0 && (waitMs < 0 || untilSend < waitMs))
+				waitMs = untilSend;
+		}
+		void* ready[1];
+		loop.Wait(ready, 1, waitMs);
+
+		// Kernel send stamps first: the OPT_ID counter starts at 0 with the first request, which has sequence number 1
+		TransportTxStamp txStamps[64];
+		int nTxStamps;
+		while ((nTxStamps = TransportRecvTxStamps(sRaw, txStamps, 64)) > 0)
+			for (int t = 0; t < nTxStamps; ++t)
+				window.SetTxStamp((unsigned short)(txStamps[t].id + 1), txStamps[t].ns);
+
+		// Drain every reply that is already queued on the socket, a batch at a time
+		int nBatchReceived;
+		while ((nBatchReceived = recvBatch.Receive(sRaw)) > 0)
+		{
+			for (int r = 0; r < nBatchReceived; ++r)
+			{
+				unsigned long ulFrom = recvBatch.Source(r);
+				ICMP_Header* pRecvIcmp = ParseEchoReply(recvBatch.Data(r), recvBatch.Length(r), sRaw);
+				unsigned long sentTick;
+				unsigned long long txStampNs;
+				IcmpErrorInfo error;
+				if (pRecvIcmp == NULL && ParseProbeError(recvBatch.Data(r), recvBatch.Length(r), sRaw, &error) && error.destination == ulDestIP)
+				{
+					// An error from a router or the target ends the request it quotes (unless it is only a redirect),
+					// it is counted instead of being taken for a reply
+					errorCodes.Record(error.type, error.code);
+					if (IcmpErrorEndsProbe((IcmpErrorClass)error.errorClass) && window.Complete(error.seq, &sentTick, &txStampNs))
+					{
+						stats.OnError();
+						output.EmitError(ulDestIP, error.seq, ulFrom, error.type, error.code, recvBatch.Stamp(r), ErrorRttNs(error, txStampNs, recvBatch.Stamp(r)));
+					}
+					continue;
+				}
+				if (pRecvIcmp == NULL || ulFrom != ulDestIP)
+				{
+					MetricsLocal().Count(METRIC_FOREIGN_PACKETS);
+					++nIgnored;														// Foreign packet
+					continue;
+				}
+				bool bOutstanding = window.Complete(pRecvIcmp->icmp_sequence, &sentTick, &txStampNs);
+				ReplyKind kind = stats.OnReply(pRecvIcmp->icmp_sequence, !bOutstanding);
+				if (kind == REPLY_LATE)
+					rto.Sample(0, EchoRttNs(pRecvIcmp, 0, recvBatch.Stamp(r)));	// Too slow for the timeout, but still a sample of the path
+				if (kind != REPLY_NEW)
+				{
+					++nIgnored;														// Duplicate or a reply that already timed out
+					output.Emit(kind == REPLY_DUPLICATE ? OUTPUT_DUPLICATE : OUTPUT_LATE, ulFrom, pRecvIcmp->icmp_sequence, recvBatch.Stamp(r), 0);
+					continue;
+				}
+
+				++nReceived;
+				unsigned long long nRttNs = EchoRttNs(pRecvIcmp, txStampNs, recvBatch.Stamp(r));
+				stats.Record(nRttNs);
+				histogram.Record(nRttNs);
+				rto.Sample(0, nRttNs);
+				output.Emit(OUTPUT_REPLY, ulFrom, pRecvIcmp->icmp_sequence, recvBatch.Stamp(r), nRttNs);	// Printed by the writer thread
+			}
+		}
+		if (nBatchReceived == TRANSPORT_ERROR)
+		{
+			cout<<"Receiving failed! Error code:"<<TransportLastError()<<endl;
+			return -1;
+		}
+
+		nTimedOut += window.ExpireDue(TransportMonotonicNs(), onTimedOut);
+	}
+
+	output.Stop();															// Everything queued is written before the summary
+	sendBatch.CountLoopErrors(loop);										// io_uring sends that failed after they were queued
+	cout<<'\n';
+	in_addr dest;
+	dest.s_addr = (unsigned int)ulDestIP;
+	PrintRttStats(cout, inet_ntoa(dest), stats, &histogram);
+	errorCodes.Print(cout);
+	cout<<"Sent: "<<nSent<<", Received: "<<nReceived<<", Errors: "<<stats.Errors()<<", Timed out: "<<nTimedOut<<", Ignored: "<<nIgnored<<", Send errors: "<<sendBatch.Errors()<<" (window "<<nWindow<<", "<<loop.Name()<<")"<<endl;
+	rto.Print(cout);
+	PrintScheduleStats(cout, schedule.Stats());
+	cout<<"Packets per syscall: send "<<PacketsPerCall(sendBatch.Packets(), sendBatch.Calls())
+		<<", receive "<<PacketsPerCall(recvBatch.Packets(), recvBatch.Calls())<<" (batch "<<sendBatch.Capacity()<<")"<<endl;
+	cout<<"Records written: "<<output.Written()<<", dropped: "<<output.Dropped()<<endl;
+	return 0;
+}
+
+
+// Multi-target sweep. Every target gets nRounds echo requests on its own deadline schedule: every nIntervalNs (or its
+// own '@' interval from the target list), starting at a random offset within the first interval so the targets do not
+// fire in sync. A token bucket caps the send rate at nRate requests per second with bursts of up to nBurst. Nothing
+// waits for replies, so a sweep takes about targets / rate instead of targets * RTT.
+// The sequence number is the target's probe number, and replies are matched through the (destination, sequence)
+// in-flight table, and so are ICMP errors through the destination and sequence number they quote. All per-target state
+// (sequence number, counters, RTT moments, timeout, errors by class) is kept in the columns of the TargetStore of
+// icmp_TargetStore.h, whose address index also finds the target of a late reply or an error, and the summary is
+// printed from them. Latency histograms are kept per target up to SweepTargetHistograms targets (4.5 KB each) and for
+// the sweep as a whole. Per-probe records are only written when an output writer is given (-o), a large sweep would
+// otherwise flood the terminal.
+// With nShards > 1 (-j) the sweep runs on that many threads, each with its own socket and icmp_id, taking the targets
+// a chunk of up to SweepChunkTargets at a time from the work-stealing queues in icmp_Shard.h; every thread gets an equal
+// share of nRate.
+#define SweepTargetHistograms 4096
+#define SweepChunkTargets 256
+
+// One thread of the sweep: its socket, the echo request it sends and its results. The target store and the per-target
+// histograms are shared by all shards, but only the shard that took a target's chunk ever writes its entries.
+struct SweepShard
+{
+	SweepShard() : nIgnored(0), nSendPackets(0), nSendCalls(0), nSendErrors(0), nRecvPackets(0), nRecvCalls(0),
+	               szLoop(""), szFailed(NULL), nErrorCode(0) {}
+
+	IcmpSocket         sRaw;
+	char               packet[sizeof(ICMP_Header) + DataLength];		// Echo request carrying this shard's icmp_id
+	long long int      nIgnored;
+	IcmpCodeCounts     errorCodes;
+	LatencyHistogram   allHistogram;
+	ScheduleStats      schedule;
+	unsigned long long nSendPackets, nSendCalls, nSendErrors, nRecvPackets, nRecvCalls;
+	const char*        szLoop;
+	const char*        szFailed;										// Why the shard stopped early, NULL if it did not
+	int                nErrorCode;
+};
+
+// Runs one shard until every chunk has been taken and its own probes are answered or timed out. A shard takes another
+// chunk whenever fewer than nLookahead of its targets are still waiting for their first probe, so it holds about as
+// much work as it can start in the near future; the rest stays in the queues for faster shards.
+void RunSweepShard(SweepShard& shard, int nShard, ShardWork& work, const vector<unsigned long>& targets, vector<LatencyHistogram>& histograms,
+                   unsigned long long nIntervalNs, long long int nRounds, double dRate, long nBurst, TargetStore& store, const RtoConfig& rtoConfig, bool bUring, int nBatch, unsigned int nMaxInFlight,
+                   unsigned long long nLookahead, OutputWriter* pOutput, PcapWriter* pCapture)
+{
+	TransportSetNonBlocking(shard.sRaw);
+	TransportLoop loop;
+	if (!loop.Init(bUring) || !loop.Add(shard.sRaw, &shard.sRaw))
+	{
+		shard.szFailed = "Unable to start the event loop!";
+		shard.nErrorCode = TransportLastError();
+		return;
+	}
+	shard.szLoop = loop.Name();
+
+	InFlightTable inFlight(nMaxInFlight);
+	inFlight.UseDeadlines(TransportMonotonicNs(), rtoConfig.granularityNs);
+	SendBatch sendBatch(shard.packet, sizeof(ICMP_Header) + DataLength, nBatch);
+	RecvBatch recvBatch(nBatch);
+	sendBatch.Capture(pCapture, nShard);									// The shards share the capture file, each through its own ring
+	recvBatch.Capture(pCapture, nShard);
+	vector<unsigned int> owned;												// Scheduler id -> target index, in the order the chunks were taken
+	unsigned long long nWaiting = 0;										// Targets taken whose first probe has not gone out yet
+	bool bWorkLeft = true;
+
+	ProbeScheduler schedule(work.ChunkSize());
+	schedule.SetRate(dRate, (double)nBurst);
+	schedule.Start(TransportMonotonicNs());
+
+	while (bWorkLeft || !schedule.Finished() || inFlight.Size() > 0)
+	{
+		unsigned long now = TransportTickMs();
+
+		// New targets start within one interval from the time their chunk is taken
+		unsigned int nBegin, nEnd;
+		while (bWorkLeft && nWaiting < nLookahead && (bWorkLeft = work.Take(nShard, &nBegin, &nEnd)))
+		{
+			unsigned long long nNowNs = TransportMonotonicNs();
+			schedule.Grow((unsigned int)(owned.size() + nEnd - nBegin));
+			for (unsigned int t = nBegin; t < nEnd; ++t)
+			{
+				schedule.Add((unsigned int)owned.size(), store.IntervalNs(t) > 0 ? store.IntervalNs(t) : nIntervalNs, nRounds, true, nNowNs);
+				owned.push_back(t);
+			}
+			if (nRounds != 0)
+				nWaiting += nEnd - nBegin;
+		}
+
+		// Queue the due requests the rate limit allows and send them in batches
+		int nQueued;
+		do
+		{
+			nQueued = schedule.Run(TransportMonotonicNs(), sendBatch.Capacity() - sendBatch.Count(), [&](unsigned int id, unsigned long long) {
+				if (inFlight.Full())
+					return false;
+				unsigned int target = owned[id];
+				if (store.Sent(target) == 0)
+					--nWaiting;
+				unsigned short nSeq = store.OnSent(target);
+				unsigned long long nNowNs = TransportMonotonicNs();
+				PatchEchoRequest((ICMP_Header*)sendBatch.Queue(targets[target]), nSeq, nNowNs);
+				inFlight.Insert(InFlightTable::MakeKey(targets[target], nSeq), target, (unsigned int)now, nNowNs + store.TimeoutNs(target, rtoConfig));
+				return true;
+			});
+			// A refused request (unroutable target) must not stop the sweep, it stays in flight and is counted as lost, and
+			// so is one that io_uring took but failed to send; both are counted in the send errors
+			while (sendBatch.Count() > 0 && sendBatch.Flush(loop, shard.sRaw) == TRANSPORT_ERROR)
+				;
+		}
+		while (nQueued > 0 && sendBatch.Count() == 0 && !inFlight.Full());
+
+		// Sleep until the next request is due, a reply arrives or the next deadline passes
+		long waitMs = NsToWaitMs(inFlight.NsUntilNextExpiry(TransportMonotonicNs()));
+		if (!inFlight.Full() && sendBatch.Count() == 0)
+		{
+			long untilSend = schedule.WaitMs(TransportMonotonicNs());
+			if (untilSend >= 0 && (waitMs < 0 || untilSend < waitMs))
+				waitMs = untilSend;
+		}
+		void* ready[1];
+		loop.Wait(ready, 1, waitMs);
+
+		int nBatchReceived;
+		while ((nBatchReceived = recvBatch.Receive(shard.sRaw)) > 0)
+		{
+			for (int r = 0; r < nBatchReceived; ++r)
+			{
+				ICMP_Header* pRecvIcmp = ParseEchoReply(recvBatch.Data(r), recvBatch.Length(r), shard.sRaw);
+				InFlightEntry entry;
+				IcmpErrorInfo error;
+				if (pRecvIcmp == NULL && ParseProbeError(recvBatch.Data(r), recvBatch.Length(r), shard.sRaw, &error))
+				{
+					unsigned int target = store.Find(error.destination);
+					if (target == TargetStoreNone)
+					{
+						MetricsLocal().Count(METRIC_FOREIGN_PACKETS);
+						++shard.nIgnored;
+						continue;
+					}
+					shard.errorCodes.Record(error.type, error.code);
+					store.CountError(target, error.type);
+					if (IcmpErrorEndsProbe((IcmpErrorClass)error.errorClass) && inFlight.Remove(InFlightTable::MakeKey(error.destination, error.seq), &entry))
+					{
+						store.OnError(entry.target);
+						if (pOutput != NULL)
+							pOutput->EmitError(error.destination, error.seq, recvBatch.Source(r), error.type, error.code, recvBatch.Stamp(r), ErrorRttNs(error, 0, recvBatch.Stamp(r)), nShard);
+					}
+					continue;
+				}
+				if (pRecvIcmp == NULL)
+				{
+					MetricsLocal().Count(METRIC_FOREIGN_PACKETS);
+					++shard.nIgnored;
+					continue;
+				}
+				if (!inFlight.Remove(InFlightTable::MakeKey(recvBatch.Source(r), pRecvIcmp->icmp_sequence), &entry))
+				{
+					// Duplicate or late reply: its target is found through the store's address index
+					unsigned int target = store.Find(recvBatch.Source(r));
+					if (target != TargetStoreNone)
+					{
+						ReplyKind kind = store.OnReply(target, pRecvIcmp->icmp_sequence, true);
+						if (kind == REPLY_LATE)
+							store.OnLate(target, EchoRttNs(pRecvIcmp, 0, recvBatch.Stamp(r)));
+						if (pOutput != NULL)
+							pOutput->Emit(kind == REPLY_DUPLICATE ? OUTPUT_DUPLICATE : OUTPUT_LATE, recvBatch.Source(r), pRecvIcmp->icmp_sequence, recvBatch.Stamp(r), 0, nShard);
+					}
+					++shard.nIgnored;
+					continue;
+				}
+				if (store.OnReply(entry.target, pRecvIcmp->icmp_sequence) != REPLY_NEW)
+				{
+					++shard.nIgnored;
+					continue;
+				}
+
+				unsigned long long nRttNs = EchoRttNs(pRecvIcmp, 0, recvBatch.Stamp(r));
+				store.Record(entry.target, nRttNs);
+				if (!histograms.empty())
+					histograms[entry.target].Record(nRttNs);
+				shard.allHistogram.Record(nRttNs);
+				if (pOutput != NULL)
+					pOutput->Emit(OUTPUT_REPLY, recvBatch.Source(r), pRecvIcmp->icmp_sequence, recvBatch.Stamp(r), nRttNs, nShard);
+			}
+		}
+		if (nBatchReceived == TRANSPORT_ERROR)
+		{
+			shard.szFailed = "Receiving failed!";
+			shard.nErrorCode = TransportLastError();
+			break;
+		}
+
+		inFlight.ExpireDue(TransportMonotonicNs(), [&](const InFlightEntry& entry) {
+			MetricsLocal().Count(METRIC_TIMEOUTS);
+			store.OnLost(entry.target);
+			if (pOutput != NULL)
+				pOutput->Emit(OUTPUT_TIMEOUT, targets[entry.target], (unsigned short)(entry.key & 0xFFFF), TransportMonotonicNs(), 0, nShard);
+		});
+	}
+
+	sendBatch.CountLoopErrors(loop);
+	shard.schedule     = schedule.Stats();
+	shard.nSendPackets = sendBatch.Packets();
+	shard.nSendCalls   = sendBatch.Calls();
+	shard.nSendErrors  = sendBatch.Errors();
+	shard.nRecvPackets = recvBatch.Packets();
+	shard.nRecvCalls   = recvBatch.Calls();
+}
+
+int RunSweep(IcmpSocket& sRaw, const vector<unsigned long>& targets, const vector<double>& intervals, char* buff, unsigned long long nIntervalNs, long long int nRounds, long nRate, long nBurst, const RtoConfig& rtoConfig, bool bUring, int nBatch, int nShards, OutputWriter* pOutput, PcapWriter* pCapture)
+{
+	unsigned int nTargets = (unsigned int)targets.size();
+	if ((unsigned int)nShards > nTargets)
+		nShards = (int)nTargets;
+
+	// Room for everything a shard can have outstanding within the longest timeout, capped at 4M requests (64 MB of table) in all
+	unsigned long long maxInFlight = (unsigned long long)((double)nRate * (rtoConfig.maxNs / 1e9)) / nShards + nTargets + nBurst;
+	if (maxInFlight > nTargets * (unsigned long long)nRounds)
+		maxInFlight = nTargets * (unsigned long long)nRounds;
+	if (maxInFlight > (1u << 22) / (unsigned int)nShards)
+		maxInFlight = (1u << 22) / (unsigned int)nShards;
+
+	vector<LatencyHistogram> histograms(nTargets <= SweepTargetHistograms ? nTargets : 0);	// Allocated once here, nothing grows with the rounds
+	TargetStore store(nTargets);													// Everything else per target, in columns
+	vector<unsigned long long> intervalsNs(nTargets);								// 0: the run's interval
+	for (unsigned int t = 0; t < nTargets; ++t)
+		intervalsNs[t] = (unsigned long long)(intervals[t] * 1e6);
+	vector<unsigned int> ids(nTargets);
+	store.Add(&targets[0], &intervalsNs[0], nTargets, TransportMonotonicNs(), &ids[0]);	// The list is sorted and unique: id == index
+	unsigned int nChunk = nTargets / (nShards * 4u);								// At least four chunks per shard, so small sweeps balance too
+	ShardWork work(nTargets, nShards, nChunk < SweepChunkTargets ? nChunk : SweepChunkTargets);
+	vector<SweepShard> shards(nShards);
+
+	// Shard 0 uses the socket the caller opened, the others open their own. Raw sockets choose their icmp_id, so the
+	// shards number theirs on from the caller's; the kernel gives every ping socket its own.
+	// Even a single socket is filtered: foreign ICMP (on loopback our own requests) is dropped before it takes buffer space.
+	bool bKernelSteering = true;
+	for (int s = 0; s < nShards; ++s)
+	{
+		SweepShard& shard = shards[s];
+		if (s == 0)
+			shard.sRaw = sRaw;
+		else if (!TransportOpen(sRaw.kind, &shard.sRaw))
+		{
+			cout<<"Unable to create the ICMP socket of shard "<<s<<"! Error code:"<<TransportLastError()<<endl;
+			for (int c = 1; c < s; ++c)
+				TransportClose(shards[c].sRaw);
+			return -1;
+		}
+		else
+			TransportEnableTimestamps(shard.sRaw, false);
+		if (sRaw.kind == ICMP_SOCKET_RAW)
+			shard.sRaw.id = (unsigned short)(sRaw.id + s);
+		memcpy(shard.packet, buff, sizeof(shard.packet));
+		ICMP_Header* pPacket = (ICMP_Header*)shard.packet;
+		pPacket->icmp_checksum = ChecksumUpdate16(pPacket->icmp_checksum, pPacket->icmp_id, shard.sRaw.id);
+		pPacket->icmp_id = shard.sRaw.id;
+		if (!TransportFilterId(shard.sRaw))
+			bKernelSteering = false;												// Every socket sees every packet and skips the foreign ones
+	}
+
+	// A shard keeps up to one interval's worth of targets at its rate waiting to start, but no more than its share
+	double dRate = (double)nRate / nShards;
+	unsigned long long nLookahead = (unsigned long long)(dRate * (double)nIntervalNs / 1e9);
+	if (nLookahead > (nTargets + nShards - 1) / (unsigned int)nShards)
+		nLookahead = (nTargets + nShards - 1) / (unsigned int)nShards;
+	if (nLookahead < work.ChunkSize())
+		nLookahead = work.ChunkSize();
+
+	unsigned long start = TransportTickMs();
+	unsigned int nCpus = thread::hardware_concurrency() > 0 ? thread::hardware_concurrency() : 1;
+	vector<thread> threads;
+	for (int s = 1; s < nShards; ++s)
+		threads.push_back(thread([&, s]() {
+			TransportPinThread((int)(s % nCpus));
+			RunSweepShard(shards[s], s, work, targets, histograms, nIntervalNs, nRounds, dRate, nBurst, store, rtoConfig, bUring, nBatch, (unsigned int)maxInFlight, nLookahead, pOutput, pCapture);
+		}));
+	if (nShards > 1)
+		TransportPinThread(0);
+	RunSweepShard(shards[0], 0, work, targets, histograms, nIntervalNs, nRounds, dRate, nBurst, store, rtoConfig, bUring, nBatch, (unsigned int)maxInFlight, nLookahead, pOutput, pCapture);
+	for (size_t i = 0; i < threads.size(); ++i)
+		threads[i].join();
+	unsigned long elapsed = TransportTickMs() - start;
+	for (int s = 1; s < nShards; ++s)
+		TransportClose(shards[s].sRaw);
+	if (pOutput != NULL)
+		pOutput->Stop();
+
+	// The shards' counters add up to the sweep's
+	SweepShard all;
+	bool bFailed = false;
+	for (int s = 0; s < nShards; ++s)
+	{
+		const SweepShard& shard = shards[s];
+		if (shard.szFailed != NULL)
+		{
+			cout<<shard.szFailed<<" Error code:"<<shard.nErrorCode<<(nShards > 1 ? " (shard " : "");
+			if (nShards > 1)
+				cout<<s<<")";
+			cout<<endl;
+			bFailed = true;
+		}
+		all.nIgnored += shard.nIgnored;
+		all.errorCodes.Merge(shard.errorCodes);
+		all.allHistogram.Merge(shard.allHistogram);
+		all.schedule.Merge(shard.schedule);
+		all.nSendPackets += shard.nSendPackets;
+		all.nSendCalls += shard.nSendCalls;
+		all.nSendErrors += shard.nSendErrors;
+		all.nRecvPackets += shard.nRecvPackets;
+		all.nRecvCalls += shard.nRecvCalls;
+	}
+	if (bFailed)
+		return -1;
+
+	// Per-target summary, from the store's columns
+	cout<<'\n';
+	unsigned int nAlive = 0;
+	RttStats allStats;
+	for (unsigned int t = 0; t < nTargets; ++t)
+	{
+		RttStats stats = store.Stats(t);
+		in_addr addr;
+		addr.s_addr = (unsigned int)targets[t];
+		cout<<inet_ntoa(addr)<<"\t"<<stats.Received()<<"/"<<stats.Sent()<<" replies";
+		if (stats.Received() > 0)
+		{
+			cout<<", RTT min/mean/max "<<NsToMs(stats.MinNs())<<"/"<<stats.MeanNs() / 1e6<<"/"<<NsToMs(stats.MaxNs())<<" ms";
+			if (!histograms.empty())
+				cout<<", p50/p99 "<<NsToMs(histograms[t].Percentile(50))<<"/"<<NsToMs(histograms[t].Percentile(99))<<" ms";
+			cout<<", jitter "<<stats.JitterNs() / 1e6<<" ms";
+			++nAlive;
+		}
+		if (stats.Duplicates() > 0 || stats.Reordered() > 0 || stats.Late() > 0)
+			cout<<", "<<stats.Duplicates()<<" dup, "<<stats.Reordered()<<" reordered, "<<stats.Late()<<" late";
+		if (store.Errors(t).Total() > 0)
+		{
+			char szErrors[128];
+			store.Errors(t).Format(szErrors, sizeof(szErrors));
+			cout<<", errors: "<<szErrors;
+		}
+		cout<<'\n';
+		allStats.Merge(stats);
+	}
+	cout<<'\n';
+	PrintRttStats(cout, "sweep", allStats, &all.allHistogram);
+	all.errorCodes.Print(cout);
+	cout<<"Targets: "<<nTargets<<", Alive: "<<nAlive<<", Sent: "<<allStats.Sent()<<", Received: "<<allStats.Received()<<", Errors: "<<allStats.Errors()
+		<<", Timed out: "<<allStats.Lost() - allStats.Errors()<<", Ignored: "<<all.nIgnored<<", Send errors: "<<all.nSendErrors<<endl;
+	cout<<"Elapsed: "<<elapsed<<" ms ("<<shards[0].szLoop<<")"<<endl;
+	PrintRtoSummary(cout, rtoConfig, nTargets, [&](size_t t) -> const RtoEstimator& { return store.Rto((unsigned int)t); });
+	if (nShards > 1)
+	{
+		cout<<"Shards: "<<nShards<<" ("<<(sRaw.kind == ICMP_SOCKET_DGRAM ? "replies steered by ping socket ids" : bKernelSteering ? "replies steered by socket filters on icmp_id" : "icmp_id checked in user space")
+			<<"), chunks of "<<work.ChunkSize()<<" targets taken";
+		for (int s = 0; s < nShards; ++s)
+			cout<<(s == 0 ? " " : "/")<<work.Taken(s);
+		cout<<", stolen";
+		for (int s = 0; s < nShards; ++s)
+			cout<<(s == 0 ? " " : "/")<<work.Stolen(s);
+		cout<<endl;
+	}
+	PrintScheduleStats(cout, all.schedule);
+	cout<<"Packets per syscall: send "<<PacketsPerCall(all.nSendPackets, all.nSendCalls)
+		<<", receive "<<PacketsPerCall(all.nRecvPackets, all.nRecvCalls)<<" (batch "<<(nBatch > TRANSPORT_MAX_BATCH ? TRANSPORT_MAX_BATCH : nBatch)<<")"<<endl;
+	if (pOutput != NULL)
+		cout<<"Records written: "<<pOutput->Written()<<", dropped: "<<pOutput->Dropped()<<endl;
+	return 0;
+}
+
+// Parallel traceroute. Every (target, TTL) pair gets nRounds probes on its own deadline schedule, so all hops of all
+// targets are probed at the same time under the one rate limit, instead of one hop after the other. The schedule of
+// probe (target t, TTL h) is number t * nMaxHops + h - 1, which is also what the in-flight table stores for it;
+// the sequence number only has to be unique per target while the probe is outstanding. Time exceeded errors
+// (quoted destination and sequence number), unreachable errors and the target's own echo reply are recorded per
+// hop in a TraceTable. All probes carry the checksum nFlow (Paris traceroute), so load balancers keep them on one path.
+#define TracePrintPaths 32															// More targets get one summary line each instead of a hop table
+
+int RunTrace(IcmpSocket& sRaw, const vector<unsigned long>& targets, char* buff, unsigned long long nIntervalNs, long long int nRounds, int nMaxHops, unsigned short nFlow, long nRate, long nBurst, unsigned long Timeout, bool bUring, int nBatch, OutputWriter* pOutput, PcapWriter* pCapture)
+{
+	TransportSetNonBlocking(sRaw);
+	TransportLoop loop;
+	if (!loop.Init(bUring) || !loop.Add(sRaw, &sRaw))
+	{
+		cout<<"Unable to start the event loop! Error code:"<<TransportLastError()<<endl;
+		return -1;
+	}
+
+	unsigned int nTargets = (unsigned int)targets.size();
+	unsigned int nProbes = nTargets * (unsigned int)nMaxHops;
+	unsigned long long maxInFlight = (unsigned long long)nRate * Timeout / 1000 + nProbes + nBurst;
+	if (maxInFlight > nProbes * (unsigned long long)nRounds)
+		maxInFlight = nProbes * (unsigned long long)nRounds;
+	if (maxInFlight > (1u << 22))
+		maxInFlight = 1u << 22;
+	InFlightTable inFlight((unsigned int)maxInFlight);
+
+	TraceTable trace(nTargets, nMaxHops);
+	IcmpCodeCounts errorCodes;
+	SendBatch sendBatch(buff, sizeof(ICMP_Header) + DataLength, nBatch);
+	RecvBatch recvBatch(nBatch);
+	sendBatch.Capture(pCapture);
+	recvBatch.Capture(pCapture);
+	vector<unsigned short> nextSeq(nTargets, 1);
+	unsigned short nChecksum = htons(nFlow);
+	long long int nSent = 0, nReceived = 0, nTimedOut = 0, nIgnored = 0, nBeyond = 0;
+
+	unsigned long start = TransportTickMs();
+	ProbeScheduler schedule(nProbes);
+	schedule.SetRate((double)nRate, (double)nBurst);
+	schedule.Start(TransportMonotonicNs());
+	for (unsigned int p = 0; p < nProbes; ++p)
+		schedule.Add(p, nIntervalNs, nRounds, true);
+
+	while (!schedule.Finished() || inFlight.Size() > 0)
+	{
+		unsigned long now = TransportTickMs();
+
+		int nQueued;
+		do
+		{
+			nQueued = schedule.Run(TransportMonotonicNs(), sendBatch.Capacity() - sendBatch.Count(), [&](unsigned int probe, unsigned long long) {
+				unsigned int target = probe / nMaxHops;
+				int nTtl = (int)(probe % nMaxHops) + 1;
+				if (trace.Beyond(target, nTtl))
+				{
+					++nBeyond;													// The target already answered at a lower TTL
+					return true;
+				}
+				if (inFlight.Full())
+					return false;
+				unsigned short nSeq = nextSeq[target]++;
+				unsigned long long nNowNs = TransportMonotonicNs();
+				ICMP_Header* pProbe = (ICMP_Header*)sendBatch.Queue(targets[target], nTtl);
+				PatchEchoRequest(pProbe, nSeq, nNowNs);
+				HoldEchoChecksum(pProbe, nChecksum);
+				inFlight.Insert(InFlightTable::MakeKey(targets[target], nSeq), probe, (unsigned int)now);
+				trace.OnSent(target, nTtl, nSeq, nNowNs);
+				++nSent;
+				return true;
+			});
+			while (sendBatch.Count() > 0 && sendBatch.Flush(loop, sRaw) == TRANSPORT_ERROR)
+				;
+		}
+		while (nQueued > 0 && sendBatch.Count() == 0 && !inFlight.Full());
+
+		long waitMs = inFlight.MillisUntilNextExpiry((unsigned int)now, Timeout);
+		if (!inFlight.Full() && sendBatch.Count() == 0)
+		{
+			long untilSend = schedule.WaitMs(TransportMonotonicNs());
+			if (untilSend >= 0 && (waitMs < 0 || untilSend < waitMs))
+				waitMs = untilSend;
+		}
+		void* ready[1];
+		loop.Wait(ready, 1, waitMs);
+
+		int nBatchReceived;
+		while ((nBatchReceived = recvBatch.Receive(sRaw)) > 0)
+		{
+			for (int r = 0; r < nBatchReceived; ++r)
+			{
+				// The target's echo reply or an error quoting one of the probes, both name the probe by (target, sequence)
+				unsigned long long nStampNs = recvBatch.Stamp(r);
+				ICMP_Header* pRecvIcmp = ParseEchoReply(recvBatch.Data(r), recvBatch.Length(r), sRaw);
+				IcmpErrorInfo error = IcmpErrorInfo();
+				unsigned long ulTarget;
+				unsigned short nSeq;
+				unsigned char nType = 0, nCode = 0;
+				if (pRecvIcmp != NULL)
+				{
+					ulTarget = recvBatch.Source(r);
+					nSeq = pRecvIcmp->icmp_sequence;
+				}
+				else if (ParseProbeError(recvBatch.Data(r), recvBatch.Length(r), sRaw, &error) && IcmpErrorEndsProbe((IcmpErrorClass)error.errorClass))
+				{
+					ulTarget = error.destination;
+					nSeq = error.seq;
+					nType = error.type;
+					nCode = error.code;
+				}
+				else
+				{
+					MetricsLocal().Count(METRIC_FOREIGN_PACKETS);
+					++nIgnored;
+					continue;
+				}
+				InFlightEntry entry;
+				if (!inFlight.Remove(InFlightTable::MakeKey(ulTarget, nSeq), &entry))
+				{
+					++nIgnored;														// Duplicate, or the probe already timed out
+					continue;
+				}
+
+				unsigned int target = entry.target / nMaxHops;
+				int nTtl = (int)(entry.target % nMaxHops) + 1;
+				TraceHop& hop = trace.Hop(target, nTtl);
+				unsigned long long nRttNs;
+				if (pRecvIcmp != NULL)
+					nRttNs = EchoRttNs(pRecvIcmp, 0, nStampNs);
+				else if ((nRttNs = ErrorRttNs(error, 0, nStampNs)) == 0)
+				{
+					// The router quoted only 8 bytes of the probe, the send time comes from the hop (or the ms tick)
+					if (hop.lastSeq == nSeq && nStampNs > hop.lastSentNs)
+						nRttNs = nStampNs - hop.lastSentNs;
+					else
+						nRttNs = (unsigned long long)((unsigned int)TransportTickMs() - entry.sentTick) * 1000000ULL;
+				}
+				if (nType != 0)
+					errorCodes.Record(nType, nCode);
+				trace.OnAnswer(target, nTtl, recvBatch.Source(r), nType, nCode, nRttNs);
+				++nReceived;
+				if (pOutput != NULL)
+					pOutput->EmitHop(nType == 0 ? OUTPUT_REPLY : OUTPUT_ERROR, ulTarget, nSeq, (unsigned char)nTtl, recvBatch.Source(r), nType, nCode, nStampNs, nRttNs);
+			}
+		}
+		if (nBatchReceived == TRANSPORT_ERROR)
+		{
+			cout<<"Receiving failed! Error code:"<<TransportLastError()<<endl;
+			return -1;
+		}
+
+		nTimedOut += inFlight.Expire((unsigned int)TransportTickMs(), Timeout, [&](const InFlightEntry& entry) {
+			MetricsLocal().Count(METRIC_TIMEOUTS);
+			if (pOutput != NULL)
+				pOutput->EmitHop(OUTPUT_TIMEOUT, targets[entry.target / nMaxHops], (unsigned short)(entry.key & 0xFFFF),
+				                 (unsigned char)(entry.target % nMaxHops + 1), 0, 0, 0, TransportMonotonicNs(), 0);
+		});
+	}
+	if (pOutput != NULL)
+		pOutput->Stop();
+
+	// Hop tables for a few targets, one line per target for many
+	cout<<'\n';
+	unsigned int nReached = 0;
+	for (unsigned int t = 0; t < nTargets; ++t)
+	{
+		in_addr addr;
+		addr.s_addr = (unsigned int)targets[t];
+		nReached += trace.Reached(t);
+		if (nTargets <= TracePrintPaths)
+		{
+			trace.Print(cout, t, inet_ntoa(addr), nFlow);
+			cout<<'\n';
+			continue;
+		}
+		cout<<inet_ntoa(addr)<<"\t";
+		if (trace.Reached(t))
+			cout<<"reached in "<<trace.PathLength(t)<<" hops";
+		else if (trace.PathLength(t) != 0)
+			cout<<"unreachable after "<<trace.PathLength(t)<<" hops";
+		else
+			cout<<"not reached, last answer from hop "<<trace.LastHop(t);
+		if (trace.UnstableHops(t) > 0)
+			cout<<", "<<trace.UnstableHops(t)<<" hops with changing responders";
+		cout<<'\n';
+	}
+	errorCodes.Print(cout);
+	cout<<"Targets: "<<nTargets<<", Reached: "<<nReached<<", Sent: "<<nSent<<", Answered: "<<nReceived<<", Timed out: "<<nTimedOut
+		<<", Not sent beyond the path: "<<nBeyond<<", Ignored: "<<nIgnored<<endl;
+	cout<<"Elapsed: "<<TransportTickMs() - start<<" ms (max "<<nMaxHops<<" hops, flow "<<nFlow<<", "<<loop.Name()<<")"<<endl;
+	PrintScheduleStats(cout, schedule.Stats());
+	cout<<"Packets per syscall: send "<<PacketsPerCall(sendBatch.Packets(), sendBatch.Calls())
+		<<", receive "<<PacketsPerCall(recvBatch.Packets(), recvBatch.Calls())<<" (batch "<<sendBatch.Capacity()<<")"<<endl;
+	if (pOutput != NULL)
+		cout<<"Records written: "<<pOutput->Written()<<", dropped: "<<pOutput->Dropped()<<endl;
+	return 0;
+}
+
+// Size sweep. Every payload size is a probe schedule of its own, sent to one destination from a PacketPool template
+// (prebuilt and summed once, only the sequence number and stamps are patched) with the don't fragment bit set
+// unless bDontFragment is off. Replies, errors and timeouts are matched by sequence number through the in-flight
+// window and counted per size in a SizeCurve, which prints the latency and loss curve and where it breaks off.
+int RunSizeSweep(IcmpSocket& sRaw, unsigned long ulDestIP, char* buff, const vector<int>& sizes, bool bDontFragment, unsigned long long nIntervalNs, long long int nRounds, int nWindow, long nRate, long nBurst, unsigned long Timeout, bool bUring, int nBatch, OutputWriter* pOutput, PcapWriter* pCapture)
+{
+	TransportSetNonBlocking(sRaw);
+	TransportLoop loop;
+	if (!loop.Init(bUring) || !loop.Add(sRaw, &sRaw))
+	{
+		cout<<"Unable to start the event loop! Error code:"<<TransportLastError()<<endl;
+		return -1;
+	}
+	if (!TransportSetDontFragment(sRaw, bDontFragment))
+		cout<<"Unable to "<<(bDontFragment ? "set" : "clear")<<" the don't fragment bit! Error code:"<<TransportLastError()<<endl;
+
+	int nSizes = (int)sizes.size();
+	vector<int> lengths(nSizes);
+	for (int i = 0; i < nSizes; ++i)
+		lengths[i] = sizes[i] + 8;											// The 8-byte echo header, the rest of ICMP_Header is payload
+	PacketPool pool(buff, sizeof(ICMP_Header), 'Y', lengths);
+	PoolBatch sendBatch(pool, nBatch);
+	RecvBatch recvBatch(nBatch, pool.Length(nSizes - 1) + 60);				// Largest reply with the largest IP header
+	sendBatch.Capture(pCapture);
+	recvBatch.Capture(pCapture);
+	SizeCurve curve(sizes);
+	IcmpCodeCounts errorCodes;
+	// Unless -w sets one, the window holds every request the rate lets out within one timeout, as the in-flight table
+	// of traceroute does: lost requests, all those beyond a black hole included, never hold up the other sizes
+	unsigned long long nDefaultWindow = (unsigned long long)nRate * Timeout / 1000 + nBurst;
+	InFlightWindow window(nWindow > 0 ? nWindow : (int)(nDefaultWindow < 65535 ? nDefaultWindow : 65535));
+	vector<unsigned short> sizeOfSeq(65536);								// Size index of every sequence number in flight
+	unsigned short nSeq = 1;
+	long long int nReceived = 0, nTimedOut = 0, nRefused = 0, nIgnored = 0;
+
+	unsigned long start = TransportTickMs();
+	ProbeScheduler schedule(nSizes);
+	schedule.SetRate((double)nRate, (double)nBurst);
+	schedule.Start(TransportMonotonicNs());
+	for (int i = 0; i < nSizes; ++i)
+		schedule.Add(i, nIntervalNs, nRounds, true);
+	auto onTimedOut = [&](unsigned short nExpiredSeq, unsigned long) {
+		MetricsLocal().Count(METRIC_TIMEOUTS);
+		curve.OnLost(sizeOfSeq[nExpiredSeq]);
+		if (pOutput != NULL)
+			pOutput->EmitSize(OUTPUT_TIMEOUT, ulDestIP, nExpiredSeq, (unsigned short)sizes[sizeOfSeq[nExpiredSeq]], ulDestIP, 0, 0, TransportMonotonicNs(), 0);
+	};
+
+	while (!schedule.Finished() || window.Outstanding() > 0 || sendBatch.Count() > 0)
+	{
+		unsigned long now = TransportTickMs();
+
+		int nQueued;
+		do
+		{
+			nQueued = schedule.Run(TransportMonotonicNs(), sendBatch.Capacity() - sendBatch.Count(), [&](unsigned int size, unsigned long long) {
+				if (sendBatch.Queued(size) || !window.CanSend())
+					return false;												// Its template has not left yet, or the window is full
+				nTimedOut += window.Retire(nSeq, onTimedOut);					// Sequence numbers wrapped onto one still out
+				PatchEchoRequest((ICMP_Header*)sendBatch.Queue(size, ulDestIP), nSeq, TransportMonotonicNs());
+				window.Insert(nSeq, now);
+				sizeOfSeq[nSeq++] = (unsigned short)size;
+				curve.OnSent(size);
+				return true;
+			});
+			while (sendBatch.Count() > 0 && sendBatch.Flush(sRaw) == TRANSPORT_ERROR)
+			{
+				// Larger than the interface MTU with DF set (EMSGSIZE): the probe never left, it is not a loss
+				int size = sendBatch.Refused();
+				unsigned long ulTick;
+				window.Complete(((ICMP_Header*)pool.Data(size))->icmp_sequence, &ulTick);
+				curve.OnRefused(size);
+				++nRefused;
+			}
+		}
+		while (nQueued > 0 && sendBatch.Count() == 0);
+
+		long waitMs = window.MillisUntilNextExpiry(now, Timeout);
+		if (sendBatch.Count() > 0)
+			waitMs = 1;															// Socket buffer full, retry shortly
+		else
+		{
+			long untilSend = schedule.WaitMs(TransportMonotonicNs());
+			if (untilSend >= 0 && (waitMs < 0 || untilSend < waitMs))
+				waitMs = untilSend;
+		}
+		void* ready[1];
+		loop.Wait(ready, 1, waitMs);
+
+		int nBatchReceived;
+		while ((nBatchReceived = recvBatch.Receive(sRaw)) > 0)
+		{
+			for (int r = 0; r < nBatchReceived; ++r)
+			{
+				unsigned long long nStampNs = recvBatch.Stamp(r);
+				ICMP_Header* pRecvIcmp = ParseEchoReply(recvBatch.Data(r), recvBatch.Length(r), sRaw);
+				IcmpErrorInfo error = IcmpErrorInfo();
+				unsigned short nRecvSeq;
+				if (pRecvIcmp != NULL && recvBatch.Source(r) == ulDestIP)
+					nRecvSeq = pRecvIcmp->icmp_sequence;
+				else if (pRecvIcmp == NULL && ParseProbeError(recvBatch.Data(r), recvBatch.Length(r), sRaw, &error) && error.destination == ulDestIP
+				         && IcmpErrorEndsProbe((IcmpErrorClass)error.errorClass))
+					nRecvSeq = error.seq;
+				else
+				{
+					MetricsLocal().Count(METRIC_FOREIGN_PACKETS);
+					++nIgnored;
+					continue;
+				}
+				unsigned long ulTick;
+				if (!window.Complete(nRecvSeq, &ulTick))
+				{
+					++nIgnored;														// Duplicate, or the probe already timed out
+					continue;
+				}
+
+				int size = sizeOfSeq[nRecvSeq];
+				if (pRecvIcmp != NULL)
+				{
+					unsigned long long nRttNs = EchoRttNs(pRecvIcmp, 0, nStampNs);
+					curve.OnReply(size, nRecvSeq, nRttNs);
+					if (pOutput != NULL)
+						pOutput->EmitSize(OUTPUT_REPLY, ulDestIP, nRecvSeq, (unsigned short)sizes[size], ulDestIP, 0, 0, nStampNs, nRttNs);
+				}
+				else
+				{
+					errorCodes.Record(error.type, error.code);
+					curve.OnError(size, error, recvBatch.Source(r));
+					if (pOutput != NULL)
+						pOutput->EmitSize(OUTPUT_ERROR, ulDestIP, nRecvSeq, (unsigned short)sizes[size], recvBatch.Source(r), error.type, error.code,
+						                  nStampNs, ErrorRttNs(error, 0, nStampNs));
+				}
+				++nReceived;
+			}
+		}
+		if (nBatchReceived == TRANSPORT_ERROR)
+		{
+			cout<<"Receiving failed! Error code:"<<TransportLastError()<<endl;
+			return -1;
+		}
+
+		nTimedOut += window.Expire(TransportTickMs(), Timeout, onTimedOut);
+	}
+	if (pOutput != NULL)
+		pOutput->Stop();
+
+	in_addr addr;
+	addr.s_addr = (unsigned int)ulDestIP;
+	cout<<'\n';
+	curve.Print(cout, inet_ntoa(addr), bDontFragment);
+	errorCodes.Print(cout);
+	cout<<"Sizes: "<<nSizes<<", Sent: "<<sendBatch.Packets()<<", Answered: "<<nReceived<<", Timed out: "<<nTimedOut<<", Refused locally: "<<nRefused
+		<<", Ignored: "<<nIgnored<<endl;
+	cout<<"Elapsed: "<<TransportTickMs() - start<<" ms (templates "<<pool.Bytes() / 1024<<" KB, window "<<window.Window()<<", "<<loop.Name()<<")"<<endl;
+	PrintScheduleStats(cout, schedule.Stats());
+	cout<<"Packets per syscall: send "<<PacketsPerCall(sendBatch.Packets(), sendBatch.Calls())
+		<<", receive "<<PacketsPerCall(recvBatch.Packets(), recvBatch.Calls())<<" (batch "<<sendBatch.Capacity()<<")"<<endl;
+	if (pOutput != NULL)
+		cout<<"Records written: "<<pOutput->Written()<<", dropped: "<<pOutput->Dropped()<<endl;
+	return 0;
+}
+
+// Passive watcher. Nothing is sent: every ICMP packet on the interface is read from the capture ring and counted
+// per type/code and per source. A line per second shows the packet rate; Ctrl+C (or nSeconds) ends the run with the
+// per-type table and the busiest sources.
+static volatile sig_atomic_t WatchStopRequested = 0;
+
+void WatchStop(int)
+{
+	WatchStopRequested = 1;
+}
+
+int RunWatch(const char* szInterface, long nSeconds)
+{
+	CaptureRing ring;
+	if (!ring.Open(szInterface))
+	{
+		cout<<"Unable to open the capture ring on "<<szInterface<<"! Error code:"<<TransportLastError()<<endl;
+		return -1;
+	}
+	signal(SIGINT, WatchStop);
+
+	WatchCounters counters;
+	cout<<"Watching ICMP on "<<szInterface<<" ("<<ring.Name()<<"), press Ctrl+C to stop"<<endl;
+	unsigned long long start = TransportMonotonicNs();
+	unsigned long long nextReport = start + 1000000000ULL;
+	unsigned long long lastPackets = 0;
+	while (!WatchStopRequested)
+	{
+		ring.Poll(100, [&counters](const unsigned char* ip, int nLen, int nWireLen, unsigned long long) {
+			counters.Count(ip, nLen, nWireLen);
+		});
+
+		unsigned long long now = TransportMonotonicNs();
+		if (now >= nextReport)
+		{
+			cout<<(now - start) / 1000000000ULL<<" s: "<<counters.Packets() - lastPackets<<" ICMP packets/s, "
+				<<counters.Packets()<<" total, "<<ring.Drops()<<" dropped by the kernel"<<endl;
+			lastPackets = counters.Packets();
+			nextReport += 1000000000ULL;
+		}
+		if (nSeconds > 0 && now - start >= (unsigned long long)nSeconds * 1000000000ULL)
+			break;
+	}
+	signal(SIGINT, SIG_DFL);
+
+	cout<<'\n';
+	counters.Print(cout, 20);
+	cout<<"\nICMP packets: "<<counters.Packets()<<", Bytes: "<<counters.Bytes()<<", Malformed: "<<counters.Malformed()
+		<<", Sources over the table limit: "<<counters.Overflow()<<", Dropped by the kernel: "<<ring.Drops()<<endl;
+	return 0;
+}
+
+
+// Replay mode. A capture (-C, or tcpdump's) goes through the reply matching, statistics and timeouts of the sweep as
+// fast as it can be read, see icmp_Replay.h. Nothing is sent and no socket is opened.
+int RunReplay(const char* szCapture, const RtoConfig& rtoConfig)
+{
+	PcapReader reader;
+	if (!reader.Open(szCapture))
+	{
+		cout<<"Unable to read the capture "<<szCapture<<" (pcap or pcapng)! Error code:"<<TransportLastError()<<endl;
+		return -1;
+	}
+	PcapReplay replay(rtoConfig);
+	replay.Run(reader);
+
+	char line[300];
+	snprintf(line, sizeof(line), "Replayed %s: %s, %zu bytes, %llu records, %llu not IPv4%s\n\n", szCapture, reader.Format() == PCAP_FORMAT_PCAPNG ? "pcapng" : "pcap",
+			 reader.Bytes(), reader.Records(), reader.Skipped(), reader.Damaged() ? ", cut off in the last record" : "");
+	cout<<line;
+	replay.Print(cout);
+	return 0;
+}
+
+// Closes the capture file of -C and prints what went into it, nothing without -C
+void FinishCapture(PcapWriter* pCapture)
+{
+	if (pCapture == NULL)
+		return;
+	bool bOk = pCapture->Close();
+	char line[200], dropped[64] = "";
+	if (pCapture->Dropped() > 0)
+		snprintf(dropped, sizeof(dropped), ", %llu dropped", pCapture->Dropped());
+	snprintf(line, sizeof(line), "Captured: %llu packets, %llu bytes%s%s%s\n", pCapture->Packets(), pCapture->Bytes(),
+			 pCapture->Mapped() ? " (memory mapped)" : "", dropped, bOk ? "" : ", writing FAILED");
+	cout<<line;
+}
+
+// Size of the time-series store written with -o tsdb, nothing for the other formats
+void PrintStoreStats(const TimeSeriesWriter& store)
+{
+	if (store.Records() == 0)
+		return;
+	char line[200];
+	snprintf(line, sizeof(line), "Stored: %llu records in %llu blocks, %llu bytes (%.2f bytes per record)%s\n", store.Records(), store.Blocks(),
+			 store.Bytes(), (double)store.Bytes() / (double)store.Records(), store.Failed() ? ", writing FAILED" : "");
+	cout<<line;
+}
+
+int main(int argc, char *argv[ ]) 
+{ 
+
+	/***** Start WinSock ****/				              		            // read it: https://docs.microsoft.com/en-us/windows/win32/winsock/initializing-winsock
+	int ret;																// TransportStartup() calls WSAStartup on Windows, see icmp_Transport.h
+	
+		if(!TransportStartup())
+		{
+			cout<<"Error to start WinSock 2.2";
+			exit(0);
+		}
+
+	char szDestIp[256] ={0}; 									            // Store the IP address or domain name to be pinged
+
+	    // Check the arguments: the destination (or "-s targets" for the sweep mode) and the mode options.
+		int nWindow = 0;													// 0 keeps the lockstep send/receive loop
+		const char* szTargets = NULL;										// Target list or CIDR ranges of the sweep mode
+		long nRate = 1000;													// Sweep send rate in requests per second
+		const char* szTrace = NULL;											// -T: targets of the traceroute mode
+		int nMaxHops = 30;													// -m: highest TTL probed by the traceroute mode
+		long nFlow = 1;														// -P: ICMP checksum every traceroute probe carries (Paris flow)
+		const char* szSizes = NULL;											// -M: payload sizes of the size sweep mode
+		bool bDontFragment = true;											// -F: let the size sweep's probes be fragmented
+		const char* szWatch = NULL;											// -W: interface of the passive watcher mode
+		long nWatchSeconds = 0;												// -t: watcher run time, 0 runs until Ctrl+C
+		long nBurst = 0;													// -B: sweep requests that may go out back to back (default: one batch)
+		int nShards = 1;													// -j: sweep threads, each with its own socket and icmp_id
+		IcmpSocketKind socketKind = ICMP_SOCKET_RAW;						// -d: unprivileged ping socket (Linux)
+		bool bUring = false;												// -u: io_uring event loop (Linux, built with ICMP_WITH_IO_URING)
+		int nBatch = 32;													// -b: requests per sendmmsg / replies per recvmmsg
+		OutputFormat outputFormat = OUTPUT_TEXT;							// -o: per-probe record format
+		bool bOutputFormat = false;
+		const char* szOutputFile = NULL;									// -f: records go to this file instead of stdout
+		long nMetricsPort = 0;												// -x: serve /metrics on 127.0.0.1:port
+		const char* szMetricsName = NULL;									// -X: publish the metrics in this shared-memory block
+		const char* szInterval = NULL;										// -i: interval in milliseconds, skips the prompt
+		const char* szCount = NULL;											// -c: ping count, skips the prompt
+		RtoConfig rtoConfig = MakeRtoConfig();								// -R: bounds of the adaptive timeout, one value fixes it
+		const char* szCapture = NULL;										// -C: every packet sent and received goes to this pcap/pcapng file
+		bool bCaptureMapped = false;										// -K: write the capture through a memory mapping
+		const char* szReplay = NULL;										// -p: capture of the replay mode
+		bool bArgsOk = argc >= 2;
+		for (int a = 1; bArgsOk && a < argc; ++a)
+		{
+			if (strcmp(argv[a], "-w") == 0 && a + 1 < argc && (nWindow = atoi(argv[a + 1])) > 0)
+				++a;
+			else if (strcmp(argv[a], "-s") == 0 && a + 1 < argc)
+				szTargets = argv[++a];
+			else if (strcmp(argv[a], "-r") == 0 && a + 1 < argc && (nRate = atol(argv[a + 1])) > 0)
+				++a;
+			else if (strcmp(argv[a], "-T") == 0 && a + 1 < argc)
+				szTrace = argv[++a];
+			else if (strcmp(argv[a], "-m") == 0 && a + 1 < argc && (nMaxHops = atoi(argv[a + 1])) > 0 && nMaxHops <= 255)
+				++a;
+			else if (strcmp(argv[a], "-P") == 0 && a + 1 < argc && (nFlow = atol(argv[a + 1])) >= 0 && nFlow <= 65535)
+				++a;
+			else if (strcmp(argv[a], "-M") == 0 && a + 1 < argc)
+				szSizes = argv[++a];
+			else if (strcmp(argv[a], "-F") == 0)
+				bDontFragment = false;
+			else if (strcmp(argv[a], "-W") == 0 && a + 1 < argc)
+				szWatch = argv[++a];
+			else if (strcmp(argv[a], "-t") == 0 && a + 1 < argc && (nWatchSeconds = atol(argv[a + 1])) > 0)
+				++a;
+			else if (strcmp(argv[a], "-B") == 0 && a + 1 < argc && (nBurst = atol(argv[a + 1])) > 0)
+				++a;
+			else if (strcmp(argv[a], "-j") == 0 && a + 1 < argc && (nShards = atoi(argv[a + 1])) > 0 && nShards <= 256)
+				++a;
+			else if (strcmp(argv[a], "-d") == 0)
+				socketKind = ICMP_SOCKET_DGRAM;
+			else if (strcmp(argv[a], "-u") == 0)
+				bUring = true;
+			else if (strcmp(argv[a], "-b") == 0 && a + 1 < argc && (nBatch = atoi(argv[a + 1])) > 0)
+				++a;
+			else if (strcmp(argv[a], "-o") == 0 && a + 1 < argc && ParseOutputFormat(argv[++a], &outputFormat))
+				bOutputFormat = true;
+			else if (strcmp(argv[a], "-f") == 0 && a + 1 < argc)
+				szOutputFile = argv[++a];
+			else if (strcmp(argv[a], "-x") == 0 && a + 1 < argc && (nMetricsPort = atol(argv[a + 1])) > 0 && nMetricsPort <= 65535)
+				++a;
+			else if (strcmp(argv[a], "-X") == 0 && a + 1 < argc)
+				szMetricsName = argv[++a];
+			else if (strcmp(argv[a], "-i") == 0 && a + 1 < argc)
+				szInterval = argv[++a];
+			else if (strcmp(argv[a], "-c") == 0 && a + 1 < argc)
+				szCount = argv[++a];
+			else if (strcmp(argv[a], "-R") == 0 && a + 1 < argc && ParseRtoBounds(argv[a + 1], &rtoConfig))
+				++a;
+			else if (strcmp(argv[a], "-C") == 0 && a + 1 < argc)
+				szCapture = argv[++a];
+			else if (strcmp(argv[a], "-K") == 0)
+				bCaptureMapped = true;
+			else if (strcmp(argv[a], "-p") == 0 && a + 1 < argc)
+				szReplay = argv[++a];
+			else if (a == 1 && argv[a][0] != '-')
+				strncpy(szDestIp, argv[a], sizeof(szDestIp) - 1);
+			else
+				bArgsOk = false;
+		}
+		int nModes = (szDestIp[0] != '\0') + (szTargets != NULL) + (szTrace != NULL) + (szWatch != NULL) + (szReplay != NULL);
+		if (!bArgsOk || nModes != 1 || (nShards > 1 && szTargets == NULL) || (szSizes != NULL && szDestIp[0] == '\0') ||
+			(outputFormat == OUTPUT_TSDB && szOutputFile == NULL) || (szCapture != NULL && (szWatch != NULL || szReplay != NULL)))
+		{
+		 	cout<<"\nCheck your argument again!\n"<<endl;
+		 	return -1;
+		}
+		if (outputFormat != OUTPUT_TEXT && szOutputFile == NULL)
+			cout.rdbuf(cerr.rdbuf());										// Records go to stdout, so prompts and summaries go to stderr
+
+	if (szWatch != NULL)
+	{
+		ret = RunWatch(szWatch, nWatchSeconds);
+		TransportCleanup();
+		return ret;
+	}
+
+	if (szReplay != NULL)
+	{
+		ret = RunReplay(szReplay, rtoConfig);
+		TransportCleanup();
+		return ret;
+	}
+
+	// Counters and histograms of the probe threads, readable while the run goes on (an unlimited run never prints a summary)
+	MetricsExporter exporter;
+	if ((nMetricsPort > 0 || szMetricsName != NULL) && !exporter.Start((unsigned short)nMetricsPort, szMetricsName))
+	{
+		cout<<"\nUnable to start the metrics export! Error code:"<<TransportLastError()<<"\n"<<endl;
+		TransportCleanup();
+		return -1;
+	}
+	if (nMetricsPort > 0)
+		cout<<"Metrics: http://127.0.0.1:"<<nMetricsPort<<"/metrics"<<endl;
+	if (szMetricsName != NULL)
+		cout<<"Metrics snapshot: shared memory \""<<szMetricsName<<"\", every second"<<endl;
+
+	if (nBurst == 0)
+		nBurst = nBatch;
+
+	if (szTrace != NULL && socketKind != ICMP_SOCKET_RAW)
+	{
+		cout<<"\nThe traceroute mode needs a raw socket, ping sockets do not receive time exceeded errors\n"<<endl;
+		TransportCleanup();
+		return -1;
+	}
+	if (szTrace != NULL)
+		szTargets = szTrace;												// Same target lists as the sweep, '@' intervals are not used
+
+	vector<int> sizes;														// Payload bytes: the rest of ICMP_Header and the send stamp at least
+	int nMinSize = (int)(sizeof(ICMP_Header) - 8 + sizeof(unsigned long long));
+	if (szSizes != NULL && !ParseSizeList(szSizes, nMinSize, PacketPoolMaxLength - 8, sizes))
+	{
+		cout<<"\nWrong size list: "<<szSizes<<" (sizes "<<nMinSize<<" to "<<PacketPoolMaxLength - 8<<", at most "<<PacketPoolMaxSizes<<" of them)\n"<<endl;
+		TransportCleanup();
+		return -1;
+	}
+
+	vector<unsigned long> targets;
+	vector<double> intervals;												// Per-target intervals in ms, 0 for the run's interval
+	if (szTargets != NULL)
+	{
+		if (!LoadTargets(szTargets, targets, &intervals))
+		{
+			cout<<"\nWrong target list or CIDR range: "<<szTargets<<"\n"<<endl;
+			TransportCleanup();
+			return -1;
+		}
+		in_addr first;
+		first.s_addr = targets[0];
+		strcpy(szDestIp, inet_ntoa(first));									// The lockstep setup below only needs one valid address
+	}
+		
+	unsigned long ulDestIP = inet_addr(szDestIp);   			            //Converts a dotted decimal IP address to a 32-bit binary representation of the IP address
+															                //In other words, inet_addr function converts the network host address (such as 192.168.1.10) to a network endian binary value
+
+
+      	// Check the written destination IP address whether in right format or not.			    
+		if(ulDestIP == INADDR_NONE)
+		{
+			cout<<"\nWrong IP address format. Host not found!\n"<<endl;
+			TransportCleanup();
+			return -1;
+		}
+	
+
+    // Create a raw socket for sending and receiving ICMP packets 
+    IcmpSocket sRaw;
+    if (!TransportOpen(socketKind, &sRaw))    		        				/*It is a standard command to create a datagram raw socket.
+                                                                            From the moment that it is created, you can send any ICMP packets over it, and
+                                                                            receive any ICMP packets that the host received after that socket was created. 
+                                                                            The protocol number for ICMP is 1. */
+															                // read it: http://www.cs.binghamton.edu/~steflik/cs455/rawip.txt
+
+																		  	// About IPPROTO_IP: It creates a socket that sends/receives raw data for IPv4-based protocols.
+	{
+		cout<<"\nUnable to create the ICMP socket! Error code:"<<TransportLastError()<<"\n"<<endl;
+		TransportCleanup();
+		return -1;
+	}
+
+
+	/*Set receive timeout*/
+	int Timeout=(int)((rtoConfig.maxNs + 999999) / 1000000);									// The longest timeout (-R max, 10 seconds by default); traceroute and the size sweep use it for every probe
+	TransportSetRecvTimeout(sRaw, Timeout);        	
+
+	/*Kernel timestamps*/
+	int nStamps = TransportEnableTimestamps(sRaw, szTargets == NULL && szSizes == NULL);		// TX stamps are matched by sequence number, which a sweep repeats for every target
+	cout.setf(ios::fixed);
+	cout.precision(3);																			// RTTs are printed in ms with microsecond resolution
+	cout<<"RTT timestamps: "<<((nStamps & TRANSPORT_STAMP_RX) ? "kernel RX" : "user space RX")<<((nStamps & TRANSPORT_STAMP_TX) ? ", kernel TX" : "")<<endl;
+																								 /* SO_RCVTIMEO is an option to set a timeout value for input operations.
+
+	/* The sockaddr_in structure specifies the address family.
+	The server, port and IP address of the server to be connected to. */                                                                                           
+	sockaddr_in RecvAddr;
+	RecvAddr.sin_family = AF_INET; 	  				                 // address family					                										
+	RecvAddr.sin_port = htons(0); 						             // port numebr										
+	RecvAddr.sin_addr.s_addr = inet_addr(szDestIp); 	             // destination IP adress	        /* Extra Note: */
+																						         		// SOCKET socket(
+																							     		// int af,		    -> Used to specify the address format used by the socket, only AF_INET is supported in WInsock
+																							     		// int type,	    -> Used to specify the type of socket
+																							     		// int protocol	-> Used with the type parameter to specify the protocol type used. Can be IPPROTO_ICMP
+																							     		// );
+
+	// ICMP packet creation
+	char buff[sizeof(ICMP_Header) + DataLength + 8];				// This buffer should also be large enough to also hold 8 more bytes of data (the size of an ICMP error message) (rfc792 says).
+	ICMP_Header* pIcmp = (ICMP_Header*)buff; 						/* Cast the binary data to our struct. Means, convert the array to the ICMP header type */
+
+
+	//Fill in the ICMP packet data                                  // read it: https://book.huihoo.com/iptables-tutorial/x1078.htm
+	pIcmp->icmp_type = 8;	                                        /* The type field contains the ICMP type of the packet. This is always different from ICMP type to type.
+																	For example ICMP Destination Unreachable packets will have a type 3 set to it. For a complete listing of
+																	the different ICMP types, see the ICMP types appendix. This field contains 8 bits total. */
+
+	pIcmp->icmp_code = 0;										    /* All ICMP types can contain different codes as well. Some types only have a single code, while others have
+																	several codes that they can use. For example, the ICMP Destination Unreachable (type 3) can have at least
+																	code 0, 1, 2, 3, 4 or 5 set. Each code has a different meaning. */
+
+	pIcmp->icmp_id = sRaw.id;		 								/*Get process number as ID  uniquely (the kernel's ping id on ping sockets). It can be adjustable specifically */
+
+	pIcmp->icmp_checksum = 0; 										/*The Checksum is a 16 bit field containing a one's complement of the ones complement of the headers starting with the ICMP type and down.
+																	While calculating the checksum, the checksum field should be set to zero */
+
+	pIcmp->icmp_sequence = 0; 										/* serial number */
+
+	pIcmp->icmp_timestamp = 0; 				
+
+
+	// Fill data part
+	memset(&buff[sizeof(ICMP_Header)], 'Y', DataLength);          // Embed inside the data part with a single letter multiple times
+	pIcmp->icmp_checksum = checksum((unsigned short*)buff, sizeof(ICMP_Header) + DataLength);	// Full checksum once, every request after that is patched
+		
+																										
+	// Start sending and receiving ICMP packets 
+	unsigned short nSeq = 1;   			   						  //Sequence number of the sent ICMP packet
+	char recvBuf[1024] = { 0 };	   								  //Define the receive buffer. We need a pointer to the memory space where the binary data of the packet is stored
+	unsigned long ulFrom = 0;   		   						  //Save the source address of the received data
+	static int Number = 0;				 
+		
+		double n;															// Fractions give sub-millisecond intervals (0.25)
+		if (szInterval != NULL)
+			n = atof(szInterval);
+		else
+		{
+			cout<<"Enter time interval in milliseconds:"<<endl;
+			cin>>n;
+		}
+		unsigned long long nIntervalNs = n > 0 ? (unsigned long long)(n * 1e6) : 0;
+
+
+
+		long long int m;
+		if (szCount != NULL)
+			m = atoll(szCount);
+		else
+		{
+			cout<<"Enter ping count:"<<endl;
+			cin>>m;
+		}
+
+	// Per-probe records are formatted and written by a separate thread, the probe loops only queue them
+	FILE* pOutFile = stdout;
+	if (szOutputFile != NULL && (pOutFile = fopen(szOutputFile, "wb")) == NULL)
+	{
+		cout<<"\nUnable to open the output file: "<<szOutputFile<<"\n"<<endl;
+		TransportClose(sRaw);
+		TransportCleanup();
+		return -1;
+	}
+	OutputWriter output(outputFormat, pOutFile, nShards);				// One ring per sweep shard
+	TimeSeriesWriter store(pOutFile);									// -o tsdb: the writer thread compresses the records into the file
+	if (outputFormat == OUTPUT_TSDB)
+		output.SetSink(&store);
+
+	PcapWriter capture;													// -C: the probe loops hand every packet to its writer thread
+	PcapWriter* pCapture = NULL;
+	if (szCapture != NULL)
+	{
+		if (!capture.Open(szCapture, PcapFormatOf(szCapture), bCaptureMapped, nShards))
+		{
+			cout<<"\nUnable to create the capture file: "<<szCapture<<"\n"<<endl;
+			if (pOutFile != stdout)
+				fclose(pOutFile);
+			TransportClose(sRaw);
+			TransportCleanup();
+			return -1;
+		}
+		pCapture = &capture;
+	}
+	output.Start();
+
+	if (szTrace != NULL)
+	{
+		ret = RunTrace(sRaw, targets, buff, nIntervalNs, m, nMaxHops, (unsigned short)nFlow, nRate, nBurst, Timeout, bUring, nBatch, bOutputFormat ? &output : NULL, pCapture);
+		output.Stop();
+		PrintStoreStats(store);
+		FinishCapture(pCapture);
+		if (pOutFile != stdout)
+			fclose(pOutFile);
+		TransportClose(sRaw);
+		TransportCleanup();
+		return ret;
+	}
+
+	if (szSizes != NULL)
+	{
+		ret = RunSizeSweep(sRaw, ulDestIP, buff, sizes, bDontFragment, nIntervalNs, m, nWindow, nRate, nBurst, Timeout, bUring, nBatch, bOutputFormat ? &output : NULL, pCapture);
+		output.Stop();
+		PrintStoreStats(store);
+		FinishCapture(pCapture);
+		if (pOutFile != stdout)
+			fclose(pOutFile);
+		TransportClose(sRaw);
+		TransportCleanup();
+		return ret;
+	}
+
+	if (szTargets != NULL)
+	{
+		ret = RunSweep(sRaw, targets, intervals, buff, nIntervalNs, m, nRate, nBurst, rtoConfig, bUring, nBatch, nShards, bOutputFormat ? &output : NULL, pCapture);
+		output.Stop();
+		PrintStoreStats(store);
+		FinishCapture(pCapture);
+		if (pOutFile != stdout)
+			fclose(pOutFile);
+		TransportClose(sRaw);
+		TransportCleanup();
+		return ret;
+	}
+
+	RtoTable rto(1, rtoConfig);										// Timeout from the RTTs so far, a loss is noticed in a few RTTs instead of 10 seconds
+	if (nWindow > 0)
+	{
+		ret = RunPipelined(sRaw, ulDestIP, buff, nIntervalNs, m, nWindow, rto, bUring, nBatch, output, pCapture);
+		output.Stop();
+		PrintStoreStats(store);
+		FinishCapture(pCapture);
+		if (pOutFile != stdout)
+			fclose(pOutFile);
+		TransportClose(sRaw);
+		TransportCleanup();
+		return ret;
+	}
+
+	RttStats stats;													// Summary printed after the last ping, fixed size for any ping count
+	LatencyHistogram histogram;
+	IcmpCodeCounts errorCodes;										// ICMP errors quoting our requests, by type and code
+	ScheduleStats schedule;											// Pings go out every interval from the start, not an interval after the reply
+	unsigned long long nDeadlineNs = TransportMonotonicNs();
+	ThreadMetrics& metrics = MetricsLocal();						// The receive call waits for the reply here, so only sends are timed
+	unsigned long nRecvTimeoutMs = (unsigned long)Timeout;			// Receive timeout the socket has now
+
+	for (long long int i = 0; i < m; ++i) 
+ 	
+	{ 
+
+		int nRet; 
+
+		
+		unsigned long nTimeoutMs = rto.TimeoutMs(0);
+		if (nTimeoutMs != nRecvTimeoutMs && TransportSetRecvTimeout(sRaw, nTimeoutMs))
+			nRecvTimeoutMs = nTimeoutMs;
+		unsigned long nSendTick = TransportTickMs();
+		unsigned long long nSendNs = TransportMonotonicNs();
+		PatchEchoRequest(pIcmp, nSeq++, nSendNs);
+		stats.OnSent();
+		schedule.OnSent(nDeadlineNs, nSendNs);
+
+
+
+		// The sendto function sends data to a specific destination.
+		/*  read it: https://docs.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-sendto?source=recommendations */
+		nRet = TransportSendTo(sRaw, buff, sizeof(ICMP_Header) + DataLength, RecvAddr.sin_addr.s_addr); 
+		metrics.Record(METRIC_SEND_CALL_NS, TransportMonotonicNs() - nSendNs);
+		if (nRet > 0)
+			metrics.Count(METRIC_PACKETS_SENT);
+		if (nRet > 0 && pCapture != NULL)
+			pCapture->WriteSent(buff, sizeof(ICMP_Header) + DataLength, RecvAddr.sin_addr.s_addr, 0, nSendNs);
+
+
+		// The recvfrom function receives a datagram, and stores the source address.
+		// A raw socket also sees ICMP packets that are not ours (on loopback even our own request), so keep
+		// receiving until our reply arrives or the timeout has passed.
+		/* read it: https://docs.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-recvfrom?source=recommendations */
+		ICMP_Header* pRecvIcmp;
+		IcmpErrorInfo error;												// An ICMP error quoting this request ends the wait as well
+		bool bError = false;
+		unsigned long long nRecvNs = 0;										// Receive stamp, from the kernel where available
+		do
+		{
+			pRecvIcmp = NULL;
+			nRet = TransportRecvFrom(sRaw, recvBuf, 1024, &ulFrom, &nRecvNs); 
+			if (nRet > 0)
+			{
+				metrics.Count(METRIC_PACKETS_RECEIVED);
+				if (pCapture != NULL)
+					pCapture->WriteReceived(sRaw, recvBuf, nRet, ulFrom, nRecvNs);
+				pRecvIcmp = ParseEchoReply(recvBuf, nRet, sRaw);				// The IP header length comes from the IHL field, not a fixed 20 bytes
+			}
+			if (nRet > 0 && pRecvIcmp == NULL)
+			{
+				if (ParseProbeError(recvBuf, nRet, sRaw, &error) && error.destination == RecvAddr.sin_addr.s_addr)
+				{
+					errorCodes.Record(error.type, error.code);
+					bError = error.seq == pIcmp->icmp_sequence && IcmpErrorEndsProbe((IcmpErrorClass)error.errorClass);
+				}
+				else
+					metrics.Count(METRIC_FOREIGN_PACKETS);
+			}
+			if (pRecvIcmp != NULL && pRecvIcmp->icmp_sequence != pIcmp->icmp_sequence)
+			{
+				if (stats.OnReply(pRecvIcmp->icmp_sequence, true) == REPLY_LATE)	// A late or duplicate reply to an earlier request
+					rto.Sample(0, EchoRttNs(pRecvIcmp, 0, nRecvNs));				// Late is still a sample of the path
+				pRecvIcmp = NULL;
+			}
+		}
+		while (nRet > 0 && pRecvIcmp == NULL && !bError && TransportTickMs() - nSendTick < nTimeoutMs);
+
+
+
+		bool bTimedOut = pRecvIcmp == NULL && !bError;
+			if(bTimedOut)
+			{
+				if(nRet == TRANSPORT_ERROR)
+				{
+					cout<<"Receiving failed! Error code:"<<TransportLastError()<<endl;
+					return -1;
+				}
+				output.Emit(OUTPUT_TIMEOUT, RecvAddr.sin_addr.s_addr, pIcmp->icmp_sequence, TransportMonotonicNs(), 0);
+				stats.OnLost();
+				metrics.Count(METRIC_TIMEOUTS);
+				rto.OnTimeout(0);												// receive time out: counted lost, the next request goes out on schedule
+			}
+		
+
+		// parsing(ayristirma) the received ICMP packet
+		unsigned long long nTxNs = 0;										// Kernel send stamp of this request (the OPT_ID counter is the sequence number - 1)
+		TransportTxStamp txStamp;
+		while (TransportRecvTxStamps(sRaw, &txStamp, 1) > 0)
+			if ((unsigned short)(txStamp.id + 1) == pIcmp->icmp_sequence)
+				nTxNs = txStamp.ns;
+		if (bError)
+		{
+			stats.OnError();												// Not an RTT: the request never reached an echo responder
+			output.EmitError(RecvAddr.sin_addr.s_addr, pIcmp->icmp_sequence, ulFrom, error.type, error.code, nRecvNs, ErrorRttNs(error, nTxNs, nRecvNs));
+		}
+		else if (!bTimedOut)
+		{
+			unsigned long long nRttNs = EchoRttNs(pRecvIcmp, nTxNs, nRecvNs);
+			stats.OnReply(pRecvIcmp->icmp_sequence);
+			stats.Record(nRttNs);
+			histogram.Record(nRttNs);
+			rto.Sample(0, nRttNs);
+			++Number;
+
+			output.Emit(OUTPUT_REPLY, ulFrom, pRecvIcmp->icmp_sequence, nRecvNs, nRttNs);	// The writer thread prints it, the sleep below is not delayed by the terminal
+		}
+
+		// Sleep until the next deadline. If the reply took longer than the interval, the deadlines it covered are skipped.
+		unsigned long long nMissed;
+		nDeadlineNs = ScheduleStats::NextDeadline(nDeadlineNs, nIntervalNs, TransportMonotonicNs(), &nMissed);
+		if (nMissed > (unsigned long long)(m - 1 - i))
+			nMissed = (unsigned long long)(m - 1 - i);
+		schedule.OnSkipped(nMissed);
+		i += (long long int)nMissed;
+		TransportSleepUntilNs(nDeadlineNs);
+  } 
+	output.Stop();
+	cout<<'\n';
+	PrintRttStats(cout, szDestIp, stats, &histogram);
+	errorCodes.Print(cout);
+	rto.Print(cout);
+	PrintScheduleStats(cout, schedule);
+	cout<<"Records written: "<<output.Written()<<", dropped: "<<output.Dropped()<<endl;
+	PrintStoreStats(store);
+	FinishCapture(pCapture);
+	if (pOutFile != stdout)
+		fclose(pOutFile);
+	TransportClose(sRaw);
+	TransportCleanup();
+ 	return 0;
+} 
+
+
+/* Data must include min. 8 bytes of data for ICMP error messages. The data portion is mandatory in reply packets, if there is a data portion in the
+/* request packet. The answering system must send a reply containing exactly the same data portion. The RFC792 does not specify if the data portion
+/* in the request packet is mandatory. The Data in this schema is not marked as (optional) as in many other RFCs. */
+																				
+ /*  0                   1                   2                   3
+     0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+     +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-
+     |     Type      |        Code   |          Checksum            |
+     +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-
+     |           Identifier          |        Sequence Number       |
+     +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-
+     |     Data ...														  // read it: https://superuser.com/questions/1086312/why-does-icmp-echo-request-and-echo-reply-packets-contain-a-data-portion 
+     +-+-+-+-+-                                                          */  
+																				
+																				
+/* However, sending a ping with zero bytes of data is entirely possible. On Windows try: ping <destination> -l 0
+																				
+To put in a nutshell, this proves that the Data-portion in an ICMP-Echo-Request is optional.  */
+
+
+/* To inject our own packets, all we need to know is the structures of the
+protocols that need to be included. Below you will find a short introduction to
+the ICMP header. */
+
+/* The data types/sizes we need to use are:
+ unsigned char      --> 1 byte (8 bits),
+ unsigned short int --> 2 bytes (16 bits)
+ unsigned int       --> 4 bytes (32 bits) */
+// read it : http://www.cs.binghamton.edu/~steflik/cs455/rawip.txt
+
+ /* IP itself has no mechanism for establishing and maintaining a connection, or
+ even containing data as a direct payload. Internet Control Messaging Protocol
+is an addition to IP to carry error, routing and control messages and
+ data, and is often considered as a protocol of the network layer. */	
+
+
+/* ============================================================================== */
+
+
+/* The usage of Timestamp:
+
+read it: https://www.rfc-editor.org/rfc/rfc1122 
+
+The use of the ICMP Timestamps is optional, and may, or may not, be implemented.
+You may find many hosts or network devices do not implement this option.  */
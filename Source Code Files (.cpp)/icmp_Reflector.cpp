@@ -0,0 +1,225 @@
+/* ICMP Packet Watcher - Echo reflector for load tests (Linux) */
+
+/* Answers echo requests in place of the kernel, with configurable delay, jitter, loss, duplication and reordering
+   (see icmp_Reflector.h), so the prober can be tested against a "network" of known behaviour without leaving the
+   machine. Run it on the far end of a veth pair in a network namespace, or on loopback in a namespace of its own.
+   The kernel keeps answering too, so switch its echo replies off where the reflector runs, or every request is
+   answered twice:  sysctl -w net.ipv4.icmp_echo_ignore_all=1
+
+   Requests are read from a raw ICMP socket with a kernel filter that passes only echo requests, a batch per recvmmsg,
+   or with -i from an AF_PACKET TPACKET_V3 ring on that interface. The ring sees requests for any destination that
+   reaches the interface, so one reflector can answer a whole routed range (10.0.0.0/16 for a sweep); it hands
+   packets over at least every millisecond. Replies go out in batches per sendmmsg on an IP_HDRINCL socket, with the
+   request's destination as their source.
+
+   To compile: g++ -O2 -pthread icmp_Reflector.cpp -o icmp_Reflector  (or the icmp_Reflector target of the CMake build)
+   To run: ./icmp_Reflector [-i interface] [-d delay] [-j jitter] [-l loss] [-D duplicate] [-r reorder [-g gap]] [-b batch] [-q queue] [-t seconds] [-S seed]
+   Times are in milliseconds and may be fractional (0.05), probabilities in percent (0.1).
+   For instance ./icmp_Reflector -d 20 -j 5 -l 1 answers after 15 to 25 ms and drops 1% of the requests. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <iostream>
+#include "icmp_Transport.h"
+#include "icmp_Batch.h"
+#include "icmp_Reflector.h"
+
+using namespace std;
+
+#define ReflectorBufferBytes (4 << 20)										// Socket buffers: a burst of a few thousand requests
+
+static volatile sig_atomic_t ReflectorStopRequested = 0;
+
+void ReflectorStop(int)
+{
+	ReflectorStopRequested = 1;
+}
+
+// Milliseconds, possibly fractional, as nanoseconds; false unless the value is a number from 0 to an hour
+bool ParseMs(const char* text, unsigned long long* ns)
+{
+	char* end;
+	double ms = strtod(text, &end);
+	if (end == text || *end != '\0' || ms < 0 || ms > 3600000)
+		return false;
+	*ns = (unsigned long long)(ms * 1000000.0 + 0.5);
+	return true;
+}
+
+// Percent as parts per million; false unless the value is from 0 to 100
+bool ParsePercent(const char* text, unsigned int* ppm)
+{
+	char* end;
+	double percent = strtod(text, &end);
+	if (end == text || *end != '\0' || percent < 0 || percent > 100)
+		return false;
+	*ppm = (unsigned int)(percent * 10000.0 + 0.5);
+	return true;
+}
+
+// Warns when the kernel would answer the same requests
+void CheckKernelEcho()
+{
+	FILE* file = fopen("/proc/sys/net/ipv4/icmp_echo_ignore_all", "r");
+	int ignore = 1;
+	if (file != NULL)
+	{
+		if (fscanf(file, "%d", &ignore) != 1)
+			ignore = 1;
+		fclose(file);
+	}
+	if (ignore == 0)
+		cout<<"Warning: the kernel answers echo requests too, local addresses get two replies per request "
+		      "(sysctl -w net.ipv4.icmp_echo_ignore_all=1)"<<endl;
+}
+
+int main(int argc, char* argv[])
+{
+	FaultConfig faults;
+	memset(&faults, 0, sizeof(faults));
+	faults.reorderGapNs = 1000000;											// -g: a reordered reply is 1 ms late by default
+	const char* szInterface = NULL;											// -i: AF_PACKET ring instead of the raw socket
+	int nBatch = 64;														// -b: requests per recvmmsg, replies per sendmmsg
+	long nQueue = 65536;													// -q: replies held at most
+	long nSeconds = 0;														// -t: run time, 0 runs until Ctrl+C
+	unsigned long long nSeed = TransportMonotonicNs();						// -S: fault pattern, the same seed repeats it
+	bool bArgsOk = true;
+	for (int a = 1; bArgsOk && a < argc; ++a)
+	{
+		const char* value = a + 1 < argc ? argv[a + 1] : NULL;
+		if (value == NULL)
+			bArgsOk = false;
+		else if (strcmp(argv[a], "-i") == 0)
+			szInterface = value;
+		else if (strcmp(argv[a], "-d") == 0)
+			bArgsOk = ParseMs(value, &faults.delayNs);
+		else if (strcmp(argv[a], "-j") == 0)
+			bArgsOk = ParseMs(value, &faults.jitterNs);
+		else if (strcmp(argv[a], "-g") == 0)
+			bArgsOk = ParseMs(value, &faults.reorderGapNs);
+		else if (strcmp(argv[a], "-l") == 0)
+			bArgsOk = ParsePercent(value, &faults.lossPpm);
+		else if (strcmp(argv[a], "-D") == 0)
+			bArgsOk = ParsePercent(value, &faults.duplicatePpm);
+		else if (strcmp(argv[a], "-r") == 0)
+			bArgsOk = ParsePercent(value, &faults.reorderPpm);
+		else if (strcmp(argv[a], "-b") == 0)
+			bArgsOk = (nBatch = atoi(value)) > 0 && nBatch <= TRANSPORT_MAX_BATCH;
+		else if (strcmp(argv[a], "-q") == 0)
+			bArgsOk = (nQueue = atol(value)) > 0 && nQueue <= (1L << 24);
+		else if (strcmp(argv[a], "-t") == 0)
+			bArgsOk = (nSeconds = atol(value)) > 0;
+		else if (strcmp(argv[a], "-S") == 0)
+			nSeed = strtoull(value, NULL, 10);
+		else
+			bArgsOk = false;
+		++a;
+	}
+	if (!bArgsOk)
+	{
+		cout<<"Usage: "<<argv[0]<<" [-i interface] [-d delay] [-j jitter] [-l loss] [-D duplicate] [-r reorder [-g gap]]"
+		      " [-b batch] [-q queue] [-t seconds] [-S seed]"<<endl;
+		cout<<"Times in milliseconds, probabilities in percent, for instance: "<<argv[0]<<" -d 20 -j 5 -l 1"<<endl;
+		return 1;
+	}
+
+	IcmpSocket sSend;
+	if (!TransportOpenIpSender(&sSend))
+	{
+		cout<<"Unable to open the sending socket (root or CAP_NET_RAW needed)! Error code:"<<TransportLastError()<<endl;
+		return 1;
+	}
+	TransportSetNonBlocking(sSend);
+	TransportSetBufferSize(sSend, ReflectorBufferBytes);
+
+	IcmpSocket sRecv;
+	CaptureRing ring;
+	TransportLoop loop;
+	RecvBatch recvBatch(nBatch, 65536);										// Reassembled requests may be up to 64 KB
+	if (szInterface != NULL)
+	{
+		if (!ring.Open(szInterface, 1u << 18, 64, 1))
+		{
+			cout<<"Unable to open the capture ring on "<<szInterface<<"! Error code:"<<TransportLastError()<<endl;
+			return 1;
+		}
+		ring.IgnoreOutgoing();												// Requests this host sends are not ours to answer
+	}
+	else if (!TransportOpen(ICMP_SOCKET_RAW, &sRecv) || !TransportFilterEchoRequests(sRecv) || !TransportSetNonBlocking(sRecv) ||
+	         !loop.Init(false) || !loop.Add(sRecv, &sRecv))
+	{
+		cout<<"Unable to open the raw socket (root or CAP_NET_RAW needed)! Error code:"<<TransportLastError()<<endl;
+		return 1;
+	}
+	else
+		TransportSetBufferSize(sRecv, ReflectorBufferBytes);
+
+	CheckKernelEcho();
+	Reflector reflector(faults, (unsigned int)nQueue, nBatch, nSeed);
+	char line[256];
+	snprintf(line, sizeof(line), "Reflecting echo requests (%s), delay %.3f ms, jitter %.3f ms, loss %.4g%%, duplicate %.4g%%, reorder %.4g%% by %.3f ms\n",
+	         szInterface != NULL ? ring.Name() : "raw socket", faults.delayNs / 1e6, faults.jitterNs / 1e6, faults.lossPpm / 1e4,
+	         faults.duplicatePpm / 1e4, faults.reorderPpm / 1e4, faults.reorderGapNs / 1e6);
+	cout<<line<<"Press Ctrl+C to stop"<<endl;
+	signal(SIGINT, ReflectorStop);
+	signal(SIGTERM, ReflectorStop);
+
+	unsigned long long start = TransportMonotonicNs();
+	unsigned long long nextReport = start + 1000000000ULL;
+	unsigned long long lastRequests = 0, lastReplies = 0;
+	reflector.Start(start);
+	while (!ReflectorStopRequested)
+	{
+		// Wait for requests until the next held reply is due (at most 100 ms, so Ctrl+C and the report are seen)
+		long long untilNs = reflector.NsUntilNext(TransportMonotonicNs());
+		long waitMs = untilNs < 0 || untilNs > 100000000LL ? 100 : (long)(untilNs / 1000000LL);
+		if (szInterface != NULL)
+			ring.Poll(waitMs, [&reflector](const unsigned char* ip, int nLen, int nWireLen, unsigned long long) {
+				if (nLen == nWireLen)
+					reflector.OnRequest(ip, nLen, TransportMonotonicNs());
+			});
+		else
+		{
+			void* ready[1];
+			loop.Wait(ready, 1, waitMs);
+			int nReceived;
+			while ((nReceived = recvBatch.Receive(sRecv)) > 0)
+			{
+				unsigned long long now = TransportMonotonicNs();
+				for (int r = 0; r < nReceived; ++r)
+					reflector.OnRequest((const unsigned char*)recvBatch.Data(r), recvBatch.Length(r), now);
+				reflector.Advance(now);
+				reflector.Flush(sSend);
+			}
+		}
+
+		unsigned long long now = TransportMonotonicNs();
+		reflector.Advance(now);
+		reflector.Flush(sSend);
+		if (now >= nextReport)
+		{
+			snprintf(line, sizeof(line), "%llu s: %llu requests/s, %llu replies/s, %u held, %llu lost, %llu duplicated, %llu reordered\n",
+			         (now - start) / 1000000000ULL, reflector.Requests() - lastRequests, reflector.Replies() - lastReplies, reflector.Held(),
+			         reflector.Lost(), reflector.Duplicated(), reflector.Reordered());
+			cout<<line<<flush;
+			lastRequests = reflector.Requests();
+			lastReplies  = reflector.Replies();
+			nextReport += 1000000000ULL;
+		}
+		if (nSeconds > 0 && now - start >= (unsigned long long)nSeconds * 1000000000ULL)
+			break;
+	}
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+
+	cout<<'\n';
+	reflector.Print(cout);
+	if (szInterface != NULL)
+		cout<<"Dropped by the kernel: "<<ring.Drops()<<endl;
+	TransportClose(sSend);
+	if (szInterface == NULL)
+		TransportClose(sRecv);
+	return 0;
+}
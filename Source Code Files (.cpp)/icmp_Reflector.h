@@ -0,0 +1,260 @@
+/* ICMP Packet Watcher - Echo reflector with fault injection */
+
+/* The reflector (icmp_Reflector.cpp) answers echo requests in user space, in place of the kernel, so a test network
+   can be made as slow and lossy as a real one and the prober can be driven at rates the kernel's echo path does not
+   shape. Per request, in this order:
+     loss        the request is dropped with probability lossPpm / 10^6
+     delay       the reply is held for delayNs plus a uniform jitter in [-jitterNs, +jitterNs] (never below 0). With
+                 jitter the replies overtake each other, as they do behind netem's jitter.
+     reorder     with probability reorderPpm / 10^6 the reply is held reorderGapNs longer, so the replies behind it
+                 go out first
+     duplicate   with probability duplicatePpm / 10^6 a second copy follows, with a delay of its own
+   The reply is built from the request (ICMP_Header and checksum() of icmp_Echo.h and icmp_Checksum.h): addresses
+   swapped, a fresh 20-byte IP header (request options are not echoed), type 0 with the checksum patched for the type
+   change only, the data untouched. Held replies wait in fixed slots on a TimingWheel (10 us ticks); a slot keeps its
+   buffer, so once every slot has seen its largest reply nothing is allocated. Replies that are due leave in batches
+   of up to "batch" per TransportSendBatch (sendmmsg) over an IP_HDRINCL socket. Without delay, jitter and reordering
+   a reply is queued for the next batch right away and the wheel is not used.
+
+   A request that is not a complete echo request (a fragment, a truncated packet, a bad ICMP checksum) is counted and
+   not answered. When every slot is taken, new requests are dropped and counted as QueueFull(). */
+
+#ifndef ICMP_REFLECTOR_H
+#define ICMP_REFLECTOR_H
+
+#include <stdio.h>
+#include <string.h>
+#include <ostream>
+#include <vector>
+#include "icmp_Checksum.h"
+#include "icmp_Echo.h"
+#include "icmp_Scheduler.h"
+#include "icmp_Transport.h"
+#include "icmp_Watcher.h"
+
+struct FaultConfig
+{
+    unsigned long long delayNs;
+    unsigned long long jitterNs;
+    unsigned long long reorderGapNs;                                        // Extra hold of a reordered reply
+    unsigned int       lossPpm;                                             // Probabilities in parts per million
+    unsigned int       duplicatePpm;
+    unsigned int       reorderPpm;
+};
+
+class Reflector
+{
+public:
+    Reflector(const FaultConfig& faults, unsigned int queueCapacity, int batch, unsigned long long seed)
+        : faults_(faults), wheel_(queueCapacity), slots_(queueCapacity), random_(seed | 1), requests_(0), replies_(0),
+          lost_(0), duplicated_(0), reordered_(0), queueFull_(0), malformed_(0), badChecksum_(0), sendErrors_(0),
+          calls_(0), packets_(0)
+    {
+        batch_ = batch < 1 ? 1 : (batch > TRANSPORT_MAX_BATCH ? TRANSPORT_MAX_BATCH : batch);
+        free_.reserve(queueCapacity);
+        for (unsigned int i = queueCapacity; i > 0; --i)
+            free_.push_back(i - 1);
+        due_.reserve(queueCapacity);
+        outgoing_.resize(batch_);
+        held_ = faults_.delayNs > 0 || faults_.jitterNs > 0 || faults_.reorderPpm > 0;
+    }
+
+    void Start(unsigned long long nowNs) { wheel_.Start(nowNs); }
+
+    // One received IPv4 datagram (ip points to the IP header). Queues its reply, or its replies, unless it is dropped.
+    void OnRequest(const unsigned char* ip, int len, unsigned long long nowNs)
+    {
+        IcmpPacketInfo info;
+        if (!ParseIcmpPacket(ip, len, &info) || (ip[6] & 0x20) != 0 || ((ip[2] << 8) | ip[3]) > len || info.type != 8 ||
+            info.code != 0 || info.icmpLength < (int)sizeof(ICMP_Header) - 4 || info.icmpLength > 65535 - 20)
+        {
+            ++malformed_;                                                   // A fragment, truncated, or not an echo request
+            return;
+        }
+        if (checksum((const unsigned short*)info.icmp, info.icmpLength) != 0)
+        {
+            ++badChecksum_;
+            return;
+        }
+        ++requests_;
+        if (Chance(faults_.lossPpm))
+        {
+            ++lost_;
+            return;
+        }
+        int copies = 1;
+        if (Chance(faults_.duplicatePpm))
+        {
+            ++duplicated_;
+            copies = 2;
+        }
+        for (int c = 0; c < copies; ++c)
+        {
+            if (free_.empty())
+            {
+                ++queueFull_;
+                return;
+            }
+            unsigned int slot = free_.back();
+            free_.pop_back();
+            BuildReply(info, slots_[slot]);
+            if (!held_)
+            {
+                due_.push_back(slot);
+                continue;
+            }
+            unsigned long long delayNs = faults_.delayNs;
+            if (faults_.jitterNs > 0)
+            {
+                unsigned long long offset = Random() % (2 * faults_.jitterNs + 1);
+                delayNs = delayNs + offset > faults_.jitterNs ? delayNs + offset - faults_.jitterNs : 0;
+            }
+            if (Chance(faults_.reorderPpm))
+            {
+                ++reordered_;
+                delayNs += faults_.reorderGapNs;
+            }
+            wheel_.Schedule(slot, nowNs + delayNs);
+        }
+    }
+
+    // Moves the held replies that are due to the send queue
+    void Advance(unsigned long long nowNs)
+    {
+        if (wheel_.Size() > 0)
+            wheel_.Advance(nowNs, [this](unsigned int slot, unsigned long long) { due_.push_back(slot); });
+    }
+
+    /* Sends the due replies, a batch per call, until they are all out or the socket buffer is full (the rest stay
+       queued). A reply the kernel refuses is dropped and counted in SendErrors(). Returns the number sent. */
+    int Flush(IcmpSocket& sender)
+    {
+        int sent = 0;
+        size_t next = 0;
+        while (next < due_.size())
+        {
+            int count = (int)(due_.size() - next) < batch_ ? (int)(due_.size() - next) : batch_;
+            for (int i = 0; i < count; ++i)
+            {
+                std::vector<char>& reply = slots_[due_[next + i]];
+                outgoing_[i].data = &reply[0];
+                outgoing_[i].len  = (int)reply.size();
+                unsigned int destination;
+                memcpy(&destination, &reply[16], 4);                        // From the reply's IP header
+                outgoing_[i].addr = destination;
+                outgoing_[i].ttl  = 0;
+            }
+            int nRet = TransportSendBatch(sender, &outgoing_[0], count);
+            ++calls_;
+            if (nRet == TRANSPORT_WOULD_BLOCK)
+                break;
+            if (nRet == TRANSPORT_ERROR)
+            {
+                ++sendErrors_;
+                nRet = 1;
+            }
+            else
+            {
+                packets_ += nRet;
+                replies_ += nRet;
+                sent += nRet;
+            }
+            for (int i = 0; i < nRet; ++i)
+                free_.push_back(due_[next + i]);
+            next += nRet;
+        }
+        due_.erase(due_.begin(), due_.begin() + next);
+        return sent;
+    }
+
+    // Nanoseconds until a reply is due (0 if one is waiting to be sent), -1 if none is held
+    long long NsUntilNext(unsigned long long nowNs) const
+    {
+        return !due_.empty() ? 0 : wheel_.NsUntilNext(nowNs);
+    }
+
+    unsigned long long Requests() const    { return requests_; }             // Complete echo requests with a valid checksum
+    unsigned long long Replies() const     { return replies_; }
+    unsigned long long Lost() const        { return lost_; }
+    unsigned long long Duplicated() const  { return duplicated_; }
+    unsigned long long Reordered() const   { return reordered_; }
+    unsigned long long QueueFull() const   { return queueFull_; }
+    unsigned long long Malformed() const   { return malformed_; }
+    unsigned long long BadChecksum() const { return badChecksum_; }
+    unsigned long long SendErrors() const  { return sendErrors_; }
+    unsigned long long Calls() const       { return calls_; }
+    unsigned long long Packets() const     { return packets_; }
+    unsigned int       Held() const        { return wheel_.Size() + (unsigned int)due_.size(); }
+
+    void Print(std::ostream& out) const
+    {
+        char line[256];
+        snprintf(line, sizeof(line), "Requests: %llu, Replies: %llu, Lost: %llu, Duplicated: %llu, Reordered: %llu\n",
+                 requests_, replies_, lost_, duplicated_, reordered_);
+        out<<line;
+        snprintf(line, sizeof(line), "Dropped: %llu (queue full), %llu (send errors); Not answered: %llu (not an echo request), %llu (bad checksum)\n",
+                 queueFull_, sendErrors_, malformed_, badChecksum_);
+        out<<line;
+        snprintf(line, sizeof(line), "Replies per syscall: %.1f (batch %d)\n", calls_ == 0 ? 0.0 : (double)packets_ / (double)calls_, batch_);
+        out<<line;
+    }
+
+private:
+    // Writes the reply to the request into buffer: IP header without options, then the ICMP message as type 0
+    static void BuildReply(const IcmpPacketInfo& request, std::vector<char>& buffer)
+    {
+        int len = 20 + request.icmpLength;
+        buffer.resize(len);
+        unsigned char* ip = (unsigned char*)&buffer[0];
+        ip[0]  = 0x45;
+        ip[1]  = 0;
+        ip[2]  = (unsigned char)(len >> 8);
+        ip[3]  = (unsigned char)len;
+        memset(ip + 4, 0, 4);                                               // IP id 0 is filled in by the kernel, no fragment flags
+        ip[8]  = 64;
+        ip[9]  = 1;
+        ip[10] = 0;
+        ip[11] = 0;
+        unsigned int address = (unsigned int)request.destination;
+        memcpy(ip + 12, &address, 4);
+        address = (unsigned int)request.source;
+        memcpy(ip + 16, &address, 4);
+        unsigned short ipChecksum = checksum((const unsigned short*)ip, 20);
+        memcpy(ip + 10, &ipChecksum, 2);
+
+        ICMP_Header* pIcmp = (ICMP_Header*)(ip + 20);
+        memcpy(pIcmp, request.icmp, request.icmpLength);
+        unsigned short oldWord, newWord;
+        memcpy(&oldWord, pIcmp, 2);
+        pIcmp->icmp_type = 0;
+        memcpy(&newWord, pIcmp, 2);
+        pIcmp->icmp_checksum = ChecksumUpdate16(pIcmp->icmp_checksum, oldWord, newWord);
+    }
+
+    bool Chance(unsigned int ppm)
+    {
+        return ppm > 0 && Random() % 1000000 < ppm;
+    }
+
+    unsigned long long Random()                                             // xorshift64, as in ProbeScheduler
+    {
+        random_ ^= random_ << 13;
+        random_ ^= random_ >> 7;
+        random_ ^= random_ << 17;
+        return random_;
+    }
+
+    FaultConfig                    faults_;
+    bool                           held_;                                   // Replies go through the wheel
+    int                            batch_;
+    TimingWheel                    wheel_;                                  // Held replies by slot, due at their send time
+    std::vector<std::vector<char>> slots_;                                  // Reply per slot, the buffer is reused
+    std::vector<unsigned int>      free_;
+    std::vector<unsigned int>      due_;                                    // Slots to send, in the order they became due
+    std::vector<TransportPacket>   outgoing_;
+    unsigned long long             random_;
+    unsigned long long             requests_, replies_, lost_, duplicated_, reordered_, queueFull_, malformed_, badChecksum_,
+                                   sendErrors_, calls_, packets_;
+};
+
+#endif // ICMP_REFLECTOR_H
@@ -0,0 +1,268 @@
+/* ICMP Packet Watcher - Offline replay of a capture through the receive path */
+
+/* -p file feeds a capture (icmp_Pcap.h) through what the sweep does with every packet it receives, as fast as the
+   packets can be read, with no network and no clock but the capture's own. Replies with IP options, truncated
+   errors, duplicates and late replies from production traffic can so be reproduced, and the receive path
+   benchmarked at millions of packets per second.
+
+   Two passes over the capture:
+     1. The echo requests in it give the targets: their destinations, sorted, go into a TargetStore as in the sweep,
+        which keeps every per-target counter and the RTT moments the summary is printed from.
+     2. Every packet in capture order. A request is put in flight (InFlightTable in deadline mode, with the timeout
+        TargetStore::TimeoutNs gives its target), a reply goes through ParseEchoReply and is matched, classified and
+        recorded as in RunSweepShard, an ICMP error through ParseIcmpError. Requests whose deadline has passed on the
+        capture's clock (the latest stamp seen so far) are counted lost before each packet, the ones still in flight
+        at the end of the capture after it.
+   Replies are matched by icmp_id against the ids of the requests in the capture, so the id the prober had and the
+   ids of several shards need no option. The RTT is the time between the two packets in the capture, not the send
+   stamp in the payload: the capture's clock is the only one every capture has. A late reply is counted but gives
+   no RTO sample, its request is no longer known. */
+
+#ifndef ICMP_REPLAY_H
+#define ICMP_REPLAY_H
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include <ostream>
+#include <vector>
+#include "icmp_Echo.h"
+#include "icmp_InFlightTable.h"
+#include "icmp_Metrics.h"
+#include "icmp_Pcap.h"
+#include "icmp_Rto.h"
+#include "icmp_Stats.h"
+#include "icmp_TargetStore.h"
+#include "icmp_Types.h"
+
+class PcapReplay
+{
+public:
+    explicit PcapReplay(const RtoConfig& config)
+        : config_(config), shift_(0), packets_(0), requests_(0), repeated_(0), replies_(0), errors_(0), truncatedErrors_(0),
+          foreign_(0), other_(0), malformed_(0), timedOut_(0), checksumFailures_(0), elapsedNs_(0)
+    {
+        // Send times are kept in the table's 32-bit ticks: as fine as they can be while the longest timeout still fits
+        while ((0xFFFFFFFFULL << shift_) < config_.maxNs * 2)
+            ++shift_;
+    }
+
+    // Replays the whole capture, once per PcapReplay; the results are read with the accessors below or printed by Print()
+    void Run(PcapReader& reader)
+    {
+        unsigned long long startNs = TransportMonotonicNs();
+        unsigned long long checksumFailures = MetricsLocal().counters[METRIC_CHECKSUM_FAILURES].load(std::memory_order_relaxed);
+        FindTargets(reader);
+
+        unsigned int nTargets = (unsigned int)targets_.size();
+        store_.reset(new TargetStore(nTargets > 0 ? nTargets : 1));
+        TargetStore& store = *store_;
+        std::vector<unsigned int> ids(nTargets);
+        if (nTargets > 0)
+            store.Add(&targets_[0], NULL, nTargets, 0, &ids[0]);             // Sorted and unique: id == index
+        InFlightTable inFlight((unsigned int)std::min<unsigned long long>(requests_ > 0 ? requests_ : 1, 1u << 22));
+
+        PcapPacket packet;
+        bool started = false;
+        unsigned long long firstNs = 0, nowNs = 0;
+        reader.Rewind();
+        while (reader.Next(&packet))
+        {
+            ++packets_;
+            if (!started)
+            {
+                inFlight.UseDeadlines(packet.timeNs, config_.granularityNs);
+                firstNs = nowNs = packet.timeNs;
+                started = true;
+            }
+            if (packet.timeNs > nowNs)
+                nowNs = packet.timeNs;
+            timedOut_ += inFlight.ExpireDue(nowNs, [&](const InFlightEntry& entry) { Lost(store, entry); });
+
+            int ipHeaderLen = (packet.ip[0] & 0x0F) * 4;
+            if (ipHeaderLen < 20 || packet.length < ipHeaderLen + 8)
+            {
+                ++malformed_;
+                continue;
+            }
+            const unsigned char* ip = packet.ip;
+            const unsigned char* icmp = ip + ipHeaderLen;
+            if (ip[9] != 1 || ((ip[6] & 0x1F) | ip[7]) != 0)                 // Not ICMP, or a fragment after the first
+            {
+                ++other_;
+                continue;
+            }
+            // On the capture's clock too: a stamp that goes backwards (an NTP step, merged captures) gets the tick of the latest one
+            unsigned int tick = (unsigned int)((nowNs - firstNs) >> shift_);
+
+            if (icmp[0] == 8)
+            {
+                unsigned int address;
+                unsigned short seq;
+                memcpy(&address, ip + 16, 4);
+                memcpy(&seq, icmp + 6, 2);
+                unsigned int target = store.Find(address);
+                // The same request seen twice (the prober's own request looped back to its raw socket) counts once
+                if (!inFlight.Insert(InFlightTable::MakeKey(address, seq), target, tick, packet.timeNs + store.TimeoutNs(target, config_)))
+                {
+                    ++repeated_;
+                    continue;
+                }
+                store.OnSent(target);
+                continue;
+            }
+
+            IcmpSocket view;                                                // The socket the packet would have arrived on
+            memset(&view, 0, sizeof(view));
+            view.kind = ICMP_SOCKET_RAW;
+            view.hasIpHeader = true;
+            memcpy(&view.id, icmp + 4, 2);
+            InFlightEntry entry;
+            if (icmp[0] == 0)
+            {
+                unsigned int source;
+                memcpy(&source, ip + 12, 4);
+                ICMP_Header* pRecvIcmp = IdSeen(view.id) ? ParseEchoReply((char*)ip, packet.length, view) : NULL;
+                if (pRecvIcmp == NULL)
+                {
+                    MetricsLocal().Count(METRIC_FOREIGN_PACKETS);
+                    ++foreign_;
+                    continue;
+                }
+                if (!inFlight.Remove(InFlightTable::MakeKey(source, pRecvIcmp->icmp_sequence), &entry))
+                {
+                    unsigned int target = store.Find(source);
+                    if (target != TargetStoreNone)
+                        store.OnReply(target, pRecvIcmp->icmp_sequence, true);
+                    continue;
+                }
+                if (store.OnReply(entry.target, pRecvIcmp->icmp_sequence) != REPLY_NEW)
+                    continue;
+                ++replies_;
+                unsigned long long rttNs = (unsigned long long)(tick - entry.sentTick) << shift_;
+                store.Record(entry.target, rttNs);
+                allHistogram_.Record(rttNs);
+                continue;
+            }
+
+            IcmpErrorInfo error;
+            if (IcmpTypes.types[icmp[0]].kind != ICMP_KIND_ERROR)
+            {
+                ++other_;
+                continue;
+            }
+            if (!ParseIcmpError(icmp, packet.length - ipHeaderLen, &error))
+            {
+                ++truncatedErrors_;                                         // Quotes less than an IPv4 header and 8 bytes
+                continue;
+            }
+            unsigned int target = error.echo && IdSeen(error.id) ? store.Find(error.destination) : TargetStoreNone;
+            if (target == TargetStoreNone)
+            {
+                MetricsLocal().Count(METRIC_FOREIGN_PACKETS);
+                ++foreign_;
+                continue;
+            }
+            ++errors_;
+            errorCodes_.Record(error.type, error.code);
+            store.CountError(target, error.type);
+            if (IcmpErrorEndsProbe((IcmpErrorClass)error.errorClass) && inFlight.Remove(InFlightTable::MakeKey(error.destination, error.seq), &entry))
+                store.OnError(entry.target);
+        }
+        if (started)                                                        // What is still in flight times out after the capture
+            timedOut_ += inFlight.ExpireDue(nowNs + config_.maxNs + 2 * config_.granularityNs, [&](const InFlightEntry& entry) { Lost(store, entry); });
+
+        checksumFailures_ = MetricsLocal().counters[METRIC_CHECKSUM_FAILURES].load(std::memory_order_relaxed) - checksumFailures;
+        elapsedNs_ = TransportMonotonicNs() - startNs;
+    }
+
+    // The summary of the replay, in the form of the sweep's
+    void Print(std::ostream& out) const
+    {
+        char line[512];
+        RttStats all;
+        unsigned int alive = 0;
+        for (unsigned int t = 0; t < (unsigned int)targets_.size(); ++t)
+        {
+            RttStats stats = store_->Stats(t);
+            all.Merge(stats);
+            if (stats.Received() > 0)
+                ++alive;
+        }
+        PrintRttStats(out, "replay", all, &allHistogram_);
+        errorCodes_.Print(out);
+        snprintf(line, sizeof(line), "Targets: %zu, Alive: %u, Sent: %llu, Received: %llu, Errors: %llu, Timed out: %llu, Late: %llu, Duplicates: %llu\n",
+                 targets_.size(), alive, all.Sent(), replies_, errors_, timedOut_, all.Late(), all.Duplicates());
+        out<<line;
+        snprintf(line, sizeof(line), "Packets: %llu, requests seen twice: %llu, foreign: %llu, other: %llu, malformed: %llu, truncated errors: %llu, checksum failures: %llu\n",
+                 packets_, repeated_, foreign_, other_, malformed_, truncatedErrors_, checksumFailures_);
+        out<<line;
+        PrintRtoSummary(out, config_, targets_.size(), [this](size_t t) -> const RtoEstimator& { return store_->Rto((unsigned int)t); });
+        snprintf(line, sizeof(line), "Replayed in %.3f ms: %.0f packets/s\n", elapsedNs_ / 1e6, elapsedNs_ > 0 ? packets_ * 1e9 / elapsedNs_ : 0.0);
+        out<<line;
+    }
+
+    size_t                   Targets() const          { return targets_.size(); }
+    RttStats                 Stats(size_t t) const    { return store_->Stats((unsigned int)t); }
+    const IcmpErrorCounts&   Errors(size_t t) const   { return store_->Errors((unsigned int)t); }
+    const LatencyHistogram&  Histogram() const        { return allHistogram_; }
+    unsigned long long Packets() const          { return packets_; }
+    unsigned long long Requests() const         { return requests_; }          // Pass 1: requests in the capture, repeats included
+    unsigned long long RepeatedRequests() const { return repeated_; }
+    unsigned long long Replies() const          { return replies_; }           // Matched, first for their request
+    unsigned long long Errors() const           { return errors_; }            // ICMP errors about one of the requests
+    unsigned long long TruncatedErrors() const  { return truncatedErrors_; }
+    unsigned long long Foreign() const          { return foreign_; }           // Replies and errors about no request of the capture
+    unsigned long long Other() const            { return other_; }             // Not ICMP, fragments, other ICMP types
+    unsigned long long Malformed() const        { return malformed_; }
+    unsigned long long TimedOut() const         { return timedOut_; }
+    unsigned long long ChecksumFailures() const { return checksumFailures_; }
+    unsigned long long ElapsedNs() const        { return elapsedNs_; }         // Both passes
+
+private:
+    // Pass 1: the destinations of the requests and the icmp_ids they carry
+    void FindTargets(PcapReader& reader)
+    {
+        PcapPacket packet;
+        memset(idSeen_, 0, sizeof(idSeen_));
+        targets_.clear();
+        reader.Rewind();
+        while (reader.Next(&packet))
+        {
+            int ipHeaderLen = (packet.ip[0] & 0x0F) * 4;
+            if (ipHeaderLen < 20 || packet.length < ipHeaderLen + 8 || packet.ip[9] != 1 || packet.ip[ipHeaderLen] != 8)
+                continue;
+            unsigned int address;
+            unsigned short id;
+            memcpy(&address, packet.ip + 16, 4);
+            memcpy(&id, packet.ip + ipHeaderLen + 4, 2);
+            idSeen_[id / 32] |= 1u << (id % 32);
+            targets_.push_back(address);
+            ++requests_;
+        }
+        std::sort(targets_.begin(), targets_.end());
+        targets_.erase(std::unique(targets_.begin(), targets_.end()), targets_.end());
+    }
+
+    bool IdSeen(unsigned short id) const { return (idSeen_[id / 32] >> (id % 32)) & 1u; }
+
+    void Lost(TargetStore& store, const InFlightEntry& entry)
+    {
+        MetricsLocal().Count(METRIC_TIMEOUTS);
+        store.OnLost(entry.target);
+    }
+
+    RtoConfig                     config_;
+    int                           shift_;                                   // Send tick = capture ns >> shift_
+    std::vector<unsigned long>    targets_;                                 // Sorted destinations, index == TargetStore id
+    unsigned int                  idSeen_[65536 / 32];                      // icmp_ids of the requests
+    std::unique_ptr<TargetStore>  store_;                                   // Built by Run() for the targets of pass 1
+    LatencyHistogram              allHistogram_;
+    IcmpCodeCounts                errorCodes_;
+    unsigned long long            packets_, requests_, repeated_, replies_, errors_, truncatedErrors_;
+    unsigned long long            foreign_, other_, malformed_, timedOut_, checksumFailures_;
+    unsigned long long            elapsedNs_;
+};
+
+#endif // ICMP_REPLAY_H
@@ -0,0 +1,194 @@
+/* ICMP Packet Watcher - Adaptive per-target timeouts */
+
+/* One fixed timeout has to fit the slowest path there is, so a lost probe to a 0.2 ms LAN target used to be noticed
+   after the same 10 seconds as one to a satellite link. Every target now gets its own timeout from its own RTTs,
+   with the retransmission timer of TCP (RFC 6298, Jacobson/Karels):
+     first RTT R     SRTT = R, RTTVAR = R / 2
+     later RTT R     RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|, SRTT = 7/8 SRTT + 1/8 R
+     timeout         RTO = SRTT + max(G, 4 RTTVAR), within [min, max]
+   G is the granularity of whatever tracks the deadlines (1 ms for a receive timeout, the tick of the TimingWheel
+   in icmp_InFlightTable.h and icmp_Pipeline.h). Before the first reply the timeout is 1 second (RFC 6298 2.1) or
+   max, if that is lower. Every timeout doubles it (5.5) until the next reply, so a path that became slower is not
+   counted lost probe after probe. Unlike TCP, every echo request has a sequence number of its own, so every reply
+   is a sample without ambiguity; a reply that comes after its probe timed out is counted late and still updates
+   the estimate. With min == max the timeout is fixed, as it was before.
+
+   RtoEstimator   SRTT and RTTVAR of one target in microseconds, scaled by 8 and 4 as in BSD: 12 bytes per target
+   RtoTable       the estimators of all targets and the bounds they share (TargetStore of icmp_TargetStore.h keeps
+                  them as a column of its own instead)
+   PrintRtoSummary  the timeout line of a run summary */
+
+#ifndef ICMP_RTO_H
+#define ICMP_RTO_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <ostream>
+#include <vector>
+
+#define RtoDefaultMinNs     (10ULL * 1000000ULL)
+#define RtoDefaultMaxNs     (10000ULL * 1000000ULL)                         // The fixed timeout of earlier versions
+#define RtoInitialNs        (1000ULL * 1000000ULL)                          // Before the first reply (RFC 6298)
+
+struct RtoConfig
+{
+    unsigned long long minNs, maxNs;
+    unsigned long long granularityNs;                                       // G: resolution of the timer the deadlines go to
+};
+
+inline RtoConfig MakeRtoConfig(unsigned long long minNs = RtoDefaultMinNs, unsigned long long maxNs = RtoDefaultMaxNs,
+                               unsigned long long granularityNs = 1000000ULL)
+{
+    RtoConfig config;
+    config.minNs         = minNs;
+    config.maxNs         = maxNs < minNs ? minNs : maxNs;
+    config.granularityNs = granularityNs;
+    return config;
+}
+
+/* Parses the -R argument, "min-max" or a single fixed timeout, in milliseconds (fractions allowed). Returns false
+   unless 0 < min <= max <= 1 hour. */
+inline bool ParseRtoBounds(const char* text, RtoConfig* config)
+{
+    char* end;
+    double minMs = strtod(text, &end);
+    double maxMs = minMs;
+    if (end != text && *end == '-')
+    {
+        const char* rest = end + 1;
+        maxMs = strtod(rest, &end);
+        if (end == rest)
+            return false;
+    }
+    if (end == text || *end != '\0' || !(minMs > 0.0) || maxMs < minMs || maxMs > 3600000.0)
+        return false;
+    config->minNs = (unsigned long long)(minMs * 1e6 + 0.5);
+    config->maxNs = (unsigned long long)(maxMs * 1e6 + 0.5);
+    return true;
+}
+
+class RtoEstimator
+{
+public:
+    RtoEstimator() : srtt8Us_(0), rttvar4Us_(0), backoff_(0) {}
+
+    void Sample(unsigned long long rttNs)
+    {
+        unsigned long long us = (rttNs + 500) / 1000;
+        unsigned int rttUs = us >= (1u << 27) ? (1u << 27) - 1 : (us == 0 ? 1 : (unsigned int)us);   // Not 0 (no sample yet), 8 * R fits an int
+        backoff_ = 0;
+        if (srtt8Us_ == 0)
+        {
+            srtt8Us_   = rttUs << 3;
+            rttvar4Us_ = rttUs << 1;                                        // 4 * R / 2
+            return;
+        }
+        int delta = (int)rttUs - (int)(srtt8Us_ >> 3);
+        srtt8Us_ = (unsigned int)((int)srtt8Us_ + delta);                   // SRTT += (R - SRTT) / 8
+        int deviation = (delta < 0 ? -delta : delta) - (int)(rttvar4Us_ >> 2);
+        rttvar4Us_ = (unsigned int)((int)rttvar4Us_ + deviation);           // RTTVAR += (|R - SRTT| - RTTVAR) / 4
+    }
+
+    void OnTimeout()
+    {
+        if (backoff_ < 63)
+            ++backoff_;
+    }
+
+    unsigned long long TimeoutNs(const RtoConfig& config) const
+    {
+        unsigned long long ns;
+        if (srtt8Us_ == 0)
+            ns = RtoInitialNs;
+        else
+        {
+            unsigned long long variance = (unsigned long long)rttvar4Us_ * 1000ULL;
+            ns = (unsigned long long)(srtt8Us_ >> 3) * 1000ULL + (variance > config.granularityNs ? variance : config.granularityNs);
+        }
+        if (ns < config.minNs)
+            ns = config.minNs;
+        for (int i = 0; i < backoff_ && ns < config.maxNs; ++i)
+            ns <<= 1;
+        return ns > config.maxNs ? config.maxNs : ns;
+    }
+
+    bool               Sampled() const  { return srtt8Us_ != 0; }
+    unsigned long long SrttNs() const   { return (unsigned long long)(srtt8Us_ >> 3) * 1000ULL; }
+    unsigned long long RttvarNs() const { return (unsigned long long)(rttvar4Us_ >> 2) * 1000ULL; }
+
+private:
+    unsigned int  srtt8Us_;                                                 // 8 * SRTT, 0 before the first sample
+    unsigned int  rttvar4Us_;                                               // 4 * RTTVAR
+    unsigned char backoff_;                                                 // Timeouts since the last reply
+};
+
+/* One line for the run summary: the bounds, and for one target its SRTT, RTTVAR and timeout, for many the median
+   and the largest timeout. estimator(t) returns the RtoEstimator of target t, wherever it is kept. */
+template <typename Estimator>
+void PrintRtoSummary(std::ostream& out, const RtoConfig& config, size_t targets, Estimator estimator)
+{
+    char line[256];
+    if (config.minNs == config.maxNs)
+    {
+        snprintf(line, sizeof(line), "Timeout: fixed %.3f ms\n", config.maxNs / 1e6);
+        out<<line;
+        return;
+    }
+    if (targets == 1)
+    {
+        const RtoEstimator& rto = estimator(0);
+        snprintf(line, sizeof(line), "Timeout: adaptive %.3f-%.3f ms, SRTT %.3f ms, RTTVAR %.3f ms, RTO %.3f ms\n",
+                 config.minNs / 1e6, config.maxNs / 1e6, rto.SrttNs() / 1e6, rto.RttvarNs() / 1e6, rto.TimeoutNs(config) / 1e6);
+        out<<line;
+        return;
+    }
+    std::vector<unsigned long long> timeouts;
+    timeouts.reserve(targets);
+    for (size_t t = 0; t < targets; ++t)
+        if (estimator(t).Sampled())
+            timeouts.push_back(estimator(t).TimeoutNs(config));
+    snprintf(line, sizeof(line), "Timeouts: adaptive %.3f-%.3f ms per target", config.minNs / 1e6, config.maxNs / 1e6);
+    out<<line;
+    if (!timeouts.empty())
+    {
+        std::nth_element(timeouts.begin(), timeouts.begin() + timeouts.size() / 2, timeouts.end());
+        snprintf(line, sizeof(line), ", RTO median/max %.3f/%.3f ms over %zu answering targets", timeouts[timeouts.size() / 2] / 1e6,
+                 *std::max_element(timeouts.begin(), timeouts.end()) / 1e6, timeouts.size());
+        out<<line;
+    }
+    out<<'\n';
+}
+
+class RtoTable
+{
+public:
+    RtoTable(size_t targets, const RtoConfig& config) : config_(config), estimators_(targets) {}
+
+    void               Sample(size_t target, unsigned long long rttNs) { estimators_[target].Sample(rttNs); }
+    void               OnTimeout(size_t target)                        { estimators_[target].OnTimeout(); }
+    unsigned long long TimeoutNs(size_t target) const                  { return estimators_[target].TimeoutNs(config_); }
+    const RtoEstimator& Estimator(size_t target) const                 { return estimators_[target]; }
+    const RtoConfig&   Config() const                                  { return config_; }
+    bool               Fixed() const                                   { return config_.minNs == config_.maxNs; }
+    size_t             Size() const                                    { return estimators_.size(); }
+
+    // Whole milliseconds, at least 1, for a receive timeout or IcmpSendEcho
+    unsigned long TimeoutMs(size_t target) const
+    {
+        unsigned long long ms = (TimeoutNs(target) + 999999ULL) / 1000000ULL;
+        return ms == 0 ? 1 : (unsigned long)ms;
+    }
+
+    // The summary line, see PrintRtoSummary
+    void Print(std::ostream& out) const
+    {
+        PrintRtoSummary(out, config_, estimators_.size(), [this](size_t target) -> const RtoEstimator& { return estimators_[target]; });
+    }
+
+private:
+    RtoConfig                 config_;
+    std::vector<RtoEstimator> estimators_;
+};
+
+#endif // ICMP_RTO_H
@@ -0,0 +1,544 @@
+/* ICMP Packet Watcher - Deadline-based probe scheduler */
+
+/* Probes go out at absolute deadlines start + offset + k * period. Nothing sleeps "interval" after a round trip, so
+   the RTT, printing and batching do not stretch the period and the rate does not drift over a long run.
+
+   TimingWheel     Hierarchical timing wheel: 4 levels of 256 slots with 10 us ticks by default, so level 0 spans
+                   2.56 ms and level 3 about 12 hours. Schedule, Cancel and firing are O(1), a timer is moved down a
+                   level at most three times and never fires before its deadline.
+   TokenBucket     Rate limit with bursts: tokens are added at "rate" per second and at most "burst" are saved up.
+   ProbeScheduler  One periodic schedule per target (own period, optional random start offset within the period so
+                   thousands of targets do not fire in sync, probe count) on a TimingWheel, with an optional
+                   TokenBucket over all targets. Due probes queue up in deadline order until the caller can send
+                   them. A probe that is sent more than a period late does not cause a catch-up burst: the deadlines
+                   it missed are skipped and counted, and the schedule stays on its grid. Targets may be added
+                   while it runs (Grow), as a sharded sweep does when it takes another chunk of targets, and removed
+                   (Remove), as the Pinger library does when a subscription ends.
+   ScheduleStats   Lag (send time minus deadline) and skipped probes, for the run summary; every lag also goes to
+                   the schedule lag histogram of icmp_Metrics.h.
+
+   All times are in nanoseconds on the TransportMonotonicNs() clock; the scheduler itself never reads the clock. */
+
+#ifndef ICMP_SCHEDULER_H
+#define ICMP_SCHEDULER_H
+
+#include <stdio.h>
+#include <string.h>
+#include <ostream>
+#include <vector>
+#include "icmp_Metrics.h"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+class TimingWheel
+{
+public:
+    static const unsigned int None = 0xFFFFFFFFu;
+
+    // Timer ids are 0 .. capacity - 1, each id is scheduled at most once at a time
+    explicit TimingWheel(unsigned int capacity, unsigned long long tickNs = 10000)
+        : tickNs_(tickNs == 0 ? 1 : tickNs), baseNs_(0), now_(0), count_(0), advancing_(false),
+          next_(capacity, None), prev_(capacity, None), slot_(capacity, None), deadline_(capacity, 0)
+    {
+        for (int i = 0; i < Levels * Slots; ++i)
+            heads_[i] = None;
+        memset(occupied_, 0, sizeof(occupied_));
+    }
+
+    // Tick 0 of the wheel, call before the first Schedule()
+    void Start(unsigned long long nowNs)
+    {
+        baseNs_ = nowNs;
+        now_    = 0;
+    }
+
+    void Schedule(unsigned int id, unsigned long long deadlineNs)
+    {
+        if (slot_[id] != None)
+            Unlink(id);
+        else
+            ++count_;
+        deadline_[id] = deadlineNs;
+        File(id);
+    }
+
+    bool Cancel(unsigned int id)
+    {
+        if (slot_[id] == None)
+            return false;
+        Unlink(id);
+        --count_;
+        return true;
+    }
+
+    bool               Scheduled(unsigned int id) const { return slot_[id] != None; }
+    unsigned long long Deadline(unsigned int id) const  { return deadline_[id]; }
+    unsigned int       Size() const                     { return count_; }
+
+    // Makes room for ids up to capacity - 1, scheduled timers keep their ids
+    void Grow(unsigned int capacity)
+    {
+        if (capacity <= next_.size())
+            return;
+        unsigned int none = None;                                           // resize() takes a reference, None has no definition
+        next_.resize(capacity, none);
+        prev_.resize(capacity, none);
+        slot_.resize(capacity, none);
+        deadline_.resize(capacity, 0);
+    }
+
+    /* Calls fire(id, deadlineNs) for every timer whose deadline is not after nowNs, in tick order. The timer is
+       removed before fire() is called, so fire() may schedule it again (a deadline that has already passed then
+       goes to the next tick). Returns the number fired. */
+    template <typename Fire>
+    int Advance(unsigned long long nowNs, Fire fire)
+    {
+        unsigned long long target = nowNs <= baseNs_ ? 0 : (nowNs - baseNs_) / tickNs_;
+        int fired = 0;
+        for (;;)
+        {
+            advancing_ = true;
+            fired += FireSlot((unsigned int)(now_ & (Slots - 1)), fire);
+            advancing_ = false;
+            if (now_ >= target)
+                return fired;
+            if (count_ == 0)
+            {
+                now_ = target;                                              // Nothing to cascade, jump straight there
+                continue;
+            }
+            // Step to the next occupied level 0 slot, or to the end of this rotation where the upper levels cascade
+            unsigned int slot = NextOccupied((unsigned int)(now_ & (Slots - 1)) + 1);
+            unsigned long long next = (now_ & ~(unsigned long long)(Slots - 1)) + slot;
+            now_ = next < target ? next : target;
+            if ((now_ & (Slots - 1)) == 0)
+                Cascade();
+        }
+    }
+
+    // Nanoseconds from nowNs until the wheel may have a timer to fire (0 if one is due), or -1 if it is empty
+    long long NsUntilNext(unsigned long long nowNs) const
+    {
+        if (count_ == 0)
+            return -1;
+        unsigned int slot = NextOccupied((unsigned int)(now_ & (Slots - 1)));
+        unsigned long long tick = (now_ & ~(unsigned long long)(Slots - 1)) + slot;  // Slot 256 is the next cascade
+        unsigned long long dueNs = baseNs_ + tick * tickNs_;
+        return dueNs <= nowNs ? 0 : (long long)(dueNs - nowNs);
+    }
+
+private:
+    static const int Levels = 4;
+    static const int Slots  = 256;
+    static const int Bits   = 8;
+
+    // A timer goes to the lowest level whose current rotation contains its tick, so it is cascaded before it is due
+    void File(unsigned int id)
+    {
+        unsigned long long offset = deadline_[id] > baseNs_ ? deadline_[id] - baseNs_ : 0;
+        unsigned long long tick = (offset + tickNs_ - 1) / tickNs_;         // Rounded up: never early
+        unsigned long long earliest = advancing_ ? now_ + 1 : now_;          // The current slot is being fired
+        if (tick < earliest)
+            tick = earliest;
+
+        int level = 0;
+        while (level < Levels - 1 && (tick >> (Bits * (level + 1))) != (now_ >> (Bits * (level + 1))))
+            ++level;
+        unsigned int index = (unsigned int)(level * Slots + ((tick >> (Bits * level)) & (Slots - 1)));
+        // Beyond the top level's rotation the slot is revisited early and the timer refiled from there
+
+        next_[id] = heads_[index];
+        prev_[id] = None;
+        if (heads_[index] != None)
+            prev_[heads_[index]] = id;
+        heads_[index] = id;
+        slot_[id] = index;
+        if (index < Slots)
+            occupied_[index / 64] |= 1ULL << (index % 64);
+    }
+
+    void Unlink(unsigned int id)
+    {
+        unsigned int index = slot_[id];
+        if (prev_[id] != None)
+            next_[prev_[id]] = next_[id];
+        else
+            heads_[index] = next_[id];
+        if (next_[id] != None)
+            prev_[next_[id]] = prev_[id];
+        slot_[id] = None;
+        if (index < Slots && heads_[index] == None)
+            occupied_[index / 64] &= ~(1ULL << (index % 64));
+    }
+
+    // Detaches a slot's list, so timers scheduled from fire() go into a fresh list
+    unsigned int Detach(unsigned int index)
+    {
+        unsigned int id = heads_[index];
+        heads_[index] = None;
+        if (index < Slots)
+            occupied_[index / 64] &= ~(1ULL << (index % 64));
+        return id;
+    }
+
+    template <typename Fire>
+    int FireSlot(unsigned int slot, Fire& fire)
+    {
+        int fired = 0;
+        unsigned int id = Detach(slot);
+        while (id != None)
+        {
+            unsigned int next = next_[id];
+            slot_[id] = None;
+            --count_;
+            ++fired;
+            fire(id, deadline_[id]);
+            id = next;
+        }
+        return fired;
+    }
+
+    // At the start of a level 0 rotation, refile the matching slot of level 1 (and of level 2, 3 when those wrap too)
+    void Cascade()
+    {
+        for (int level = 1; level < Levels; ++level)
+        {
+            unsigned int slot = (unsigned int)((now_ >> (Bits * level)) & (Slots - 1));
+            unsigned int id = Detach((unsigned int)(level * Slots) + slot);
+            while (id != None)
+            {
+                unsigned int next = next_[id];
+                File(id);
+                id = next;
+            }
+            if (slot != 0)
+                break;
+        }
+    }
+
+    // First occupied level 0 slot at or after "from", Slots if there is none
+    unsigned int NextOccupied(unsigned int from) const
+    {
+        for (unsigned int word = from / 64; word < Slots / 64; ++word)
+        {
+            unsigned long long bits = occupied_[word];
+            if (word == from / 64)
+                bits &= ~0ULL << (from % 64);
+            if (bits != 0)
+                return word * 64 + (unsigned int)CountTrailingZeros(bits);
+        }
+        return Slots;
+    }
+
+    static int CountTrailingZeros(unsigned long long v)
+    {
+#if defined(_MSC_VER)
+        unsigned long bit;
+        _BitScanForward64(&bit, v);
+        return (int)bit;
+#else
+        return __builtin_ctzll(v);
+#endif
+    }
+
+    unsigned long long        tickNs_;
+    unsigned long long        baseNs_;
+    unsigned long long        now_;                                         // Current tick, everything before it has fired
+    unsigned int              count_;
+    bool                      advancing_;
+    unsigned int              heads_[Levels * Slots];                       // Doubly linked list of timer ids per slot
+    unsigned long long        occupied_[Slots / 64];                        // Non-empty level 0 slots
+    std::vector<unsigned int> next_;
+    std::vector<unsigned int> prev_;
+    std::vector<unsigned int> slot_;                                        // level * Slots + slot, None if not scheduled
+    std::vector<unsigned long long> deadline_;
+};
+
+class TokenBucket
+{
+public:
+    // ratePerSecond <= 0 means unlimited
+    TokenBucket(double ratePerSecond = 0.0, double burst = 1.0)
+        : rate_(ratePerSecond), burst_(burst < 1.0 ? 1.0 : burst), tokens_(burst_), lastNs_(0)
+    {
+    }
+
+    void Start(unsigned long long nowNs)
+    {
+        tokens_ = burst_;
+        lastNs_ = nowNs;
+    }
+
+    // Refills and takes one token if there is one
+    bool Take(unsigned long long nowNs)
+    {
+        if (rate_ <= 0.0)
+            return true;
+        Refill(nowNs);
+        if (tokens_ < 1.0)
+            return false;
+        tokens_ -= 1.0;
+        return true;
+    }
+
+    void Return() { if (rate_ > 0.0 && tokens_ + 1.0 <= burst_) tokens_ += 1.0; }
+
+    // Nanoseconds until a token is available, 0 if one is
+    unsigned long long NsUntilToken(unsigned long long nowNs)
+    {
+        if (rate_ <= 0.0)
+            return 0;
+        Refill(nowNs);
+        return tokens_ >= 1.0 ? 0 : (unsigned long long)((1.0 - tokens_) * 1e9 / rate_) + 1;
+    }
+
+private:
+    void Refill(unsigned long long nowNs)
+    {
+        if (nowNs <= lastNs_)
+            return;
+        tokens_ += (double)(nowNs - lastNs_) * rate_ / 1e9;
+        if (tokens_ > burst_)
+            tokens_ = burst_;
+        lastNs_ = nowNs;
+    }
+
+    double             rate_;
+    double             burst_;
+    double             tokens_;
+    unsigned long long lastNs_;
+};
+
+class ScheduleStats
+{
+public:
+    ScheduleStats() : sent_(0), skipped_(0), lagSumNs_(0), maxLagNs_(0) {}
+
+    void OnSent(unsigned long long deadlineNs, unsigned long long nowNs)
+    {
+        unsigned long long lag = nowNs > deadlineNs ? nowNs - deadlineNs : 0;
+        MetricsLocal().Record(METRIC_SCHEDULE_LAG_NS, lag);
+        ++sent_;
+        lagSumNs_ += lag;
+        if (lag > maxLagNs_)
+            maxLagNs_ = lag;
+    }
+
+    void OnSkipped(unsigned long long count) { skipped_ += count; }
+
+    unsigned long long Sent() const     { return sent_; }
+    unsigned long long Skipped() const  { return skipped_; }
+    unsigned long long MaxLagNs() const { return maxLagNs_; }
+    double MeanLagNs() const            { return sent_ == 0 ? 0.0 : (double)lagSumNs_ / (double)sent_; }
+
+    // Adds the probes of another schedule (another shard of the same run)
+    void Merge(const ScheduleStats& other)
+    {
+        sent_     += other.sent_;
+        skipped_  += other.skipped_;
+        lagSumNs_ += other.lagSumNs_;
+        if (other.maxLagNs_ > maxLagNs_)
+            maxLagNs_ = other.maxLagNs_;
+    }
+
+    /* Next deadline of a periodic schedule after a probe for deadlineNs was sent at nowNs. Deadlines that have
+       already passed are skipped (counted in *missed) instead of being sent back to back. A period of 0 means
+       "as soon as possible", its next deadline is nowNs. */
+    static unsigned long long NextDeadline(unsigned long long deadlineNs, unsigned long long periodNs, unsigned long long nowNs, unsigned long long* missed)
+    {
+        *missed = 0;
+        if (periodNs == 0)
+            return nowNs;
+        if (nowNs > deadlineNs)
+            *missed = (nowNs - deadlineNs) / periodNs;
+        return deadlineNs + (*missed + 1) * periodNs;
+    }
+
+private:
+    unsigned long long sent_;
+    unsigned long long skipped_;
+    unsigned long long lagSumNs_;
+    unsigned long long maxLagNs_;
+};
+
+class ProbeScheduler
+{
+public:
+    explicit ProbeScheduler(unsigned int targets, unsigned long long tickNs = 10000)
+        : wheel_(targets, tickNs), period_(targets, 0), remaining_(targets, 0), due_(targets), dueHead_(0), dueCount_(0),
+          startNs_(0), random_(0x9E3779B97F4A7C15ULL)
+    {
+    }
+
+    // Rate limit over all targets, call before Start()
+    void SetRate(double perSecond, double burst) { bucket_ = TokenBucket(perSecond, burst); }
+
+    void Start(unsigned long long nowNs)
+    {
+        startNs_ = nowNs;
+        wheel_.Start(nowNs);
+        bucket_.Start(nowNs);
+        random_ ^= nowNs;
+    }
+
+    /* Schedules "count" probes (-1: no limit) for a target every periodNs, starting at Start() time or, with jitter,
+       at a random offset within the first period. A period of 0 sends as fast as the rate limit and the caller allow.
+       A target added while the schedule runs passes fromNs (its own start time), so it does not begin with a run
+       of missed deadlines. */
+    void Add(unsigned int target, unsigned long long periodNs, long long count, bool jitter, unsigned long long fromNs = 0)
+    {
+        period_[target]    = periodNs;
+        remaining_[target] = count;
+        if (count == 0)
+            return;
+        unsigned long long offset = jitter && periodNs > 0 ? Random() % periodNs : 0;
+        wheel_.Schedule(target, (fromNs > startNs_ ? fromNs : startNs_) + offset);
+    }
+
+    /* Makes room for target ids up to targets - 1 (at least doubling, so adding targets a few at a time stays
+       linear overall). Schedules already added keep running, the due queue keeps its order. */
+    void Grow(unsigned int targets)
+    {
+        if (targets <= period_.size())
+            return;
+        if (targets < period_.size() * 2)
+            targets = (unsigned int)period_.size() * 2;
+        wheel_.Grow(targets);
+        period_.resize(targets, 0);
+        remaining_.resize(targets, 0);
+        std::vector<unsigned int> due(targets);
+        for (size_t i = 0; i < dueCount_; ++i)
+            due[i] = due_[(dueHead_ + i) % due_.size()];
+        due_.swap(due);
+        dueHead_ = 0;
+    }
+
+    // Ends a target's schedule: no further probe of it is sent, whether it was waiting on the wheel or already due.
+    // The id may then be passed to Add() again.
+    void Remove(unsigned int target)
+    {
+        remaining_[target] = 0;
+        wheel_.Cancel(target);
+        size_t kept = 0;
+        for (size_t i = 0; i < dueCount_; ++i)
+        {
+            unsigned int id = due_[(dueHead_ + i) % due_.size()];
+            if (id != target)
+                due_[(dueHead_ + kept++) % due_.size()] = id;
+        }
+        dueCount_ = kept;
+    }
+
+    /* Calls send(target, deadlineNs) for due probes in deadline order until "max" were sent, the rate limit is
+       reached or send() returns false (that probe stays due, e.g. while the in-flight window is full). Returns how
+       many were sent. */
+    template <typename Send>
+    int Run(unsigned long long nowNs, int max, Send send)
+    {
+        wheel_.Advance(nowNs, [this](unsigned int id, unsigned long long) { PushDue(id); });
+        int sent = 0;
+        while (sent < max && dueCount_ > 0 && bucket_.Take(nowNs))
+        {
+            unsigned int target = due_[dueHead_];
+            unsigned long long deadline = wheel_.Deadline(target);
+            if (!send(target, deadline))
+            {
+                bucket_.Return();
+                break;
+            }
+            PopDue();
+            ++sent;
+            OnSent(target, deadline, nowNs);
+        }
+        return sent;
+    }
+
+    // Nanoseconds until the next probe may be sent (0 if one is due), -1 when every schedule has finished
+    long long NsUntilNext(unsigned long long nowNs)
+    {
+        if (dueCount_ > 0)
+            return (long long)bucket_.NsUntilToken(nowNs);
+        return wheel_.NsUntilNext(nowNs);
+    }
+
+    // Milliseconds for an event loop wait: rounded down, the remaining fraction is polled
+    long WaitMs(unsigned long long nowNs)
+    {
+        long long ns = NsUntilNext(nowNs);
+        return ns < 0 ? -1 : (long)(ns / 1000000);
+    }
+
+    bool Finished() const               { return dueCount_ == 0 && wheel_.Size() == 0; }
+    long long Remaining(unsigned int target) const { return remaining_[target]; }   // Probes still to send, -1 for no limit
+    bool Pending() const                { return dueCount_ > 0; }
+    const ScheduleStats& Stats() const  { return stats_; }
+
+private:
+    void OnSent(unsigned int target, unsigned long long deadline, unsigned long long nowNs)
+    {
+        stats_.OnSent(period_[target] > 0 ? deadline : nowNs, nowNs);      // "As soon as possible" is never late
+        long long& remaining = remaining_[target];
+        if (remaining > 0)
+            --remaining;
+        if (remaining == 0)
+            return;
+
+        unsigned long long missed;
+        unsigned long long next = ScheduleStats::NextDeadline(deadline, period_[target], nowNs, &missed);
+        if (missed > 0)
+        {
+            if (remaining > 0 && (unsigned long long)remaining <= missed)
+                missed = (unsigned long long)remaining;
+            stats_.OnSkipped(missed);
+            if (remaining > 0 && (remaining -= (long long)missed) == 0)
+                return;
+        }
+        if (period_[target] == 0)
+            PushDue(target);                                                // Back of the queue: round robin over the targets
+        else
+            wheel_.Schedule(target, next);
+    }
+
+    void PushDue(unsigned int target)
+    {
+        due_[(dueHead_ + dueCount_) % due_.size()] = target;
+        ++dueCount_;
+    }
+
+    void PopDue()
+    {
+        dueHead_ = (dueHead_ + 1) % due_.size();
+        --dueCount_;
+    }
+
+    unsigned long long Random()                                             // xorshift64
+    {
+        random_ ^= random_ << 13;
+        random_ ^= random_ >> 7;
+        random_ ^= random_ << 17;
+        return random_;
+    }
+
+    TimingWheel               wheel_;
+    TokenBucket               bucket_;
+    ScheduleStats             stats_;
+    std::vector<unsigned long long> period_;
+    std::vector<long long>    remaining_;                                   // Probes left per target, -1 for no limit
+    std::vector<unsigned int> due_;                                         // FIFO of due targets, each at most once
+    size_t                    dueHead_;
+    size_t                    dueCount_;
+    unsigned long long        startNs_;
+    unsigned long long        random_;
+};
+
+// One summary line: how late probes went out and how many deadlines were skipped
+inline void PrintScheduleStats(std::ostream& out, const ScheduleStats& stats)
+{
+    char line[192];
+    snprintf(line, sizeof(line), "Schedule lag mean/max = %.3f/%.3f ms, %llu probes skipped (more than an interval behind)\n",
+             stats.MeanLagNs() / 1e6, stats.MaxLagNs() / 1e6, stats.Skipped());
+    out<<line;
+}
+
+#endif // ICMP_SCHEDULER_H
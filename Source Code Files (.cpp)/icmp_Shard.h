@@ -0,0 +1,160 @@
+/* ICMP Packet Watcher - Work distribution for the multi-threaded (sharded) sweep */
+
+/* With -j shards the sweep runs on that many threads. Each thread (shard) owns everything on its hot path: its own
+   socket with its own icmp_id, event loop, send/receive batches, in-flight table and scheduler, and the per-target
+   statistics of the targets it took. The kernel steers every reply and error to the socket whose id it carries (a
+   socket filter on raw sockets, the ping id on ping sockets, see TransportFilterId), so shards never look at each
+   other's packets and share no lock; records go to the OutputWriter through one ring per shard.
+
+   The target list is cut into chunks of consecutive targets. Every shard starts with a contiguous block of chunks in
+   its own WorkStealingDeque and takes a new chunk whenever it runs short of targets to start; once its block is used
+   up it steals chunks from the far end of the other shards' deques. A shard that is slowed down (busy core, full
+   socket buffer) therefore hands its remaining work to the others instead of finishing last.
+
+   WorkStealingDeque   Chase-Lev deque of chunk numbers with a fixed capacity. The owner pushes and pops at the
+                       bottom, any thread steals from the top; only a steal and the owner's pop of the last item
+                       compete, through one compare-and-swap on top.
+   ShardWork           The chunks, the deques and per-shard taken/stolen counters (each on its own cache line). */
+
+#ifndef ICMP_SHARD_H
+#define ICMP_SHARD_H
+
+#include <atomic>
+#include <vector>
+
+class WorkStealingDeque
+{
+public:
+    explicit WorkStealingDeque(unsigned int capacity = 1)
+        : top_(0), bottom_(0)
+    {
+        unsigned int size = 1;
+        while (size < capacity)
+            size <<= 1;
+        items_ = std::vector<std::atomic<unsigned int> >(size);
+        mask_ = size - 1;
+    }
+
+    // Owner only. Returns false when the deque is full.
+    bool Push(unsigned int item)
+    {
+        long long b = bottom_.load(std::memory_order_relaxed);
+        long long t = top_.load(std::memory_order_acquire);
+        if (b - t > (long long)mask_)
+            return false;
+        items_[b & mask_].store(item, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Owner only: the item pushed last. Returns false when the deque is empty.
+    bool Pop(unsigned int* item)
+    {
+        long long b = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);              // The new bottom must be visible before top is read
+        long long t = top_.load(std::memory_order_relaxed);
+        if (t > b)
+        {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        *item = items_[b & mask_].load(std::memory_order_relaxed);
+        if (t == b)
+        {
+            // Last item: a thief may be taking it at the same time, the compare-and-swap on top decides
+            bool won = top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // Any thread: the oldest item. Returns false only when the deque is empty (a lost race is retried).
+    bool Steal(unsigned int* item)
+    {
+        for (;;)
+        {
+            long long t = top_.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            long long b = bottom_.load(std::memory_order_acquire);
+            if (t >= b)
+                return false;
+            *item = items_[t & mask_].load(std::memory_order_relaxed);
+            if (top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                return true;
+        }
+    }
+
+private:
+    std::vector<std::atomic<unsigned int> > items_;
+    unsigned long long                       mask_;
+    alignas(64) std::atomic<long long>       top_;                          // Thieves' end
+    alignas(64) std::atomic<long long>       bottom_;                       // Owner's end
+};
+
+class ShardWork
+{
+public:
+    // Items 0 .. items - 1 in chunks of chunkSize, shard s starts with the s-th contiguous block of chunks
+    ShardWork(unsigned int items, int shards, unsigned int chunkSize)
+        : items_(items), chunkSize_(chunkSize < 1 ? 1 : chunkSize), deques_(shards), counters_(shards)
+    {
+        unsigned int chunks = (items_ + chunkSize_ - 1) / chunkSize_;
+        for (int s = 0; s < shards; ++s)
+        {
+            unsigned int first = (unsigned int)((unsigned long long)chunks * s / shards);
+            unsigned int last  = (unsigned int)((unsigned long long)chunks * (s + 1) / shards);
+            deques_[s] = new WorkStealingDeque(last - first);
+            for (unsigned int c = last; c > first; --c)                     // Pushed backwards, so the owner pops them in order
+                deques_[s]->Push(c - 1);
+        }
+    }
+
+    ~ShardWork()
+    {
+        for (size_t s = 0; s < deques_.size(); ++s)
+            delete deques_[s];
+    }
+
+    /* Called by shard "shard" only: the next chunk [*begin, *end) from its own deque, else one stolen from the other
+       shards (the next shard first). Returns false once every deque is empty, no chunk comes back after that. */
+    bool Take(int shard, unsigned int* begin, unsigned int* end)
+    {
+        int shards = (int)deques_.size();
+        unsigned int chunk;
+        bool found = deques_[shard]->Pop(&chunk);
+        for (int v = 1; !found && v < shards; ++v)
+            if (deques_[(shard + v) % shards]->Steal(&chunk))
+            {
+                found = true;
+                ++counters_[shard].stolen;
+            }
+        if (!found)
+            return false;
+        ++counters_[shard].taken;
+        *begin = chunk * chunkSize_;
+        *end   = *begin + chunkSize_ < items_ ? *begin + chunkSize_ : items_;
+        return true;
+    }
+
+    unsigned int ChunkSize() const            { return chunkSize_; }
+    unsigned int Taken(int shard) const       { return counters_[shard].taken; }    // Read after the shards have finished
+    unsigned int Stolen(int shard) const      { return counters_[shard].stolen; }
+
+private:
+    struct alignas(64) Counters                                             // Own cache line per shard, only its owner writes
+    {
+        Counters() : taken(0), stolen(0) {}
+        unsigned int taken;
+        unsigned int stolen;
+    };
+
+    unsigned int                    items_;
+    unsigned int                    chunkSize_;
+    std::vector<WorkStealingDeque*> deques_;
+    std::vector<Counters>           counters_;
+};
+
+#endif // ICMP_SHARD_H
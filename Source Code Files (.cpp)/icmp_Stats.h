@@ -0,0 +1,316 @@
+/* ICMP Packet Watcher - Constant-memory streaming latency statistics */
+
+/* Everything here is updated in O(1) per probe without allocating, and the memory used is fixed when the object
+   is created, so a run that never ends (pingCount == -1 in icmp_Winsock_API.cpp) keeps the same footprint.
+
+   LatencyHistogram  HDR-style log-linear histogram of RTTs in nanoseconds. Values below 64 ns get a bucket each,
+                     above that every power of two is split into 32 buckets, so a percentile is within about 1.6%
+                     of the true value. 1152 buckets cover 0 ns to 2^40 ns (18 minutes) in 4.5 KB.
+   SequenceWindow    Bitmap over the last 1024 sequence numbers answered, which tells a duplicate or a reordered reply
+                     from the newest one.
+   RttStats          Counters (sent, received, lost, errors, late, duplicates, reordered), min/max, mean and standard
+                     deviation (Welford) and the RFC 3550 interarrival jitter J += (|D| - J) / 16, where D is the
+                     difference between the RTTs of two consecutive replies, and a SequenceWindow. The sweep keeps the
+                     same state in the columns of a TargetStore (icmp_TargetStore.h) and builds an RttStats from them
+                     for its summary. */
+
+#ifndef ICMP_STATS_H
+#define ICMP_STATS_H
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <ostream>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+class LatencyHistogram
+{
+public:
+    static const int Buckets = 64 + 34 * 32;                                // Exact below 64 ns, then 34 powers of two up to 2^40 ns
+
+    LatencyHistogram() : count_(0)
+    {
+        memset(counts_, 0, sizeof(counts_));
+    }
+
+    void Record(unsigned long long ns)
+    {
+        ++counts_[Index(ns)];
+        ++count_;
+    }
+
+    void Merge(const LatencyHistogram& other)
+    {
+        for (int i = 0; i < Buckets; ++i)
+            counts_[i] += other.counts_[i];
+        count_ += other.count_;
+    }
+
+    unsigned long long Count() const { return count_; }
+
+    // Value at the given percentile (0..100), reported as the middle of its bucket. 0 if nothing was recorded.
+    unsigned long long Percentile(double percentile) const
+    {
+        if (count_ == 0)
+            return 0;
+        unsigned long long rank = (unsigned long long)ceil(percentile / 100.0 * (double)count_);
+        if (rank == 0)
+            rank = 1;
+        unsigned long long seen = 0;
+        for (int i = 0; i < Buckets; ++i)
+        {
+            seen += counts_[i];
+            if (seen >= rank)
+                return (Lowest(i) + Highest(i)) / 2;
+        }
+        return Highest(Buckets - 1);
+    }
+
+private:
+    static int HighestBit(unsigned long long v)
+    {
+#if defined(_MSC_VER)
+        unsigned long bit;
+        _BitScanReverse64(&bit, v);
+        return (int)bit;
+#else
+        return 63 - __builtin_clzll(v);
+#endif
+    }
+
+    static int Index(unsigned long long ns)
+    {
+        if (ns < 64)
+            return (int)ns;
+        int shift = HighestBit(ns) - 5;                                     // ns >> shift is in [32, 64)
+        if (shift > 34)
+            return Buckets - 1;                                             // 2^40 ns and above share the last bucket
+        return 64 + (shift - 1) * 32 + (int)(ns >> shift) - 32;
+    }
+
+    static unsigned long long Lowest(int index)
+    {
+        if (index < 64)
+            return (unsigned long long)index;
+        int shift = (index - 64) / 32 + 1;
+        return (unsigned long long)((index - 64) % 32 + 32) << shift;
+    }
+
+    static unsigned long long Highest(int index)
+    {
+        if (index < 64)
+            return (unsigned long long)index;
+        int shift = (index - 64) / 32 + 1;
+        return Lowest(index) + (1ULL << shift) - 1;
+    }
+
+    unsigned int       counts_[Buckets];
+    unsigned long long count_;
+};
+
+enum ReplyKind
+{
+    REPLY_NEW,                                                              // First reply for this sequence number, record its RTT
+    REPLY_DUPLICATE,                                                        // Sequence number was already answered
+    REPLY_LATE                                                              // First reply, but the request was already counted as lost
+};
+
+enum SeqOrder
+{
+    SEQ_NEWEST,                                                             // Newer than any sequence number answered so far
+    SEQ_OLDER,                                                              // Older, but not answered yet
+    SEQ_SEEN                                                                // Already answered
+};
+
+class SequenceWindow
+{
+public:
+    static const int Span = 1024;
+
+    SequenceWindow() : highest_(0), anyReply_(false)
+    {
+        memset(seen_, 0, sizeof(seen_));
+    }
+
+    // Marks the sequence number and tells whether it is the newest so far, an older one, or was already marked
+    SeqOrder Classify(unsigned short seq)
+    {
+        if (!anyReply_)
+        {
+            anyReply_ = true;
+            highest_  = seq;
+            Mark(seq);
+            return SEQ_NEWEST;
+        }
+
+        short ahead = (short)(unsigned short)(seq - highest_);
+        if (ahead > 0)
+        {
+            if (ahead >= Span)
+                memset(seen_, 0, sizeof(seen_));
+            else
+                for (unsigned short s = (unsigned short)(highest_ + 1); s != seq; ++s)
+                    Unmark(s);                                              // Sequence numbers that enter the window
+            highest_ = seq;
+            Mark(seq);
+            return SEQ_NEWEST;
+        }
+        if (-ahead >= Span)
+            return SEQ_OLDER;                                               // Too old to tell, not counted as a duplicate
+        if (IsMarked(seq))
+            return SEQ_SEEN;
+        Mark(seq);
+        return SEQ_OLDER;
+    }
+
+private:
+    void Mark(unsigned short seq)           { seen_[(seq % Span) / 32] |= 1u << (seq % 32); }
+    void Unmark(unsigned short seq)         { seen_[(seq % Span) / 32] &= ~(1u << (seq % 32)); }
+    bool IsMarked(unsigned short seq) const { return (seen_[(seq % Span) / 32] >> (seq % 32)) & 1u; }
+
+    unsigned short highest_;                                                // Newest sequence number answered so far
+    bool           anyReply_;
+    unsigned int   seen_[Span / 32];                                        // Answered sequence numbers, bit (seq % Span)
+};
+
+class RttStats
+{
+public:
+    RttStats()
+        : sent_(0), received_(0), lost_(0), errors_(0), late_(0), duplicates_(0), reordered_(0),
+          min_(0), max_(0), mean_(0.0), m2_(0.0), jitter_(0.0), lastRtt_(0) {}
+
+    // A target's summary from its columns in a TargetStore (TargetStore::Stats), with an empty sequence window
+    RttStats(unsigned long long sent, unsigned long long received, unsigned long long lost, unsigned long long errors,
+             unsigned long long late, unsigned long long duplicates, unsigned long long reordered,
+             unsigned long long minNs, unsigned long long maxNs, double meanNs, double m2, double jitterNs,
+             unsigned long long lastRttNs)
+        : sent_(sent), received_(received), lost_(lost), errors_(errors), late_(late), duplicates_(duplicates),
+          reordered_(reordered), min_(minNs), max_(maxNs), mean_(meanNs), m2_(m2), jitter_(jitterNs), lastRtt_(lastRttNs) {}
+
+    void OnSent() { ++sent_; }
+    void OnLost() { ++lost_; }
+    void OnError() { ++lost_; ++errors_; }                                  // Answered by an ICMP error instead of a reply, also lost
+
+    /* Classifies a reply by its sequence number before its RTT is recorded. One whose sequence number was already
+       answered is a duplicate; expired says the request has already timed out (a late reply). Otherwise a reply
+       that is older than the newest one seen so far counts as reordered. */
+    ReplyKind OnReply(unsigned short seq, bool expired = false)
+    {
+        SeqOrder order = window_.Classify(seq);
+        if (order == SEQ_SEEN)
+        {
+            ++duplicates_;
+            return REPLY_DUPLICATE;
+        }
+        if (expired)
+        {
+            ++late_;
+            return REPLY_LATE;
+        }
+        if (order == SEQ_OLDER)
+            ++reordered_;
+        return REPLY_NEW;
+    }
+
+
+    void Record(unsigned long long rttNs)
+    {
+        ++received_;
+        if (received_ == 1 || rttNs < min_)
+            min_ = rttNs;
+        if (rttNs > max_)
+            max_ = rttNs;
+
+        double delta = (double)rttNs - mean_;
+        mean_ += delta / (double)received_;
+        m2_   += delta * ((double)rttNs - mean_);
+
+        if (received_ > 1)
+        {
+            double d = (double)rttNs - (double)lastRtt_;
+            jitter_ += (fabs(d) - jitter_) / 16.0;
+        }
+        lastRtt_ = rttNs;
+    }
+
+    /* Adds another target's counters, min/max and mean/variance (Chan et al.). The jitter of a merged set is the
+       reply-weighted mean of the jitters, since consecutive replies of different targets are unrelated. */
+    void Merge(const RttStats& other)
+    {
+        if (other.received_ > 0)
+        {
+            unsigned long long n = received_ + other.received_;
+            double delta = other.mean_ - mean_;
+            if (received_ == 0 || other.min_ < min_)
+                min_ = other.min_;
+            if (other.max_ > max_)
+                max_ = other.max_;
+            m2_     += other.m2_ + delta * delta * (double)received_ * (double)other.received_ / (double)n;
+            mean_   += delta * (double)other.received_ / (double)n;
+            jitter_  = (jitter_ * (double)received_ + other.jitter_ * (double)other.received_) / (double)n;
+            received_ = n;
+        }
+        sent_       += other.sent_;
+        lost_       += other.lost_;
+        errors_     += other.errors_;
+        late_       += other.late_;
+        duplicates_ += other.duplicates_;
+        reordered_  += other.reordered_;
+    }
+
+    unsigned long long Sent() const       { return sent_; }
+    unsigned long long Received() const   { return received_; }
+    unsigned long long Lost() const       { return lost_; }
+    unsigned long long Errors() const     { return errors_; }
+    unsigned long long Late() const       { return late_; }
+    unsigned long long Duplicates() const { return duplicates_; }
+    unsigned long long Reordered() const  { return reordered_; }
+    unsigned long long MinNs() const      { return min_; }
+    unsigned long long MaxNs() const      { return max_; }
+    double MeanNs() const                 { return mean_; }
+    double StdDevNs() const               { return received_ > 1 ? sqrt(m2_ / (double)(received_ - 1)) : 0.0; }
+    double JitterNs() const               { return jitter_; }
+    double LossPercent() const            { return sent_ == 0 ? 0.0 : 100.0 * (double)lost_ / (double)sent_; }
+
+private:
+    unsigned long long sent_;
+    unsigned long long received_;
+    unsigned long long lost_;
+    unsigned long long errors_;
+    unsigned long long late_;
+    unsigned long long duplicates_;
+    unsigned long long reordered_;
+    unsigned long long min_;
+    unsigned long long max_;
+    double             mean_;
+    double             m2_;
+    double             jitter_;
+    unsigned long long lastRtt_;
+    SequenceWindow     window_;
+};
+
+// Prints the summary of one target (or of a merged set), in ms with microsecond resolution
+inline void PrintRttStats(std::ostream& out, const char* name, const RttStats& stats, const LatencyHistogram* histogram)
+{
+    char line[256];
+    snprintf(line, sizeof(line), "--- %s statistics ---\n", name);
+    out<<line;
+    snprintf(line, sizeof(line), "%llu sent, %llu received, %llu lost (%.3f%%), %llu errors, %llu late, %llu duplicates, %llu reordered\n",
+             stats.Sent(), stats.Received(), stats.Lost(), stats.LossPercent(), stats.Errors(), stats.Late(), stats.Duplicates(), stats.Reordered());
+    out<<line;
+    if (stats.Received() == 0)
+        return;
+    snprintf(line, sizeof(line), "RTT min/mean/max/stddev = %.3f/%.3f/%.3f/%.3f ms, jitter %.3f ms\n",
+             stats.MinNs() / 1e6, stats.MeanNs() / 1e6, stats.MaxNs() / 1e6, stats.StdDevNs() / 1e6, stats.JitterNs() / 1e6);
+    out<<line;
+    if (histogram == NULL || histogram->Count() == 0)
+        return;
+    snprintf(line, sizeof(line), "RTT p50/p90/p99/p99.9 = %.3f/%.3f/%.3f/%.3f ms\n",
+             histogram->Percentile(50) / 1e6, histogram->Percentile(90) / 1e6, histogram->Percentile(99) / 1e6, histogram->Percentile(99.9) / 1e6);
+    out<<line;
+}
+
+#endif // ICMP_STATS_H
@@ -0,0 +1,447 @@
+/* ICMP Packet Watcher - Struct-of-arrays target state for million-target sweeps */
+
+/* All the state the sweep and the replay keep per target, one array per field. A probe touches only the fields
+   it needs, and a pass over every target reads only the columns it sums. The columns fall into three groups:
+
+     hot columns    seq (2 bytes), sent / received / lost (4 bytes each), the RtoEstimator of icmp_Rto.h (12 bytes):
+                    26 bytes per target, read and written for every probe sent or timed out
+     reply columns  min / max / last RTT, mean, M2 (Welford) and jitter (8 bytes each), errors / late / duplicates /
+                    reordered (4 bytes each) and the SequenceWindow of icmp_Stats.h (132 bytes): 196 bytes per
+                    target, the rest of an RttStats, written for a reply or an ICMP error
+     cold columns   address, interval, the time the target was added and its ICMP errors by class (IcmpErrorCounts):
+                    44 bytes per target, read when a target is added, looked up or printed
+     index          address -> id, open addressing with backward-shift deletion as in icmp_InFlightTable.h,
+                    8 bytes a slot at a load factor of at most 50%
+
+   OnSent, OnReply / Record, OnLost and OnError update a target as the same calls update an RttStats, and Stats()
+   builds that RttStats back from the columns for a summary. The columns are cut into pages of TargetStorePage
+   targets. Each group has its own TargetArena, so the hot pages of all targets lie next to each other in a few
+   large blocks. A page is allocated when the first id on it is handed out and is never moved or freed, so adding
+   targets never copies the ones already there. The index is sized for the store's capacity when it is built and
+   never rehashes. Removed ids go to a free list and are handed out again first, so a run that keeps adding and
+   removing target sets stays within the pages it already has.
+
+   The next deadline of a target is not a column here: ProbeScheduler keeps it on its TimingWheel, in arrays indexed
+   by the same id. Ids are 0 .. Capacity() - 1, as the scheduler wants them, and a store that is filled by one Add()
+   hands them out in the order of the addresses given. Addresses are in network byte order. Add() and Remove() are
+   not thread-safe. While nothing is added or removed, Find() and the getters may run on many threads, and threads
+   may update different targets at the same time (the sweep's shards each update the targets they took). */
+
+#ifndef ICMP_TARGET_STORE_H
+#define ICMP_TARGET_STORE_H
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <vector>
+#include "icmp_Rto.h"
+#include "icmp_Stats.h"
+#include "icmp_Types.h"
+
+#define TargetStorePage  4096                                               // Targets per page, a power of two
+#define TargetStoreNone  0xFFFFFFFFu
+
+/* Bump allocator over large blocks: Allocate() hands out 64-byte aligned pieces, which live until the arena is
+   destroyed. Nothing is freed one by one, so allocating is a pointer increment and the pieces lie back to back. */
+class TargetArena
+{
+public:
+    explicit TargetArena(size_t blockBytes = 4u << 20) : blockBytes_(blockBytes), used_(0), left_(0), bytes_(0), next_(NULL) {}
+
+    ~TargetArena()
+    {
+        for (size_t b = 0; b < blocks_.size(); ++b)
+            free(blocks_[b]);
+    }
+
+    void* Allocate(size_t bytes)
+    {
+        bytes = (bytes + 63) & ~(size_t)63;
+        if (bytes > left_)
+        {
+            size_t blockBytes = bytes > blockBytes_ ? bytes : blockBytes_;
+            char* block = (char*)malloc(blockBytes + 64);
+            if (block == NULL)
+                throw std::bad_alloc();
+            blocks_.push_back(block);
+            bytes_ += blockBytes + 64;
+            next_ = (char*)(((size_t)block + 63) & ~(size_t)63);
+            left_ = blockBytes;
+        }
+        void* piece = next_;
+        next_ += bytes;
+        left_ -= bytes;
+        used_ += bytes;
+        return piece;
+    }
+
+    size_t Used() const  { return used_; }                                  // Handed out
+    size_t Bytes() const { return bytes_; }                                 // Taken from the heap
+
+private:
+    TargetArena(const TargetArena&);
+    TargetArena& operator=(const TargetArena&);
+
+    size_t             blockBytes_;
+    size_t             used_;
+    size_t             left_;
+    size_t             bytes_;
+    char*              next_;
+    std::vector<char*> blocks_;
+};
+
+class TargetStore
+{
+public:
+    // capacity is the largest number of targets held at the same time
+    explicit TargetStore(unsigned int capacity)
+        : capacity_(capacity == 0 ? 1 : capacity), size_(0), highWater_(0),
+          hotArena_(ArenaBlockBytes(capacity_, sizeof(TargetHotPage))), replyArena_(ArenaBlockBytes(capacity_, sizeof(TargetReplyPage))),
+          coldArena_(ArenaBlockBytes(capacity_, sizeof(TargetColdPage)))
+    {
+        bits_ = 1;
+        while ((1u << bits_) < capacity_ * 2)                                // Load factor at or below 50%, as the in-flight table
+            ++bits_;
+        slots_.resize(1u << bits_);
+        mask_ = (1u << bits_) - 1;
+        for (size_t i = 0; i < slots_.size(); ++i)
+            slots_[i].id = TargetStoreNone;
+        unsigned int pages = (capacity_ + TargetStorePage - 1) / TargetStorePage;
+        hot_.resize(pages, NULL);
+        reply_.resize(pages, NULL);
+        cold_.resize(pages, NULL);
+    }
+
+    /* Adds count targets in one pass: addresses[i] with intervalsNs[i] (NULL: 0 for all, the run's interval). ids[i]
+       gets the target's id; an address that is already in the store keeps its id, and once the store is full the
+       rest get TargetStoreNone. Returns the number of targets that were new. */
+    size_t Add(const unsigned long* addresses, const unsigned long long* intervalsNs, size_t count, unsigned long long nowNs, unsigned int* ids)
+    {
+        size_t added = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            unsigned int address = (unsigned int)addresses[i];
+            unsigned int slot = Hash(address);
+            while (slots_[slot].id != TargetStoreNone && slots_[slot].address != address)
+                slot = (slot + 1) & mask_;
+            if (slots_[slot].id != TargetStoreNone)
+            {
+                ids[i] = slots_[slot].id;
+                continue;
+            }
+            unsigned int id = NewId();
+            ids[i] = id;
+            if (id == TargetStoreNone)
+                continue;
+            slots_[slot].address = address;
+            slots_[slot].id      = id;
+            TargetColdPage& cold = *cold_[id / TargetStorePage];
+            unsigned int at = id % TargetStorePage;
+            cold.address[at]    = address;
+            cold.intervalNs[at] = intervalsNs != NULL ? intervalsNs[i] : 0;
+            cold.addedNs[at]    = nowNs;
+            ++size_;
+            ++added;
+        }
+        return added;
+    }
+
+    /* Removes count targets by id, their state is cleared and their ids are handed out again by later Add() calls.
+       Ids that are not in use are skipped. Returns the number removed. */
+    size_t Remove(const unsigned int* ids, size_t count)
+    {
+        size_t removed = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            unsigned int id = ids[i];
+            unsigned int slot = id < highWater_ ? Slot((unsigned int)Address(id)) : TargetStoreNone;
+            if (slot == TargetStoreNone || slots_[slot].id != id)
+                continue;                                                   // Not in use
+            Erase(slot);
+
+            TargetHotPage& hot = *hot_[id / TargetStorePage];
+            TargetReplyPage& reply = *reply_[id / TargetStorePage];
+            unsigned int at = id % TargetStorePage;
+            hot.seq[at]      = 0;
+            hot.sent[at]     = 0;
+            hot.received[at] = 0;
+            hot.lost[at]     = 0;
+            hot.rto[at]      = RtoEstimator();
+            reply.minNs[at] = reply.maxNs[at] = reply.lastRttNs[at] = 0;
+            reply.meanNs[at] = reply.m2[at] = reply.jitterNs[at] = 0.0;
+            reply.errors[at] = reply.late[at] = reply.duplicates[at] = reply.reordered[at] = 0;
+            reply.window[at] = SequenceWindow();
+            cold_[id / TargetStorePage]->errorClasses[at] = IcmpErrorCounts();
+            free_.push_back(id);
+            --size_;
+            ++removed;
+        }
+        return removed;
+    }
+
+    // The id of an address, TargetStoreNone if it is not in the store
+    unsigned int Find(unsigned long address) const
+    {
+        unsigned int slot = Slot((unsigned int)address);
+        return slot == TargetStoreNone ? TargetStoreNone : slots_[slot].id;
+    }
+
+    // Probe path: the sequence number the next request carries (1, 2, ... per target), counted as sent
+    unsigned short OnSent(unsigned int id)
+    {
+        TargetHotPage& hot = *hot_[id / TargetStorePage];
+        unsigned int at = id % TargetStorePage;
+        ++hot.sent[at];
+        return ++hot.seq[at];
+    }
+
+    // Classifies a reply by its sequence number before its RTT is recorded, as RttStats::OnReply
+    ReplyKind OnReply(unsigned int id, unsigned short seq, bool expired = false)
+    {
+        TargetReplyPage& reply = *reply_[id / TargetStorePage];
+        unsigned int at = id % TargetStorePage;
+        SeqOrder order = reply.window[at].Classify(seq);
+        if (order == SEQ_SEEN)
+        {
+            ++reply.duplicates[at];
+            return REPLY_DUPLICATE;
+        }
+        if (expired)
+        {
+            ++reply.late[at];
+            return REPLY_LATE;
+        }
+        if (order == SEQ_OLDER)
+            ++reply.reordered[at];
+        return REPLY_NEW;
+    }
+
+    // The RTT of a new reply: counted as received, into the moments as RttStats::Record, and sampled for the timeout
+    void Record(unsigned int id, unsigned long long rttNs)
+    {
+        TargetHotPage& hot = *hot_[id / TargetStorePage];
+        TargetReplyPage& reply = *reply_[id / TargetStorePage];
+        unsigned int at = id % TargetStorePage;
+        unsigned int received = ++hot.received[at];
+        hot.rto[at].Sample(rttNs);
+        if (received == 1 || rttNs < reply.minNs[at])
+            reply.minNs[at] = rttNs;
+        if (rttNs > reply.maxNs[at])
+            reply.maxNs[at] = rttNs;
+        double delta = (double)rttNs - reply.meanNs[at];
+        reply.meanNs[at] += delta / (double)received;
+        reply.m2[at]     += delta * ((double)rttNs - reply.meanNs[at]);
+        if (received > 1)
+            reply.jitterNs[at] += (fabs((double)rttNs - (double)reply.lastRttNs[at]) - reply.jitterNs[at]) / 16.0;
+        reply.lastRttNs[at] = rttNs;
+    }
+
+    // A reply that came after its probe was counted lost: still a sample of the path
+    void OnLate(unsigned int id, unsigned long long rttNs)
+    {
+        hot_[id / TargetStorePage]->rto[id % TargetStorePage].Sample(rttNs);
+    }
+
+    void OnLost(unsigned int id)
+    {
+        TargetHotPage& hot = *hot_[id / TargetStorePage];
+        unsigned int at = id % TargetStorePage;
+        ++hot.lost[at];
+        hot.rto[at].OnTimeout();
+    }
+
+    // A probe answered by an ICMP error that ends it (unreachable, time exceeded, parameter problem): also lost
+    void OnError(unsigned int id)
+    {
+        ++hot_[id / TargetStorePage]->lost[id % TargetStorePage];
+        ++reply_[id / TargetStorePage]->errors[id % TargetStorePage];
+    }
+
+    // Any ICMP error about the target, by class, whether it ended a probe or not
+    void CountError(unsigned int id, unsigned char type)
+    {
+        cold_[id / TargetStorePage]->errorClasses[id % TargetStorePage].Record(type);
+    }
+
+    // The target's counters and RTT moments as an RttStats, for a summary
+    RttStats Stats(unsigned int id) const
+    {
+        const TargetHotPage& hot = *hot_[id / TargetStorePage];
+        const TargetReplyPage& reply = *reply_[id / TargetStorePage];
+        unsigned int at = id % TargetStorePage;
+        return RttStats(hot.sent[at], hot.received[at], hot.lost[at], reply.errors[at], reply.late[at], reply.duplicates[at],
+                        reply.reordered[at], reply.minNs[at], reply.maxNs[at], reply.meanNs[at], reply.m2[at], reply.jitterNs[at],
+                        reply.lastRttNs[at]);
+    }
+
+    unsigned long long TimeoutNs(unsigned int id, const RtoConfig& config) const
+    {
+        return hot_[id / TargetStorePage]->rto[id % TargetStorePage].TimeoutNs(config);
+    }
+
+    unsigned short      Seq(unsigned int id) const        { return hot_[id / TargetStorePage]->seq[id % TargetStorePage]; }
+    unsigned int        Sent(unsigned int id) const       { return hot_[id / TargetStorePage]->sent[id % TargetStorePage]; }
+    unsigned int        Received(unsigned int id) const   { return hot_[id / TargetStorePage]->received[id % TargetStorePage]; }
+    unsigned int        Lost(unsigned int id) const       { return hot_[id / TargetStorePage]->lost[id % TargetStorePage]; }
+    const RtoEstimator& Rto(unsigned int id) const        { return hot_[id / TargetStorePage]->rto[id % TargetStorePage]; }
+    unsigned long       Address(unsigned int id) const    { return cold_[id / TargetStorePage]->address[id % TargetStorePage]; }
+    unsigned long long  IntervalNs(unsigned int id) const { return cold_[id / TargetStorePage]->intervalNs[id % TargetStorePage]; }
+    unsigned long long  AddedNs(unsigned int id) const    { return cold_[id / TargetStorePage]->addedNs[id % TargetStorePage]; }
+    const IcmpErrorCounts& Errors(unsigned int id) const  { return cold_[id / TargetStorePage]->errorClasses[id % TargetStorePage]; }
+
+    /* Sums the counters of every target, page by page over the three counter columns only: a pass over a million
+       targets reads 12 MB instead of every target's whole state */
+    void Totals(unsigned long long* sent, unsigned long long* received, unsigned long long* lost) const
+    {
+        unsigned long long s = 0, r = 0, l = 0;
+        for (unsigned int page = 0; page * TargetStorePage < highWater_; ++page)
+        {
+            const TargetHotPage& hot = *hot_[page];
+            unsigned int n = highWater_ - page * TargetStorePage < TargetStorePage ? highWater_ - page * TargetStorePage : TargetStorePage;
+            for (unsigned int at = 0; at < n; ++at)
+            {
+                s += hot.sent[at];
+                r += hot.received[at];
+                l += hot.lost[at];
+            }
+        }
+        *sent = s;
+        *received = r;
+        *lost = l;
+    }
+
+    unsigned int Size() const      { return size_; }
+    unsigned int Capacity() const  { return capacity_; }
+    unsigned int IdLimit() const   { return highWater_; }                   // Every id handed out so far is below this
+
+    // Heap bytes in use: the pages allocated so far and the index
+    size_t Bytes() const
+    {
+        return hotArena_.Bytes() + replyArena_.Bytes() + coldArena_.Bytes() + slots_.size() * sizeof(IndexSlot) +
+               (hot_.size() + reply_.size() + cold_.size()) * sizeof(void*) + free_.capacity() * sizeof(unsigned int);
+    }
+
+private:
+    struct TargetHotPage
+    {
+        unsigned short seq[TargetStorePage];
+        unsigned int   sent[TargetStorePage];
+        unsigned int   received[TargetStorePage];
+        unsigned int   lost[TargetStorePage];
+        RtoEstimator   rto[TargetStorePage];
+    };
+
+    struct TargetReplyPage
+    {
+        unsigned long long minNs[TargetStorePage];
+        unsigned long long maxNs[TargetStorePage];
+        unsigned long long lastRttNs[TargetStorePage];
+        double             meanNs[TargetStorePage];
+        double             m2[TargetStorePage];
+        double             jitterNs[TargetStorePage];
+        unsigned int       errors[TargetStorePage];
+        unsigned int       late[TargetStorePage];
+        unsigned int       duplicates[TargetStorePage];
+        unsigned int       reordered[TargetStorePage];
+        SequenceWindow     window[TargetStorePage];
+    };
+
+    struct TargetColdPage
+    {
+        unsigned int       address[TargetStorePage];
+        unsigned long long intervalNs[TargetStorePage];
+        unsigned long long addedNs[TargetStorePage];
+        IcmpErrorCounts    errorClasses[TargetStorePage];
+    };
+
+    struct IndexSlot
+    {
+        unsigned int address;
+        unsigned int id;                                                    // TargetStoreNone marks an empty slot
+    };
+
+    TargetStore(const TargetStore&);
+    TargetStore& operator=(const TargetStore&);
+
+    // Arena blocks of 4 MB, or of all the pages a small store can ever need
+    static size_t ArenaBlockBytes(unsigned int capacity, size_t pageBytes)
+    {
+        size_t bytes = (capacity + TargetStorePage - 1) / TargetStorePage * ((pageBytes + 63) & ~(size_t)63);
+        return bytes < (4u << 20) ? bytes : (4u << 20);
+    }
+
+    // A free id, or the next new one (with its pages); TargetStoreNone when the store is full
+    unsigned int NewId()
+    {
+        if (!free_.empty())
+        {
+            unsigned int id = free_.back();
+            free_.pop_back();
+            return id;
+        }
+        if (highWater_ == capacity_)
+            return TargetStoreNone;
+        unsigned int id = highWater_++;
+        if (id % TargetStorePage == 0)
+        {
+            hot_[id / TargetStorePage]   = new (hotArena_.Allocate(sizeof(TargetHotPage))) TargetHotPage();
+            reply_[id / TargetStorePage] = new (replyArena_.Allocate(sizeof(TargetReplyPage))) TargetReplyPage();
+            cold_[id / TargetStorePage]  = new (coldArena_.Allocate(sizeof(TargetColdPage))) TargetColdPage();
+        }
+        return id;
+    }
+
+    // Index slot of an address, TargetStoreNone if it is not in the store
+    unsigned int Slot(unsigned int address) const
+    {
+        unsigned int slot = Hash(address);
+        while (slots_[slot].address != address || slots_[slot].id == TargetStoreNone)
+        {
+            if (slots_[slot].id == TargetStoreNone)
+                return TargetStoreNone;
+            slot = (slot + 1) & mask_;
+        }
+        return slot;
+    }
+
+    unsigned int Hash(unsigned int address) const
+    {
+        return (unsigned int)(((unsigned long long)address * 0x9E3779B97F4A7C15ull) >> (64 - bits_));   // Fibonacci hashing
+    }
+
+    // Backward-shift deletion, as InFlightTable::Erase
+    void Erase(unsigned int hole)
+    {
+        unsigned int i = hole;
+        for (;;)
+        {
+            i = (i + 1) & mask_;
+            if (slots_[i].id == TargetStoreNone)
+                break;
+            unsigned int home = Hash(slots_[i].address);
+            if (((i - home) & mask_) >= ((i - hole) & mask_))
+            {
+                slots_[hole] = slots_[i];
+                hole = i;
+            }
+        }
+        slots_[hole].id = TargetStoreNone;
+    }
+
+    unsigned int                  capacity_;
+    unsigned int                  size_;
+    unsigned int                  highWater_;                               // Ids below it have their pages
+    unsigned int                  bits_;
+    unsigned int                  mask_;
+    std::vector<IndexSlot>        slots_;
+    std::vector<TargetHotPage*>   hot_;                                     // Page pointers, NULL until the page is needed
+    std::vector<TargetReplyPage*> reply_;
+    std::vector<TargetColdPage*>  cold_;
+    std::vector<unsigned int>     free_;                                    // Removed ids, handed out again first
+    TargetArena                   hotArena_;
+    TargetArena                   replyArena_;
+    TargetArena                   coldArena_;
+};
+
+#endif // ICMP_TARGET_STORE_H
@@ -0,0 +1,142 @@
+/* ICMP Packet Watcher - Target list parsing for the multi-target sweep mode */
+
+/* A target specification can be
+     - a single IPv4 address                 192.168.1.10
+     - a CIDR range                          10.0.0.0/24
+     - a comma separated list of the above   10.0.0.1,10.0.1.0/28
+     - the path of a text file that holds one of the above per line ('#' starts a comment)
+   Any address or range may carry its own probe interval in milliseconds after an '@' (10.0.0.0/24@250,
+   10.0.1.1@0.5); the others use the interval of the run. Addresses are returned in network byte order, sorted and
+   without duplicates (an address listed twice keeps its shortest '@' interval). */
+
+#ifndef ICMP_TARGETS_H
+#define ICMP_TARGETS_H
+
+#ifdef _WIN32
+#include <Winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Parses one address or CIDR range. Prefixes shorter than /8 are refused, they would expand to more than 16M targets.
+inline bool ParseTargetRange(const std::string& spec, std::vector<unsigned long>& targets)
+{
+    std::string address = spec;
+    int prefix = 32;
+
+    size_t slash = spec.find('/');
+    if (slash != std::string::npos)
+    {
+        address = spec.substr(0, slash);
+        char* end = NULL;
+        prefix = (int)strtol(spec.c_str() + slash + 1, &end, 10);
+        if (*end != '\0' || prefix < 8 || prefix > 32)
+            return false;
+    }
+
+    unsigned long ulAddr = inet_addr(address.c_str());
+    if (ulAddr == INADDR_NONE && address != "255.255.255.255")
+        return false;
+
+    unsigned long first = ntohl(ulAddr) & (prefix == 32 ? 0xffffffffUL : ~(0xffffffffUL >> prefix) & 0xffffffffUL);
+    unsigned long count = 1UL << (32 - prefix);
+    for (unsigned long n = 0; n < count; ++n)
+        targets.push_back(htonl((first + n) & 0xffffffffUL));
+    return true;
+}
+
+// Parses a comma separated list of addresses and CIDR ranges. intervals gets one entry per target: the "@ms"
+// interval of its item, 0 if it has none.
+inline bool ParseTargetList(const std::string& list, std::vector<unsigned long>& targets, std::vector<double>& intervals)
+{
+    size_t start = 0;
+    while (start <= list.size())
+    {
+        size_t comma = list.find(',', start);
+        if (comma == std::string::npos)
+            comma = list.size();
+
+        std::string item = list.substr(start, comma - start);
+        size_t first = item.find_first_not_of(" \t\r\n");
+        size_t last  = item.find_last_not_of(" \t\r\n");
+        if (first != std::string::npos)
+        {
+            item = item.substr(first, last - first + 1);
+            double interval = 0.0;
+            size_t at = item.find('@');
+            if (at != std::string::npos)
+            {
+                char* end = NULL;
+                interval = strtod(item.c_str() + at + 1, &end);
+                if (*end != '\0' || !(interval > 0.0))
+                    return false;
+                item = item.substr(0, at);
+            }
+            if (!ParseTargetRange(item, targets))
+                return false;
+            intervals.resize(targets.size(), interval);
+        }
+        start = comma + 1;
+    }
+    return true;
+}
+
+/* Loads the targets from a specification or from a target file (see the top of this file). With intervals, it
+   gets each target's own interval in ms (0: the run's interval), in the order of targets. */
+inline bool LoadTargets(const char* spec, std::vector<unsigned long>& targets, std::vector<double>* intervals = NULL)
+{
+    std::vector<double> itemIntervals;
+    FILE* file = fopen(spec, "r");
+    if (file == NULL)
+    {
+        if (!ParseTargetList(spec, targets, itemIntervals))
+            return false;
+    }
+    else
+    {
+        char line[512];
+        bool ok = true;
+        while (ok && fgets(line, sizeof(line), file) != NULL)
+        {
+            char* comment = strchr(line, '#');
+            if (comment != NULL)
+                *comment = '\0';
+            ok = ParseTargetList(line, targets, itemIntervals);
+        }
+        fclose(file);
+        if (!ok)
+            return false;
+    }
+
+    if (intervals == NULL)
+    {
+        std::sort(targets.begin(), targets.end());
+        targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+        return !targets.empty();
+    }
+
+    // Sorted by address, then explicit intervals before "no interval" (0) and shorter before longer
+    std::vector<std::pair<unsigned long, double> > entries(targets.size());
+    for (size_t i = 0; i < targets.size(); ++i)
+        entries[i] = std::make_pair(targets[i], itemIntervals[i] > 0.0 ? itemIntervals[i] : 1e300);
+    std::sort(entries.begin(), entries.end());
+    targets.clear();
+    intervals->clear();
+    for (size_t i = 0; i < entries.size(); ++i)
+        if (i == 0 || entries[i].first != entries[i - 1].first)
+        {
+            targets.push_back(entries[i].first);
+            intervals->push_back(entries[i].second < 1e300 ? entries[i].second : 0.0);
+        }
+    return !targets.empty();
+}
+
+#endif // ICMP_TARGETS_H
@@ -0,0 +1,901 @@
+/* ICMP Packet Watcher - Compressed columnar time-series store for probe results */
+
+/* Long and unlimited runs can keep their per-probe records (OutputRecord, icmp_Output.h) in a file that stays small
+   enough for months of results from thousands of targets (-o tsdb -f file). The records of each target collect in
+   an open block. A block is sealed when it holds 1024 records or spans 10 minutes. It is then compressed column by
+   column and appended to the file. Each column is a bit stream of its own:
+     time    Unix ns, delta of delta (Gorilla): 1 bit while probes keep the spacing of the one before, 14 to 68 bits
+             when they drift (a zigzag-coded difference in one of four sizes)
+     rtt     RTTs of replies and errors, each XORed with the one before (Gorilla): 1 bit for the same value, else the
+             bits that differ, with 2 bits of framing when they fit within the previous leading/trailing zero window
+     event   1 bit for a reply, 4 bits for any other event (OutputEvent)
+     seq     1 bit when the sequence number is one more than the one before, 17 bits otherwise
+     extra   sender, ICMP type and code of every error; 1 bit per record for the traceroute hop and the size sweep
+             payload (25 bits when either is set)
+   A target answering at a steady rate costs a few bytes per probe instead of the 32 of a binary record.
+
+   File layout, little-endian:
+     header    "ICMPTSDB", u32 version, u32 reserved
+     blocks    80-byte block header: "TSBK", target, u32 count, replies, timeouts, errors, late, u32 byte length of
+               each column, u64 first_ns, last_ns, min_rtt_ns, max_rtt_ns; then the five columns
+     index     one 32-byte entry per block: target, u32 count, u64 first_ns, u64 last_ns, u64 file offset of the block
+     trailer   u64 index offset, u64 entries, "TSDBINDX"
+   Addresses are stored as their four bytes in network order. The block header carries the block's counters
+   (replies, timeouts, errors, late replies), its first and last time, the min and max reply RTT and the byte length
+   of every column. A query therefore takes the loss of a block that lies inside its window from the header alone,
+   decodes only the event and rtt columns of such a block for percentiles, and decodes every column only for the
+   blocks at the edges of the window; blocks of other targets or times are skipped by the index. The index is
+   written when the run ends. A file without one (the run was killed) is read by walking the block headers, and
+   only the records of blocks that were still open are missing.
+
+   TimeSeriesWriter   OutputSink of the tsdb format: the compression runs on OutputWriter's thread, never on the
+                      probe path. Also usable on its own (icmp_Winsock_API.cpp writes to it directly).
+   TimeSeriesReader   maps the file (TransportMappedFile), decodes blocks and sums up loss and RTT percentiles per
+                      target over a time window (icmp_TimeSeriesQuery.cpp) */
+
+#ifndef ICMP_TIMESERIES_H
+#define ICMP_TIMESERIES_H
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+#include "icmp_Output.h"
+#include "icmp_Stats.h"
+#include "icmp_Transport.h"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#define TimeSeriesVersion       1
+#define TimeSeriesFileHeader    16
+#define TimeSeriesBlockHeader   80
+#define TimeSeriesIndexEntry    32
+#define TimeSeriesTrailer       24
+#define TimeSeriesBlockMagic    0x4B425354u                                 // "TSBK"
+#define TimeSeriesColumns       5
+#define TimeSeriesBlockRecords  1024                                        // Records per block at most
+#define TimeSeriesBlockSpanNs   (600ULL * 1000000000ULL)                    // A block is sealed once it spans 10 minutes
+
+enum TimeSeriesColumn
+{
+    TIMESERIES_TIME,
+    TIMESERIES_RTT,
+    TIMESERIES_EVENT,
+    TIMESERIES_SEQ,
+    TIMESERIES_EXTRA
+};
+
+inline void TimeSeriesPut32(unsigned char* p, unsigned int v)
+{
+    for (int i = 0; i < 4; ++i)
+        p[i] = (unsigned char)(v >> (8 * i));
+}
+
+inline void TimeSeriesPut64(unsigned char* p, unsigned long long v)
+{
+    for (int i = 0; i < 8; ++i)
+        p[i] = (unsigned char)(v >> (8 * i));
+}
+
+inline unsigned int TimeSeriesGet32(const unsigned char* p)
+{
+    return (unsigned int)p[0] | ((unsigned int)p[1] << 8) | ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+inline unsigned long long TimeSeriesGet64(const unsigned char* p)
+{
+    return (unsigned long long)TimeSeriesGet32(p) | ((unsigned long long)TimeSeriesGet32(p + 4) << 32);
+}
+
+inline unsigned long long TimeSeriesZigZag(long long v)
+{
+    return ((unsigned long long)v << 1) ^ (unsigned long long)(v >> 63);
+}
+
+inline long long TimeSeriesUnZigZag(unsigned long long z)
+{
+    return (long long)(z >> 1) ^ -(long long)(z & 1);
+}
+
+inline int TimeSeriesLeadingZeros(unsigned long long v)                    // v != 0
+{
+#if defined(_MSC_VER)
+    unsigned long bit;
+    _BitScanReverse64(&bit, v);
+    return 63 - (int)bit;
+#else
+    return __builtin_clzll(v);
+#endif
+}
+
+inline int TimeSeriesTrailingZeros(unsigned long long v)                   // v != 0
+{
+#if defined(_MSC_VER)
+    unsigned long bit;
+    _BitScanForward64(&bit, v);
+    return (int)bit;
+#else
+    return __builtin_ctzll(v);
+#endif
+}
+
+// Bits appended most significant first
+class TimeSeriesBitWriter
+{
+public:
+    TimeSeriesBitWriter() : bits_(0) {}
+
+    // The low "count" bits of value (1 to 64)
+    void Write(unsigned long long value, int count)
+    {
+        while (count > 0)
+        {
+            int used = (int)(bits_ & 7);
+            if (used == 0)
+                bytes_.push_back(0);
+            int take = 8 - used < count ? 8 - used : count;
+            unsigned int chunk = (unsigned int)(value >> (count - take)) & ((1u << take) - 1);
+            bytes_.back() |= (unsigned char)(chunk << (8 - used - take));
+            count -= take;
+            bits_ += take;
+        }
+    }
+
+    void Clear()
+    {
+        bytes_.clear();
+        bits_ = 0;
+    }
+
+    const std::vector<unsigned char>& Bytes() const { return bytes_; }
+
+private:
+    std::vector<unsigned char> bytes_;
+    unsigned long long         bits_;
+};
+
+// Reads the bits of a TimeSeriesBitWriter back; the next bits wait left-aligned in a 64-bit buffer
+class TimeSeriesBitReader
+{
+public:
+    TimeSeriesBitReader(const unsigned char* data, size_t bytes) : data_(data), bytes_(bytes), next_(0), buffer_(0), buffered_(0), overrun_(false) {}
+
+    // The next "count" bits (1 to 64); 0 and Overrun() past the end of the column
+    unsigned long long Read(int count)
+    {
+        if (count > 32)
+        {
+            unsigned long long high = Read(count - 32);
+            return (high << 32) | Read(32);
+        }
+        if (buffered_ < count)
+        {
+            while (buffered_ <= 56 && next_ < bytes_)
+            {
+                buffer_ |= (unsigned long long)data_[next_++] << (56 - buffered_);
+                buffered_ += 8;
+            }
+            if (buffered_ < count)
+            {
+                Fail();                                                     // A damaged block: the caller drops it
+                return 0;
+            }
+        }
+        unsigned long long value = buffer_ >> (64 - count);
+        buffer_ <<= count;
+        buffered_ -= count;
+        return value;
+    }
+
+    bool Bit()            { return Read(1) != 0; }
+    void Fail()           { overrun_ = true; next_ = bytes_; buffer_ = 0; buffered_ = 0; }
+    bool Overrun() const  { return overrun_; }
+
+private:
+    const unsigned char* data_;
+    size_t               bytes_;
+    size_t               next_;                                             // First byte not in the buffer yet
+    unsigned long long   buffer_;
+    int                  buffered_;                                         // Bits in buffer_
+    bool                 overrun_;
+};
+
+// The open block of one target: records are encoded into the columns as they arrive
+class TimeSeriesBlock
+{
+public:
+    explicit TimeSeriesBlock(unsigned int target = 0) : target_(target) { Reset(); }
+
+    void Append(const OutputRecord& record, unsigned long long unixNs)
+    {
+        // time: delta of delta
+        if (count_ == 0)
+            firstNs_ = lastNs_ = unixNs;
+        else
+        {
+            long long delta = (long long)(unixNs - lastNs_);
+            unsigned long long z = TimeSeriesZigZag(delta - prevDelta_);
+            if (z == 0)
+                columns_[TIMESERIES_TIME].Write(0, 1);
+            else if (z < (1ULL << 12))
+                columns_[TIMESERIES_TIME].Write((2ULL << 12) | z, 14);     // 10 + 12 bits
+            else if (z < (1ULL << 20))
+                columns_[TIMESERIES_TIME].Write((6ULL << 20) | z, 23);     // 110 + 20 bits
+            else if (z < (1ULL << 32))
+                columns_[TIMESERIES_TIME].Write((14ULL << 32) | z, 36);    // 1110 + 32 bits
+            else
+            {
+                columns_[TIMESERIES_TIME].Write(15, 4);
+                columns_[TIMESERIES_TIME].Write(z, 64);
+            }
+            prevDelta_ = delta;
+            lastNs_ = unixNs;
+        }
+
+        // event, and the counters of the block header
+        if (record.event == OUTPUT_REPLY)
+            columns_[TIMESERIES_EVENT].Write(0, 1);
+        else
+            columns_[TIMESERIES_EVENT].Write(8 | (record.event & 7), 4);
+        switch (record.event)
+        {
+        case OUTPUT_REPLY:
+            ++replies_;
+            if (replies_ == 1 || record.rttNs < minRttNs_)
+                minRttNs_ = record.rttNs;
+            if (record.rttNs > maxRttNs_)
+                maxRttNs_ = record.rttNs;
+            break;
+        case OUTPUT_TIMEOUT: ++timeouts_; break;
+        case OUTPUT_ERROR:   ++errors_;   break;
+        case OUTPUT_LATE:    ++late_;     break;
+        default:                          break;
+        }
+
+        // seq: one more than the one before, or in full
+        if (count_ > 0 && record.seq == (unsigned short)(prevSeq_ + 1))
+            columns_[TIMESERIES_SEQ].Write(0, 1);
+        else
+            columns_[TIMESERIES_SEQ].Write((1u << 16) | record.seq, 17);
+        prevSeq_ = record.seq;
+
+        if (record.event == OUTPUT_REPLY || record.event == OUTPUT_ERROR)
+            AppendRtt(record.rttNs);
+
+        TimeSeriesBitWriter& extra = columns_[TIMESERIES_EXTRA];
+        if (record.event == OUTPUT_ERROR)
+        {
+            const unsigned char* from = (const unsigned char*)&record.from;
+            for (int i = 0; i < 4; ++i)
+                extra.Write(from[i], 8);
+            extra.Write(record.icmpType, 8);
+            extra.Write(record.icmpCode, 8);
+        }
+        if (record.hop == 0 && record.size == 0)
+            extra.Write(0, 1);
+        else
+            extra.Write((1u << 24) | ((unsigned int)record.hop << 16) | record.size, 25);
+        ++count_;
+    }
+
+    // Appends the block (header and columns) to out
+    void Serialize(std::vector<unsigned char>& out) const
+    {
+        size_t start = out.size();
+        size_t length = TimeSeriesBlockHeader;
+        for (int c = 0; c < TimeSeriesColumns; ++c)
+            length += columns_[c].Bytes().size();
+        out.resize(start + length);
+        unsigned char* p = &out[start];
+        TimeSeriesPut32(p, TimeSeriesBlockMagic);
+        memcpy(p + 4, &target_, 4);                                         // Network byte order, as on the wire
+        TimeSeriesPut32(p + 8, count_);
+        TimeSeriesPut32(p + 12, replies_);
+        TimeSeriesPut32(p + 16, timeouts_);
+        TimeSeriesPut32(p + 20, errors_);
+        TimeSeriesPut32(p + 24, late_);
+        TimeSeriesPut64(p + 48, firstNs_);
+        TimeSeriesPut64(p + 56, lastNs_);
+        TimeSeriesPut64(p + 64, minRttNs_);
+        TimeSeriesPut64(p + 72, maxRttNs_);
+        unsigned char* column = p + TimeSeriesBlockHeader;
+        for (int c = 0; c < TimeSeriesColumns; ++c)
+        {
+            const std::vector<unsigned char>& bytes = columns_[c].Bytes();
+            TimeSeriesPut32(p + 28 + 4 * c, (unsigned int)bytes.size());
+            if (!bytes.empty())
+                memcpy(column, &bytes[0], bytes.size());
+            column += bytes.size();
+        }
+    }
+
+    // Empties the block for the next records of the target; the column buffers keep their memory
+    void Reset()
+    {
+        count_ = replies_ = timeouts_ = errors_ = late_ = 0;
+        firstNs_ = lastNs_ = minRttNs_ = maxRttNs_ = prevRtt_ = 0;
+        prevDelta_ = 0;
+        prevSeq_ = 0;
+        prevLeading_ = prevTrailing_ = -1;
+        rttCount_ = 0;
+        for (int c = 0; c < TimeSeriesColumns; ++c)
+            columns_[c].Clear();
+    }
+
+    unsigned int       Target() const  { return target_; }
+    unsigned int       Count() const   { return count_; }
+    unsigned long long FirstNs() const { return firstNs_; }
+    unsigned long long LastNs() const  { return lastNs_; }
+
+private:
+    // rtt: XOR with the previous value, the first in full
+    void AppendRtt(unsigned long long rttNs)
+    {
+        TimeSeriesBitWriter& rtt = columns_[TIMESERIES_RTT];
+        unsigned long long x = rttNs ^ prevRtt_;
+        if (rttCount_ == 0)
+            rtt.Write(rttNs, 64);
+        else if (x == 0)
+            rtt.Write(0, 1);
+        else
+        {
+            int leading = TimeSeriesLeadingZeros(x);
+            int trailing = TimeSeriesTrailingZeros(x);
+            if (prevLeading_ >= 0 && leading >= prevLeading_ && trailing >= prevTrailing_)
+            {
+                rtt.Write(2, 2);                                            // 10: within the previous window
+                rtt.Write(x >> prevTrailing_, 64 - prevLeading_ - prevTrailing_);
+            }
+            else
+            {
+                int meaningful = 64 - leading - trailing;
+                rtt.Write(3, 2);                                            // 11: a new window
+                rtt.Write((unsigned long long)leading, 6);
+                rtt.Write((unsigned long long)(meaningful - 1), 6);
+                rtt.Write(x >> trailing, meaningful);
+                prevLeading_  = leading;
+                prevTrailing_ = trailing;
+            }
+        }
+        prevRtt_ = rttNs;
+        ++rttCount_;
+    }
+
+    unsigned int        target_;
+    unsigned int        count_, replies_, timeouts_, errors_, late_, rttCount_;
+    unsigned long long  firstNs_, lastNs_, minRttNs_, maxRttNs_, prevRtt_;
+    long long           prevDelta_;
+    unsigned short      prevSeq_;
+    int                 prevLeading_, prevTrailing_;                       // XOR window of the rtt column, -1 before the first
+    TimeSeriesBitWriter columns_[TimeSeriesColumns];
+};
+
+class TimeSeriesWriter : public OutputSink
+{
+public:
+    explicit TimeSeriesWriter(FILE* file, unsigned int blockRecords = TimeSeriesBlockRecords, unsigned long long blockSpanNs = TimeSeriesBlockSpanNs)
+        : file_(file), blockRecords_(blockRecords == 0 ? 1 : blockRecords), blockSpanNs_(blockSpanNs), offset_(0), latestNs_(0),
+          records_(0), failed_(false), closed_(false)
+    {
+    }
+
+    // Record time is unixNs; record.timeNs is not used
+    void Write(const OutputRecord& record, unsigned long long unixNs)
+    {
+        if (offset_ == 0)
+            WriteFileHeader();
+        std::unordered_map<unsigned int, unsigned int>::iterator found = byTarget_.find(record.target);
+        unsigned int index;
+        if (found != byTarget_.end())
+            index = found->second;
+        else
+        {
+            index = (unsigned int)open_.size();
+            open_.push_back(TimeSeriesBlock(record.target));
+            byTarget_[record.target] = index;
+        }
+        TimeSeriesBlock& block = open_[index];
+        if (block.Count() > 0 && (long long)(unixNs - block.FirstNs()) >= (long long)blockSpanNs_)
+            Seal(block);
+        block.Append(record, unixNs);
+        if (block.Count() >= blockRecords_)
+            Seal(block);
+        if (unixNs > latestNs_)
+            latestNs_ = unixNs;
+        if ((++records_ & 4095) == 0)
+            SealQuiet();
+    }
+
+    // Seals every open block and writes the index; the file is complete after this
+    void Close()
+    {
+        if (closed_)
+            return;
+        closed_ = true;
+        if (offset_ == 0)
+            WriteFileHeader();
+        for (size_t i = 0; i < open_.size(); ++i)
+            if (open_[i].Count() > 0)
+                Seal(open_[i]);
+        unsigned long long indexOffset = offset_;
+        buffer_.resize(index_.size() * TimeSeriesIndexEntry + TimeSeriesTrailer);
+        unsigned char* p = &buffer_[0];
+        for (size_t i = 0; i < index_.size(); ++i, p += TimeSeriesIndexEntry)
+        {
+            memcpy(p, &index_[i].target, 4);
+            TimeSeriesPut32(p + 4, index_[i].count);
+            TimeSeriesPut64(p + 8, index_[i].firstNs);
+            TimeSeriesPut64(p + 16, index_[i].lastNs);
+            TimeSeriesPut64(p + 24, index_[i].offset);
+        }
+        TimeSeriesPut64(p, indexOffset);
+        TimeSeriesPut64(p + 8, index_.size());
+        memcpy(p + 16, "TSDBINDX", 8);
+        Put(&buffer_[0], buffer_.size());
+        if (fflush(file_) != 0)
+            failed_ = true;
+    }
+
+    unsigned long long Records() const { return records_; }
+    unsigned long long Blocks() const  { return index_.size(); }
+    unsigned long long Bytes() const   { return offset_; }                 // Written to the file so far
+    bool               Failed() const  { return failed_; }                 // A write failed (disk full, ...)
+
+private:
+    struct IndexEntry
+    {
+        unsigned int       target;
+        unsigned int       count;
+        unsigned long long firstNs, lastNs, offset;
+    };
+
+    void WriteFileHeader()
+    {
+        unsigned char header[TimeSeriesFileHeader];
+        memcpy(header, "ICMPTSDB", 8);
+        TimeSeriesPut32(header + 8, TimeSeriesVersion);
+        TimeSeriesPut32(header + 12, 0);
+        Put(header, sizeof(header));
+    }
+
+    void Seal(TimeSeriesBlock& block)
+    {
+        IndexEntry entry;
+        entry.target  = block.Target();
+        entry.count   = block.Count();
+        entry.firstNs = block.FirstNs();
+        entry.lastNs  = block.LastNs();
+        entry.offset  = offset_;
+        index_.push_back(entry);
+        buffer_.clear();
+        block.Serialize(buffer_);
+        Put(&buffer_[0], buffer_.size());
+        block.Reset();
+    }
+
+    // Seals the blocks of targets that went quiet, so a killed run loses at most the last blockSpanNs of them
+    void SealQuiet()
+    {
+        for (size_t i = 0; i < open_.size(); ++i)
+            if (open_[i].Count() > 0 && latestNs_ - open_[i].FirstNs() >= blockSpanNs_)
+                Seal(open_[i]);
+    }
+
+    void Put(const void* data, size_t len)
+    {
+        if (fwrite(data, 1, len, file_) != len)
+            failed_ = true;
+        offset_ += len;
+    }
+
+    FILE*                                          file_;
+    unsigned int                                   blockRecords_;
+    unsigned long long                             blockSpanNs_;
+    std::vector<TimeSeriesBlock>                   open_;                   // One open block per target
+    std::unordered_map<unsigned int, unsigned int> byTarget_;
+    std::vector<IndexEntry>                        index_;
+    std::vector<unsigned char>                     buffer_;
+    unsigned long long                             offset_;
+    unsigned long long                             latestNs_;
+    unsigned long long                             records_;
+    bool                                           failed_;
+    bool                                           closed_;
+};
+
+// A block as listed by the index (or found by walking the file)
+struct TimeSeriesIndexInfo
+{
+    unsigned int       target;                                              // Network byte order
+    unsigned int       count;
+    unsigned long long firstNs, lastNs;                                     // Unix ns
+    unsigned long long offset;                                              // Of the block header in the file
+};
+
+// A block's header and columns
+struct TimeSeriesBlockInfo
+{
+    unsigned int         target;                                            // Network byte order
+    unsigned int         count, replies, timeouts, errors, late;
+    unsigned long long   firstNs, lastNs;                                   // Unix ns
+    unsigned long long   minRttNs, maxRttNs;                                // Of the replies, 0 without one
+    const unsigned char* columns[TimeSeriesColumns];
+    unsigned int         columnBytes[TimeSeriesColumns];
+};
+
+// Loss and RTT distribution of one target over a query window
+struct TimeSeriesSummary
+{
+    unsigned int       target;
+    unsigned long long replies, timeouts, errors, late, duplicates;
+    unsigned long long minRttNs, maxRttNs;
+    LatencyHistogram   rtt;
+
+    unsigned long long Probes() const      { return replies + timeouts + errors; }
+    double             LossPercent() const { return Probes() == 0 ? 0.0 : 100.0 * (double)timeouts / (double)Probes(); }
+};
+
+struct TimeSeriesQueryStats
+{
+    size_t blocks;                                                          // In the file
+    size_t read;                                                            // Of the target and time window
+    size_t rttOnly;                                                         // Inside the window: event and rtt columns decoded
+    size_t decoded;                                                         // At its edges: every column decoded
+    size_t damaged;                                                         // Failed to decode, left out
+};
+
+class TimeSeriesReader
+{
+public:
+    TimeSeriesReader() : data_(NULL), size_(0), indexed_(false) {}
+
+    // Maps the file and lists its blocks. False if it is not a time-series file.
+    bool Open(const char* path)
+    {
+        size_t size;
+        const void* data = file_.Open(path, &size);
+        return data != NULL && Attach(data, size);
+    }
+
+    // Reads a file that is already in memory; the caller keeps data alive as long as the reader is used
+    bool Attach(const void* data, size_t size)
+    {
+        index_.clear();
+        data_ = (const unsigned char*)data;
+        size_ = size;
+        if (size_ < TimeSeriesFileHeader || memcmp(data_, "ICMPTSDB", 8) != 0 || TimeSeriesGet32(data_ + 8) != TimeSeriesVersion)
+            return false;
+        indexed_ = ReadIndex();
+        if (!indexed_)
+            Scan();
+        return true;
+    }
+
+    size_t Blocks() const   { return index_.size(); }
+    bool   Indexed() const  { return indexed_; }                            // False: no index, the blocks were found by walking the file
+    unsigned long long FileBytes() const { return size_; }
+    const TimeSeriesIndexInfo& Index(size_t i) const { return index_[i]; }
+
+    // Reads the header of the i-th block; false if it is damaged
+    bool Block(size_t i, TimeSeriesBlockInfo* block) const
+    {
+        return ParseBlock(index_[i].offset, block) && block->target == index_[i].target && block->count == index_[i].count;
+    }
+
+    /* Decodes every record of a block: visit(const OutputRecord& record) with record.timeNs in Unix ns. Returns false
+       for a damaged block (records already visited stay visited). */
+    template <typename Visit>
+    bool Decode(const TimeSeriesBlockInfo& block, Visit visit) const
+    {
+        TimeSeriesBitReader time(block.columns[TIMESERIES_TIME], block.columnBytes[TIMESERIES_TIME]);
+        TimeSeriesBitReader rtt(block.columns[TIMESERIES_RTT], block.columnBytes[TIMESERIES_RTT]);
+        TimeSeriesBitReader event(block.columns[TIMESERIES_EVENT], block.columnBytes[TIMESERIES_EVENT]);
+        TimeSeriesBitReader seq(block.columns[TIMESERIES_SEQ], block.columnBytes[TIMESERIES_SEQ]);
+        TimeSeriesBitReader extra(block.columns[TIMESERIES_EXTRA], block.columnBytes[TIMESERIES_EXTRA]);
+        RttDecoder rtts;
+        unsigned long long timeNs = block.firstNs;
+        long long delta = 0;
+        unsigned short lastSeq = 0;
+        for (unsigned int i = 0; i < block.count; ++i)
+        {
+            OutputRecord record;
+            memset(&record, 0, sizeof(record));
+            if (i > 0)
+            {
+                delta += TimeSeriesUnZigZag(ReadDeltaOfDelta(time));
+                timeNs += (unsigned long long)delta;
+            }
+            record.timeNs = timeNs;
+            record.event  = ReadEvent(event);
+            record.seq    = seq.Bit() ? (unsigned short)seq.Read(16) : (unsigned short)(lastSeq + 1);
+            lastSeq = record.seq;
+            if (record.event == OUTPUT_REPLY || record.event == OUTPUT_ERROR)
+                record.rttNs = rtts.Next(rtt);
+            record.target = block.target;
+            record.from   = block.target;
+            if (record.event == OUTPUT_ERROR)
+            {
+                unsigned char* from = (unsigned char*)&record.from;
+                for (int b = 0; b < 4; ++b)
+                    from[b] = (unsigned char)extra.Read(8);
+                record.icmpType = (unsigned char)extra.Read(8);
+                record.icmpCode = (unsigned char)extra.Read(8);
+            }
+            if (extra.Bit())
+            {
+                unsigned int hopSize = (unsigned int)extra.Read(24);
+                record.hop  = (unsigned char)(hopSize >> 16);
+                record.size = (unsigned short)hopSize;
+            }
+            if (time.Overrun() || rtt.Overrun() || event.Overrun() || seq.Overrun() || extra.Overrun())
+                return false;
+            visit(record);
+        }
+        return true;
+    }
+
+    // Only the event and rtt columns: visit(unsigned char event, unsigned long long rttNs) for every reply and error
+    template <typename Visit>
+    bool DecodeRtts(const TimeSeriesBlockInfo& block, Visit visit) const
+    {
+        TimeSeriesBitReader rtt(block.columns[TIMESERIES_RTT], block.columnBytes[TIMESERIES_RTT]);
+        TimeSeriesBitReader event(block.columns[TIMESERIES_EVENT], block.columnBytes[TIMESERIES_EVENT]);
+        RttDecoder rtts;
+        for (unsigned int i = 0; i < block.count; ++i)
+        {
+            unsigned char kind = ReadEvent(event);
+            if (kind != OUTPUT_REPLY && kind != OUTPUT_ERROR)
+                continue;
+            unsigned long long rttNs = rtts.Next(rtt);
+            if (rtt.Overrun() || event.Overrun())
+                return false;
+            visit(kind, rttNs);
+        }
+        return !rtt.Overrun() && !event.Overrun();
+    }
+
+    /* Loss and RTT percentiles per target over [fromNs, toNs) (Unix ns), for one target (network byte order) or all
+       of them (allTargets). Without percentiles, blocks inside the window are not decoded at all. Summaries are
+       sorted by address. */
+    void Query(unsigned long long fromNs, unsigned long long toNs, bool allTargets, unsigned int target, bool percentiles,
+               std::vector<TimeSeriesSummary>* summaries, TimeSeriesQueryStats* stats) const
+    {
+        memset(stats, 0, sizeof(*stats));
+        stats->blocks = index_.size();
+        summaries->clear();
+        std::unordered_map<unsigned int, size_t> byTarget;
+        for (size_t b = 0; b < index_.size(); ++b)
+        {
+            const TimeSeriesIndexInfo& entry = index_[b];
+            if ((!allTargets && entry.target != target) || entry.lastNs < fromNs || entry.firstNs >= toNs)
+                continue;                                                   // Its pages are never touched
+            ++stats->read;
+            TimeSeriesBlockInfo block;
+            if (!Block(b, &block))
+            {
+                ++stats->damaged;
+                continue;
+            }
+            std::unordered_map<unsigned int, size_t>::iterator found = byTarget.find(block.target);
+            if (found == byTarget.end())
+            {
+                found = byTarget.insert(std::make_pair(block.target, summaries->size())).first;
+                summaries->push_back(TimeSeriesSummary());
+                TimeSeriesSummary& fresh = summaries->back();
+                fresh.target = block.target;
+                fresh.replies = fresh.timeouts = fresh.errors = fresh.late = fresh.duplicates = 0;
+                fresh.minRttNs = fresh.maxRttNs = 0;
+            }
+            TimeSeriesSummary& summary = (*summaries)[found->second];
+
+            if (block.firstNs >= fromNs && block.lastNs < toNs)
+            {
+                // Inside the window: the counters come from the header
+                if (block.replies > 0)
+                {
+                    if (summary.replies == 0 || block.minRttNs < summary.minRttNs)
+                        summary.minRttNs = block.minRttNs;
+                    if (block.maxRttNs > summary.maxRttNs)
+                        summary.maxRttNs = block.maxRttNs;
+                }
+                summary.replies    += block.replies;
+                summary.timeouts   += block.timeouts;
+                summary.errors     += block.errors;
+                summary.late       += block.late;
+                summary.duplicates += block.count - block.replies - block.timeouts - block.errors - block.late;
+                if (!percentiles)
+                    continue;
+                ++stats->rttOnly;
+                if (!DecodeRtts(block, [&summary](unsigned char kind, unsigned long long rttNs) {
+                        if (kind == OUTPUT_REPLY)
+                            summary.rtt.Record(rttNs);
+                    }))
+                    ++stats->damaged;
+                continue;
+            }
+
+            // At an edge of the window: every record is checked against it
+            ++stats->decoded;
+            if (!Decode(block, [&](const OutputRecord& record) {
+                    if (record.timeNs < fromNs || record.timeNs >= toNs)
+                        return;
+                    switch (record.event)
+                    {
+                    case OUTPUT_REPLY:
+                        if (summary.replies == 0 || record.rttNs < summary.minRttNs)
+                            summary.minRttNs = record.rttNs;
+                        if (record.rttNs > summary.maxRttNs)
+                            summary.maxRttNs = record.rttNs;
+                        ++summary.replies;
+                        if (percentiles)
+                            summary.rtt.Record(record.rttNs);
+                        break;
+                    case OUTPUT_TIMEOUT: ++summary.timeouts;   break;
+                    case OUTPUT_ERROR:   ++summary.errors;     break;
+                    case OUTPUT_LATE:    ++summary.late;       break;
+                    default:             ++summary.duplicates; break;
+                    }
+                }))
+                ++stats->damaged;
+        }
+        std::sort(summaries->begin(), summaries->end(), [](const TimeSeriesSummary& a, const TimeSeriesSummary& b) {
+            return memcmp(&a.target, &b.target, 4) < 0;                     // Network byte order sorts like the address
+        });
+    }
+
+    // First and last record time in the file, 0 and 0 when it holds none
+    void TimeRange(unsigned long long* firstNs, unsigned long long* lastNs) const
+    {
+        *firstNs = *lastNs = 0;
+        for (size_t b = 0; b < index_.size(); ++b)
+        {
+            if (b == 0 || index_[b].firstNs < *firstNs)
+                *firstNs = index_[b].firstNs;
+            if (index_[b].lastNs > *lastNs)
+                *lastNs = index_[b].lastNs;
+        }
+    }
+
+private:
+    struct RttDecoder
+    {
+        RttDecoder() : value(0), count(0), leading(0), trailing(0) {}
+
+        unsigned long long Next(TimeSeriesBitReader& in)
+        {
+            if (count++ == 0)
+                return value = in.Read(64);
+            if (!in.Bit())
+                return value;
+            if (in.Bit())
+            {
+                leading = (int)in.Read(6);
+                int meaningful = (int)in.Read(6) + 1;
+                trailing = 64 - leading - meaningful;
+                if (trailing < 0)
+                {
+                    in.Fail();                                              // Damaged
+                    return 0;
+                }
+            }
+            return value ^= in.Read(64 - leading - trailing) << trailing;
+        }
+
+        unsigned long long value;
+        unsigned long long count;
+        int                leading, trailing;
+    };
+
+    static unsigned long long ReadDeltaOfDelta(TimeSeriesBitReader& in)
+    {
+        if (!in.Bit())
+            return 0;
+        if (!in.Bit())
+            return in.Read(12);
+        if (!in.Bit())
+            return in.Read(20);
+        if (!in.Bit())
+            return in.Read(32);
+        return in.Read(64);
+    }
+
+    static unsigned char ReadEvent(TimeSeriesBitReader& in)
+    {
+        return in.Bit() ? (unsigned char)in.Read(3) : (unsigned char)OUTPUT_REPLY;
+    }
+
+    // The block at offset, if its header and columns lie within the file
+    bool ParseBlock(unsigned long long offset, TimeSeriesBlockInfo* block) const
+    {
+        if (offset + TimeSeriesBlockHeader > size_)
+            return false;
+        const unsigned char* p = data_ + offset;
+        if (TimeSeriesGet32(p) != TimeSeriesBlockMagic)
+            return false;
+        memcpy(&block->target, p + 4, 4);
+        block->count    = TimeSeriesGet32(p + 8);
+        block->replies  = TimeSeriesGet32(p + 12);
+        block->timeouts = TimeSeriesGet32(p + 16);
+        block->errors   = TimeSeriesGet32(p + 20);
+        block->late     = TimeSeriesGet32(p + 24);
+        block->firstNs  = TimeSeriesGet64(p + 48);
+        block->lastNs   = TimeSeriesGet64(p + 56);
+        block->minRttNs = TimeSeriesGet64(p + 64);
+        block->maxRttNs = TimeSeriesGet64(p + 72);
+        unsigned long long column = offset + TimeSeriesBlockHeader;
+        for (int c = 0; c < TimeSeriesColumns; ++c)
+        {
+            block->columnBytes[c] = TimeSeriesGet32(p + 28 + 4 * c);
+            block->columns[c] = data_ + column;
+            column += block->columnBytes[c];
+        }
+        return column <= size_ && block->count > 0 &&
+               (unsigned long long)block->replies + block->timeouts + block->errors + block->late <= block->count;
+    }
+
+    unsigned long long BlockEnd(unsigned long long offset, const TimeSeriesBlockInfo& block) const
+    {
+        unsigned long long end = offset + TimeSeriesBlockHeader;
+        for (int c = 0; c < TimeSeriesColumns; ++c)
+            end += block.columnBytes[c];
+        return end;
+    }
+
+    bool ReadIndex()
+    {
+        if (size_ < TimeSeriesFileHeader + TimeSeriesTrailer)
+            return false;
+        const unsigned char* trailer = data_ + size_ - TimeSeriesTrailer;
+        if (memcmp(trailer + 16, "TSDBINDX", 8) != 0)
+            return false;
+        unsigned long long indexOffset = TimeSeriesGet64(trailer);
+        unsigned long long entries = TimeSeriesGet64(trailer + 8);
+        if (indexOffset < TimeSeriesFileHeader || indexOffset > size_ - TimeSeriesTrailer ||
+            entries != (size_ - TimeSeriesTrailer - indexOffset) / TimeSeriesIndexEntry)
+            return false;
+        index_.resize((size_t)entries);
+        for (unsigned long long i = 0; i < entries; ++i)
+        {
+            const unsigned char* p = data_ + indexOffset + i * TimeSeriesIndexEntry;
+            TimeSeriesIndexInfo& entry = index_[(size_t)i];
+            memcpy(&entry.target, p, 4);
+            entry.count   = TimeSeriesGet32(p + 4);
+            entry.firstNs = TimeSeriesGet64(p + 8);
+            entry.lastNs  = TimeSeriesGet64(p + 16);
+            entry.offset  = TimeSeriesGet64(p + 24);
+            if (entry.offset < TimeSeriesFileHeader || entry.offset + TimeSeriesBlockHeader > indexOffset)
+            {
+                index_.clear();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Walks the blocks from the start of the file up to the first one that is cut short (the file of a killed run)
+    void Scan()
+    {
+        unsigned long long offset = TimeSeriesFileHeader;
+        TimeSeriesBlockInfo block;
+        while (ParseBlock(offset, &block))
+        {
+            TimeSeriesIndexInfo entry;
+            entry.target  = block.target;
+            entry.count   = block.count;
+            entry.firstNs = block.firstNs;
+            entry.lastNs  = block.lastNs;
+            entry.offset  = offset;
+            index_.push_back(entry);
+            offset = BlockEnd(offset, block);
+        }
+    }
+
+    TransportMappedFile              file_;
+    const unsigned char*             data_;
+    size_t                           size_;
+    bool                             indexed_;
+    std::vector<TimeSeriesIndexInfo> index_;
+};
+
+#endif // ICMP_TIMESERIES_H
@@ -0,0 +1,143 @@
+/* ICMP Packet Watcher - Query tool for the time-series store */
+
+/* Reads a store written with -o tsdb (icmp_TimeSeries.h) and prints, per target, the probes, the loss, the ICMP
+   errors and the RTT min/p50/p90/p99/p99.9/max over a time window. The file is memory-mapped and the index picks
+   the blocks of the targets and the time window asked for, so the rest of the file is never read. Blocks inside the
+   window are summed up from their headers (and their event and rtt columns for the percentiles); only the blocks at
+   the edges of the window are decoded in full. Percentiles come from the same histogram as the prober's summary,
+   within about 1.6%.
+
+   To compile: g++ -O2 icmp_TimeSeriesQuery.cpp -o icmp_TimeSeriesQuery  (or the icmp_TimeSeriesQuery target of the CMake build)
+   To run: ./icmp_TimeSeriesQuery file [-t target] [-s start] [-e end] [-l seconds] [-n]
+   start and end are Unix times in seconds, fractions allowed; -l takes the last "seconds" of the file instead.
+   Without them the whole file is summed up. -n leaves out the percentiles, then no block inside the window is decoded.
+   For instance ./icmp_TimeSeriesQuery ping.tsdb -t 10.0.0.1 -l 3600 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <iostream>
+#include <vector>
+#include "icmp_Transport.h"
+#include "icmp_TimeSeries.h"
+
+using namespace std;
+
+// Seconds, possibly fractional, as nanoseconds; false unless the value is a number from 0 up
+bool ParseSeconds(const char* text, unsigned long long* ns)
+{
+    char* end;
+    double seconds = strtod(text, &end);
+    if (end == text || *end != '\0' || seconds < 0 || seconds > 1.8e10)
+        return false;
+    *ns = (unsigned long long)(seconds * 1e9 + 0.5);
+    return true;
+}
+
+// Unix ns as "2024-05-01 12:00:00 UTC"
+const char* FormatTime(unsigned long long ns, char* out, size_t size)
+{
+    time_t seconds = (time_t)(ns / 1000000000ULL);
+    struct tm* utc = gmtime(&seconds);
+    if (utc == NULL || strftime(out, size, "%Y-%m-%d %H:%M:%S UTC", utc) == 0)
+        snprintf(out, size, "%llu s", ns / 1000000000ULL);
+    return out;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* szFile = NULL;
+    unsigned int target = 0;                                                // -t: one target (network byte order), all without it
+    bool bAllTargets = true;
+    unsigned long long startNs = 0, endNs = ~0ULL;                          // -s, -e: the window
+    unsigned long long lastNs = 0;                                          // -l: the last seconds of the file
+    bool bPercentiles = true;                                               // -n: loss only
+    bool bArgsOk = argc >= 2;
+    for (int a = 1; bArgsOk && a < argc; ++a)
+    {
+        const char* value = a + 1 < argc ? argv[a + 1] : NULL;
+        if (strcmp(argv[a], "-n") == 0)
+            bPercentiles = false;
+        else if (argv[a][0] != '-' && szFile == NULL)
+            szFile = argv[a];
+        else if (value == NULL)
+            bArgsOk = false;
+        else if (strcmp(argv[a], "-t") == 0)
+        {
+            unsigned long address = inet_addr(value);
+            bArgsOk = address != INADDR_NONE;
+            target = (unsigned int)address;
+            bAllTargets = false;
+            ++a;
+        }
+        else if (strcmp(argv[a], "-s") == 0)
+            bArgsOk = ParseSeconds(argv[++a], &startNs);
+        else if (strcmp(argv[a], "-e") == 0)
+            bArgsOk = ParseSeconds(argv[++a], &endNs);
+        else if (strcmp(argv[a], "-l") == 0)
+            bArgsOk = ParseSeconds(argv[++a], &lastNs) && lastNs > 0;
+        else
+            bArgsOk = false;
+    }
+    if (!bArgsOk || szFile == NULL)
+    {
+        cout << "Usage: " << argv[0] << " file [-t target] [-s start] [-e end] [-l seconds] [-n]" << endl;
+        cout << "Times are Unix seconds, for instance: " << argv[0] << " ping.tsdb -t 10.0.0.1 -l 3600" << endl;
+        return 1;
+    }
+
+    TimeSeriesReader reader;
+    if (!reader.Open(szFile))
+    {
+        cout << "Unable to read " << szFile << ", not a time-series store (-o tsdb) or cannot be opened" << endl;
+        return 1;
+    }
+    unsigned long long firstNs, latestNs;
+    reader.TimeRange(&firstNs, &latestNs);
+    if (lastNs > 0)
+    {
+        startNs = latestNs > lastNs ? latestNs - lastNs + 1 : 0;
+        endNs = latestNs + 1;
+    }
+    char from[40], to[40], line[320];
+    snprintf(line, sizeof(line), "%s: %zu blocks, %llu bytes, %s to %s%s\n", szFile, reader.Blocks(), reader.FileBytes(),
+             FormatTime(firstNs, from, sizeof(from)), FormatTime(latestNs, to, sizeof(to)),
+             reader.Indexed() ? "" : " (no index, the run did not end normally: blocks found by walking the file)");
+    cout << line;
+
+    vector<TimeSeriesSummary> summaries;
+    TimeSeriesQueryStats stats;
+    reader.Query(startNs, endNs, bAllTargets, target, bPercentiles, &summaries, &stats);
+    snprintf(line, sizeof(line), "Window %s to %s\n", FormatTime(startNs > firstNs ? startNs : firstNs, from, sizeof(from)),
+             FormatTime(endNs <= latestNs ? endNs : latestNs, to, sizeof(to)));
+    cout << line;
+    if (summaries.empty())
+        cout << "No records in the window" << endl;
+
+    for (size_t i = 0; i < summaries.size(); ++i)
+    {
+        const TimeSeriesSummary& summary = summaries[i];
+        const unsigned char* b = (const unsigned char*)&summary.target;
+        char address[16];
+        snprintf(address, sizeof(address), "%u.%u.%u.%u", b[0], b[1], b[2], b[3]);
+        snprintf(line, sizeof(line), "%-15s %llu probes, %llu replies, %llu timeouts (%.3f%% loss), %llu errors, %llu late, %llu duplicates\n",
+                 address, summary.Probes(), summary.replies, summary.timeouts, summary.LossPercent(), summary.errors, summary.late,
+                 summary.duplicates);
+        cout << line;
+        if (summary.replies == 0)
+            continue;
+        if (bPercentiles)
+            snprintf(line, sizeof(line), "%-15s RTT min/p50/p90/p99/p99.9/max = %.3f/%.3f/%.3f/%.3f/%.3f/%.3f ms\n", "",
+                     summary.minRttNs / 1e6, summary.rtt.Percentile(50) / 1e6, summary.rtt.Percentile(90) / 1e6,
+                     summary.rtt.Percentile(99) / 1e6, summary.rtt.Percentile(99.9) / 1e6, summary.maxRttNs / 1e6);
+        else
+            snprintf(line, sizeof(line), "%-15s RTT min/max = %.3f/%.3f ms\n", "", summary.minRttNs / 1e6, summary.maxRttNs / 1e6);
+        cout << line;
+    }
+
+    snprintf(line, sizeof(line), "Blocks read: %zu of %zu; decoded: %zu in full (the window's edges), %zu for their rtt column only%s\n",
+             stats.read, stats.blocks, stats.decoded, stats.rttOnly, stats.damaged > 0 ? "; damaged blocks were left out" : "");
+    cout << line;
+    return stats.damaged > 0 ? 2 : 0;
+}
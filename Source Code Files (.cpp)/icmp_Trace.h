@@ -0,0 +1,171 @@
+/* ICMP Packet Watcher - Per-hop tables of the parallel traceroute mode */
+
+/* The traceroute mode (-T) does not walk a path one hop at a time. Every (destination, TTL) pair is a probe
+   schedule of its own, so the probes for all hops of all destinations are in flight together and a path costs
+   about one timeout, not one round trip per hop. Routers answer with time exceeded, the destination with an echo
+   reply; both are matched to the probe through the quoted (destination, sequence number) and land in the hop's
+   counters here. Once the destination (or an unreachable error) has answered at some TTL, the path length is
+   known and the TTLs beyond it are no longer probed.
+
+   Paris traceroute: load balancers pick the next hop from a hash of the addresses and the first four bytes of the
+   ICMP header (type, code, checksum). All probes of a run carry the same checksum (the flow), so they all follow
+   the same path and a hop whose responder changes shows a real path change, not the balancer. The same flow
+   value gives the same path in the next run.
+
+   TraceHop is 48 bytes, so 10000 destinations with 30 hops each need 14 MB. */
+
+#ifndef ICMP_TRACE_H
+#define ICMP_TRACE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <ostream>
+#include <vector>
+#include "icmp_Types.h"
+
+struct TraceHop
+{
+    unsigned long long rttSumNs;
+    unsigned long long rttMinNs;
+    unsigned long long rttMaxNs;
+    unsigned long long lastSentNs;                                          // Send time of the newest probe, for quotes too short to hold it
+    unsigned int       responder;                                           // First address that answered (network byte order), 0 if none did
+    unsigned short     sent;
+    unsigned short     received;
+    unsigned short     lastSeq;                                             // Sequence number of the newest probe
+    unsigned char      type;                                                // ICMP type and code of the first answer
+    unsigned char      code;
+    unsigned char      otherResponders;                                     // Answers from another address than responder (up to 255)
+};
+
+class TraceTable
+{
+public:
+    TraceTable(unsigned int destinations, int maxHops)
+        : maxHops_(maxHops), hops_((size_t)destinations * maxHops), pathLength_(destinations, 0), reached_(destinations, false)
+    {
+        memset(&hops_[0], 0, hops_.size() * sizeof(TraceHop));
+    }
+
+    int MaxHops() const { return maxHops_; }
+
+    TraceHop& Hop(unsigned int destination, int ttl)             { return hops_[(size_t)destination * maxHops_ + ttl - 1]; }
+    const TraceHop& Hop(unsigned int destination, int ttl) const { return hops_[(size_t)destination * maxHops_ + ttl - 1]; }
+
+    // TTL at which the destination (or the last router before an unreachable error) answered, 0 while unknown
+    int  PathLength(unsigned int destination) const { return pathLength_[destination]; }
+    bool Reached(unsigned int destination) const    { return reached_[destination]; }
+
+    // Probes with a TTL beyond the known path length would only be answered by the destination again
+    bool Beyond(unsigned int destination, int ttl) const
+    {
+        return pathLength_[destination] != 0 && ttl > pathLength_[destination];
+    }
+
+    void OnSent(unsigned int destination, int ttl, unsigned short seq, unsigned long long nowNs)
+    {
+        TraceHop& hop = Hop(destination, ttl);
+        ++hop.sent;
+        hop.lastSeq    = seq;
+        hop.lastSentNs = nowNs;
+    }
+
+    /* An answer to the probe sent with TTL ttl: an echo reply (type 0) from the destination, a time exceeded from a
+       router on the way, or an unreachable error that ends the path. */
+    void OnAnswer(unsigned int destination, int ttl, unsigned long responder, unsigned char type, unsigned char code, unsigned long long rttNs)
+    {
+        TraceHop& hop = Hop(destination, ttl);
+        if (hop.received == 0)
+        {
+            hop.responder = (unsigned int)responder;
+            hop.type      = type;
+            hop.code      = code;
+        }
+        else if (hop.responder != (unsigned int)responder && hop.otherResponders < 255)
+            ++hop.otherResponders;
+        if (hop.received == 0 || rttNs < hop.rttMinNs)
+            hop.rttMinNs = rttNs;
+        if (rttNs > hop.rttMaxNs)
+            hop.rttMaxNs = rttNs;
+        hop.rttSumNs += rttNs;
+        ++hop.received;
+
+        bool ends = type == 0 || IcmpErrorClassOf(type) == ICMP_ERROR_UNREACHABLE;
+        if (ends && (pathLength_[destination] == 0 || ttl < pathLength_[destination]))
+        {
+            pathLength_[destination] = (unsigned char)ttl;
+            reached_[destination]    = type == 0;
+        }
+    }
+
+    // Hops whose responder changed although the flow stayed the same
+    int UnstableHops(unsigned int destination) const
+    {
+        int unstable = 0;
+        for (int ttl = 1; ttl <= LastHop(destination); ++ttl)
+            unstable += Hop(destination, ttl).otherResponders > 0;
+        return unstable;
+    }
+
+    // Last hop worth printing: the path length if known, else the farthest hop that answered
+    int LastHop(unsigned int destination) const
+    {
+        if (pathLength_[destination] != 0)
+            return pathLength_[destination];
+        for (int ttl = maxHops_; ttl > 0; --ttl)
+            if (Hop(destination, ttl).received > 0)
+                return ttl;
+        return 0;
+    }
+
+    // Per-hop table of one destination
+    void Print(std::ostream& out, unsigned int destination, const char* name, unsigned int flow) const
+    {
+        char line[256];
+        snprintf(line, sizeof(line), "--- path to %s (flow %u, %s) ---\n", name, flow,
+                 reached_[destination] ? "reached" : (pathLength_[destination] != 0 ? "unreachable" : "not reached"));
+        out<<line;
+        snprintf(line, sizeof(line), "%-4s %-16s %6s %6s %8s  %s\n", "hop", "address", "sent", "recv", "loss", "RTT min/mean/max ms");
+        out<<line;
+        int last = LastHop(destination);
+        for (int ttl = 1; ttl <= last; ++ttl)
+        {
+            const TraceHop& hop = Hop(destination, ttl);
+            char address[24] = "*";
+            if (hop.received > 0)
+                FormatAddress(address, hop.responder);
+            double loss = hop.sent == 0 ? 0.0 : 100.0 * (double)(hop.sent - hop.received) / (double)hop.sent;
+            int len = snprintf(line, sizeof(line), "%-4d %-16s %6u %6u %7.1f%%", ttl, address, hop.sent, hop.received, loss);
+            if (hop.received > 0)
+                len += snprintf(line + len, sizeof(line) - len, "  %.3f/%.3f/%.3f", hop.rttMinNs / 1e6,
+                                (double)hop.rttSumNs / (double)hop.received / 1e6, hop.rttMaxNs / 1e6);
+            if (hop.received > 0 && hop.type != 0 && hop.type != 11)
+            {
+                const char* codeName = IcmpCodeName(hop.type, hop.code);
+                len += snprintf(line + len, sizeof(line) - len, "  (%s)", codeName != NULL ? codeName : IcmpTypeName(hop.type));
+            }
+            if (hop.otherResponders > 0)
+                len += snprintf(line + len, sizeof(line) - len, "  +%u answers from other addresses", hop.otherResponders);
+            out<<line<<'\n';
+        }
+        if (last < maxHops_ && pathLength_[destination] == 0)
+        {
+            snprintf(line, sizeof(line), "(no answer from hops %d to %d)\n", last + 1, maxHops_);
+            out<<line;
+        }
+    }
+
+    static int FormatAddress(char* out, unsigned int address)
+    {
+        const unsigned char* b = (const unsigned char*)&address;
+        return sprintf(out, "%u.%u.%u.%u", b[0], b[1], b[2], b[3]);
+    }
+
+private:
+    int                        maxHops_;
+    std::vector<TraceHop>      hops_;                                       // maxHops_ per destination, TTL 1 first
+    std::vector<unsigned char> pathLength_;
+    std::vector<bool>          reached_;
+};
+
+#endif // ICMP_TRACE_H
@@ -0,0 +1,125 @@
+/* ICMP Packet Watcher - Transport interface (sockets, clock and sleep) */
+
+/* The prober only talks to the operating system through the calls below. Each backend implements all of them:
+     icmp_TransportWinsock.h   Windows, Winsock 2 raw sockets, select() based loop
+     icmp_TransportLinux.h     Linux, non-blocking raw or SOCK_DGRAM/IPPROTO_ICMP ("ping") sockets, epoll loop,
+                               and an io_uring loop that batches submissions (compiled with -DICMP_WITH_IO_URING)
+
+   Sockets
+     bool TransportStartup() / void TransportCleanup()
+     bool TransportOpen(IcmpSocketKind kind, IcmpSocket* s)       s->id is the icmp_id replies will carry
+     void TransportClose(IcmpSocket& s)
+     bool TransportSetNonBlocking(IcmpSocket& s)
+     bool TransportSetRecvTimeout(IcmpSocket& s, unsigned long ms)
+     bool TransportSetDontFragment(IcmpSocket& s, bool on)    DF bit on every datagram sent (the size sweep)
+     int  TransportSendTo(IcmpSocket& s, const void* buff, int len, unsigned long destination)
+     int  TransportRecvFrom(IcmpSocket& s, void* buff, int len, unsigned long* source, unsigned long long* stampNs = NULL)
+          Both return the number of bytes, TRANSPORT_WOULD_BLOCK (no data / send buffer full / receive timeout)
+          or TRANSPORT_ERROR (details from TransportLastError()). Addresses are in network byte order.
+     int  TransportSendBatch(IcmpSocket& s, TransportPacket* packets, int count)
+     int  TransportRecvBatch(IcmpSocket& s, TransportPacket* packets, int count)
+          Up to TRANSPORT_MAX_BATCH packets per call (sendmmsg/recvmmsg on Linux, a loop elsewhere). They return
+          how many packets were handled from the front of the array, or TRANSPORT_WOULD_BLOCK / TRANSPORT_ERROR if
+          the first one could not be. TransportRecvBatch sets len and addr of every received packet
+          and does not wait for data (on Windows the socket has to be non-blocking). A packet sent with a ttl
+          other than 0 leaves with that IP TTL (an IP_TTL control message on Linux, setsockopt on Windows).
+
+   Threads (the sharded sweep, see icmp_Shard.h)
+     bool TransportFilterId(IcmpSocket& s)       the kernel delivers only replies and errors for s.id to s
+          Returns false where that is not possible (Windows), the socket then also sees the other shards' packets.
+     bool TransportPinThread(int cpu)            keeps the calling thread on one CPU
+
+   Timestamps
+     int  TransportEnableTimestamps(IcmpSocket& s, bool tx)      returns the TRANSPORT_STAMP_* flags in effect
+          With TRANSPORT_STAMP_RX the receive stamps (stampNs of TransportRecvFrom, TransportPacket::stampNs) come
+          from the kernel, otherwise they are taken right after the receive call. Both are TransportMonotonicNs() values.
+     int  TransportRecvTxStamps(IcmpSocket& s, TransportTxStamp* stamps, int max)
+          With TRANSPORT_STAMP_TX: kernel send stamps, id counts the datagrams sent on the socket from 0.
+          Returns how many were read (0 if none is queued or TX stamps are not available). The socket reports
+          readable/error while stamps are queued, so a caller that enables them has to drain them.
+
+   Clock and sleep
+     unsigned long      TransportTickMs()        millisecond tick, only differences are meaningful
+     unsigned long long TransportMonotonicNs()   monotonic nanoseconds
+     void               TransportSleepMs(unsigned long ms)
+     void               TransportSleepUntilNs(unsigned long long deadlineNs)   absolute TransportMonotonicNs() deadline
+     long long          TransportRealtimeOffsetNs()   Unix time minus TransportMonotonicNs(), for printing stamps
+
+   Passive capture
+     CaptureRing reads the ICMP packets on one interface without sending anything (the -W watcher mode):
+       bool Open(const char* iface)          interface name on Linux, the interface's IPv4 address on Windows
+       int  Poll(long timeoutMs, Handler handle)
+            calls handle(const unsigned char* ip, int capturedLength, int wireLength, unsigned long long realtimeNs)
+            for every packet that arrived, ip is the start of the IPv4 header
+       unsigned long long Packets() / Drops()   seen and lost by the kernel (Drops() is 0 where it is not reported)
+
+   Reflector (icmp_Reflector.cpp, Linux only)
+     bool TransportFilterEchoRequests(IcmpSocket& s)   the kernel delivers only echo requests to s
+     bool TransportOpenIpSender(IcmpSocket* s)         sends whole IPv4 datagrams, the IP header is the caller's
+     bool TransportSetBufferSize(IcmpSocket& s, int bytes)
+     CaptureRing::Open(iface, blockSize, blocks, retireMs) and CaptureRing::IgnoreOutgoing() set the ring's latency
+     and leave out what the host sends itself
+
+   Metrics export (icmp_Metrics.h)
+     TransportTcpServer   bool Listen(unsigned short port)    binds 127.0.0.1 only
+                          bool Serve(long timeoutMs, Handler handle)
+                               waits for one connection, calls handle(const char* request, int len, std::string* response)
+                               with the request head and sends the response back
+     TransportSharedMemory void* Create(const char* name, size_t size)   a zeroed block other processes can map,
+                               /dev/shm/<name> on Linux, the file mapping Local\<name> on Windows; Close() removes it
+
+   Stored results (icmp_TimeSeries.h, icmp_Pcap.h)
+     TransportMappedFile  const void* Open(const char* path, size_t* size)   maps a whole file read-only; Close() unmaps it
+     TransportMappedWriter bool Open(const char* path)                       creates the file
+                          void* Map(unsigned long long offset, size_t size)  grows it and maps that window for writing
+                          bool Close(unsigned long long length)              unmaps and cuts the file to length
+
+   Event loop
+     TransportLoop services any number of non-blocking sockets from one thread:
+       bool Init(bool preferUring)           preferUring is ignored where io_uring is not available
+       bool Add(IcmpSocket& s, void* context)
+       int  Send(IcmpSocket& s, const void* buff, int len, unsigned long destination)   may be queued (io_uring)
+       int  SendBatch(IcmpSocket& s, TransportPacket* packets, int count)                 same as TransportSendBatch
+       int  Wait(void** ready, int maxReady, long timeoutMs)   flushes queued sends, returns the contexts of readable sockets
+*/
+
+#ifndef ICMP_TRANSPORT_H
+#define ICMP_TRANSPORT_H
+
+enum IcmpSocketKind
+{
+    ICMP_SOCKET_RAW,                                                        // SOCK_RAW: replies include the IP header, needs root/administrator
+    ICMP_SOCKET_DGRAM                                                       // SOCK_DGRAM ping socket (Linux): no IP header, the kernel owns icmp_id
+};
+
+#define TRANSPORT_ERROR       (-1)
+#define TRANSPORT_WOULD_BLOCK (-2)
+#define TRANSPORT_MAX_BATCH   256
+
+#define TRANSPORT_STAMP_RX    1                                             // Kernel receive timestamps
+#define TRANSPORT_STAMP_TX    2                                             // Kernel send timestamps on the error queue
+
+// One packet of a batched send or receive
+struct TransportPacket
+{
+    char*         data;
+    int           len;                                                      // Bytes to send / buffer size on input, bytes received on output
+    unsigned long addr;                                                     // Destination / source address in network byte order
+    unsigned long long stampNs;                                             // Receive time (TransportMonotonicNs clock), set on receive
+    int           ttl;                                                      // IP TTL to send with, 0 for the socket's default
+};
+
+// Kernel send timestamp of the id-th datagram sent on a socket
+struct TransportTxStamp
+{
+    unsigned int       id;
+    unsigned long long ns;                                                  // TransportMonotonicNs clock
+};
+
+#ifdef _WIN32
+#include "icmp_TransportWinsock.h"
+#else
+#include "icmp_TransportLinux.h"
+#endif
+
+#endif // ICMP_TRANSPORT_H
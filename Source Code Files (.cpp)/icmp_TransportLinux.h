@@ -0,0 +1,959 @@
+/* ICMP Packet Watcher - Linux transport backend (see icmp_Transport.h) */
+
+/* Sockets are raw (SOCK_RAW, needs CAP_NET_RAW) or unprivileged ping sockets (SOCK_DGRAM + IPPROTO_ICMP, allowed for the
+   groups in /proc/sys/net/ipv4/ping_group_range). A ping socket differs in two ways: received datagrams start at the
+   ICMP header, and the kernel writes its own icmp_id (the socket's local "port") into every request and only delivers
+   replies that carry it. TransportOpen binds the socket so that id is known up front.
+
+   TransportLoop uses epoll. Built with -DICMP_WITH_IO_URING, Init(true) switches it to io_uring: sends are queued as
+   SENDMSG entries and readiness as POLL_ADD entries, and everything queued goes to the kernel in one io_uring_enter per
+   Wait(). If the kernel refuses io_uring the loop stays on epoll.
+
+   Timestamps: SO_TIMESTAMPNS stamps every received datagram in the kernel, SO_TIMESTAMPING with OPT_ID|OPT_TSONLY
+   queues a software TX stamp per sent datagram on the error queue, tagged with a per-socket counter that starts at 0.
+   The kernel reports both on CLOCK_REALTIME; they are moved to the CLOCK_MONOTONIC timeline of TransportMonotonicNs()
+   with the offset between the two clocks sampled at the time of the receive call.
+
+   CaptureRing reads an interface through an AF_PACKET socket with a TPACKET_V3 receive ring: the kernel copies every
+   packet once, into memory shared with the process, and hands over whole blocks of packets. A classic BPF filter
+   ("ip proto icmp") runs in the kernel, so nothing else takes ring space. SOCK_DGRAM strips the link layer header,
+   so Ethernet, loopback and tunnels all deliver packets that start at the IP header.
+
+   Several raw sockets of one process all receive every ICMP packet. TransportFilterId attaches a classic BPF filter
+   that keeps only the echo replies carrying the socket's id and the errors quoting a request with it, so the kernel
+   hands each packet to the one socket (shard) that sent the request and drops the rest before any copy is made.
+
+   The metrics exporter (icmp_Metrics.h) serves HTTP from a TransportTcpServer bound to 127.0.0.1 and publishes its
+   snapshot in a POSIX shared-memory object (shm_open, /dev/shm/<name>), which is removed again on Close(). */
+
+#ifndef ICMP_TRANSPORT_LINUX_H
+#define ICMP_TRANSPORT_LINUX_H
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/filter.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+struct IcmpSocket
+{
+    int             fd;
+    IcmpSocketKind  kind;
+    unsigned short  id;                                                     // icmp_id to put into requests and expect in replies
+    bool            hasIpHeader;                                            // Received datagrams start with the IP header
+    unsigned char   stamps;                                                 // TRANSPORT_STAMP_* flags enabled by TransportEnableTimestamps
+};
+
+inline bool TransportStartup() { return true; }
+inline void TransportCleanup() {}
+
+inline unsigned long long TransportMonotonicNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+inline unsigned long TransportTickMs()
+{
+    return (unsigned long)(TransportMonotonicNs() / 1000000ULL);
+}
+
+inline void TransportSleepMs(unsigned long ms)
+{
+    timespec ts;
+    ts.tv_sec  = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+        ;
+}
+
+// Absolute deadline on the TransportMonotonicNs() clock, so the time spent before the call does not add to the wait
+inline void TransportSleepUntilNs(unsigned long long deadlineNs)
+{
+    timespec ts;
+    ts.tv_sec  = (time_t)(deadlineNs / 1000000000ULL);
+    ts.tv_nsec = (long)(deadlineNs % 1000000000ULL);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+// CLOCK_REALTIME minus CLOCK_MONOTONIC, to move kernel socket timestamps onto the monotonic timeline and back
+inline long long TransportRealtimeOffsetNs()
+{
+    timespec real, mono;
+    clock_gettime(CLOCK_REALTIME, &real);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    return ((long long)real.tv_sec - (long long)mono.tv_sec) * 1000000000LL + ((long long)real.tv_nsec - (long long)mono.tv_nsec);
+}
+
+// Kernel RX timestamp of a received message (SCM_TIMESTAMPNS, or the software stamp of SCM_TIMESTAMPING), 0 if none
+inline unsigned long long TransportControlStamp(msghdr* msg, long long offsetNs)
+{
+    for (cmsghdr* c = CMSG_FIRSTHDR(msg); c != NULL; c = CMSG_NXTHDR(msg, c))
+    {
+        if (c->cmsg_level != SOL_SOCKET || (c->cmsg_type != SCM_TIMESTAMPNS && c->cmsg_type != SCM_TIMESTAMPING))
+            continue;
+        timespec ts;
+        memcpy(&ts, CMSG_DATA(c), sizeof(ts));                              // ts[0] of SCM_TIMESTAMPING is the software stamp
+        if (ts.tv_sec == 0 && ts.tv_nsec == 0)
+            continue;
+        return (unsigned long long)((long long)ts.tv_sec * 1000000000LL + ts.tv_nsec - offsetNs);
+    }
+    return 0;
+}
+
+#define TRANSPORT_STAMP_CONTROL 128                                         // Control buffer per datagram: SCM_TIMESTAMPNS + SCM_TIMESTAMPING
+
+inline bool TransportOpen(IcmpSocketKind kind, IcmpSocket* s)
+{
+    s->kind        = kind;
+    s->hasIpHeader = kind == ICMP_SOCKET_RAW;
+    s->stamps      = 0;
+    s->fd          = socket(AF_INET, (kind == ICMP_SOCKET_RAW ? SOCK_RAW : SOCK_DGRAM) | SOCK_CLOEXEC, IPPROTO_ICMP);
+    if (s->fd < 0)
+        return false;
+
+    if (kind == ICMP_SOCKET_RAW)
+    {
+        s->id = (unsigned short)getpid();
+        return true;
+    }
+
+    // Bind to an ephemeral ping id and read it back, it is stored in the packet exactly as sin_port holds it
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    socklen_t addrLen = sizeof(addr);
+    if (bind(s->fd, (sockaddr*)&addr, sizeof(addr)) != 0 || getsockname(s->fd, (sockaddr*)&addr, &addrLen) != 0)
+    {
+        close(s->fd);
+        s->fd = -1;
+        return false;
+    }
+    s->id = addr.sin_port;
+    return true;
+}
+
+/* Opens a socket that sends complete IPv4 datagrams (SOCK_RAW/IPPROTO_RAW, IP_HDRINCL): the caller writes the IP
+   header, source address included. The kernel fills in the total length, the header checksum and a zero IP id. The
+   socket never receives anything. */
+inline bool TransportOpenIpSender(IcmpSocket* s)
+{
+    s->kind        = ICMP_SOCKET_RAW;
+    s->hasIpHeader = true;
+    s->stamps      = 0;
+    s->id          = 0;
+    s->fd          = socket(AF_INET, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_RAW);
+    return s->fd >= 0;
+}
+
+inline void TransportClose(IcmpSocket& s)
+{
+    if (s.fd >= 0)
+        close(s.fd);
+    s.fd = -1;
+}
+
+inline int TransportLastError()
+{
+    return errno;
+}
+
+inline bool TransportSetNonBlocking(IcmpSocket& s)
+{
+    int flags = fcntl(s.fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(s.fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+/* Lets only echo replies with icmp_id s.id and ICMP errors (unreachable, source quench, redirect, time exceeded,
+   parameter problem) quoting an ICMP packet with that id onto a raw socket. The filter sees the packet from the IP
+   header on; both IP header lengths come from their IHL fields. Ping sockets get only their own id from the kernel
+   anyway, nothing is attached to them. */
+inline bool TransportFilterId(IcmpSocket& s)
+{
+    if (s.kind != ICMP_SOCKET_RAW)
+        return true;
+    unsigned short id = ntohs(s.id);                                        // Loads of the filter are in network byte order
+    sock_filter code[] = {
+        BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),                             //  0 x = IP header length
+        BPF_STMT(BPF_LD | BPF_B | BPF_IND, 0),                              //  1 ICMP type
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 13, 0),                      //  2 echo reply: 16
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 11, 3, 0),                      //  3 time exceeded: 7
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 12, 2, 0),                      //  4 parameter problem: 7
+        BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 3, 0, 13),                      //  5 types 3 to 5: 7, others: drop
+        BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, 5, 12, 0),
+        BPF_STMT(BPF_LD | BPF_B | BPF_IND, 17),                             //  7 protocol of the quoted IP header
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_ICMP, 0, 10),
+        BPF_STMT(BPF_LD | BPF_B | BPF_IND, 8),                              //  9 x += quoted IP header length
+        BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0x0F),
+        BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 2),
+        BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        BPF_STMT(BPF_LD | BPF_H | BPF_IND, 12),                             // 14 quoted icmp_id (8 bytes of error header + 4)
+        BPF_JUMP(BPF_JMP | BPF_JA, 1, 0, 0),
+        BPF_STMT(BPF_LD | BPF_H | BPF_IND, 4),                              // 16 icmp_id of the reply
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, id, 0, 1),                      // 17
+        BPF_STMT(BPF_RET | BPF_K, 0xFFFF),
+        BPF_STMT(BPF_RET | BPF_K, 0)                                        // 19 drop
+    };
+    sock_fprog filter;
+    filter.len    = sizeof(code) / sizeof(code[0]);
+    filter.filter = code;
+    return setsockopt(s.fd, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) == 0;
+}
+
+/* Lets only echo requests onto a raw socket, for the reflector (icmp_Reflector.cpp): everything else that arrives over
+   ICMP, the replies it sends itself on loopback included, is dropped in the kernel. */
+inline bool TransportFilterEchoRequests(IcmpSocket& s)
+{
+    sock_filter code[] = {
+        BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),                             // x = IP header length
+        BPF_STMT(BPF_LD | BPF_H | BPF_IND, 0),                              // ICMP type and code
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 8 << 8, 0, 1),                  // echo request, code 0
+        BPF_STMT(BPF_RET | BPF_K, 0xFFFF),
+        BPF_STMT(BPF_RET | BPF_K, 0)
+    };
+    sock_fprog filter;
+    filter.len    = sizeof(code) / sizeof(code[0]);
+    filter.filter = code;
+    return setsockopt(s.fd, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) == 0;
+}
+
+// Keeps the calling thread on one CPU (modulo the CPUs there are), so a shard's socket and tables stay in its caches
+inline bool TransportPinThread(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % CPU_SETSIZE, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+/* Sets the socket's receive and send buffers to bytes each. The FORCE options pass net.core.rmem_max/wmem_max when
+   the process has CAP_NET_ADMIN; without it the kernel caps the size at those limits. */
+inline bool TransportSetBufferSize(IcmpSocket& s, int bytes)
+{
+    bool ok = setsockopt(s.fd, SOL_SOCKET, SO_RCVBUFFORCE, &bytes, sizeof(bytes)) == 0 ||
+              setsockopt(s.fd, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes)) == 0;
+    return (setsockopt(s.fd, SOL_SOCKET, SO_SNDBUFFORCE, &bytes, sizeof(bytes)) == 0 ||
+            setsockopt(s.fd, SOL_SOCKET, SO_SNDBUF, &bytes, sizeof(bytes)) == 0) && ok;
+}
+
+inline bool TransportSetRecvTimeout(IcmpSocket& s, unsigned long ms)
+{
+    timeval tv;
+    tv.tv_sec  = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+    return setsockopt(s.fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0;
+}
+
+/* Sets or clears the don't fragment bit of every datagram sent. IP_PMTUDISC_PROBE sets DF but ignores the cached path
+   MTU, so each size is tried on the wire (a size sweep measures the path, not the kernel's earlier guess); sizes over
+   the interface MTU are still refused with EMSGSIZE. */
+inline bool TransportSetDontFragment(IcmpSocket& s, bool on)
+{
+    int mode = on ? IP_PMTUDISC_PROBE : IP_PMTUDISC_DONT;
+    return setsockopt(s.fd, IPPROTO_IP, IP_MTU_DISCOVER, &mode, sizeof(mode)) == 0;
+}
+
+// Turns on kernel RX timestamps and, if tx is set, TX timestamps. Returns the TRANSPORT_STAMP_* flags now enabled.
+inline int TransportEnableTimestamps(IcmpSocket& s, bool tx)
+{
+    int on = 1;
+    if (setsockopt(s.fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == 0)
+        s.stamps |= TRANSPORT_STAMP_RX;
+    if (tx)
+    {
+        int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+        if (setsockopt(s.fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0)
+            s.stamps |= TRANSPORT_STAMP_TX;
+    }
+    return s.stamps;
+}
+
+inline int TransportSendTo(IcmpSocket& s, const void* buff, int len, unsigned long destination)
+{
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = (in_addr_t)destination;
+    ssize_t nRet = sendto(s.fd, buff, len, 0, (sockaddr*)&addr, sizeof(addr));
+    if (nRet < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) ? TRANSPORT_WOULD_BLOCK : TRANSPORT_ERROR;
+    return (int)nRet;
+}
+
+inline int TransportRecvFrom(IcmpSocket& s, void* buff, int len, unsigned long* source, unsigned long long* stampNs = NULL)
+{
+    sockaddr_in from;
+    iovec iov;
+    iov.iov_base = buff;
+    iov.iov_len  = len;
+    char control[TRANSPORT_STAMP_CONTROL];
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name    = &from;
+    msg.msg_namelen = sizeof(from);
+    msg.msg_iov     = &iov;
+    msg.msg_iovlen  = 1;
+    if (stampNs != NULL && (s.stamps & TRANSPORT_STAMP_RX))
+    {
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+    }
+
+    ssize_t nRet = recvmsg(s.fd, &msg, 0);
+    if (nRet < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? TRANSPORT_WOULD_BLOCK : TRANSPORT_ERROR;
+    *source = from.sin_addr.s_addr;
+    if (stampNs != NULL)
+    {
+        *stampNs = msg.msg_controllen > 0 ? TransportControlStamp(&msg, TransportRealtimeOffsetNs()) : 0;
+        if (*stampNs == 0)
+            *stampNs = TransportMonotonicNs();
+    }
+    return (int)nRet;
+}
+
+// Attaches an IP_TTL control message to a send, control has room for CMSG_SPACE(sizeof(int)) bytes
+inline void TransportSetControlTtl(msghdr* msg, char* control, int ttl)
+{
+    memset(control, 0, CMSG_SPACE(sizeof(int)));
+    msg->msg_control    = control;
+    msg->msg_controllen = CMSG_SPACE(sizeof(int));
+    cmsghdr* c = CMSG_FIRSTHDR(msg);
+    c->cmsg_level = SOL_IP;
+    c->cmsg_type  = IP_TTL;
+    c->cmsg_len   = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(c), &ttl, sizeof(int));
+}
+
+inline int TransportSendBatch(IcmpSocket& s, TransportPacket* packets, int count)
+{
+    mmsghdr     msgs[TRANSPORT_MAX_BATCH];
+    iovec       iovs[TRANSPORT_MAX_BATCH];
+    sockaddr_in addrs[TRANSPORT_MAX_BATCH];
+    char        controls[TRANSPORT_MAX_BATCH][CMSG_SPACE(sizeof(int))];
+    if (count > TRANSPORT_MAX_BATCH)
+        count = TRANSPORT_MAX_BATCH;
+
+    memset(msgs, 0, sizeof(mmsghdr) * count);
+    for (int i = 0; i < count; ++i)
+    {
+        memset(&addrs[i], 0, sizeof(addrs[i]));
+        addrs[i].sin_family      = AF_INET;
+        addrs[i].sin_addr.s_addr = (in_addr_t)packets[i].addr;
+        iovs[i].iov_base = packets[i].data;
+        iovs[i].iov_len  = packets[i].len;
+        msgs[i].msg_hdr.msg_name    = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        msgs[i].msg_hdr.msg_iov     = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen  = 1;
+        if (packets[i].ttl > 0)
+            TransportSetControlTtl(&msgs[i].msg_hdr, controls[i], packets[i].ttl);
+    }
+
+    int nRet = sendmmsg(s.fd, msgs, count, 0);
+    if (nRet < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) ? TRANSPORT_WOULD_BLOCK : TRANSPORT_ERROR;
+    return nRet;
+}
+
+inline int TransportRecvBatch(IcmpSocket& s, TransportPacket* packets, int count)
+{
+    mmsghdr     msgs[TRANSPORT_MAX_BATCH];
+    iovec       iovs[TRANSPORT_MAX_BATCH];
+    sockaddr_in addrs[TRANSPORT_MAX_BATCH];
+    char        controls[TRANSPORT_MAX_BATCH][TRANSPORT_STAMP_CONTROL];
+    if (count > TRANSPORT_MAX_BATCH)
+        count = TRANSPORT_MAX_BATCH;
+
+    bool kernelStamps = (s.stamps & TRANSPORT_STAMP_RX) != 0;
+    memset(msgs, 0, sizeof(mmsghdr) * count);
+    for (int i = 0; i < count; ++i)
+    {
+        if (kernelStamps)
+        {
+            msgs[i].msg_hdr.msg_control    = controls[i];
+            msgs[i].msg_hdr.msg_controllen = TRANSPORT_STAMP_CONTROL;
+        }
+        iovs[i].iov_base = packets[i].data;
+        iovs[i].iov_len  = packets[i].len;
+        msgs[i].msg_hdr.msg_name    = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        msgs[i].msg_hdr.msg_iov     = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen  = 1;
+    }
+
+    int nRet = recvmmsg(s.fd, msgs, count, MSG_DONTWAIT, NULL);
+    if (nRet < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? TRANSPORT_WOULD_BLOCK : TRANSPORT_ERROR;
+
+    unsigned long long now = TransportMonotonicNs();                        // Fallback stamp for datagrams without a kernel stamp
+    long long offsetNs = kernelStamps ? TransportRealtimeOffsetNs() : 0;
+    for (int i = 0; i < nRet; ++i)
+    {
+        packets[i].len     = (int)msgs[i].msg_len;
+        packets[i].addr    = addrs[i].sin_addr.s_addr;
+        packets[i].stampNs = kernelStamps ? TransportControlStamp(&msgs[i].msg_hdr, offsetNs) : 0;
+        if (packets[i].stampNs == 0)
+            packets[i].stampNs = now;
+    }
+    return nRet;
+}
+
+// Reads TX timestamps from the error queue. Each one carries the OPT_ID counter of the datagram it belongs to.
+inline int TransportRecvTxStamps(IcmpSocket& s, TransportTxStamp* stamps, int max)
+{
+    if (!(s.stamps & TRANSPORT_STAMP_TX))
+        return 0;
+
+    long long offsetNs = TransportRealtimeOffsetNs();
+    int count = 0;
+    while (count < max)
+    {
+        char data[64];                                                      // OPT_TSONLY: no payload comes back, only the control data
+        char control[256];
+        iovec iov;
+        iov.iov_base = data;
+        iov.iov_len  = sizeof(data);
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov        = &iov;
+        msg.msg_iovlen     = 1;
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(s.fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            break;
+
+        unsigned long long ns = 0;
+        const sock_extended_err* err = NULL;
+        for (cmsghdr* c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c))
+        {
+            if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPING)
+            {
+                timespec ts;
+                memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+                ns = (unsigned long long)((long long)ts.tv_sec * 1000000000LL + ts.tv_nsec - offsetNs);
+            }
+            else if (c->cmsg_level == SOL_IP && c->cmsg_type == IP_RECVERR)
+                err = (const sock_extended_err*)CMSG_DATA(c);
+        }
+        if (ns == 0 || err == NULL || err->ee_origin != SO_EE_ORIGIN_TIMESTAMPING)
+            continue;                                                       // Not a timestamp (an ICMP error queued by IP_RECVERR)
+        stamps[count].id = err->ee_data;
+        stamps[count].ns = ns;
+        ++count;
+    }
+    return count;
+}
+
+// Passive capture of the ICMP packets on one interface (the -W watcher mode), see the top of this file
+class CaptureRing
+{
+public:
+    CaptureRing() : fd_(-1), ring_(NULL), blockSize_(0), blocks_(0), current_(0), packets_(0), drops_(0) {}
+    ~CaptureRing() { Close(); }
+
+    // blocks * blockSize bytes of ring; a block is handed over when it is full or retireMs after its first packet
+    bool Open(const char* iface, unsigned int blockSize = 1u << 20, unsigned int blocks = 64, unsigned int retireMs = 10)
+    {
+        unsigned int ifindex = if_nametoindex(iface);
+        if (ifindex == 0)
+            return false;
+        fd_ = socket(AF_PACKET, SOCK_DGRAM, 0);                              // Protocol 0: nothing arrives before bind()
+        if (fd_ < 0)
+            return false;
+
+        // ldb [9] (IP protocol); jeq #1 (ICMP); ret #65535; ret #0
+        sock_filter code[] = {
+            BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 9),
+            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_ICMP, 0, 1),
+            BPF_STMT(BPF_RET | BPF_K, 0xFFFF),
+            BPF_STMT(BPF_RET | BPF_K, 0)
+        };
+        sock_fprog filter;
+        filter.len    = sizeof(code) / sizeof(code[0]);
+        filter.filter = code;
+        int version = TPACKET_V3;
+        if (setsockopt(fd_, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) != 0 ||
+            setsockopt(fd_, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0)
+            return Fail();
+
+        // Loopback shows every packet twice, once leaving and once arriving; only count it arriving
+        ifreq ifr;
+        memset(&ifr, 0, sizeof(ifr));
+        strncpy(ifr.ifr_name, iface, IFNAMSIZ - 1);
+        if (ioctl(fd_, SIOCGIFFLAGS, &ifr) == 0 && (ifr.ifr_flags & IFF_LOOPBACK))
+            IgnoreOutgoing();
+
+        tpacket_req3 req;
+        memset(&req, 0, sizeof(req));
+        req.tp_block_size     = blockSize;
+        req.tp_block_nr       = blocks;
+        req.tp_frame_size     = 2048;                                       // Only used to check the geometry with TPACKET_V3
+        req.tp_frame_nr       = blockSize / req.tp_frame_size * blocks;
+        req.tp_retire_blk_tov = retireMs;
+        if (setsockopt(fd_, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) != 0)
+            return Fail();
+        void* ring = mmap(NULL, (size_t)blockSize * blocks, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (ring == MAP_FAILED)
+            return Fail();
+        ring_      = (unsigned char*)ring;
+        blockSize_ = blockSize;
+        blocks_    = blocks;
+        current_   = 0;
+
+        sockaddr_ll addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sll_family   = AF_PACKET;
+        addr.sll_protocol = htons(ETH_P_IP);
+        addr.sll_ifindex  = (int)ifindex;
+        if (bind(fd_, (sockaddr*)&addr, sizeof(addr)) != 0)
+            return Fail();
+        return true;
+    }
+
+    void Close()
+    {
+        if (ring_ != NULL)
+            munmap(ring_, (size_t)blockSize_ * blocks_);
+        ring_ = NULL;
+        if (fd_ >= 0)
+            close(fd_);
+        fd_ = -1;
+    }
+
+    const char* Name() const { return "AF_PACKET TPACKET_V3"; }
+
+    // Leaves out the packets this host sends, so only arriving packets are seen. Returns false on kernels before 4.20.
+    bool IgnoreOutgoing()
+    {
+#ifdef PACKET_IGNORE_OUTGOING
+        int ignore = 1;
+        return setsockopt(fd_, SOL_PACKET, PACKET_IGNORE_OUTGOING, &ignore, sizeof(ignore)) == 0;
+#else
+        return false;
+#endif
+    }
+
+    /* Waits up to timeoutMs for a block and calls handle(ip, capturedLength, wireLength, realtimeNs) for every packet
+       of every block that is ready. ip points into the ring, the packet is not copied. Returns the number of packets. */
+    template <typename Handler>
+    int Poll(long timeoutMs, Handler handle)
+    {
+        if (!Ready(Block(current_)))
+        {
+            pollfd p;
+            p.fd      = fd_;
+            p.events  = POLLIN | POLLERR;
+            p.revents = 0;
+            if (poll(&p, 1, (int)timeoutMs) <= 0 || !Ready(Block(current_)))
+                return 0;
+        }
+
+        int count = 0;
+        tpacket_block_desc* block;
+        while (Ready(block = Block(current_)))
+        {
+            unsigned int n = block->hdr.bh1.num_pkts;
+            const tpacket3_hdr* packet = (const tpacket3_hdr*)((unsigned char*)block + block->hdr.bh1.offset_to_first_pkt);
+            for (unsigned int i = 0; i < n; ++i)
+            {
+                handle((const unsigned char*)packet + packet->tp_net, (int)packet->tp_snaplen, (int)packet->tp_len,
+                       (unsigned long long)packet->tp_sec * 1000000000ULL + packet->tp_nsec);
+                packet = (const tpacket3_hdr*)((const unsigned char*)packet + packet->tp_next_offset);
+            }
+            count += (int)n;
+            __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);   // Back to the kernel
+            current_ = (current_ + 1) % blocks_;
+        }
+        return count;
+    }
+
+    // Packets the kernel passed the filter and packets it dropped because the ring was full, since Open()
+    unsigned long long Packets() { ReadStatistics(); return packets_; }
+    unsigned long long Drops()   { ReadStatistics(); return drops_; }
+
+private:
+    bool Fail()
+    {
+        Close();
+        return false;
+    }
+
+    tpacket_block_desc* Block(unsigned int i) const { return (tpacket_block_desc*)(ring_ + (size_t)i * blockSize_); }
+
+    static bool Ready(tpacket_block_desc* block)
+    {
+        return (__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) != 0;
+    }
+
+    // PACKET_STATISTICS resets the kernel counters on every read
+    void ReadStatistics()
+    {
+        tpacket_stats_v3 stats;
+        socklen_t len = sizeof(stats);
+        if (fd_ >= 0 && getsockopt(fd_, SOL_PACKET, PACKET_STATISTICS, &stats, &len) == 0)
+        {
+            packets_ += stats.tp_packets;
+            drops_   += stats.tp_drops;
+        }
+    }
+
+    int                fd_;
+    unsigned char*     ring_;
+    unsigned int       blockSize_;
+    unsigned int       blocks_;
+    unsigned int       current_;
+    unsigned long long packets_;
+    unsigned long long drops_;
+};
+
+// A TCP listener on 127.0.0.1 that answers one short request per connection (the /metrics endpoint)
+class TransportTcpServer
+{
+public:
+    TransportTcpServer() : fd_(-1) {}
+    ~TransportTcpServer() { Close(); }
+
+    bool Listen(unsigned short port)
+    {
+        fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd_ < 0)
+            return false;
+        int on = 1;
+        setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family      = AF_INET;
+        addr.sin_port        = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(fd_, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd_, 16) != 0)
+        {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    /* Waits up to timeoutMs for a connection, reads the request head (up to 4 KB), calls handle(request, length,
+       &response) and writes the response back before closing. A client gets one second to send and to read.
+       Returns false if no connection came in. */
+    template <typename Handler>
+    bool Serve(long timeoutMs, Handler handle)
+    {
+        pollfd p;
+        p.fd      = fd_;
+        p.events  = POLLIN;
+        p.revents = 0;
+        if (poll(&p, 1, (int)timeoutMs) <= 0)
+            return false;
+        int client = accept4(fd_, NULL, NULL, SOCK_CLOEXEC);
+        if (client < 0)
+            return false;
+        timeval tv;
+        tv.tv_sec  = 1;
+        tv.tv_usec = 0;
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+        char request[4096];
+        int len = 0;
+        request[0] = '\0';
+        while (len < (int)sizeof(request) - 1 && strstr(request, "\r\n\r\n") == NULL)
+        {
+            ssize_t n = recv(client, request + len, sizeof(request) - 1 - len, 0);
+            if (n <= 0)
+                break;
+            len += (int)n;
+            request[len] = '\0';
+        }
+        std::string response;
+        handle((const char*)request, len, &response);
+        size_t sent = 0;
+        while (sent < response.size())
+        {
+            ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+                break;
+            sent += (size_t)n;
+        }
+        close(client);
+        return true;
+    }
+
+    void Close()
+    {
+        if (fd_ >= 0)
+            close(fd_);
+        fd_ = -1;
+    }
+
+private:
+    int fd_;
+};
+
+// A named block of memory other processes can map read-only (/dev/shm/<name>)
+class TransportSharedMemory
+{
+public:
+    TransportSharedMemory() : data_(NULL), size_(0) {}
+    ~TransportSharedMemory() { Close(); }
+
+    // Creates (or takes over) the object and maps size zeroed bytes of it; a leading '/' is added when missing
+    void* Create(const char* name, size_t size)
+    {
+        name_ = name[0] == '/' ? name : std::string("/") + name;
+        int fd = shm_open(name_.c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+        if (fd < 0)
+            return NULL;
+        void* data = MAP_FAILED;
+        if (ftruncate(fd, 0) == 0 && ftruncate(fd, (off_t)size) == 0)
+            data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);                                                          // The mapping keeps the object
+        if (data == MAP_FAILED)
+        {
+            shm_unlink(name_.c_str());
+            return NULL;
+        }
+        data_ = data;
+        size_ = size;
+        return data_;
+    }
+
+    void Close()
+    {
+        if (data_ == NULL)
+            return;
+        munmap(data_, size_);
+        shm_unlink(name_.c_str());
+        data_ = NULL;
+    }
+
+private:
+    std::string name_;
+    void*       data_;
+    size_t      size_;
+};
+
+// A whole file mapped read-only (the time-series store, icmp_TimeSeries.h, and a capture replayed with -p, icmp_Pcap.h)
+class TransportMappedFile
+{
+public:
+    TransportMappedFile() : data_(NULL), size_(0) {}
+    ~TransportMappedFile() { Close(); }
+
+    // Maps the file; NULL if it cannot be opened or is empty. Pages are read in as they are touched.
+    const void* Open(const char* path, size_t* size)
+    {
+        Close();
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return NULL;
+        struct stat info;
+        void* data = MAP_FAILED;
+        if (fstat(fd, &info) == 0 && info.st_size > 0)
+            data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED)
+            return NULL;
+        data_ = data;
+        size_ = (size_t)info.st_size;
+        *size = size_;
+        return data_;
+    }
+
+    void Close()
+    {
+        if (data_ != NULL)
+            munmap(data_, size_);
+        data_ = NULL;
+    }
+
+private:
+    void*  data_;
+    size_t size_;
+};
+
+// A file written through a moving mapped window (the capture file of -C with -K, icmp_Pcap.h)
+class TransportMappedWriter
+{
+public:
+    TransportMappedWriter() : fd_(-1), data_(NULL), size_(0) {}
+    ~TransportMappedWriter() { Close(0); }
+
+    // Creates (or empties) the file
+    bool Open(const char* path)
+    {
+        Close(0);
+        fd_ = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        return fd_ >= 0;
+    }
+
+    // Grows the file to offset + size and maps that window for writing, in place of the previous one. offset is a
+    // multiple of 64 KB. Dirty pages are written back by the kernel, not by the caller.
+    void* Map(unsigned long long offset, size_t size)
+    {
+        Unmap();
+        if (fd_ < 0 || ftruncate(fd_, (off_t)(offset + size)) != 0)
+            return NULL;
+        void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, (off_t)offset);
+        if (data == MAP_FAILED)
+            return NULL;
+        data_ = data;
+        size_ = size;
+        return data_;
+    }
+
+    // Unmaps the window and cuts the file to the bytes written
+    bool Close(unsigned long long length)
+    {
+        Unmap();
+        if (fd_ < 0)
+            return true;
+        bool ok = ftruncate(fd_, (off_t)length) == 0;
+        close(fd_);
+        fd_ = -1;
+        return ok;
+    }
+
+private:
+    void Unmap()
+    {
+        if (data_ != NULL)
+            munmap(data_, size_);
+        data_ = NULL;
+    }
+
+    int    fd_;
+    void*  data_;
+    size_t size_;
+};
+
+#ifdef ICMP_WITH_IO_URING
+#include "icmp_TransportUring.h"
+#endif
+
+class TransportLoop
+{
+public:
+    TransportLoop() : epollFd_(-1), useUring_(false) {}
+    ~TransportLoop()
+    {
+        if (epollFd_ >= 0)
+            close(epollFd_);
+    }
+
+    bool Init(bool preferUring = false)
+    {
+#ifdef ICMP_WITH_IO_URING
+        if (preferUring && uring_.Init())
+        {
+            useUring_ = true;
+            return true;
+        }
+#endif
+        (void)preferUring;
+        epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+        return epollFd_ >= 0;
+    }
+
+    const char* Name() const { return useUring_ ? "io_uring" : "epoll"; }
+
+    bool Add(IcmpSocket& s, void* context)
+    {
+#ifdef ICMP_WITH_IO_URING
+        if (useUring_)
+            return uring_.Add(s.fd, context);
+#endif
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events   = EPOLLIN;
+        event.data.ptr = context;
+        return epoll_ctl(epollFd_, EPOLL_CTL_ADD, s.fd, &event) == 0;
+    }
+
+    int Send(IcmpSocket& s, const void* buff, int len, unsigned long destination)
+    {
+#ifdef ICMP_WITH_IO_URING
+        if (useUring_)
+            return uring_.QueueSend(s.fd, buff, len, destination);
+#endif
+        return TransportSendTo(s, buff, len, destination);
+    }
+
+    int SendBatch(IcmpSocket& s, TransportPacket* packets, int count)
+    {
+#ifdef ICMP_WITH_IO_URING
+        if (useUring_)
+        {
+            // io_uring batches on its own: every packet becomes one SENDMSG entry of the next submission
+            int nQueued = 0;
+            for (; nQueued < count; ++nQueued)
+            {
+                int nRet = uring_.QueueSend(s.fd, packets[nQueued].data, packets[nQueued].len, packets[nQueued].addr, packets[nQueued].ttl);
+                if (nRet < 0)
+                    return nQueued > 0 ? nQueued : nRet;
+            }
+            return nQueued;
+        }
+#endif
+        return TransportSendBatch(s, packets, count);
+    }
+
+    /* Sends that Send() and SendBatch() took but that failed afterwards: io_uring completions with an error, found
+       by Wait(). Always 0 with epoll, whose sends report their errors when they are made. */
+    unsigned long long SendErrors() const
+    {
+#ifdef ICMP_WITH_IO_URING
+        if (useUring_)
+            return uring_.SendErrors();
+#endif
+        return 0;
+    }
+
+    int Wait(void** ready, int maxReady, long timeoutMs)
+    {
+        if (timeoutMs < 0)
+            timeoutMs = 0;
+#ifdef ICMP_WITH_IO_URING
+        if (useUring_)
+            return uring_.Wait(ready, maxReady, timeoutMs);
+#endif
+        epoll_event events[64];
+        if (maxReady > 64)
+            maxReady = 64;
+        int nReady = epoll_wait(epollFd_, events, maxReady, (int)timeoutMs);
+        for (int i = 0; i < nReady; ++i)
+            ready[i] = events[i].data.ptr;
+        return nReady < 0 ? 0 : nReady;
+    }
+
+private:
+    int  epollFd_;
+    bool useUring_;
+#ifdef ICMP_WITH_IO_URING
+    UringLoop uring_;
+#endif
+};
+
+#endif // ICMP_TRANSPORT_LINUX_H
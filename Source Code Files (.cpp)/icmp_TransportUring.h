@@ -0,0 +1,283 @@
+/* ICMP Packet Watcher - io_uring event loop for the Linux transport (compiled with -DICMP_WITH_IO_URING) */
+
+/* Talks to the kernel with the raw io_uring_setup/io_uring_enter system calls, so there is no liburing dependency.
+   Needs IORING_FEAT_SINGLE_MMAP and IORING_FEAT_EXT_ARG (Linux 5.11), otherwise Init() fails and TransportLoop
+   falls back to epoll.
+
+   Sends are copied into one of SendSlots preallocated slots (the caller's packet buffer is patched again right after
+   the call) and queued as IORING_OP_SENDMSG, with an IP_TTL control message when a ttl is given. A queued send
+   counts as sent; if its completion reports an error later, that is counted in SendErrors(). Each registered socket
+   has one IORING_OP_POLL_ADD outstanding; when it fires the socket is reported ready and the poll is queued again.
+   Wait() hands all queued entries to the kernel and waits for completions in a single io_uring_enter. */
+
+#ifndef ICMP_TRANSPORT_URING_H
+#define ICMP_TRANSPORT_URING_H
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+
+class UringLoop
+{
+public:
+    UringLoop()
+        : ringFd_(-1), ring_(NULL), ringSize_(0), sqes_(NULL), sqesSize_(0), queued_(0), sendErrors_(0),
+          ready_(NULL), nReady_(0), maxReady_(0) {}
+
+    ~UringLoop()
+    {
+        if (sqes_ != NULL)
+            munmap(sqes_, sqesSize_);
+        if (ring_ != NULL)
+            munmap(ring_, ringSize_);
+        if (ringFd_ >= 0)
+            close(ringFd_);
+    }
+
+    bool Init()
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        ringFd_ = (int)syscall(__NR_io_uring_setup, 1024, &params);
+        if (ringFd_ < 0)
+            return false;
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG))
+            return false;
+
+        size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        ringSize_ = sqSize > cqSize ? sqSize : cqSize;
+        void* ring = mmap(NULL, ringSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQ_RING);
+        if (ring == MAP_FAILED)
+            return false;
+        ring_ = (char*)ring;
+
+        sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqes = mmap(NULL, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+            return false;
+        sqes_ = (io_uring_sqe*)sqes;
+
+        sqHead_  = (unsigned*)(ring_ + params.sq_off.head);
+        sqTail_  = (unsigned*)(ring_ + params.sq_off.tail);
+        sqMask_  = *(unsigned*)(ring_ + params.sq_off.ring_mask);
+        sqArray_ = (unsigned*)(ring_ + params.sq_off.array);
+        sqEntries_ = params.sq_entries;
+        cqHead_  = (unsigned*)(ring_ + params.cq_off.head);
+        cqTail_  = (unsigned*)(ring_ + params.cq_off.tail);
+        cqMask_  = *(unsigned*)(ring_ + params.cq_off.ring_mask);
+        cqes_    = (io_uring_cqe*)(ring_ + params.cq_off.cqes);
+
+        slots_.resize(SendSlots);
+        for (unsigned i = 0; i < SendSlots; ++i)
+            freeSlots_.push_back(i);
+        return true;
+    }
+
+    bool Add(int fd, void* context)
+    {
+        fds_.push_back(fd);
+        contexts_.push_back(context);
+        rearm_.reserve(fds_.size());                                        // Enter() never allocates
+        return QueuePoll((unsigned)fds_.size() - 1);
+    }
+
+    int QueueSend(int fd, const void* buff, int len, unsigned long destination, int ttl = 0)
+    {
+        if (len > (int)sizeof(slots_[0].data))
+        {
+            // Too big for a slot, send it directly (ordering with queued sends does not matter for ICMP)
+            sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family      = AF_INET;
+            addr.sin_addr.s_addr = (in_addr_t)destination;
+            iovec iov;
+            iov.iov_base = (void*)buff;
+            iov.iov_len  = len;
+            char control[CMSG_SPACE(sizeof(int))];
+            msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_name    = &addr;
+            msg.msg_namelen = sizeof(addr);
+            msg.msg_iov     = &iov;
+            msg.msg_iovlen  = 1;
+            if (ttl > 0)
+                TransportSetControlTtl(&msg, control, ttl);
+            ssize_t nRet = sendmsg(fd, &msg, 0);
+            if (nRet < 0)
+                return (errno == EAGAIN || errno == ENOBUFS) ? TRANSPORT_WOULD_BLOCK : TRANSPORT_ERROR;
+            return (int)nRet;
+        }
+        if (freeSlots_.empty())
+        {
+            Enter(0);                                                       // Flush and collect finished sends to free their slots
+            if (freeSlots_.empty())
+                return TRANSPORT_WOULD_BLOCK;
+        }
+
+        unsigned index = freeSlots_.back();
+        freeSlots_.pop_back();
+        SendSlot& slot = slots_[index];
+        memcpy(slot.data, buff, len);
+        memset(&slot.addr, 0, sizeof(slot.addr));
+        slot.addr.sin_family      = AF_INET;
+        slot.addr.sin_addr.s_addr = (in_addr_t)destination;
+        slot.iov.iov_base = slot.data;
+        slot.iov.iov_len  = len;
+        memset(&slot.msg, 0, sizeof(slot.msg));
+        slot.msg.msg_name    = &slot.addr;
+        slot.msg.msg_namelen = sizeof(slot.addr);
+        slot.msg.msg_iov     = &slot.iov;
+        slot.msg.msg_iovlen  = 1;
+        if (ttl > 0)
+            TransportSetControlTtl(&slot.msg, slot.control, ttl);
+
+        io_uring_sqe* sqe = GetSqe();
+        if (sqe == NULL)
+        {
+            freeSlots_.push_back(index);
+            return TRANSPORT_WOULD_BLOCK;
+        }
+        sqe->opcode    = IORING_OP_SENDMSG;
+        sqe->fd        = fd;
+        sqe->addr      = (unsigned long long)(uintptr_t)&slot.msg;
+        sqe->len       = 1;
+        sqe->user_data = SendTag | index;
+        CommitSqe();
+        return len;
+    }
+
+    int Wait(void** ready, int maxReady, long timeoutMs)
+    {
+        nReady_ = 0;
+        ready_ = ready;
+        maxReady_ = maxReady;
+        Enter(timeoutMs);
+        ready_ = NULL;                                                      // Polls reaped outside Wait() are re-armed and fire again
+        return nReady_;
+    }
+
+    unsigned long long SendErrors() const { return sendErrors_; }
+
+private:
+    static const unsigned SendSlots = 256;
+    static const unsigned long long SendTag = 1ULL << 63;
+
+    struct SendSlot
+    {
+        msghdr      msg;
+        iovec       iov;
+        sockaddr_in addr;
+        char        control[CMSG_SPACE(sizeof(int))];                       // IP_TTL of a send with a ttl
+        char        data[2048];
+    };
+
+    io_uring_sqe* GetSqe()
+    {
+        unsigned tail = *sqTail_;
+        if (tail - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= sqEntries_)
+        {
+            Enter(0);
+            if (tail - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= sqEntries_)
+                return NULL;
+        }
+        io_uring_sqe* sqe = &sqes_[tail & sqMask_];
+        memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    void CommitSqe()
+    {
+        unsigned tail = *sqTail_;
+        sqArray_[tail & sqMask_] = tail & sqMask_;
+        __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+        ++queued_;
+    }
+
+    bool QueuePoll(unsigned index)
+    {
+        io_uring_sqe* sqe = GetSqe();
+        if (sqe == NULL)
+            return false;
+        sqe->opcode        = IORING_OP_POLL_ADD;
+        sqe->fd            = fds_[index];
+        sqe->poll32_events = POLLIN;
+        sqe->user_data     = index;
+        CommitSqe();
+        return true;
+    }
+
+    // Submits everything queued, waits up to timeoutMs for at least one completion and reaps all completions
+    void Enter(long timeoutMs)
+    {
+        __kernel_timespec ts;
+        ts.tv_sec  = timeoutMs / 1000;
+        ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+        io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = (unsigned long long)(uintptr_t)&ts;
+
+        unsigned flags = IORING_ENTER_EXT_ARG | (timeoutMs > 0 ? IORING_ENTER_GETEVENTS : 0);
+        int submitted = (int)syscall(__NR_io_uring_enter, ringFd_, queued_, timeoutMs > 0 ? 1 : 0, flags, &arg, sizeof(arg));
+        if (submitted > 0)
+            queued_ -= (unsigned)submitted;
+
+        rearm_.clear();
+        unsigned head = *cqHead_;
+        unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head)
+        {
+            io_uring_cqe& cqe = cqes_[head & cqMask_];
+            if (cqe.user_data & SendTag)
+            {
+                if (cqe.res < 0)
+                    ++sendErrors_;
+                freeSlots_.push_back((unsigned)(cqe.user_data & ~SendTag));
+            }
+            else
+            {
+                unsigned index = (unsigned)cqe.user_data;
+                if (ready_ != NULL && nReady_ < maxReady_)
+                    ready_[nReady_++] = contexts_[index];
+                rearm_.push_back(index);
+            }
+        }
+        __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+
+        for (size_t i = 0; i < rearm_.size(); ++i)
+            QueuePoll(rearm_[i]);
+    }
+
+    int            ringFd_;
+    char*          ring_;
+    size_t         ringSize_;
+    io_uring_sqe*  sqes_;
+    size_t         sqesSize_;
+    unsigned*      sqHead_;
+    unsigned*      sqTail_;
+    unsigned       sqMask_;
+    unsigned*      sqArray_;
+    unsigned       sqEntries_;
+    unsigned*      cqHead_;
+    unsigned*      cqTail_;
+    unsigned       cqMask_;
+    io_uring_cqe*  cqes_;
+    unsigned       queued_;
+
+    std::vector<SendSlot> slots_;
+    std::vector<unsigned> freeSlots_;
+    std::vector<int>      fds_;
+    std::vector<void*>    contexts_;
+    std::vector<unsigned> rearm_;                                           // Polls that fired in this Enter()
+    unsigned long long    sendErrors_;
+
+    void**                ready_;
+    int                   nReady_;
+    int                   maxReady_;
+};
+
+#endif // ICMP_TRANSPORT_URING_H
@@ -0,0 +1,575 @@
+/* ICMP Packet Watcher - Winsock transport backend (see icmp_Transport.h) */
+
+#ifndef ICMP_TRANSPORT_WINSOCK_H
+#define ICMP_TRANSPORT_WINSOCK_H
+
+#include <Winsock2.h>
+#include <Ws2tcpip.h>
+#include <mstcpip.h>
+#include <windows.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#pragma comment (lib, "ws2_32.lib")                                         // For linking the dynamic library of WinSock2
+
+struct IcmpSocket
+{
+    SOCKET          fd;
+    IcmpSocketKind  kind;
+    unsigned short  id;                                                     // icmp_id to put into requests and expect in replies
+    bool            hasIpHeader;                                            // Received datagrams start with the IP header
+    unsigned char   stamps;                                                 // Always 0, Winsock has no kernel timestamps for raw ICMP
+    int             ttl;                                                    // IP_TTL last set by TransportSendBatch, 0 for the default
+};
+
+inline bool TransportStartup()
+{
+    WSADATA wsaData;                                                        // The WSADATA structure contains information about the Windows Sockets implementation.
+    return WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+}
+
+inline void TransportCleanup()
+{
+    WSACleanup();
+}
+
+inline unsigned long TransportTickMs()
+{
+    return GetTickCount();
+}
+
+inline unsigned long long TransportMonotonicNs()
+{
+    static LARGE_INTEGER frequency = { 0 };
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (unsigned long long)(counter.QuadPart / frequency.QuadPart) * 1000000000ULL +
+           (unsigned long long)(counter.QuadPart % frequency.QuadPart) * 1000000000ULL / frequency.QuadPart;
+}
+
+inline void TransportSleepMs(unsigned long ms)
+{
+    Sleep(ms);
+}
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+// Sleep() rounds to the timer resolution (often 15.6 ms), a high resolution waitable timer (Windows 10 1803 and later)
+// wakes within about 0.5 ms. The last stretch is spun either way, so the deadline is not overslept.
+inline void TransportSleepUntilNs(unsigned long long deadlineNs)
+{
+    static HANDLE timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    const unsigned long long spinNs = timer != NULL ? 500000ULL : 16000000ULL;
+    unsigned long long now = TransportMonotonicNs();
+    if (deadlineNs > now + spinNs)
+    {
+        unsigned long long waitNs = deadlineNs - now - spinNs;
+        if (timer != NULL)
+        {
+            LARGE_INTEGER due;
+            due.QuadPart = -(LONGLONG)(waitNs / 100);                        // Relative, in 100 ns units
+            if (SetWaitableTimer(timer, &due, 0, NULL, NULL, FALSE))
+                WaitForSingleObject(timer, INFINITE);
+        }
+        else
+            Sleep((DWORD)(waitNs / 1000000ULL));
+    }
+    while (TransportMonotonicNs() < deadlineNs)
+        SwitchToThread();
+}
+
+// Unix time minus TransportMonotonicNs(), to print monotonic stamps as wall-clock time
+inline long long TransportRealtimeOffsetNs()
+{
+    FILETIME ft;
+    GetSystemTimePreciseAsFileTime(&ft);
+    unsigned long long ticks = ((unsigned long long)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    long long realNs = (long long)(ticks - 116444736000000000ULL) * 100;    // FILETIME counts 100 ns since 1601
+    return realNs - (long long)TransportMonotonicNs();
+}
+
+// Winsock has no unprivileged ping sockets, only ICMP_SOCKET_RAW is available
+inline bool TransportOpen(IcmpSocketKind kind, IcmpSocket* s)
+{
+    if (kind != ICMP_SOCKET_RAW)
+        return false;
+    s->fd          = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+    s->kind        = kind;
+    s->id          = (unsigned short)::GetCurrentProcessId();              // Get process number as ID uniquely
+    s->hasIpHeader = true;
+    s->stamps      = 0;
+    s->ttl         = 0;
+    return s->fd != INVALID_SOCKET;
+}
+
+inline void TransportClose(IcmpSocket& s)
+{
+    closesocket(s.fd);
+    s.fd = INVALID_SOCKET;
+}
+
+inline int TransportLastError()
+{
+    return WSAGetLastError();
+}
+
+inline bool TransportSetNonBlocking(IcmpSocket& s)
+{
+    u_long nonBlocking = 1;
+    return ioctlsocket(s.fd, FIONBIO, &nonBlocking) == 0;
+}
+
+// Winsock has no socket filters: every raw socket receives every ICMP packet and the receiver checks icmp_id itself
+inline bool TransportFilterId(IcmpSocket& /*s*/)
+{
+    return false;
+}
+
+inline bool TransportPinThread(int cpu)
+{
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << (cpu % (int)(8 * sizeof(DWORD_PTR)))) != 0;
+}
+
+inline bool TransportSetRecvTimeout(IcmpSocket& s, unsigned long ms)
+{
+    DWORD Timeout = ms;
+    return setsockopt(s.fd, SOL_SOCKET, SO_RCVTIMEO, (char*)&Timeout, sizeof(Timeout)) == 0;
+}
+
+// Sets or clears the don't fragment bit of every datagram sent (sizes over the interface MTU fail with WSAEMSGSIZE)
+inline bool TransportSetDontFragment(IcmpSocket& s, bool on)
+{
+    DWORD DontFragment = on ? 1 : 0;
+    return setsockopt(s.fd, IPPROTO_IP, IP_DONTFRAGMENT, (char*)&DontFragment, sizeof(DontFragment)) == 0;
+}
+
+// SIO_TIMESTAMPING only covers UDP, so receive stamps are taken right after recvfrom and there are no send stamps
+inline int TransportEnableTimestamps(IcmpSocket& s, bool /*tx*/)
+{
+    return s.stamps;
+}
+
+inline int TransportSendTo(IcmpSocket& s, const void* buff, int len, unsigned long destination)
+{
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = destination;
+    int nRet = sendto(s.fd, (const char*)buff, len, 0, (SOCKADDR*)&addr, sizeof(addr));
+    if (nRet == SOCKET_ERROR)
+        return WSAGetLastError() == WSAEWOULDBLOCK ? TRANSPORT_WOULD_BLOCK : TRANSPORT_ERROR;
+    return nRet;
+}
+
+inline int TransportRecvFrom(IcmpSocket& s, void* buff, int len, unsigned long* source, unsigned long long* stampNs = NULL)
+{
+    sockaddr_in from;
+    int nLen = sizeof(from);
+    int nRet = recvfrom(s.fd, (char*)buff, len, 0, (sockaddr*)&from, &nLen);
+    if (nRet == SOCKET_ERROR)
+    {
+        int error = WSAGetLastError();
+        return (error == WSAEWOULDBLOCK || error == WSAETIMEDOUT) ? TRANSPORT_WOULD_BLOCK : TRANSPORT_ERROR;
+    }
+    *source = from.sin_addr.s_addr;
+    if (stampNs != NULL)
+        *stampNs = TransportMonotonicNs();
+    return nRet;
+}
+
+// Winsock has no sendmmsg/recvmmsg, a batch is one sendto/recvfrom per packet (the socket must be non-blocking).
+// There is no per-packet TTL either: IP_TTL is set on the socket whenever the next packet needs another one.
+inline int TransportSendBatch(IcmpSocket& s, TransportPacket* packets, int count)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        int ttl = packets[i].ttl > 0 ? packets[i].ttl : 128;
+        if (ttl != (s.ttl > 0 ? s.ttl : 128))
+        {
+            if (setsockopt(s.fd, IPPROTO_IP, IP_TTL, (const char*)&ttl, sizeof(ttl)) != 0)
+                return i > 0 ? i : TRANSPORT_ERROR;
+            s.ttl = ttl;
+        }
+        int nRet = TransportSendTo(s, packets[i].data, packets[i].len, packets[i].addr);
+        if (nRet < 0)
+            return i > 0 ? i : nRet;
+    }
+    return count;
+}
+
+inline int TransportRecvBatch(IcmpSocket& s, TransportPacket* packets, int count)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        int nRet = TransportRecvFrom(s, packets[i].data, packets[i].len, &packets[i].addr, &packets[i].stampNs);
+        if (nRet < 0)
+            return i > 0 ? i : nRet;
+        packets[i].len = nRet;
+    }
+    return count;
+}
+
+inline int TransportRecvTxStamps(IcmpSocket& /*s*/, TransportTxStamp* /*stamps*/, int /*max*/)
+{
+    return 0;
+}
+
+/* Passive capture for the -W watcher mode. Winsock has no packet ring: a raw IP socket bound to the interface's
+   address is switched to SIO_RCVALL and every packet is copied into one receive buffer, ICMP is picked out here.
+   iface is the IPv4 address of the interface. Needs administrator rights. */
+class CaptureRing
+{
+public:
+    CaptureRing() : fd_(INVALID_SOCKET), packets_(0), buffer_(65536) {}
+    ~CaptureRing() { Close(); }
+
+    bool Open(const char* iface, unsigned int /*blockSize*/ = 0, unsigned int /*blocks*/ = 0)
+    {
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family      = AF_INET;
+        addr.sin_addr.s_addr = inet_addr(iface);
+        fd_ = socket(AF_INET, SOCK_RAW, IPPROTO_IP);
+        if (fd_ == INVALID_SOCKET)
+            return false;
+        DWORD on = RCVALL_ON, bytes = 0;
+        u_long nonBlocking = 1;
+        if (bind(fd_, (SOCKADDR*)&addr, sizeof(addr)) != 0 ||
+            WSAIoctl(fd_, SIO_RCVALL, &on, sizeof(on), NULL, 0, &bytes, NULL, NULL) != 0 ||
+            ioctlsocket(fd_, FIONBIO, &nonBlocking) != 0)
+        {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void Close()
+    {
+        if (fd_ != INVALID_SOCKET)
+            closesocket(fd_);
+        fd_ = INVALID_SOCKET;
+    }
+
+    const char* Name() const { return "SIO_RCVALL"; }
+
+    template <typename Handler>
+    int Poll(long timeoutMs, Handler handle)
+    {
+        fd_set readSet;
+        FD_ZERO(&readSet);
+        FD_SET(fd_, &readSet);
+        timeval tv;
+        tv.tv_sec  = timeoutMs / 1000;
+        tv.tv_usec = (timeoutMs % 1000) * 1000;
+        if (select(0, &readSet, NULL, NULL, &tv) <= 0)
+            return 0;
+
+        int count = 0;
+        long long offsetNs = TransportRealtimeOffsetNs();
+        int nRet;
+        while ((nRet = recv(fd_, &buffer_[0], (int)buffer_.size(), 0)) > 0)
+        {
+            ++packets_;
+            if ((unsigned char)buffer_[9] != IPPROTO_ICMP)
+                continue;                                                   // No kernel filter, everything IP arrives here
+            handle((const unsigned char*)&buffer_[0], nRet, nRet, (unsigned long long)((long long)TransportMonotonicNs() + offsetNs));
+            ++count;
+        }
+        return count;
+    }
+
+    unsigned long long Packets() { return packets_; }
+    unsigned long long Drops()   { return 0; }                              // Not reported by Winsock
+
+private:
+    SOCKET             fd_;
+    unsigned long long packets_;
+    std::vector<char>  buffer_;
+};
+
+// A TCP listener on 127.0.0.1 that answers one short request per connection (the /metrics endpoint)
+class TransportTcpServer
+{
+public:
+    TransportTcpServer() : fd_(INVALID_SOCKET) {}
+    ~TransportTcpServer() { Close(); }
+
+    bool Listen(unsigned short port)
+    {
+        fd_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (fd_ == INVALID_SOCKET)
+            return false;
+        BOOL exclusive = TRUE;                                              // No other process may bind the port on top of ours
+        setsockopt(fd_, SOL_SOCKET, SO_EXCLUSIVEADDRUSE, (const char*)&exclusive, sizeof(exclusive));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family      = AF_INET;
+        addr.sin_port        = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(fd_, (SOCKADDR*)&addr, sizeof(addr)) != 0 || listen(fd_, 16) != 0)
+        {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    template <typename Handler>
+    bool Serve(long timeoutMs, Handler handle)
+    {
+        fd_set readSet;
+        FD_ZERO(&readSet);
+        FD_SET(fd_, &readSet);
+        timeval tv;
+        tv.tv_sec  = timeoutMs / 1000;
+        tv.tv_usec = (timeoutMs % 1000) * 1000;
+        if (select(0, &readSet, NULL, NULL, &tv) <= 0)
+            return false;
+        SOCKET client = accept(fd_, NULL, NULL);
+        if (client == INVALID_SOCKET)
+            return false;
+        DWORD timeout = 1000;
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, (const char*)&timeout, sizeof(timeout));
+
+        char request[4096];
+        int len = 0;
+        request[0] = '\0';
+        while (len < (int)sizeof(request) - 1 && strstr(request, "\r\n\r\n") == NULL)
+        {
+            int n = recv(client, request + len, (int)sizeof(request) - 1 - len, 0);
+            if (n <= 0)
+                break;
+            len += n;
+            request[len] = '\0';
+        }
+        std::string response;
+        handle((const char*)request, len, &response);
+        size_t sent = 0;
+        while (sent < response.size())
+        {
+            int n = send(client, response.data() + sent, (int)(response.size() - sent), 0);
+            if (n <= 0)
+                break;
+            sent += (size_t)n;
+        }
+        closesocket(client);
+        return true;
+    }
+
+    void Close()
+    {
+        if (fd_ != INVALID_SOCKET)
+            closesocket(fd_);
+        fd_ = INVALID_SOCKET;
+    }
+
+private:
+    SOCKET fd_;
+};
+
+// A named file mapping backed by the paging file (Local\<name>), readable by other processes of the session
+class TransportSharedMemory
+{
+public:
+    TransportSharedMemory() : mapping_(NULL), data_(NULL) {}
+    ~TransportSharedMemory() { Close(); }
+
+    void* Create(const char* name, size_t size)
+    {
+        std::string fullName = std::string("Local\\") + name;
+        mapping_ = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, (DWORD)size, fullName.c_str());
+        if (mapping_ == NULL)
+            return NULL;
+        data_ = MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, size);
+        if (data_ == NULL)
+        {
+            Close();
+            return NULL;
+        }
+        memset(data_, 0, size);
+        return data_;
+    }
+
+    // The mapping disappears with its last handle
+    void Close()
+    {
+        if (data_ != NULL)
+            UnmapViewOfFile(data_);
+        if (mapping_ != NULL)
+            CloseHandle(mapping_);
+        data_    = NULL;
+        mapping_ = NULL;
+    }
+
+private:
+    HANDLE mapping_;
+    void*  data_;
+};
+
+// A whole file mapped read-only (the time-series store, icmp_TimeSeries.h, and a capture replayed with -p, icmp_Pcap.h)
+class TransportMappedFile
+{
+public:
+    TransportMappedFile() : mapping_(NULL), data_(NULL) {}
+    ~TransportMappedFile() { Close(); }
+
+    // Maps the file; NULL if it cannot be opened or is empty
+    const void* Open(const char* path, size_t* size)
+    {
+        Close();
+        HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            return NULL;
+        LARGE_INTEGER fileSize;
+        if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+            mapping_ = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        CloseHandle(file);                                                  // The mapping keeps the file open
+        if (mapping_ == NULL)
+            return NULL;
+        data_ = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+        if (data_ == NULL)
+        {
+            Close();
+            return NULL;
+        }
+        *size = (size_t)fileSize.QuadPart;
+        return data_;
+    }
+
+    void Close()
+    {
+        if (data_ != NULL)
+            UnmapViewOfFile(data_);
+        if (mapping_ != NULL)
+            CloseHandle(mapping_);
+        data_    = NULL;
+        mapping_ = NULL;
+    }
+
+private:
+    HANDLE mapping_;
+    void*  data_;
+};
+
+// A file written through a moving mapped window (the capture file of -C with -K, icmp_Pcap.h)
+class TransportMappedWriter
+{
+public:
+    TransportMappedWriter() : file_(INVALID_HANDLE_VALUE), mapping_(NULL), data_(NULL) {}
+    ~TransportMappedWriter() { Close(0); }
+
+    // Creates (or empties) the file
+    bool Open(const char* path)
+    {
+        Close(0);
+        file_ = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        return file_ != INVALID_HANDLE_VALUE;
+    }
+
+    // Grows the file to offset + size and maps that window for writing, in place of the previous one. offset is a
+    // multiple of 64 KB (the allocation granularity). Dirty pages are written back by the system, not by the caller.
+    void* Map(unsigned long long offset, size_t size)
+    {
+        Unmap();
+        if (file_ == INVALID_HANDLE_VALUE)
+            return NULL;
+        unsigned long long end = offset + size;
+        mapping_ = CreateFileMappingA(file_, NULL, PAGE_READWRITE, (DWORD)(end >> 32), (DWORD)end, NULL);
+        if (mapping_ == NULL)
+            return NULL;
+        data_ = MapViewOfFile(mapping_, FILE_MAP_WRITE, (DWORD)(offset >> 32), (DWORD)offset, size);
+        return data_;
+    }
+
+    // Unmaps the window and cuts the file to the bytes written
+    bool Close(unsigned long long length)
+    {
+        Unmap();
+        if (file_ == INVALID_HANDLE_VALUE)
+            return true;
+        LARGE_INTEGER position;
+        position.QuadPart = (LONGLONG)length;
+        bool ok = SetFilePointerEx(file_, position, NULL, FILE_BEGIN) && SetEndOfFile(file_);
+        CloseHandle(file_);
+        file_ = INVALID_HANDLE_VALUE;
+        return ok;
+    }
+
+private:
+    void Unmap()
+    {
+        if (data_ != NULL)
+            UnmapViewOfFile(data_);
+        if (mapping_ != NULL)
+            CloseHandle(mapping_);
+        data_    = NULL;
+        mapping_ = NULL;
+    }
+
+    HANDLE file_;
+    HANDLE mapping_;
+    void*  data_;
+};
+
+// select() based loop, good for up to FD_SETSIZE sockets
+class TransportLoop
+{
+public:
+    bool Init(bool /*preferUring*/ = false) { return true; }
+    const char* Name() const                { return "select"; }
+
+    bool Add(IcmpSocket& s, void* context)
+    {
+        if (sockets_.size() >= FD_SETSIZE)
+            return false;
+        sockets_.push_back(s.fd);
+        contexts_.push_back(context);
+        return true;
+    }
+
+    int Send(IcmpSocket& s, const void* buff, int len, unsigned long destination)
+    {
+        return TransportSendTo(s, buff, len, destination);
+    }
+
+    int SendBatch(IcmpSocket& s, TransportPacket* packets, int count)
+    {
+        return TransportSendBatch(s, packets, count);
+    }
+
+    unsigned long long SendErrors() const { return 0; }                     // Sends are synchronous, Send() reports their errors
+
+    int Wait(void** ready, int maxReady, long timeoutMs)
+    {
+        fd_set readSet;
+        FD_ZERO(&readSet);
+        for (size_t i = 0; i < sockets_.size(); ++i)
+            FD_SET(sockets_[i], &readSet);
+
+        if (timeoutMs < 0)
+            timeoutMs = 0;
+        timeval tv;
+        tv.tv_sec  = timeoutMs / 1000;
+        tv.tv_usec = (timeoutMs % 1000) * 1000;
+        if (select(0, &readSet, NULL, NULL, &tv) <= 0)
+            return 0;
+
+        int nReady = 0;
+        for (size_t i = 0; i < sockets_.size() && nReady < maxReady; ++i)
+            if (FD_ISSET(sockets_[i], &readSet))
+                ready[nReady++] = contexts_[i];
+        return nReady;
+    }
+
+private:
+    std::vector<SOCKET> sockets_;
+    std::vector<void*>  contexts_;
+};
+
+#endif // ICMP_TRANSPORT_WINSOCK_H
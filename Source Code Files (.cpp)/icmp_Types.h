@@ -0,0 +1,319 @@
+/* ICMP Packet Watcher - ICMP type/code table and error message decoding */
+
+/* IcmpTypes is a 256-entry table built at compile time from the list of assigned types below (RFC 792, RFC 1812,
+   RFC 4884, RFC 8335). One indexed load gives a type's name, whether it is an echo reply, a query or an error,
+   the error class, and where the names of its codes start in IcmpCodeNames, so classifying a received message
+   needs no switch and no allocation. The order of IcmpCodeNames has to follow IcmpTypeSpecs, which is checked
+   by a static_assert on the total number of codes.
+
+   Error messages (destination unreachable, source quench, redirect, time exceeded, parameter problem) carry the
+   IP header and at least the first 8 bytes of the datagram that caused them. ParseIcmpError decodes that quote,
+   so an error can be matched to the echo request it answers by the quoted destination, identifier and sequence
+   number. IcmpErrorCounts counts errors per error class (small enough to keep one per sweep target),
+   IcmpCodeCounts counts them per type and code for a run's summary. */
+
+#ifndef ICMP_TYPES_H
+#define ICMP_TYPES_H
+
+#include <stdio.h>
+#include <string.h>
+#include <ostream>
+
+enum IcmpKind
+{
+    ICMP_KIND_OTHER,                                                        // Unassigned or deprecated
+    ICMP_KIND_ECHO_REPLY,
+    ICMP_KIND_QUERY,                                                        // Requests and replies other than the echo reply
+    ICMP_KIND_ERROR                                                         // Carries the header of the datagram that caused it
+};
+
+enum IcmpErrorClass
+{
+    ICMP_ERROR_NONE,
+    ICMP_ERROR_UNREACHABLE,                                                 // These three end the probe: no reply will follow
+    ICMP_ERROR_TIME_EXCEEDED,
+    ICMP_ERROR_PARAMETER,
+    ICMP_ERROR_SOURCE_QUENCH,                                               // These two do not, the datagram was still forwarded
+    ICMP_ERROR_REDIRECT,
+    ICMP_ERROR_CLASSES
+};
+
+struct IcmpTypeSpec
+{
+    unsigned char type;
+    const char*   name;
+    unsigned char kind;                                                     // IcmpKind
+    unsigned char errorClass;                                               // IcmpErrorClass
+    unsigned char codes;                                                    // Named codes 0 .. codes - 1 in IcmpCodeNames
+};
+
+constexpr IcmpTypeSpec IcmpTypeSpecs[] =
+{
+    {  0, "echo reply",              ICMP_KIND_ECHO_REPLY, ICMP_ERROR_NONE,          0 },
+    {  3, "destination unreachable", ICMP_KIND_ERROR,      ICMP_ERROR_UNREACHABLE,   16 },
+    {  4, "source quench",           ICMP_KIND_ERROR,      ICMP_ERROR_SOURCE_QUENCH, 0 },
+    {  5, "redirect",                ICMP_KIND_ERROR,      ICMP_ERROR_REDIRECT,      4 },
+    {  8, "echo request",            ICMP_KIND_QUERY,      ICMP_ERROR_NONE,          0 },
+    {  9, "router advertisement",    ICMP_KIND_QUERY,      ICMP_ERROR_NONE,          0 },
+    { 10, "router solicitation",     ICMP_KIND_QUERY,      ICMP_ERROR_NONE,          0 },
+    { 11, "time exceeded",           ICMP_KIND_ERROR,      ICMP_ERROR_TIME_EXCEEDED, 2 },
+    { 12, "parameter problem",       ICMP_KIND_ERROR,      ICMP_ERROR_PARAMETER,     3 },
+    { 13, "timestamp",               ICMP_KIND_QUERY,      ICMP_ERROR_NONE,          0 },
+    { 14, "timestamp reply",         ICMP_KIND_QUERY,      ICMP_ERROR_NONE,          0 },
+    { 15, "information request",     ICMP_KIND_OTHER,      ICMP_ERROR_NONE,          0 },
+    { 16, "information reply",       ICMP_KIND_OTHER,      ICMP_ERROR_NONE,          0 },
+    { 17, "address mask request",    ICMP_KIND_OTHER,      ICMP_ERROR_NONE,          0 },
+    { 18, "address mask reply",      ICMP_KIND_OTHER,      ICMP_ERROR_NONE,          0 },
+    { 30, "traceroute",              ICMP_KIND_OTHER,      ICMP_ERROR_NONE,          0 },
+    { 40, "photuris",                ICMP_KIND_OTHER,      ICMP_ERROR_NONE,          6 },
+    { 42, "extended echo request",   ICMP_KIND_QUERY,      ICMP_ERROR_NONE,          0 },
+    { 43, "extended echo reply",     ICMP_KIND_QUERY,      ICMP_ERROR_NONE,          5 }
+};
+
+constexpr const char* IcmpCodeNames[] =
+{
+    // 3 destination unreachable
+    "net unreachable", "host unreachable", "protocol unreachable", "port unreachable",
+    "fragmentation needed and DF set", "source route failed", "destination network unknown",
+    "destination host unknown", "source host isolated", "network administratively prohibited",
+    "host administratively prohibited", "network unreachable for TOS", "host unreachable for TOS",
+    "communication administratively prohibited", "host precedence violation", "precedence cutoff in effect",
+    // 5 redirect
+    "redirect for network", "redirect for host", "redirect for TOS and network", "redirect for TOS and host",
+    // 11 time exceeded
+    "TTL exceeded in transit", "fragment reassembly time exceeded",
+    // 12 parameter problem
+    "pointer indicates the error", "missing a required option", "bad length",
+    // 40 photuris
+    "bad SPI", "authentication failed", "decompression failed", "decryption failed", "need authentication",
+    "need authorization",
+    // 43 extended echo reply
+    "no error", "malformed query", "no such interface", "no such table entry", "multiple interfaces satisfy query"
+};
+
+struct IcmpTypeInfo
+{
+    const char*   name;
+    unsigned char kind;                                                     // IcmpKind
+    unsigned char errorClass;                                               // IcmpErrorClass
+    unsigned char codes;                                                    // Named codes
+    unsigned char firstCode;                                                // Index of code 0 in IcmpCodeNames
+    unsigned char firstSlot;                                                // Error types: first IcmpCodeCounts slot
+};
+
+// Error types get one counter slot per named code and one for all other codes
+constexpr int IcmpErrorSlots()
+{
+    int slots = 0;
+    for (const IcmpTypeSpec& spec : IcmpTypeSpecs)
+        if (spec.kind == ICMP_KIND_ERROR)
+            slots += spec.codes + 1;
+    return slots;
+}
+
+struct IcmpTypeTable
+{
+    IcmpTypeInfo types[256];
+    int          codeNames;                                                 // Total of the named codes, for the static_assert
+};
+
+constexpr IcmpTypeTable MakeIcmpTypeTable()
+{
+    IcmpTypeTable table = {};
+    for (int type = 0; type < 256; ++type)
+        table.types[type] = IcmpTypeInfo { "unassigned", ICMP_KIND_OTHER, ICMP_ERROR_NONE, 0, 0, 0 };
+    int code = 0, slot = 0;
+    for (const IcmpTypeSpec& spec : IcmpTypeSpecs)
+    {
+        table.types[spec.type] = IcmpTypeInfo { spec.name, spec.kind, spec.errorClass, spec.codes,
+                                                (unsigned char)code, (unsigned char)slot };
+        code += spec.codes;
+        if (spec.kind == ICMP_KIND_ERROR)
+            slot += spec.codes + 1;
+    }
+    table.codeNames = code;
+    return table;
+}
+
+constexpr IcmpTypeTable IcmpTypes = MakeIcmpTypeTable();
+
+static_assert(IcmpTypes.codeNames == sizeof(IcmpCodeNames) / sizeof(IcmpCodeNames[0]), "IcmpCodeNames does not match IcmpTypeSpecs");
+static_assert(IcmpErrorSlots() < 256, "IcmpTypeInfo::firstSlot is a byte");
+
+inline const char* IcmpTypeName(unsigned char type)
+{
+    return IcmpTypes.types[type].name;
+}
+
+// Name of the code, NULL if the type has no named code of that number
+inline const char* IcmpCodeName(unsigned char type, unsigned char code)
+{
+    const IcmpTypeInfo& info = IcmpTypes.types[type];
+    return code < info.codes ? IcmpCodeNames[info.firstCode + code] : NULL;
+}
+
+inline IcmpErrorClass IcmpErrorClassOf(unsigned char type)
+{
+    return (IcmpErrorClass)IcmpTypes.types[type].errorClass;
+}
+
+// Unreachable, time exceeded and parameter problem: the datagram was discarded, no reply is coming
+inline bool IcmpErrorEndsProbe(IcmpErrorClass errorClass)
+{
+    return (unsigned int)(errorClass - ICMP_ERROR_UNREACHABLE) <= ICMP_ERROR_PARAMETER - ICMP_ERROR_UNREACHABLE;
+}
+
+// Short name of an error class for summaries
+inline const char* IcmpErrorClassName(int errorClass)
+{
+    static const char* const names[ICMP_ERROR_CLASSES] = { "none", "unreachable", "time exceeded", "parameter problem",
+                                                           "source quench", "redirect" };
+    return errorClass >= 0 && errorClass < ICMP_ERROR_CLASSES ? names[errorClass] : "unknown";
+}
+
+// An ICMP error message and the echo request it quotes
+struct IcmpErrorInfo
+{
+    unsigned char        type;
+    unsigned char        code;
+    unsigned char        errorClass;                                        // IcmpErrorClass
+    unsigned char        pointer;                                           // Parameter problem: octet of the quoted datagram at fault
+    unsigned short       mtu;                                               // Fragmentation needed: next-hop MTU (0 if not reported)
+    unsigned long        destination;                                       // Quoted IP destination (network byte order): the probed address
+    unsigned char        ttl;                                               // Quoted TTL, as it was where the error was generated
+    bool                 echo;                                              // The quoted datagram is an ICMP echo request, id/seq are valid
+    unsigned short       id;                                                // Quoted icmp_id and icmp_sequence, as they were sent
+    unsigned short       seq;
+    const unsigned char* probe;                                             // Quoted ICMP message, probeLength bytes of it (8 at least)
+    int                  probeLength;
+};
+
+/* Decodes an ICMP error message: icmp points at its ICMP header, len is the length up to the end of the message.
+   Returns false for every other type, and for errors whose quote is not an IPv4 header followed by 8 bytes. */
+inline bool ParseIcmpError(const unsigned char* icmp, int len, IcmpErrorInfo* info)
+{
+    const IcmpTypeInfo& type = IcmpTypes.types[icmp[0]];
+    if (type.kind != ICMP_KIND_ERROR || len < 8 + 20 + 8)
+        return false;
+    const unsigned char* ip = icmp + 8;
+    int ihl = (ip[0] & 0x0F) * 4;
+    if ((ip[0] >> 4) != 4 || ihl < 20 || len < 8 + ihl + 8)
+        return false;
+
+    unsigned int address;
+    memcpy(&address, ip + 16, 4);
+    info->type        = icmp[0];
+    info->code        = icmp[1];
+    info->errorClass  = type.errorClass;
+    info->pointer     = type.errorClass == ICMP_ERROR_PARAMETER ? icmp[4] : 0;
+    info->mtu         = (icmp[0] == 3 && icmp[1] == 4) ? (unsigned short)((icmp[6] << 8) | icmp[7]) : 0;
+    info->destination = address;
+    info->ttl         = ip[8];
+    info->probe       = ip + ihl;
+    info->probeLength = len - 8 - ihl;
+    info->echo        = ip[9] == 1 && ((ip[6] & 0x1F) | ip[7]) == 0 && info->probe[0] == 8;
+    memcpy(&info->id, info->probe + 4, 2);
+    memcpy(&info->seq, info->probe + 6, 2);
+    return true;
+}
+
+// Errors of one target by class, 24 bytes
+class IcmpErrorCounts
+{
+public:
+    IcmpErrorCounts() { memset(counts_, 0, sizeof(counts_)); }
+
+    void Record(unsigned char type) { ++counts_[IcmpTypes.types[type].errorClass]; }
+
+    void Merge(const IcmpErrorCounts& other)
+    {
+        for (int i = 0; i < ICMP_ERROR_CLASSES; ++i)
+            counts_[i] += other.counts_[i];
+    }
+
+    unsigned int Count(int errorClass) const { return counts_[errorClass]; }
+
+    unsigned int Total() const
+    {
+        unsigned int total = 0;
+        for (int i = ICMP_ERROR_UNREACHABLE; i < ICMP_ERROR_CLASSES; ++i)
+            total += counts_[i];
+        return total;
+    }
+
+    // "2 unreachable, 1 time exceeded", empty when there was no error
+    int Format(char* out, size_t size) const
+    {
+        int len = 0;
+        out[0] = '\0';
+        for (int i = ICMP_ERROR_UNREACHABLE; i < ICMP_ERROR_CLASSES && len < (int)size; ++i)
+            if (counts_[i] > 0)
+                len += snprintf(out + len, size - len, "%s%u %s", len > 0 ? ", " : "", counts_[i], IcmpErrorClassName(i));
+        return len;
+    }
+
+private:
+    unsigned int counts_[ICMP_ERROR_CLASSES];
+};
+
+// Errors of a run by type and code
+class IcmpCodeCounts
+{
+public:
+    IcmpCodeCounts() : total_(0) { memset(counts_, 0, sizeof(counts_)); }
+
+    void Record(unsigned char type, unsigned char code)
+    {
+        const IcmpTypeInfo& info = IcmpTypes.types[type];
+        if (info.kind != ICMP_KIND_ERROR)
+            return;
+        ++counts_[info.firstSlot + (code < info.codes ? code : info.codes)];
+        ++total_;
+    }
+
+    unsigned long long Total() const { return total_; }
+
+    void Merge(const IcmpCodeCounts& other)
+    {
+        for (int i = 0; i < IcmpErrorSlots(); ++i)
+            counts_[i] += other.counts_[i];
+        total_ += other.total_;
+    }
+
+    // One line per error type seen: "destination unreachable: 3 (host unreachable 2, port unreachable 1)"
+    void Print(std::ostream& out) const
+    {
+        char line[512];
+        for (const IcmpTypeSpec& spec : IcmpTypeSpecs)
+        {
+            if (spec.kind != ICMP_KIND_ERROR)
+                continue;
+            const IcmpTypeInfo& info = IcmpTypes.types[spec.type];
+            unsigned long long total = 0;
+            for (int code = 0; code <= info.codes; ++code)
+                total += counts_[info.firstSlot + code];
+            if (total == 0)
+                continue;
+            int len = snprintf(line, sizeof(line), "%s: %llu", info.name, total);
+            const char* separator = " (";
+            for (int code = 0; code <= info.codes && len < (int)sizeof(line) - 64; ++code)
+            {
+                unsigned long long count = counts_[info.firstSlot + code];
+                if (count == 0 || (info.codes == 0 && code == 0))
+                    continue;
+                if (code < info.codes)
+                    len += snprintf(line + len, sizeof(line) - len, "%s%s %llu", separator, IcmpCodeNames[info.firstCode + code], count);
+                else
+                    len += snprintf(line + len, sizeof(line) - len, "%sother codes %llu", separator, count);
+                separator = ", ";
+            }
+            out<<line<<(separator[0] == ',' ? ")\n" : "\n");
+        }
+    }
+
+private:
+    unsigned long long counts_[IcmpErrorSlots()];
+    unsigned long long total_;
+};
+
+#endif // ICMP_TYPES_H
@@ -0,0 +1,215 @@
+/* ICMP Packet Watcher - Passive ICMP traffic counters */
+
+/* The watcher mode (-W) does not send anything. It reads every IPv4 packet carrying ICMP from an interface (see
+   CaptureRing in the transport backends) and counts it here:
+     ParseIcmpPacket   Checks an IPv4 header and finds the ICMP message behind it. The header length comes from the
+                       IHL field, so packets with IP options parse correctly; truncated headers, non-first fragments
+                       and other protocols are refused.
+     WatchCounters     Packets and bytes per ICMP type, per type/code, and per (source, type, code). The per-source
+                       counters live in an open-addressing table that is sized once and never rehashes; sources that
+                       do not fit any more are added up in Overflow(). Counting a packet does not allocate. */
+
+#ifndef ICMP_WATCHER_H
+#define ICMP_WATCHER_H
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <ostream>
+#include <vector>
+#include "icmp_Types.h"
+
+struct IcmpPacketInfo
+{
+    unsigned long        source;                                            // Network byte order
+    unsigned long        destination;
+    unsigned char        type;
+    unsigned char        code;
+    int                  ipHeaderLength;                                    // IHL * 4, 20 to 60 bytes
+    int                  icmpLength;                                        // ICMP header and data, as far as they were captured
+    const unsigned char* icmp;
+};
+
+// Returns false unless ip points to an IPv4 header followed by (the start of) an ICMP message
+inline bool ParseIcmpPacket(const unsigned char* ip, int len, IcmpPacketInfo* info)
+{
+    if (len < 20 || (ip[0] >> 4) != 4 || ip[9] != 1)                        // Version 4, protocol ICMP
+        return false;
+    int ihl = (ip[0] & 0x0F) * 4;
+    if (ihl < 20 || len < ihl + 4)
+        return false;
+    if (((ip[6] & 0x1F) | ip[7]) != 0)
+        return false;                                                       // Fragment offset > 0: no ICMP header in it
+
+    int total = (ip[2] << 8) | ip[3];
+    if (total >= ihl + 4 && total < len)
+        len = total;                                                        // Ignore link layer padding
+    unsigned int address;
+    memcpy(&address, ip + 12, 4);
+    info->source = address;
+    memcpy(&address, ip + 16, 4);
+    info->destination = address;
+    info->type           = ip[ihl];
+    info->code           = ip[ihl + 1];
+    info->ipHeaderLength = ihl;
+    info->icmpLength     = len - ihl;
+    info->icmp           = ip + ihl;
+    return true;
+}
+
+struct WatchEntry
+{
+    unsigned long long key;                                                 // 1 << 48 | source << 16 | type << 8 | code, 0 marks an empty slot
+    unsigned long long packets;
+    unsigned long long bytes;
+};
+
+class WatchCounters
+{
+public:
+    static const int Codes = 16;                                            // Codes above 15 are counted together
+
+    // maxSources is the number of (source, type, code) triples that get their own counters
+    explicit WatchCounters(unsigned int maxSources = 1u << 16)
+        : packets_(0), bytes_(0), malformed_(0), overflow_(0), size_(0)
+    {
+        unsigned int capacity = 2;
+        while (capacity < maxSources * 2)                                   // Load factor at or below 50%
+            capacity <<= 1;
+        slots_.resize(capacity);
+        mask_ = capacity - 1;
+        limit_ = capacity / 2;
+        memset(typePackets_, 0, sizeof(typePackets_));
+        memset(typeBytes_, 0, sizeof(typeBytes_));
+        memset(codePackets_, 0, sizeof(codePackets_));
+    }
+
+    // Counts one captured IPv4 packet of wireLength bytes
+    void Count(const unsigned char* ip, int len, int wireLength)
+    {
+        IcmpPacketInfo info;
+        if (!ParseIcmpPacket(ip, len, &info))
+        {
+            ++malformed_;
+            return;
+        }
+        ++packets_;
+        bytes_ += wireLength;
+        ++typePackets_[info.type];
+        typeBytes_[info.type] += wireLength;
+        ++codePackets_[info.type][info.code < Codes ? info.code : Codes];
+
+        WatchEntry* entry = Find(MakeKey(info.source, info.type, info.code));
+        if (entry == NULL)
+        {
+            ++overflow_;
+            return;
+        }
+        ++entry->packets;
+        entry->bytes += wireLength;
+    }
+
+    unsigned long long Packets() const   { return packets_; }
+    unsigned long long Bytes() const     { return bytes_; }
+    unsigned long long Malformed() const { return malformed_; }             // Not IPv4/ICMP, truncated or a later fragment
+    unsigned long long Overflow() const  { return overflow_; }              // Packets of sources beyond maxSources
+    unsigned long long TypePackets(unsigned char type) const { return typePackets_[type]; }
+
+    static unsigned long SourceOf(const WatchEntry& e) { return (unsigned long)((e.key >> 16) & 0xFFFFFFFFULL); }
+    static unsigned char TypeOf(const WatchEntry& e)   { return (unsigned char)(e.key >> 8); }
+    static unsigned char CodeOf(const WatchEntry& e)   { return (unsigned char)e.key; }
+
+    // The per-source entries with the most packets first
+    std::vector<WatchEntry> Top(size_t count) const
+    {
+        std::vector<WatchEntry> entries;
+        for (size_t i = 0; i < slots_.size(); ++i)
+            if (slots_[i].key != 0)
+                entries.push_back(slots_[i]);
+        size_t n = std::min(count, entries.size());
+        std::partial_sort(entries.begin(), entries.begin() + n, entries.end(),
+                          [](const WatchEntry& a, const WatchEntry& b) { return a.packets > b.packets; });
+        entries.resize(n);
+        return entries;
+    }
+
+    // Per-type table (with the codes seen) and the top sources
+    void Print(std::ostream& out, size_t topSources) const
+    {
+        char line[256];
+        snprintf(line, sizeof(line), "%-4s %-26s %12s %14s  codes\n", "type", "name", "packets", "bytes");
+        out<<line;
+        for (int type = 0; type < 256; ++type)
+        {
+            if (typePackets_[type] == 0)
+                continue;
+            int len = snprintf(line, sizeof(line), "%-4d %-26s %12llu %14llu ", type, IcmpTypeName((unsigned char)type),
+                               typePackets_[type], typeBytes_[type]);
+            for (int code = 0; code <= Codes && len < (int)sizeof(line) - 32; ++code)
+            {
+                if (codePackets_[type][code] == 0)
+                    continue;
+                if (code < Codes)
+                    len += snprintf(line + len, sizeof(line) - len, " %d:%llu", code, codePackets_[type][code]);
+                else
+                    len += snprintf(line + len, sizeof(line) - len, " %d+:%llu", Codes, codePackets_[type][code]);
+            }
+            out<<line<<'\n';
+        }
+
+        std::vector<WatchEntry> top = Top(topSources);
+        if (top.empty())
+            return;
+        snprintf(line, sizeof(line), "\n%-16s %-4s %-4s %12s %14s\n", "source", "type", "code", "packets", "bytes");
+        out<<line;
+        for (size_t i = 0; i < top.size(); ++i)
+        {
+            unsigned long source = SourceOf(top[i]);
+            const unsigned char* b = (const unsigned char*)&source;
+            char address[16];
+            snprintf(address, sizeof(address), "%u.%u.%u.%u", b[0], b[1], b[2], b[3]);
+            snprintf(line, sizeof(line), "%-16s %-4u %-4u %12llu %14llu\n", address, TypeOf(top[i]), CodeOf(top[i]),
+                     top[i].packets, top[i].bytes);
+            out<<line;
+        }
+    }
+
+private:
+    static unsigned long long MakeKey(unsigned long source, unsigned char type, unsigned char code)
+    {
+        return (1ull << 48) | ((unsigned long long)(source & 0xFFFFFFFFUL) << 16) | ((unsigned long long)type << 8) | code;
+    }
+
+    // Entry of the key, created if needed; NULL when the table has reached its limit
+    WatchEntry* Find(unsigned long long key)
+    {
+        unsigned int i = (unsigned int)((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask_;
+        while (slots_[i].key != 0)
+        {
+            if (slots_[i].key == key)
+                return &slots_[i];
+            i = (i + 1) & mask_;
+        }
+        if (size_ >= limit_)
+            return NULL;
+        ++size_;
+        slots_[i].key     = key;
+        slots_[i].packets = 0;
+        slots_[i].bytes   = 0;
+        return &slots_[i];
+    }
+
+    unsigned long long      packets_;
+    unsigned long long      bytes_;
+    unsigned long long      malformed_;
+    unsigned long long      overflow_;
+    unsigned long long      typePackets_[256];
+    unsigned long long      typeBytes_[256];
+    unsigned long long      codePackets_[256][Codes + 1];
+    std::vector<WatchEntry> slots_;
+    unsigned int            mask_;
+    unsigned int            limit_;
+    unsigned int            size_;
+};
+
+#endif // ICMP_WATCHER_H
@@ -1,276 +1,528 @@
-/* Prepared by Yekta Parlak - September 2022 */
-
- // Steps:
- // 1. Use the function IcmpCreateFile to create an Icmp handle.
- // 2. Construct the API parameters. (IcmpHandle, ipaddr, SendData, sizeof(SendData), &ipOptions, ReplyBuffer, ReplySize, Timeout)
- // 3. Call the function IcmpSendEcho to send.
- // 4. Close the Icmp handle obtained by IcmpCreateFile.
-
- /* 1. IcmpCreateFile();  => Opens a handle on which IPv4 ICMP echo requests can be issued.
-    2. IcmpSendEcho();    => Sends an IPv4 ICMP echo request and returns any echo response replies and the call returns when the time-out has expired or the reply buffer is filled.
-    3. IcmpCloseHandle(); => Closes a handle opened by a call to the IcmpCreateFile or  IcmpCreateFile functions.*/
-
-    /* To compile: g++ *.cpp -o pingapi.exe -lws2_32 -fPIC -static -static-libgcc -static-libstdc++ C:\Windows\System32\iphlpapi.dll
-       and then enter: ./pingapi DestinationIP (such as ./pingapi 1.1.1.1) */
-
-
-#include <winsock2.h>
-#include <iphlpapi.h>
-#include <icmpapi.h>
-#include <iostream>
-#include <WS2tcpip.h>
-
-#pragma comment(lib, "iphlpapi.lib")
-#pragma comment(lib, "ws2_32.lib")
-
-using namespace std;
-
-// Function to check if the provided IP address is valid
-bool CheckIPAddr(unsigned long ipaddr) {
-    cout << "Checking IP address using CheckIPAddr function" << endl << '\n';
-    return ipaddr != INADDR_NONE;
-}
-
-// Function to handle ICMP response status codes
-void HandleICMPStatus(int statusCode) {
-    switch (statusCode) {
-    case IP_SUCCESS:
-        cout << "Ping was successful!" << endl;
-        break;
-    case IP_DEST_NET_UNREACHABLE:
-        cout << "Destination network is unreachable." << endl;
-        break;
-    case IP_DEST_HOST_UNREACHABLE:
-        cout << "Destination host is unreachable." << endl;
-        break;
-        // Add more cases for other status codes
-    default:
-        cout << "Unknown ICMP status code: " << statusCode << endl;
-        break;
-    }
-}
-
-// Function to handle errors from IcmpSendEcho
-void HandleICMPSendEchoError(DWORD errorCode) {
-    switch (errorCode) {
-    case IP_REQ_TIMED_OUT:
-        cout << "Ping request timed out." << endl;
-        break;
-    case IP_DEST_NET_UNREACHABLE:
-        cout << "Destination network is unreachable." << endl;
-        break;
-        // Add more cases for other error codes
-    default:
-        cout << "Unknown ICMP error code: " << errorCode << endl;
-        break;
-    }
-}
-
-int main(int argc, char** argv) {
-    // Declarations and initializations
-    HANDLE IcmpHandle;
-    unsigned long ipaddr = INADDR_NONE;
-    DWORD dwRetVal = 0;
-    DWORD dwError = 0;
-    const char SendData[32] = "abcdefghijklmnopqrstuvwxyz12345";
-    LPVOID ReplyBuffer = NULL;
-    static int Number = 0;
-    DWORD Timeout = 10000;
-    static int TTL = 128;
-
-    // Check if the correct number of arguments is provided
-    if (argc != 2) {
-        cout << "Invalid usage. Please provide a valid IPv4 address." << endl;
-        return 1;
-    }
-
-    // Convert the provided IP address to binary form
-    ipaddr = inet_pton(AF_INET, argv[1], &ipaddr);
-
-    // Check if the provided IP address is valid
-    if (!CheckIPAddr(ipaddr)) {
-        cout << "Invalid IPv4 address: " << argv[1] << endl;
-        return 1;
-    }
-
-    // Create a handle for sending ICMP echo requests
-    IcmpHandle = IcmpCreateFile();
-    if (IcmpHandle == INVALID_HANDLE_VALUE) {
-        cout << "Unable to open handle." << endl;
-        cout << "IcmpCreatefile returned error code: " << GetLastError() << endl;
-        return 1;
-    }
-
-    // Allocate memory for storing reply data
-    DWORD ICMP_ERROR_SIZE = 8;
-    DWORD ReplySize = sizeof(ICMP_ECHO_REPLY) + sizeof(SendData) + ICMP_ERROR_SIZE;
-    ReplyBuffer = malloc(ReplySize);
-
-    if (ReplyBuffer == NULL) {
-        cout << "Unable to allocate memory for reply buffer" << endl;
-        return 1;
-    }
-
-    // Set IP options for the ICMP request
-    IP_OPTION_INFORMATION ipOptions;
-    memset(&ipOptions, 0, sizeof(IP_OPTION_INFORMATION));
-    ipOptions.Ttl = TTL;
-
-    // Input interval time in milliseconds
-    int intervalMillis;
-    cout << "Enter time interval in milliseconds: ";
-    cin >> intervalMillis;
-
-    // Choose between unlimited ping or manual ping count
-    char choice;
-    cout << "Type 't' for unlimited ping or 'm' for entering manual ping count: ";
-    cin >> choice;
-
-    long long int pingCount;
-    if (choice == 't') {
-        pingCount = -1; // -1 indicates unlimited ping
-    }
-    else if (choice == 'm') {
-        cout << "Enter ping count: ";
-        cin >> pingCount;
-    }
-    else {
-        cout << "Invalid choice. Exiting..." << endl;
-        return 1;
-    }
-
-    // Loop for sending ping requests
-    for (long long int i = 0; (pingCount == -1 || i < pingCount); ++i) {
-        dwRetVal = IcmpSendEcho(IcmpHandle, ipaddr, (LPVOID)SendData, sizeof(SendData), &ipOptions, ReplyBuffer, ReplySize, Timeout);
-
-        // Process the response if no error occurred
-        if (dwRetVal != 0) {
-            PICMP_ECHO_REPLY pEchoReply = (PICMP_ECHO_REPLY)ReplyBuffer;
-            struct in_addr ipAddr {};
-            ipAddr.S_un.S_addr = pEchoReply->Address;
-
-            cout << endl;
-            cout << "Sent ICMP echo request to " << argv[1] << " with " << sizeof(SendData) << " Bytes payload" << endl;
-
-            if (dwRetVal > 1) {
-                cout << "Successfully received ICMP response: " << dwRetVal << endl;
-            }
-            else {
-                cout << "Received " << dwRetVal << " ICMP response successfully" << endl;
-            }
-            cout << "Round Trip Time (RTT): " << pEchoReply->RoundTripTime << " ms" << endl;
-            cout << "Time Interval: " << intervalMillis << " ms" << endl;
-            cout << "Ping Count: " << ++Number << endl;
-            cout << "TTL: " << TTL << endl;
-
-            HandleICMPStatus(pEchoReply->Status); // Handle different status codes...
-        }
-        // Handle error if IcmpSendEcho fails
-        else {
-            cout << "IcmpSendEcho returned error code: " << GetLastError() << endl;
-            dwError = GetLastError();
-            HandleICMPSendEchoError(dwError); // Handle different error codes...
-        }
-        Sleep(intervalMillis); // Sleep for specified interval before sending next ping
-    }
-
-    // Free allocated memory and close the ICMP handle
-    free(ReplyBuffer);
-    IcmpCloseHandle(IcmpHandle);
-    return 0;
-}
-
-
-
-
-/* SEVERAL REMARKS:
-
-
-/* Error Code Links:    https://docs.automic.com/documentation/webhelp/english/ARA/11.2/AE/11.2/All%20Guides/Content/uczaia.htm
-                        https://docs.microsoft.com/en-us/windows/win32/api/ipexport/ns-ipexport-icmp_echo_reply
-                        https://docs.microsoft.com/en-us/windows/win32/debug/system-error-codes  */
-
-                        //////////////////////////////////////////////////////////////////////////////////////////////
-                        // Routine Name:
-                        //
-                        //     IcmpCreateFile
-                        //
-                        // Routine Description:
-                        //
-                        //     Opens a handle on which ICMP Echo Requests can be issued.
-                        //
-                        // Arguments:
-                        //
-                        //     None.
-                        //
-                        // Return Value:
-                        //
-                        //     An open file handle or INVALID_HANDLE_VALUE. Extended error information
-                        //     is available by calling GetLastError().
-                        //
-                        ////////////////////////////////////////////////////////////////////////////////////////////
-                        //
-                        // Routine Name:
-                        //
-                        //     IcmpCloseHandle
-                        //
-                        // Routine Description:
-                        //
-                        //     Closes a handle opened by ICMPOpenFile.
-                        //
-                        // Arguments:
-                        //
-                        //     IcmpHandle  - The handle to close.
-                        //
-                        // Return Value:
-                        //
-                        //     TRUE if the handle was closed successfully, otherwise FALSE. Extended
-                        //     error information is available by calling GetLastError().
-                        //
-                        ////////////////////////////////////////////////////////////////////////////////////////////
-                        //
-                        // Routine Name:
-                        //
-                        //     IcmpSendEcho
-                        //
-                        // Routine Description:
-                        //
-                        //     Sends an ICMP Echo request and returns any replies. The
-                        //     call returns when the timeout has expired or the reply buffer
-                        //     is filled.
-                        //
-                        // Arguments:
-                        //
-                        //     IcmpHandle           - An open handle returned by ICMPCreateFile.
-                        //
-                        //     DestinationAddress   - The destination of the echo request.
-                        //
-                        //     RequestData          - A buffer containing the data to send in the
-                        //                            request.
-                        //
-                        //     RequestSize          - The number of bytes in the request data buffer.
-                        //
-                        //     RequestOptions       - Pointer to the IP header options for the request.
-                        //                            May be NULL.
-                        //
-                        //     ReplyBuffer          - A buffer to hold any replies to the request.
-                        //                            On return, the buffer will contain an array of
-                        //                            ICMP_ECHO_REPLY structures followed by the
-                        //                            options and data for the replies. The buffer
-                        //                            should be large enough to hold at least one
-                        //                            ICMP_ECHO_REPLY structure plus
-                        //                            MAX(RequestSize, 8) bytes of data since an ICMP
-                        //                            error message contains 8 bytes of data.
-                        //
-                        //     ReplySize            - The size in bytes of the reply buffer.
-                        //
-                        //     Timeout              - The time in milliseconds to wait for replies.
-                        //
-                        // Return Value:
-                        //
-                        //     Returns the number of ICMP_ECHO_REPLY structures stored in ReplyBuffer.
-                        //     The status of each reply is contained in the structure. If the return
-                        //     value is zero, extended error information is available via
-                        //     GetLastError().
-                        //
-                        ////////////////////////////////////////////////////////////////////////////////////////////
+/* Prepared by Yekta Parlak - September 2022 */
+
+ // Steps:
+ // 1. Use the function IcmpCreateFile to create an Icmp handle.
+ // 2. Construct the API parameters. (IcmpHandle, ipaddr, SendData, payloadSize, &ipOptions, ReplyBuffer, ReplySize, Timeout)
+ // 3. Call the function IcmpSendEcho to send.
+ // 4. Close the Icmp handle obtained by IcmpCreateFile.
+
+ /* 1. IcmpCreateFile();  => Opens a handle on which IPv4 ICMP echo requests can be issued.
+    2. IcmpSendEcho();    => Sends an IPv4 ICMP echo request and returns any echo response replies and the call returns when the time-out has expired or the reply buffer is filled.
+    3. IcmpCloseHandle(); => Closes a handle opened by a call to the IcmpCreateFile or  IcmpCreateFile functions.*/
+
+    /* Press Ctrl+C to stop the unlimited mode, the statistics of the run (loss, min/mean/max, percentiles, jitter) are printed at the end.
+       To compile: g++ *.cpp -o pingapi.exe -lws2_32 -fPIC -static -static-libgcc -static-libstdc++ C:\Windows\System32\iphlpapi.dll
+       and then enter: ./pingapi DestinationIP (such as ./pingapi 1.1.1.1)
+       An optional payload size sends that many bytes with the don't fragment bit set (./pingapi 1.1.1.1 1472), a size
+       over the path MTU then fails with "packet too big" instead of being fragmented.
+       Metrics of a long run: -x port serves them on http://127.0.0.1:port/metrics (Prometheus), -X name publishes them
+       in the shared-memory block Local\name (./pingapi 1.1.1.1 -x 9100), see icmp_Metrics.h.
+       Without prompts: -i interval (milliseconds) and -c count (./pingapi 1.1.1.1 -i 500 -c 20); -i alone pings until Ctrl+C,
+       -c alone pings once a second.
+       Results of a long run: -f file keeps every ping in a compressed time-series file (./pingapi 1.1.1.1 -i 1000 -f ping.tsdb),
+       read with icmp_TimeSeriesQuery (loss and RTT percentiles over any time window), see icmp_TimeSeries.h.
+       Timeout: adapts to the RTTs seen, from 10 ms up to 10 seconds; -R min-max sets the bounds in milliseconds and
+       -R ms a fixed timeout (./pingapi 1.1.1.1 -R 50-2000), see icmp_Rto.h. */
+
+
+#include <winsock2.h>
+#include <iphlpapi.h>
+#include <icmpapi.h>
+#include <iostream>
+#include <vector>
+#include <WS2tcpip.h>
+#include "icmp_Metrics.h"
+#include "icmp_Rto.h"
+#include "icmp_Stats.h"
+#include "icmp_Scheduler.h"
+#include "icmp_TimeSeries.h"
+#include "icmp_Types.h"
+
+#pragma comment(lib, "iphlpapi.lib")
+#pragma comment(lib, "ws2_32.lib")
+
+using namespace std;
+
+// Function to check if the provided IP address is valid
+bool CheckIPAddr(unsigned long ipaddr) {
+    cout << "Checking IP address using CheckIPAddr function" << endl << '\n';
+    return ipaddr != INADDR_NONE;
+}
+
+// Monotonic nanoseconds for the ping deadlines
+static unsigned long long NowNs() {
+    static LARGE_INTEGER frequency = { 0 };
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (unsigned long long)(counter.QuadPart / frequency.QuadPart) * 1000000000ULL +
+           (unsigned long long)(counter.QuadPart % frequency.QuadPart) * 1000000000ULL / frequency.QuadPart;
+}
+
+// Set by Ctrl+C / Ctrl+Break, so the unlimited mode stops after the current ping and prints its statistics
+static volatile LONG StopRequested = 0;
+
+BOOL WINAPI ConsoleCtrlHandler(DWORD ctrlType) {
+    if (ctrlType == CTRL_C_EVENT || ctrlType == CTRL_BREAK_EVENT) {
+        InterlockedExchange(&StopRequested, 1);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+// What each IP_STATUS value (IP_STATUS_BASE + index) means. Statuses that report an ICMP error carry its type and
+// code, the names come from the ICMP table; type 0xFF marks a status raised locally (no ICMP message behind it).
+struct IpStatusEntry {
+    unsigned char type;
+    unsigned char code;
+    const char* text;
+};
+
+static const IpStatusEntry IpStatusTable[] = {
+    { 0xFF, 0, "success" },                         // IP_SUCCESS is 0, not IP_STATUS_BASE
+    { 0xFF, 0, "reply buffer too small" },          // IP_BUF_TOO_SMALL
+    { 3, 0, NULL },                                 // IP_DEST_NET_UNREACHABLE
+    { 3, 1, NULL },                                 // IP_DEST_HOST_UNREACHABLE
+    { 3, 2, NULL },                                 // IP_DEST_PROT_UNREACHABLE
+    { 3, 3, NULL },                                 // IP_DEST_PORT_UNREACHABLE
+    { 0xFF, 0, "no resources" },                    // IP_NO_RESOURCES
+    { 0xFF, 0, "bad IP option" },                   // IP_BAD_OPTION
+    { 0xFF, 0, "hardware error" },                  // IP_HW_ERROR
+    { 3, 4, NULL },                                 // IP_PACKET_TOO_BIG
+    { 0xFF, 0, "request timed out" },               // IP_REQ_TIMED_OUT
+    { 0xFF, 0, "bad request" },                     // IP_BAD_REQ
+    { 3, 5, NULL },                                 // IP_BAD_ROUTE
+    { 11, 0, NULL },                                // IP_TTL_EXPIRED_TRANSIT
+    { 11, 1, NULL },                                // IP_TTL_EXPIRED_REASSEM
+    { 12, 0, NULL },                                // IP_PARAM_PROBLEM
+    { 4, 0, NULL },                                 // IP_SOURCE_QUENCH
+    { 0xFF, 0, "option too big" },                  // IP_OPTION_TOO_BIG
+    { 0xFF, 0, "bad destination" }                  // IP_BAD_DESTINATION
+};
+
+const int IpStatusCount = sizeof(IpStatusTable) / sizeof(IpStatusTable[0]);
+
+// Failed pings by cause: ICMP errors by type and code, local statuses by status, anything else (IP_GENERAL_FAILURE,
+// Win32 errors of IcmpSendEcho) together. Fixed size, so the unlimited mode can count for weeks.
+struct IcmpStatusCounts {
+    IcmpCodeCounts icmp;
+    unsigned long long local[IpStatusCount] = {};
+    unsigned long long other = 0;
+    ULONG lastOther = 0;
+};
+
+// Function to handle ICMP response status codes: they are counted, the summary prints them
+void HandleICMPStatus(ULONG statusCode, IcmpStatusCounts& counts) {
+    if (statusCode == IP_SUCCESS)
+        return;
+    ULONG index = statusCode - IP_STATUS_BASE;
+    if (statusCode <= IP_STATUS_BASE || index >= (ULONG)IpStatusCount) {
+        ++counts.other;
+        counts.lastOther = statusCode;
+        return;
+    }
+    const IpStatusEntry& entry = IpStatusTable[index];
+    if (entry.type != 0xFF)
+        counts.icmp.Record(entry.type, entry.code);
+    else
+        ++counts.local[index];
+}
+
+// Function to handle errors from IcmpSendEcho: GetLastError() is an IP_STATUS value (IP_REQ_TIMED_OUT when nothing
+// came back, an ICMP error otherwise) or a Win32 error code
+void HandleICMPSendEchoError(DWORD errorCode, IcmpStatusCounts& counts) {
+    HandleICMPStatus(errorCode == 0 ? (ULONG)IP_GENERAL_FAILURE : (ULONG)errorCode, counts);
+}
+
+// Prints the counts of HandleICMPStatus / HandleICMPSendEchoError
+void PrintICMPStatusCounts(ostream& out, const IcmpStatusCounts& counts) {
+    counts.icmp.Print(out);
+    for (int i = 1; i < IpStatusCount; ++i) {
+        if (counts.local[i] > 0)
+            out << IpStatusTable[i].text << ": " << counts.local[i] << endl;
+    }
+    if (counts.other > 0)
+        out << "other errors: " << counts.other << " (last error code " << counts.lastOther << ")" << endl;
+}
+
+// Appends one ping to the -f store: a reply, a timeout, or an ICMP error with its sender and the type and code of
+// its status. Statuses raised locally (no resources, bad option, ...) are not probe results and are not stored.
+void StoreRecord(TimeSeriesWriter& store, OutputEvent event, unsigned long target, unsigned short seq, unsigned long from,
+                 ULONG status, unsigned long long rttNs) {
+    OutputRecord record = {};
+    record.timeNs = TransportMonotonicNs();
+    record.rttNs = rttNs;
+    record.target = (unsigned int)target;
+    record.from = (unsigned int)from;
+    record.seq = seq;
+    record.event = (unsigned char)event;
+    if (event == OUTPUT_ERROR) {
+        ULONG index = status - IP_STATUS_BASE;
+        if (status <= IP_STATUS_BASE || index >= (ULONG)IpStatusCount || IpStatusTable[index].type == 0xFF)
+            return;
+        record.icmpType = IpStatusTable[index].type;
+        record.icmpCode = IpStatusTable[index].code;
+    }
+    store.Write(record, record.timeNs + (unsigned long long)TransportRealtimeOffsetNs());
+}
+
+int main(int argc, char** argv) {
+    // Declarations and initializations
+    HANDLE IcmpHandle;
+    unsigned long ipaddr = INADDR_NONE;
+    DWORD dwRetVal = 0;
+    DWORD dwError = 0;
+    DWORD payloadSize = 32;
+    LPVOID ReplyBuffer = NULL;
+    static int Number = 0;
+    static int TTL = 128;
+
+    // Check if the correct number of arguments is provided: the address, optionally a payload size and the metrics options
+    const char* payloadArg = NULL;
+    long metricsPort = 0;
+    const char* metricsName = NULL;
+    const char* intervalArg = NULL;     // -i: interval in milliseconds, skips the prompts
+    const char* countArg = NULL;        // -c: ping count, unlimited with -i alone
+    const char* storeArg = NULL;        // -f: time-series file of the results
+    RtoConfig rtoConfig = MakeRtoConfig();  // -R: bounds of the adaptive timeout, one value fixes it
+    bool argsOk = argc >= 2;
+    for (int a = 2; argsOk && a < argc; ++a) {
+        if (strcmp(argv[a], "-x") == 0 && a + 1 < argc && (metricsPort = atol(argv[a + 1])) > 0 && metricsPort <= 65535)
+            ++a;
+        else if (strcmp(argv[a], "-X") == 0 && a + 1 < argc)
+            metricsName = argv[++a];
+        else if (strcmp(argv[a], "-i") == 0 && a + 1 < argc)
+            intervalArg = argv[++a];
+        else if (strcmp(argv[a], "-c") == 0 && a + 1 < argc && atoll(argv[a + 1]) > 0)
+            countArg = argv[++a];
+        else if (strcmp(argv[a], "-f") == 0 && a + 1 < argc)
+            storeArg = argv[++a];
+        else if (strcmp(argv[a], "-R") == 0 && a + 1 < argc && ParseRtoBounds(argv[a + 1], &rtoConfig))
+            ++a;
+        else if (payloadArg == NULL && argv[a][0] != '-')
+            payloadArg = argv[a];
+        else
+            argsOk = false;
+    }
+    if (!argsOk) {
+        cout << "Invalid usage. Please provide a valid IPv4 address and optionally a payload size (and -i interval / -c count, -x port / -X name for the metrics, -f file to store the results, -R min-max for the timeout)." << endl;
+        return 1;
+    }
+
+    // IcmpSendEcho takes up to 65500 bytes of payload (as ping -l does)
+    bool dontFragment = payloadArg != NULL;
+    if (dontFragment && (atoi(payloadArg) < 0 || atoi(payloadArg) > 65500)) {
+        cout << "Invalid payload size: " << payloadArg << " (0 to 65500 bytes)" << endl;
+        return 1;
+    }
+    if (dontFragment)
+        payloadSize = (DWORD)atoi(payloadArg);
+
+    // Payload built once, the same letters as before repeated up to the requested size
+    vector<char> SendData(payloadSize + 1);
+    for (DWORD i = 0; i < payloadSize; ++i)
+        SendData[i] = "abcdefghijklmnopqrstuvwxyz12345"[i % 31];
+
+    // Convert the provided IP address to binary form
+    ipaddr = inet_pton(AF_INET, argv[1], &ipaddr);
+
+    // Check if the provided IP address is valid
+    if (!CheckIPAddr(ipaddr)) {
+        cout << "Invalid IPv4 address: " << argv[1] << endl;
+        return 1;
+    }
+
+    // Create a handle for sending ICMP echo requests
+    IcmpHandle = IcmpCreateFile();
+    if (IcmpHandle == INVALID_HANDLE_VALUE) {
+        cout << "Unable to open handle." << endl;
+        cout << "IcmpCreatefile returned error code: " << GetLastError() << endl;
+        return 1;
+    }
+
+    // Allocate memory for storing reply data
+    DWORD ICMP_ERROR_SIZE = 8;
+    DWORD ReplySize = sizeof(ICMP_ECHO_REPLY) + payloadSize + ICMP_ERROR_SIZE;
+    ReplyBuffer = malloc(ReplySize);
+
+    if (ReplyBuffer == NULL) {
+        cout << "Unable to allocate memory for reply buffer" << endl;
+        return 1;
+    }
+
+    // Set IP options for the ICMP request
+    IP_OPTION_INFORMATION ipOptions;
+    memset(&ipOptions, 0, sizeof(IP_OPTION_INFORMATION));
+    ipOptions.Ttl = TTL;
+    if (dontFragment)
+        ipOptions.Flags = IP_FLAG_DF;
+
+    // Input interval time in milliseconds
+    int intervalMillis;
+    if (intervalArg != NULL || countArg != NULL) {
+        intervalMillis = intervalArg != NULL ? atoi(intervalArg) : 1000;
+    }
+    else {
+        cout << "Enter time interval in milliseconds: ";
+        cin >> intervalMillis;
+    }
+
+    // Choose between unlimited ping or manual ping count
+    char choice = 't';
+    if (countArg != NULL) {
+        choice = 'c';
+    }
+    else if (intervalArg == NULL) {
+        cout << "Type 't' for unlimited ping or 'm' for entering manual ping count: ";
+        cin >> choice;
+    }
+
+    long long int pingCount;
+    if (choice == 'c') {
+        pingCount = atoll(countArg);
+    }
+    else if (choice == 't') {
+        pingCount = -1; // -1 indicates unlimited ping
+    }
+    else if (choice == 'm') {
+        cout << "Enter ping count: ";
+        cin >> pingCount;
+    }
+    else {
+        cout << "Invalid choice. Exiting..." << endl;
+        return 1;
+    }
+
+    // The metrics endpoint is a Winsock socket, IcmpSendEcho itself needs no WSAStartup
+    MetricsExporter exporter;
+    if (metricsPort > 0 || metricsName != NULL) {
+        if (!TransportStartup() || !exporter.Start((unsigned short)metricsPort, metricsName)) {
+            cout << "Unable to start the metrics export. Error code: " << TransportLastError() << endl;
+            return 1;
+        }
+        if (metricsPort > 0)
+            cout << "Metrics: http://127.0.0.1:" << metricsPort << "/metrics" << endl;
+    }
+    ThreadMetrics& metrics = MetricsLocal();
+
+    // -f: every ping goes to the time-series store, its index is written when the run ends (also after Ctrl+C)
+    FILE* storeFile = NULL;
+    if (storeArg != NULL && (storeFile = fopen(storeArg, "wb")) == NULL) {
+        cout << "Unable to open " << storeArg << endl;
+        return 1;
+    }
+    TimeSeriesWriter store(storeFile);
+    unsigned long storeTarget = INADDR_NONE;
+    inet_pton(AF_INET, argv[1], &storeTarget);
+
+    // Streaming statistics: fixed memory and O(1) per ping, so the unlimited mode can run for weeks
+    RttStats stats;
+    LatencyHistogram histogram;
+    IcmpStatusCounts errors; // Failed pings by ICMP error or status
+    const long long int SummaryEvery = 1000; // The unlimited mode prints the statistics so far every 1000 pings
+    SetConsoleCtrlHandler(ConsoleCtrlHandler, TRUE);
+
+    // Pings go out every intervalMillis from the start, not intervalMillis after the previous reply
+    ScheduleStats schedule;
+    const unsigned long long intervalNs = (unsigned long long)(intervalMillis > 0 ? intervalMillis : 0) * 1000000ULL;
+    unsigned long long deadlineNs = NowNs();
+    RtoTable rto(1, rtoConfig);                             // IcmpSendEcho waits as long as the RTTs so far suggest, not 10 seconds
+
+    // Loop for sending ping requests
+    for (long long int i = 0; (pingCount == -1 || i < pingCount) && !StopRequested; ++i) {
+        stats.OnSent();
+        schedule.OnSent(deadlineNs, NowNs());
+        metrics.Count(METRIC_PACKETS_SENT);                 // IcmpSendEcho waits for the reply, so its time is not a send call's
+        dwRetVal = IcmpSendEcho(IcmpHandle, ipaddr, (LPVOID)&SendData[0], (WORD)payloadSize, &ipOptions, ReplyBuffer, ReplySize, rto.TimeoutMs(0));
+        if (dwRetVal != 0)
+            metrics.Count(METRIC_PACKETS_RECEIVED, dwRetVal);
+
+        // Process the response if no error occurred
+        if (dwRetVal != 0) {
+            PICMP_ECHO_REPLY pEchoReply = (PICMP_ECHO_REPLY)ReplyBuffer;
+            struct in_addr ipAddr {};
+            ipAddr.S_un.S_addr = pEchoReply->Address;
+
+            cout << endl;
+            cout << "Sent ICMP echo request to " << argv[1] << " with " << payloadSize << " Bytes payload" << (dontFragment ? " (don't fragment)" : "") << endl;
+
+            if (dwRetVal > 1) {
+                cout << "Successfully received ICMP response: " << dwRetVal << endl;
+            }
+            else {
+                cout << "Received " << dwRetVal << " ICMP response successfully" << endl;
+            }
+            cout << "Round Trip Time (RTT): " << pEchoReply->RoundTripTime << " ms" << endl;
+            cout << "Time Interval: " << intervalMillis << " ms" << endl;
+            cout << "Ping Count: " << ++Number << endl;
+            cout << "TTL: " << TTL << endl;
+
+            HandleICMPStatus(pEchoReply->Status, errors); // Counts the ICMP error or status, printed with the statistics
+
+            // IcmpSendEcho waits for its own reply, so there is no reordering or duplicate to find here. An ICMP error
+            // (unreachable, TTL expired, ...) also comes back as a reply, its RoundTripTime is not an RTT of the target.
+            unsigned long long rttNs = (unsigned long long)pEchoReply->RoundTripTime * 1000000ULL;
+            if (pEchoReply->Status == IP_SUCCESS) {
+                stats.Record(rttNs);
+                histogram.Record(rttNs);
+                rto.Sample(0, rttNs);
+            }
+            else {
+                stats.OnError();
+            }
+            if (storeFile != NULL)
+                StoreRecord(store, pEchoReply->Status == IP_SUCCESS ? OUTPUT_REPLY : OUTPUT_ERROR, storeTarget, (unsigned short)(i + 1),
+                            pEchoReply->Address, pEchoReply->Status, rttNs);
+        }
+        // Handle error if IcmpSendEcho fails
+        else {
+            cout << "IcmpSendEcho returned error code: " << GetLastError() << endl;
+            dwError = GetLastError();
+            HandleICMPSendEchoError(dwError, errors); // Handle different error codes...
+            if (dwError == IP_REQ_TIMED_OUT) {
+                stats.OnLost();
+                metrics.Count(METRIC_TIMEOUTS);
+                rto.OnTimeout(0);
+            }
+            else
+                stats.OnError();
+            if (storeFile != NULL)
+                StoreRecord(store, dwError == IP_REQ_TIMED_OUT ? OUTPUT_TIMEOUT : OUTPUT_ERROR, storeTarget, (unsigned short)(i + 1),
+                            storeTarget, dwError, 0);
+        }
+
+        if (pingCount == -1 && (i + 1) % SummaryEvery == 0) {
+            cout << endl;
+            PrintRttStats(cout, argv[1], stats, &histogram);
+            PrintICMPStatusCounts(cout, errors);
+        }
+
+        // Wait for the next deadline; deadlines already missed (the reply took longer than the interval) are skipped
+        unsigned long long missed;
+        deadlineNs = ScheduleStats::NextDeadline(deadlineNs, intervalNs, NowNs(), &missed);
+        if (pingCount != -1 && missed > (unsigned long long)(pingCount - 1 - i))
+            missed = (unsigned long long)(pingCount - 1 - i);
+        schedule.OnSkipped(missed);
+        i += (long long int)missed;
+        unsigned long long nowNs = NowNs();
+        if (deadlineNs > nowNs)
+            Sleep((DWORD)((deadlineNs - nowNs + 999999ULL) / 1000000ULL));
+    }
+
+    cout << endl;
+    PrintRttStats(cout, argv[1], stats, &histogram);
+    PrintICMPStatusCounts(cout, errors);
+    rto.Print(cout);
+    PrintScheduleStats(cout, schedule);
+    if (storeFile != NULL) {
+        store.Close();
+        fclose(storeFile);
+        cout << "Stored: " << store.Records() << " pings in " << store.Blocks() << " blocks, " << store.Bytes() << " bytes"
+             << (store.Failed() ? ", writing FAILED" : "") << " (" << storeArg << ")" << endl;
+    }
+
+    // Free allocated memory and close the ICMP handle
+    free(ReplyBuffer);
+    IcmpCloseHandle(IcmpHandle);
+    if (metricsPort > 0 || metricsName != NULL) {
+        exporter.Stop();
+        TransportCleanup();
+    }
+    return 0;
+}
+
+
+
+
+/* SEVERAL REMARKS:
+
+
+/* Error Code Links:    https://docs.automic.com/documentation/webhelp/english/ARA/11.2/AE/11.2/All%20Guides/Content/uczaia.htm
+                        https://docs.microsoft.com/en-us/windows/win32/api/ipexport/ns-ipexport-icmp_echo_reply
+                        https://docs.microsoft.com/en-us/windows/win32/debug/system-error-codes  */
+
+                        //////////////////////////////////////////////////////////////////////////////////////////////
+                        // Routine Name:
+                        //
+                        //     IcmpCreateFile
+                        //
+                        // Routine Description:
+                        //
+                        //     Opens a handle on which ICMP Echo Requests can be issued.
+                        //
+                        // Arguments:
+                        //
+                        //     None.
+                        //
+                        // Return Value:
+                        //
+                        //     An open file handle or INVALID_HANDLE_VALUE. Extended error information
+                        //     is available by calling GetLastError().
+                        //
+                        ////////////////////////////////////////////////////////////////////////////////////////////
+                        //
+                        // Routine Name:
+                        //
+                        //     IcmpCloseHandle
+                        //
+                        // Routine Description:
+                        //
+                        //     Closes a handle opened by ICMPOpenFile.
+                        //
+                        // Arguments:
+                        //
+                        //     IcmpHandle  - The handle to close.
+                        //
+                        // Return Value:
+                        //
+                        //     TRUE if the handle was closed successfully, otherwise FALSE. Extended
+                        //     error information is available by calling GetLastError().
+                        //
+                        ////////////////////////////////////////////////////////////////////////////////////////////
+                        //
+                        // Routine Name:
+                        //
+                        //     IcmpSendEcho
+                        //
+                        // Routine Description:
+                        //
+                        //     Sends an ICMP Echo request and returns any replies. The
+                        //     call returns when the timeout has expired or the reply buffer
+                        //     is filled.
+                        //
+                        // Arguments:
+                        //
+                        //     IcmpHandle           - An open handle returned by ICMPCreateFile.
+                        //
+                        //     DestinationAddress   - The destination of the echo request.
+                        //
+                        //     RequestData          - A buffer containing the data to send in the
+                        //                            request.
+                        //
+                        //     RequestSize          - The number of bytes in the request data buffer.
+                        //
+                        //     RequestOptions       - Pointer to the IP header options for the request.
+                        //                            May be NULL.
+                        //
+                        //     ReplyBuffer          - A buffer to hold any replies to the request.
+                        //                            On return, the buffer will contain an array of
+                        //                            ICMP_ECHO_REPLY structures followed by the
+                        //                            options and data for the replies. The buffer
+                        //                            should be large enough to hold at least one
+                        //                            ICMP_ECHO_REPLY structure plus
+                        //                            MAX(RequestSize, 8) bytes of data since an ICMP
+                        //                            error message contains 8 bytes of data.
+                        //
+                        //     ReplySize            - The size in bytes of the reply buffer.
+                        //
+                        //     Timeout              - The time in milliseconds to wait for replies.
+                        //
+                        // Return Value:
+                        //
+                        //     Returns the number of ICMP_ECHO_REPLY structures stored in ReplyBuffer.
+                        //     The status of each reply is contained in the structure. If the return
+                        //     value is zero, extended error information is available via
+                        //     GetLastError().
+                        //
+                        ////////////////////////////////////////////////////////////////////////////////////////////